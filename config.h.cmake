@@ -40,6 +40,7 @@
 #cmakedefine HAVE_GTHREAD
 #cmakedefine HAVE_GTHREAD_H
 #cmakedefine HAVE_OPENSSL
+#cmakedefine HAVE_LZ4
 #define SIZEOF_RLIM_T @SIZEOF_RLIM_T@
 
 #cmakedefine SIMPLE_PARSER 1
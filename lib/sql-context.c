@@ -22,6 +22,7 @@
 
 #include "mylexer.l.h"
 #include "sql-property.h"
+#include "sql-digest.h"
 
 void sqlParser(void *yyp, int yymajor, sql_token_t yyminor, sql_context_t *);
 void sqlParserFree(void *p, void (*freeProc) (void *));
@@ -68,6 +69,21 @@ sql_context_reset(sql_context_t *p)
     sql_context_init(p);
 }
 
+/**
+ * turn on/off the fingerprint of parsed statements, it lives across
+ * statements and must be turned off before the context is freed
+ */
+void
+sql_context_set_digest(sql_context_t *p, gboolean on)
+{
+    if (on && p->digest == NULL) {
+        p->digest = sql_digest_new();
+    } else if (!on && p->digest) {
+        sql_digest_free(p->digest);
+        p->digest = NULL;
+    }
+}
+
 void
 sql_context_append_msg(sql_context_t *p, char *msg)
 {
@@ -155,11 +171,9 @@ parse_token(sql_context_t *context, int code, sql_token_t token, void *parser, s
 
 #define PARSER_TRACE 0
 
-/* Parse user allocated sql string
-  sql->str must be terminated with 2 NUL
-  sql->len is length including the 2 NUL */
-void
-sql_context_parse_len(sql_context_t *context, GString *sql)
+/* feed the tokens to the parser, and to @digest if not NULL */
+static void
+sql_context_parse_tokens(sql_context_t *context, GString *sql, sql_digest_t *digest)
 {
     yyscan_t scanner;
     yylex_init(&scanner);
@@ -184,11 +198,20 @@ sql_context_parse_len(sql_context_t *context, GString *sql)
         printf("***LexerTrace: code: %d, yytext: %.*s\n", code, token.n, token.z);
         printf("***LexerTrace: yytext addr: %p\n", token.z);
 #endif
+        if (digest) {
+            sql_digest_add_token(digest, code, token.z, token.n);
+        }
         parse_token(context, code, token, parser, &comment_parser);
 
         last_parsed_token = code;
 
         if (context->rc != PARSE_OK) {  /* break on PARSE_HEAD, other error */
+            if (digest) {
+                /* the digest covers the whole statement */
+                while ((code = yylex(scanner)) > 0) {
+                    sql_digest_add_token(digest, code, yyget_text(scanner), yyget_leng(scanner));
+                }
+            }
             yylex_restore_buffer(scanner);  /* restore the input string */
             break;
         }
@@ -205,6 +228,56 @@ sql_context_parse_len(sql_context_t *context, GString *sql)
     yylex_destroy(scanner);
 }
 
+/* Parse user allocated sql string
+  sql->str must be terminated with 2 NUL
+  sql->len is length including the 2 NUL */
+void
+sql_context_parse_len(sql_context_t *context, GString *sql)
+{
+    if (context->digest) {
+        sql_digest_reset(context->digest);
+    }
+    sql_context_parse_tokens(context, sql, context->digest);
+    if (context->digest) {
+        sql_digest_finish(context->digest);
+    }
+}
+
+/**
+ * Only lex the statement into the digest, which must be turned on,
+ * no statement is built. Same requirements on @sql as parse_len().
+ */
+void
+sql_context_scan_len(sql_context_t *context, GString *sql)
+{
+    g_assert(context->digest);
+
+    yyscan_t scanner;
+    yylex_init(&scanner);
+    YY_BUFFER_STATE buf_state = yy_scan_buffer(sql->str, sql->len, scanner);
+
+    sql_context_reset(context);
+    sql_digest_reset(context->digest);
+
+    int code;
+    while ((code = yylex(scanner)) > 0) {
+        sql_digest_add_token(context->digest, code, yyget_text(scanner), yyget_leng(scanner));
+    }
+    sql_digest_finish(context->digest);
+
+    yy_delete_buffer(buf_state, scanner);
+    yylex_destroy(scanner);
+}
+
+/**
+ * parse a statement already passed to scan_len(), the digest is kept
+ */
+void
+sql_context_parse_scanned(sql_context_t *context, GString *sql)
+{
+    sql_context_parse_tokens(context, sql, NULL);
+}
+
 gboolean
 sql_context_is_autocommit_on(sql_context_t *context)
 {
@@ -43,6 +43,7 @@ enum sql_parsing_place_t {
 };
 
 struct sql_property_t;
+struct sql_digest_t;
 
 typedef struct sql_context_t {
     enum sql_parse_state_code_t rc;
@@ -59,6 +60,7 @@ typedef struct sql_context_t {
     enum sql_parsing_place_t parsing_place;
 
     struct sql_property_t *property;
+    struct sql_digest_t *digest;    /* NULL if not wanted, keep unchanged on reset */
     unsigned int is_parsing_subquery:1;
     unsigned int allow_subquery_nesting:1;
     unsigned int sql_needs_reconstruct:1;
@@ -68,6 +70,8 @@ void sql_context_init(sql_context_t *);
 
 void sql_context_reset(sql_context_t *);
 
+void sql_context_set_digest(sql_context_t *, gboolean on);
+
 void sql_context_destroy(sql_context_t *);
 
 void sql_context_append_msg(sql_context_t *, char *msg);
@@ -82,6 +86,10 @@ gboolean sql_context_has_sharding_property(sql_context_t *p);
 
 void sql_context_parse_len(sql_context_t *, GString *sql);
 
+void sql_context_scan_len(sql_context_t *, GString *sql);
+
+void sql_context_parse_scanned(sql_context_t *, GString *sql);
+
 gboolean sql_context_is_autocommit_on(sql_context_t *);
 
 gboolean sql_context_is_autocommit_off(sql_context_t *);
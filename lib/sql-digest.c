@@ -0,0 +1,264 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sql-digest.h"
+
+#include <string.h>
+
+#include "myparser.y.h"
+
+#define SQL_DIGEST_LIST "(...)"
+
+#define SQL_DIGEST_FNV_BASIS G_GUINT64_CONSTANT(0xcbf29ce484222325)
+#define SQL_DIGEST_FNV_PRIME G_GUINT64_CONSTANT(0x100000001b3)
+
+sql_digest_t *
+sql_digest_new(void)
+{
+    sql_digest_t *d = g_new0(sql_digest_t, 1);
+    d->text = g_string_sized_new(256);
+    d->literals = g_array_sized_new(FALSE, FALSE, sizeof(sql_digest_literal_t), 16);
+    d->shape = SQL_DIGEST_FNV_BASIS;
+    return d;
+}
+
+void
+sql_digest_free(sql_digest_t *d)
+{
+    if (d == NULL) {
+        return;
+    }
+    g_string_free(d->text, TRUE);
+    g_array_free(d->literals, TRUE);
+    g_free(d);
+}
+
+void
+sql_digest_reset(sql_digest_t *d)
+{
+    g_string_truncate(d->text, 0);
+    d->hash = 0;
+    d->shape = SQL_DIGEST_FNV_BASIS;
+    g_array_set_size(d->literals, 0);
+    d->prev = 0;
+    d->pending = 0;
+    d->list_start = 0;
+    d->last_list_end = 0;
+    d->in_list = 0;
+    d->in_values = 0;
+    d->in_property = 0;
+    d->truncated = 0;
+    d->has_property = 0;
+}
+
+static gboolean
+sql_digest_is_literal(int code)
+{
+    switch (code) {
+    case TK_INTEGER:
+    case TK_FLOAT:
+    case TK_STRING:
+    case TK_HEX_NUM:
+    case TK_BIN_NUM:
+    case TK_VARIABLE:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static guint64
+sql_digest_hash_bytes(guint64 hash, const void *p, gsize n)
+{
+    const guchar *c = p;
+    gsize i;
+    for (i = 0; i < n; i++) {
+        hash ^= c[i];
+        hash *= SQL_DIGEST_FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * literals only count by their type in the shape, "?" is a placeholder
+ * and stays part of it. Keywords are case insensitive, identifiers not.
+ */
+static void
+sql_digest_add_shape(sql_digest_t *d, int code, const char *z, int n)
+{
+    d->shape = sql_digest_hash_bytes(d->shape, &code, sizeof(code));
+    if (sql_digest_is_literal(code) && code != TK_VARIABLE) {
+        sql_digest_literal_t literal = { code, n, z };
+        g_array_append_val(d->literals, literal);
+    } else if (code == TK_ID) {
+        d->shape = sql_digest_hash_bytes(d->shape, z, n);
+    } else {
+        guint64 hash = d->shape;
+        int i;
+        for (i = 0; i < n; i++) {
+            hash ^= (guchar)g_ascii_tolower(z[i]);
+            hash *= SQL_DIGEST_FNV_PRIME;
+        }
+        d->shape = hash;
+    }
+}
+
+/* a sign after anything else than an operand is unary */
+static gboolean
+sql_digest_is_operand(int code)
+{
+    return code == TK_ID || code == TK_RP || sql_digest_is_literal(code);
+}
+
+static void
+sql_digest_append(sql_digest_t *d, int code, const char *z, int n)
+{
+    if (d->truncated) {
+        return;
+    }
+
+    GString *s = d->text;
+    if (s->len > 0 && code != TK_RP && code != TK_COMMA && code != TK_DOT && code != TK_SEMI
+        && d->prev != TK_DOT && d->prev != TK_AT_SIGN && s->str[s->len - 1] != '('
+        && !(code == TK_LP && d->prev == TK_ID)) {
+        g_string_append_c(s, ' ');
+    }
+
+    if (s->len + n > SQL_DIGEST_MAX_LEN) {
+        g_string_append(s, "...");
+        d->truncated = 1;
+        d->in_list = 0;
+        return;
+    }
+
+    if (code != TK_ID && g_ascii_isalpha(z[0])) {
+        int i;
+        for (i = 0; i < n; i++) {
+            g_string_append_c(s, g_ascii_toupper(z[i]));
+        }
+    } else {
+        g_string_append_len(s, z, n);
+    }
+    d->prev = code;
+}
+
+/**
+ * feed the next token returned by the lexer
+ */
+void
+sql_digest_add_token(sql_digest_t *d, int code, const char *z, int n)
+{
+    sql_digest_add_shape(d, code, z, n);
+
+    if (d->in_property) {
+        if (code == TK_PROPERTY_END) {
+            d->in_property = 0;
+        }
+        return;
+    }
+
+    switch (code) {
+    case TK_PROPERTY_START:
+        d->in_property = 1;
+        d->has_property = 1;
+        return;
+    case TK_MYSQL_HINT:
+    case TK_UNDERSCORE_CHARSET:
+        return;
+    default:
+        break;
+    }
+
+    int pending = d->pending;
+    d->pending = 0;
+    if (pending == TK_SEMI) {
+        sql_digest_append(d, TK_SEMI, ";", 1);
+        d->in_values = 0;
+    } else if (pending && !sql_digest_is_literal(code)) {
+        /* a signed literal is just a literal */
+        sql_digest_append(d, pending, pending == TK_MINUS ? "-" : "+", 1);
+    }
+
+    /* the trailing ';' is dropped */
+    if (code == TK_SEMI) {
+        d->pending = TK_SEMI;
+        return;
+    }
+    if ((code == TK_MINUS || code == TK_PLUS) && !sql_digest_is_operand(d->prev)) {
+        d->pending = code;
+        return;
+    }
+
+    if (sql_digest_is_literal(code)) {
+        sql_digest_append(d, TK_VARIABLE, "?", 1);
+        return;
+    }
+
+    if (d->in_list && code != TK_COMMA && code != TK_RP) {
+        d->in_list = 0;
+    }
+
+    switch (code) {
+    case TK_VALUES:
+        d->in_values = 1;
+        break;
+    case TK_LP:
+        if (d->prev == TK_IN || d->prev == TK_VALUES) {
+            d->in_list = 1;
+            d->list_start = d->text->len;
+        } else if (d->in_values && d->prev == TK_COMMA && d->text->len == d->last_list_end + 1) {
+            /* next row of a multi-row insert, folded into the first one */
+            d->in_list = 1;
+            d->list_start = d->last_list_end;
+        }
+        break;
+    case TK_RP:
+        if (d->in_list) {
+            d->in_list = 0;
+            gboolean next_row = d->list_start == d->last_list_end;
+            g_string_truncate(d->text, d->list_start);
+            if (!next_row) {
+                g_string_append(d->text, " " SQL_DIGEST_LIST);
+            }
+            d->last_list_end = d->text->len;
+            d->prev = TK_RP;
+            return;
+        }
+        break;
+    default:
+        break;
+    }
+
+    sql_digest_append(d, code, z, n);
+}
+
+/**
+ * compute the digest of the text, FNV-1a
+ */
+void
+sql_digest_finish(sql_digest_t *d)
+{
+    if (d->pending == TK_MINUS || d->pending == TK_PLUS) {
+        sql_digest_append(d, d->pending, d->pending == TK_MINUS ? "-" : "+", 1);
+    }
+    d->pending = 0;
+
+    d->hash = sql_digest_hash_bytes(SQL_DIGEST_FNV_BASIS, d->text->str, d->text->len);
+}
@@ -0,0 +1,77 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef SQL_DIGEST_H
+#define SQL_DIGEST_H
+
+#include <glib.h>
+
+/* longer fingerprints are cut and end with "..." */
+#define SQL_DIGEST_MAX_LEN 1024
+
+/**
+ * A literal of the statement, points into the statement buffer
+ */
+typedef struct sql_digest_literal_t {
+    int code;
+    int n;
+    const char *z;
+} sql_digest_literal_t;
+
+/**
+ * Normalized form of a statement, built from the lexer tokens.
+ *
+ * Literals are replaced by "?", keywords are upper cased, comments and
+ * property hints are dropped, and lists made of literals only after IN
+ * or VALUES collapse to "(...)", so statements of the same shape share
+ * one fingerprint and one 64-bit digest.
+ *
+ * The shape is stricter: it hashes every token but the value of the
+ * literals, nothing is folded, so statements of the same shape only
+ * differ in the literals listed in @literals.
+ */
+typedef struct sql_digest_t {
+    GString *text;
+    guint64 hash;
+    guint64 shape;
+    GArray *literals;           /* sql_digest_literal_t, in statement order */
+
+    int prev;                   /* last token kept in text */
+    int pending;                /* unary sign or ';' waiting for the next token */
+    gsize list_start;           /* text length before the literal list */
+    gsize last_list_end;        /* text length after the last collapsed list */
+    unsigned int in_list:1;
+    unsigned int in_values:1;
+    unsigned int in_property:1;
+    unsigned int truncated:1;
+    unsigned int has_property:1;
+} sql_digest_t;
+
+sql_digest_t *sql_digest_new(void);
+
+void sql_digest_free(sql_digest_t *);
+
+void sql_digest_reset(sql_digest_t *);
+
+void sql_digest_add_token(sql_digest_t *, int code, const char *z, int n);
+
+void sql_digest_finish(sql_digest_t *);
+
+#endif /* SQL_DIGEST_H */
@@ -21,6 +21,7 @@
 #include "sql-property.h"
 
 #include <string.h>
+#include <stdlib.h>
 
 enum property_parse_state_t {
     // PARSE_STATE_INIT,
@@ -42,6 +43,8 @@ sql_property_is_valid(sql_property_t *p)
 {
     if (p->table && p->group)   /* mutual exclusive */
         return FALSE;
+    if (p->max_lag < 0)
+        return FALSE;
     return TRUE;
 }
 
@@ -84,6 +87,16 @@ string_to_code(const char *str)
     return ERROR_VALUE;
 }
 
+static int
+string_to_msec(const char *str)
+{
+    char *end = NULL;
+    long value = strtol(str, &end, 10);
+    if (end == str || *end != '\0' || value <= 0 || value > G_MAXINT32)
+        return ERROR_VALUE;
+    return value;
+}
+
 static gboolean
 parser_find_key(sql_property_parser_t *parser, const char *token, int len)
 {
@@ -97,6 +110,7 @@ parser_find_key(sql_property_parser_t *parser, const char *token, int len)
         "mode", offsetof(struct sql_property_t, mode), TYPE_INT, string_to_code}, {
         "scope", offsetof(struct sql_property_t, scope), TYPE_INT, string_to_code}, {
         "transaction", offsetof(struct sql_property_t, transaction), TYPE_INT, string_to_code}, {
+        "max_lag", offsetof(struct sql_property_t, max_lag), TYPE_INT, string_to_msec}, {
         "group", offsetof(struct sql_property_t, group), TYPE_STRING, NULL}, {
         "table", offsetof(struct sql_property_t, table), TYPE_STRING, NULL}, {
     "key", offsetof(struct sql_property_t, key), TYPE_STRING, NULL},};
@@ -38,6 +38,7 @@ typedef struct sql_property_t {
     int mode;
     int scope;
     int transaction;
+    int max_lag;                /* in ms, 0 if not given */
     char *group;
     char *table;
     char *key;
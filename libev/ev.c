@@ -296,6 +296,10 @@
 # define EV_USE_KQUEUE 0
 #endif
 
+#ifndef EV_USE_IOURING
+# define EV_USE_IOURING 0
+#endif
+
 #ifndef EV_USE_PORT
 # define EV_USE_PORT 0
 #endif
@@ -1719,7 +1723,7 @@ typedef struct
   unsigned char reify;  /* flag set when this ANFD needs reification (EV_ANFD_REIFY, EV__IOFDSET) */
   unsigned char emask;  /* the epoll backend stores the actual kernel mask in here */
   unsigned char unused;
-#if EV_USE_EPOLL
+#if EV_USE_EPOLL || EV_USE_IOURING
   unsigned int egen;    /* generation counter to counter epoll bugs */
 #endif
 #if EV_SELECT_IS_WINSOCKET || EV_USE_IOCP
@@ -2619,6 +2623,9 @@ childcb (EV_P_ ev_signal *sw, int revents)
 #if EV_USE_EPOLL
 # include "ev_epoll.c"
 #endif
+#if EV_USE_IOURING
+# include "ev_iouring.c"
+#endif
 #if EV_USE_POLL
 # include "ev_poll.c"
 #endif
@@ -2655,6 +2662,7 @@ ev_supported_backends (void) EV_THROW
   if (EV_USE_PORT  ) flags |= EVBACKEND_PORT;
   if (EV_USE_KQUEUE) flags |= EVBACKEND_KQUEUE;
   if (EV_USE_EPOLL ) flags |= EVBACKEND_EPOLL;
+  if (EV_USE_IOURING) flags |= EVBACKEND_IOURING;
   if (EV_USE_POLL  ) flags |= EVBACKEND_POLL;
   if (EV_USE_SELECT) flags |= EVBACKEND_SELECT;
   
@@ -2680,6 +2688,8 @@ ev_recommended_backends (void) EV_THROW
 #ifdef __FreeBSD__
   flags &= ~EVBACKEND_POLL;   /* poll return value is unusable (http://forums.freebsd.org/archive/index.php/t-10270.html) */
 #endif
+  /* io_uring is opt-in, it needs a recent kernel and may be disabled by policy */
+  flags &= ~EVBACKEND_IOURING;
 
   return flags;
 }
@@ -2831,6 +2841,9 @@ loop_init (EV_P_ unsigned int flags) EV_THROW
 #if EV_USE_KQUEUE
       if (!backend && (flags & EVBACKEND_KQUEUE)) backend = kqueue_init (EV_A_ flags);
 #endif
+#if EV_USE_IOURING
+      if (!backend && (flags & EVBACKEND_IOURING)) backend = iouring_init (EV_A_ flags);
+#endif
 #if EV_USE_EPOLL
       if (!backend && (flags & EVBACKEND_EPOLL )) backend = epoll_init  (EV_A_ flags);
 #endif
@@ -2914,6 +2927,9 @@ ev_loop_destroy (EV_P)
 #if EV_USE_EPOLL
   if (backend == EVBACKEND_EPOLL ) epoll_destroy  (EV_A);
 #endif
+#if EV_USE_IOURING
+  if (backend == EVBACKEND_IOURING) iouring_destroy (EV_A);
+#endif
 #if EV_USE_POLL
   if (backend == EVBACKEND_POLL  ) poll_destroy   (EV_A);
 #endif
@@ -2978,6 +2994,9 @@ loop_fork (EV_P)
 #if EV_USE_EPOLL
   if (backend == EVBACKEND_EPOLL ) epoll_fork  (EV_A);
 #endif
+#if EV_USE_IOURING
+  if (backend == EVBACKEND_IOURING) iouring_fork (EV_A);
+#endif
 #if EV_USE_INOTIFY
   infy_fork (EV_A);
 #endif
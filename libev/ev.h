@@ -521,7 +521,8 @@ enum {
   EVBACKEND_KQUEUE  = 0x00000008U, /* bsd, broken on osx */
   EVBACKEND_DEVPOLL = 0x00000010U, /* solaris 8 */ /* NYI */
   EVBACKEND_PORT    = 0x00000020U, /* solaris 10 */
-  EVBACKEND_ALL     = 0x0000003FU, /* all known backends */
+  EVBACKEND_IOURING = 0x00000080U, /* linux 5.11+, never chosen automatically */
+  EVBACKEND_ALL     = 0x000000BFU, /* all known backends */
   EVBACKEND_MASK    = 0x0000FFFFU  /* all future backends */
 };
 
@@ -0,0 +1,414 @@
+/*
+ * libev linux io_uring fd activity backend
+ *
+ * Redistribution and use in source and binary forms, with or without modifica-
+ * tion, are permitted provided that the following conditions are met:
+ *
+ *   1.  Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *
+ *   2.  Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MER-
+ * CHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  IN NO EVENT SHALL THE
+ * AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ * Alternatively, the contents of this file may be used under the terms of
+ * the GNU General Public License ("GPL") version 2 or any later version,
+ * in which case the provisions of the GPL are applicable instead of
+ * the above. If you wish to allow the use of your version of this file
+ * only under the terms of the GPL and not to allow others to use your
+ * version of this file under the BSD license, indicate your decision
+ * by deleting the provisions above and replace them with the notice
+ * and other provisions required by the GPL. If you do not delete the
+ * provisions above, a recipient may use your version of this file under
+ * either the BSD or the GPL.
+ */
+
+/*
+ * general notes about this backend:
+ *
+ * readiness is still what libev hands out, io_uring is only used to get
+ * rid of the per-change epoll_ctl calls: every interest change is queued
+ * as a poll sqe and all of them are handed to the kernel together with
+ * the wait for completions, in a single io_uring_enter per iteration.
+ *
+ * polls are oneshot and re-armed on the next fd_reify after every
+ * completion. libev backends have to be level triggered, a multishot poll
+ * is edge triggered and would stay silent for an fd that is still ready,
+ * e.g. a listening socket whose watcher accepts one connection per
+ * event. the sqe user_data carries the fd in the lower and the anfd
+ * generation counter in the upper 32 bits, exactly like the epoll
+ * backend, so completions of polls that were replaced are recognised
+ * and dropped.
+ *
+ * unlike epoll, a pending poll holds a reference on the file, so we can
+ * not lazily ignore removals: closing a socket with a poll still armed
+ * would keep the connection open. every removal is therefore queued as a
+ * POLL_REMOVE, which matches by user_data and works after close, too.
+ *
+ * we need IORING_FEAT_EXT_ARG (5.11+) to pass the timeout to the wait
+ * and IORING_FEAT_NODROP so the completion queue never loses events,
+ * the loop falls back to the next backend otherwise.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+
+#ifndef __NR_io_uring_setup
+# define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+# define __NR_io_uring_enter 426
+#endif
+
+/* user_data of sqes whose completion we are not interested in */
+#define EV_IOURING_IGNORE 0xffffffffffffffffULL
+
+#define EV_SQ_VAR(name) *(unsigned *)((char *)iouring_sq_ring + iouring_sq_ ## name)
+#define EV_CQ_VAR(name) *(unsigned *)((char *)iouring_cq_ring + iouring_cq_ ## name)
+#define EV_SQ_ARRAY     ((unsigned *)((char *)iouring_sq_ring + iouring_sq_array))
+#define EV_SQES         ((struct io_uring_sqe *)iouring_sqes)
+#define EV_CQES         ((struct io_uring_cqe *)((char *)iouring_cq_ring + iouring_cq_cqes))
+
+inline_size
+int
+evsys_io_uring_setup (unsigned entries, struct io_uring_params *params)
+{
+  return syscall (__NR_io_uring_setup, entries, params);
+}
+
+inline_size
+int
+evsys_io_uring_enter (int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t argsz)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* sqes filled in but not yet seen by the kernel */
+inline_size
+unsigned
+iouring_sq_pending (EV_P)
+{
+  return iouring_sq_local_tail - EV_SQ_VAR (head);
+}
+
+static int iouring_reap (EV_P);
+
+static void
+iouring_submit (EV_P)
+{
+  int res;
+
+  while (iouring_sq_pending (EV_A))
+    {
+      res = evsys_io_uring_enter (backend_fd, iouring_sq_pending (EV_A), 0, 0, 0, 0);
+
+      if (res >= 0)
+        continue;
+
+      /* EBUSY: the completion queue is backed up, make room first */
+      if (errno == EBUSY)
+        iouring_reap (EV_A);
+      else if (errno != EINTR && errno != EAGAIN)
+        ev_syserr ("(libev) io_uring_enter");
+    }
+}
+
+static struct io_uring_sqe *
+iouring_sqe_get (EV_P)
+{
+  struct io_uring_sqe *sqe;
+
+  /* the ring is full, hand what we have to the kernel first */
+  if (expect_false (iouring_sq_pending (EV_A) >= EV_SQ_VAR (ring_entries)))
+    iouring_submit (EV_A);
+
+  sqe = EV_SQES + (iouring_sq_local_tail & EV_SQ_VAR (ring_mask));
+  memset (sqe, 0, sizeof (*sqe));
+
+  return sqe;
+}
+
+inline_size
+void
+iouring_sqe_push (EV_P)
+{
+  /* the sq array is an identity mapping set up in iouring_init */
+  ++iouring_sq_local_tail;
+  ECB_MEMORY_FENCE_RELEASE;
+  EV_SQ_VAR (tail) = iouring_sq_local_tail;
+}
+
+inline_size
+uint64_t
+iouring_user_data (int fd, unsigned int gen)
+{
+  return (uint64_t)(uint32_t)fd | ((uint64_t)(uint32_t)gen << 32);
+}
+
+static void
+iouring_poll_add (EV_P_ int fd, int nev)
+{
+  struct io_uring_sqe *sqe = iouring_sqe_get (EV_A);
+
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = fd;
+  sqe->poll32_events = (nev & EV_READ  ? POLLIN  : 0)
+                     | (nev & EV_WRITE ? POLLOUT : 0);
+  sqe->user_data     = iouring_user_data (fd, ++anfds [fd].egen);
+  iouring_sqe_push (EV_A);
+
+  anfds [fd].emask = nev;
+}
+
+static void
+iouring_poll_remove (EV_P_ int fd)
+{
+  struct io_uring_sqe *sqe = iouring_sqe_get (EV_A);
+
+  sqe->opcode    = IORING_OP_POLL_REMOVE;
+  sqe->fd        = -1;
+  sqe->addr      = iouring_user_data (fd, anfds [fd].egen);
+  sqe->user_data = EV_IOURING_IGNORE;
+  iouring_sqe_push (EV_A);
+
+  anfds [fd].emask = 0;
+}
+
+static void
+iouring_modify (EV_P_ int fd, int oev, int nev)
+{
+  /*
+   * the armed poll is tracked in emask rather than oev, fd_rearm_all
+   * and completed oneshot polls reset it without telling us.
+   * the final completion of the removed poll carries the old
+   * generation and is dropped in iouring_process_cqe.
+   */
+  if (anfds [fd].emask)
+    iouring_poll_remove (EV_A_ fd);
+
+  if (nev)
+    iouring_poll_add (EV_A_ fd, nev);
+}
+
+static void
+iouring_process_cqe (EV_P_ struct io_uring_cqe *cqe)
+{
+  int fd;
+  int res;
+
+  if (cqe->user_data == EV_IOURING_IGNORE)
+    return;
+
+  fd  = (uint32_t)cqe->user_data;
+  res = cqe->res;
+
+  /* we never shrink the anfds array, so fd is always in range */
+  if (expect_false ((uint32_t)anfds [fd].egen != (uint32_t)(cqe->user_data >> 32)))
+    return;
+
+  /* the poll is gone from the kernel, arm it again on the next fd_reify */
+  anfds [fd].emask = 0;
+
+  if (expect_false (res < 0 && res != -ECANCELED))
+    {
+      fd_kill (EV_A_ fd);
+      return;
+    }
+
+  fd_change (EV_A_ fd, EV__IOFDSET);
+
+  if (res < 0)
+    return;
+
+  /* fd_event skips fds scheduled for reification, so feed the event directly */
+  fd_event_nocheck (EV_A_ fd,
+                      (res & (POLLOUT | POLLERR | POLLHUP) ? EV_WRITE : 0)
+                    | (res & (POLLIN  | POLLERR | POLLHUP) ? EV_READ  : 0));
+}
+
+static int
+iouring_reap (EV_P)
+{
+  unsigned head, tail;
+  int cnt = 0;
+
+  head = EV_CQ_VAR (head);
+  tail = EV_CQ_VAR (tail);
+  ECB_MEMORY_FENCE_ACQUIRE;
+
+  while (head != tail)
+    {
+      iouring_process_cqe (EV_A_ EV_CQES + (head & EV_CQ_VAR (ring_mask)));
+      ++head;
+      ++cnt;
+    }
+
+  ECB_MEMORY_FENCE_RELEASE;
+  EV_CQ_VAR (head) = head;
+
+  return cnt;
+}
+
+static void
+iouring_poll (EV_P_ ev_tstamp timeout)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  int res;
+
+  /* completions already waiting, or backlogged in the kernel, do not block */
+  if (EV_CQ_VAR (head) != EV_CQ_VAR (tail) || EV_SQ_VAR (flags) & IORING_SQ_CQ_OVERFLOW)
+    timeout = 0.;
+
+  ts.tv_sec  = (long)timeout;
+  ts.tv_nsec = (long)((timeout - (ev_tstamp)ts.tv_sec) * 1e9);
+
+  memset (&arg, 0, sizeof (arg));
+  arg.ts = (uint64_t)(uintptr_t)&ts;
+
+  /* submit all queued poll changes and wait for completions in one go */
+  EV_RELEASE_CB;
+  res = evsys_io_uring_enter (backend_fd, iouring_sq_pending (EV_A), 1,
+                              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof (arg));
+  EV_ACQUIRE_CB;
+
+  if (expect_false (res < 0) && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+    ev_syserr ("(libev) io_uring_enter");
+
+  iouring_reap (EV_A);
+}
+
+static void
+iouring_internal_destroy (EV_P)
+{
+  if (iouring_sq_ring != MAP_FAILED && iouring_sq_ring)
+    munmap (iouring_sq_ring, iouring_sq_ring_size);
+  if (iouring_cq_ring != MAP_FAILED && iouring_cq_ring && iouring_cq_ring != iouring_sq_ring)
+    munmap (iouring_cq_ring, iouring_cq_ring_size);
+  if (iouring_sqes != MAP_FAILED && iouring_sqes)
+    munmap (iouring_sqes, iouring_sqes_size);
+
+  iouring_sq_ring = 0;
+  iouring_cq_ring = 0;
+  iouring_sqes    = 0;
+}
+
+static int
+iouring_internal_init (EV_P)
+{
+  struct io_uring_params params;
+  unsigned i;
+
+  memset (&params, 0, sizeof (params));
+  params.flags      = IORING_SETUP_CQSIZE;
+  params.cq_entries = iouring_entries * 4; /* room for the completions of removed polls */
+
+  backend_fd = evsys_io_uring_setup (iouring_entries, &params);
+  if (backend_fd < 0)
+    return -1;
+
+  if ((~params.features) & (IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG))
+    return -1;
+
+  iouring_sq_head         = params.sq_off.head;
+  iouring_sq_tail         = params.sq_off.tail;
+  iouring_sq_ring_mask    = params.sq_off.ring_mask;
+  iouring_sq_ring_entries = params.sq_off.ring_entries;
+  iouring_sq_flags        = params.sq_off.flags;
+  iouring_sq_array        = params.sq_off.array;
+
+  iouring_cq_head         = params.cq_off.head;
+  iouring_cq_tail         = params.cq_off.tail;
+  iouring_cq_ring_mask    = params.cq_off.ring_mask;
+  iouring_cq_cqes         = params.cq_off.cqes;
+
+  iouring_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+  iouring_cq_ring_size = params.cq_off.cqes  + params.cq_entries * sizeof (struct io_uring_cqe);
+  iouring_sqes_size    = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  /* with IORING_FEAT_SINGLE_MMAP both rings share one mapping */
+  if (iouring_cq_ring_size > iouring_sq_ring_size)
+    iouring_sq_ring_size = iouring_cq_ring_size;
+  iouring_cq_ring_size = iouring_sq_ring_size;
+
+  iouring_sq_ring = mmap (0, iouring_sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, backend_fd, IORING_OFF_SQ_RING);
+  iouring_cq_ring = iouring_sq_ring;
+  iouring_sqes    = mmap (0, iouring_sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, backend_fd, IORING_OFF_SQES);
+
+  if (iouring_sq_ring == MAP_FAILED || iouring_sqes == MAP_FAILED)
+    return -1;
+
+  for (i = 0; i < params.sq_entries; ++i)
+    EV_SQ_ARRAY [i] = i;
+
+  iouring_sq_local_tail = EV_SQ_VAR (tail);
+
+  return 0;
+}
+
+inline_size
+int
+iouring_init (EV_P_ int flags)
+{
+  iouring_entries = 256; /* poll changes queued per iteration before an extra submit */
+  iouring_sq_ring = 0;
+  iouring_cq_ring = 0;
+  iouring_sqes    = 0;
+
+  if (iouring_internal_init (EV_A) < 0)
+    {
+      iouring_internal_destroy (EV_A);
+
+      if (backend_fd >= 0)
+        close (backend_fd);
+      backend_fd = -1;
+
+      return 0;
+    }
+
+  fcntl (backend_fd, F_SETFD, FD_CLOEXEC);
+
+  backend_mintime = 1e-6;
+  backend_modify  = iouring_modify;
+  backend_poll    = iouring_poll;
+
+  return EVBACKEND_IOURING;
+}
+
+inline_size
+void
+iouring_destroy (EV_P)
+{
+  iouring_internal_destroy (EV_A);
+}
+
+inline_size
+void
+iouring_fork (EV_P)
+{
+  iouring_internal_destroy (EV_A);
+  close (backend_fd);
+
+  while (iouring_internal_init (EV_A) < 0)
+    ev_syserr ("(libev) io_uring_setup");
+
+  fcntl (backend_fd, F_SETFD, FD_CLOEXEC);
+
+  /* the polls belong to the old ring, re-arm everything on the new one */
+  fd_rearm_all (EV_A);
+}
@@ -107,6 +107,27 @@ VARx(int, epoll_epermcnt)
 VARx(int, epoll_epermmax)
 #endif
 
+#if EV_USE_IOURING || EV_GENWRAP
+VARx(int, iouring_entries)
+VARx(void *, iouring_sq_ring)
+VARx(void *, iouring_cq_ring)
+VARx(void *, iouring_sqes)
+VARx(size_t, iouring_sq_ring_size)
+VARx(size_t, iouring_cq_ring_size)
+VARx(size_t, iouring_sqes_size)
+VARx(unsigned int, iouring_sq_local_tail)
+VARx(unsigned int, iouring_sq_head)
+VARx(unsigned int, iouring_sq_tail)
+VARx(unsigned int, iouring_sq_ring_mask)
+VARx(unsigned int, iouring_sq_ring_entries)
+VARx(unsigned int, iouring_sq_flags)
+VARx(unsigned int, iouring_sq_array)
+VARx(unsigned int, iouring_cq_head)
+VARx(unsigned int, iouring_cq_tail)
+VARx(unsigned int, iouring_cq_ring_mask)
+VARx(unsigned int, iouring_cq_cqes)
+#endif
+
 #if EV_USE_KQUEUE || EV_GENWRAP
 VARx(pid_t, kqueue_fd_pid)
 VARx(struct kevent *, kqueue_changes)
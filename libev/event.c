@@ -124,6 +124,18 @@ event_base_new (void)
 #endif
 }
 
+/* like event_base_new, but restricted to the given EVBACKEND_* set, NULL if none works */
+struct event_base *
+event_base_new_with_backend (unsigned int backends)
+{
+#if EV_MULTIPLICITY
+  return (struct event_base *)ev_loop_new (backends & EVBACKEND_MASK);
+#else
+  assert (("libev: multiple event bases not supported when not compiled with EV_MULTIPLICITY"));
+  return NULL;
+#endif
+}
+
 void event_base_free (struct event_base *base)
 {
   dLOOPbase;
@@ -158,6 +158,7 @@ int event_priority_init (int npri);
 int event_priority_set (struct event *ev, int pri);
 
 struct event_base *event_base_new (void);
+struct event_base *event_base_new_with_backend (unsigned int backends);
 const char *event_base_get_method (const struct event_base *);
 int event_base_set (struct event_base *base, struct event *ev);
 int event_base_loop (struct event_base *base, int);
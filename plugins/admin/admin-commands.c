@@ -27,6 +27,9 @@
 #include "chassis-sql-log.h"
 #include "cetus-acl.h"
 #include "cetus-process-cycle.h"
+#include "query-cache.h"
+#include "query-digest.h"
+#include "query-admission.h"
 
 static gint save_setting(chassis *srv, gint *effected_rows);
 static void send_result(network_socket *client, gint ret, gint affected);
@@ -355,10 +358,11 @@ void admin_select_conn_details(network_mysqld_con *con)
         if (users != NULL) {
             GHashTableIter iter;
             GString *key;
-            GQueue *queue;
+            network_connection_pool_bucket *bucket;
             g_hash_table_iter_init(&iter, users);
             /* count all users' pooled connections */
-            while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&queue)) {
+            while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&bucket)) {
+                GQueue *queue = &(bucket->conns);
                 row = g_ptr_array_new_with_free_func(g_free);
 
                 sprintf(buffer, "%d", process_id);
@@ -964,14 +968,28 @@ void admin_select_connection_stat(network_mysqld_con* con, int backend_ndx, char
         return;
     }
 
+    /* checkout waits of the backend pool, bucketed as network_connection_pool_record_wait */
+    static char *wait_cols[POOL_WAIT_BUCKETS] = {
+        "wait_lt_1ms", "wait_lt_10ms", "wait_lt_100ms", "wait_lt_1s", "wait_ge_1s"
+    };
+
     GPtrArray* fields = network_mysqld_proto_fielddefs_new();
 
     MAKE_FIELD_DEF_1_COL(fields, "connection_num");
+    int i;
+    for (i = 0; i < POOL_WAIT_BUCKETS; i++) {
+        MAKE_FIELD_DEF_1_COL(fields, wait_cols[i]);
+    }
+    MAKE_FIELD_DEF_1_COL(fields, "wait_failed");
+    MAKE_FIELD_DEF_1_COL(fields, "attr_matched");
+    MAKE_FIELD_DEF_1_COL(fields, "attr_mismatched");
 
     GPtrArray *rows = g_ptr_array_new_with_free_func(
         (void*)network_mysqld_mysql_field_row_free);
 
-    char* numstr = NULL;
+    int conn_num = 0;
+    guint64 wait_hist[POOL_WAIT_BUCKETS] = {0};
+    guint64 wait_failed = 0, attr_matched = 0, attr_mismatched = 0;
     chassis_private *g = con->srv->priv;
     backend_ndx -= 1; /* index in sql start from 1, not 0 */
     if (backend_ndx >= 0 && backend_ndx < network_backends_count(g->backends)) {
@@ -981,22 +999,29 @@ void admin_select_connection_stat(network_mysqld_con* con, int backend_ndx, char
         /*TODO: if robbed, conns is not for user_name */
         GQueue* conns = network_connection_pool_get_conns(backend->pool, user_name, NULL);
         if (conns) {
-            numstr = g_strdup_printf("%d", conns->length);
+            conn_num = conns->length;
         }
         g_string_free(user_name, TRUE);
+        memcpy(wait_hist, backend->pool->wait_hist, sizeof(wait_hist));
+        wait_failed = backend->pool->wait_failed;
+        attr_matched = backend->pool->attr_matched;
+        attr_mismatched = backend->pool->attr_mismatched;
     }
-    if (numstr) {
-        APPEND_ROW_1_COL(rows, numstr);
-    } else {
-        APPEND_ROW_1_COL(rows, "0");
+
+    GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(row, g_strdup_printf("%d", conn_num));
+    for (i = 0; i < POOL_WAIT_BUCKETS; i++) {
+        g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)wait_hist[i]));
     }
+    g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)wait_failed));
+    g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)attr_matched));
+    g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)attr_mismatched));
+    g_ptr_array_add(rows, row);
 
     network_mysqld_con_send_resultset(con->client, fields, rows);
 
     network_mysqld_proto_fielddefs_free(fields);
     g_ptr_array_free(rows, TRUE);
-    if (numstr)
-        g_free(numstr);
 }
 
 static enum cetus_pwd_type password_type(char* table)
@@ -1391,84 +1416,336 @@ static void admin_supported_stats(network_mysqld_con* con)
     APPEND_ROW_1_COL(rows, "query_time_table");
     APPEND_ROW_1_COL(rows, "server_query_details");
     APPEND_ROW_1_COL(rows, "query_wait_table");
+    APPEND_ROW_1_COL(rows, "latency");
+    APPEND_ROW_1_COL(rows, "query_cache");
+    APPEND_ROW_1_COL(rows, "plan_cache");
+    APPEND_ROW_1_COL(rows, "stmt_cache");
     network_mysqld_con_send_resultset(con->client, fields, rows);
     network_mysqld_proto_fielddefs_free(fields);
     g_ptr_array_free(rows, TRUE);
 }
 
+static void admin_append_stats_row(GPtrArray* rows, const char* pid, char* name, guint64 value)
+{
+    GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(row, g_strdup(pid));
+    g_ptr_array_add(row, name);
+    g_ptr_array_add(row, g_strdup_printf("%lu", value));
+    g_ptr_array_add(rows, row);
+}
+
+/* non-empty buckets, named by their upper bound in microseconds */
+static void admin_append_histogram_table(GPtrArray* rows, const char* pid,
+                                         const char* name, stats_histogram_t* h)
+{
+    guint i;
+    for (i = 0; i < STATS_HIST_BUCKETS; ++i) {
+        if (h->buckets[i]) {
+            admin_append_stats_row(rows, pid,
+                                   g_strdup_printf("%s.%lu", name, stats_histogram_bucket_high(i)),
+                                   h->buckets[i]);
+        }
+    }
+}
+
+static void admin_append_latency(GPtrArray* rows, const char* pid,
+                                 const char* name, stats_histogram_t* h)
+{
+    if (h->count == 0) {
+        return;
+    }
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.count", name), h->count);
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.avg", name), h->sum / h->count);
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.p50", name),
+                           stats_histogram_percentile(h, 50));
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.p90", name),
+                           stats_histogram_percentile(h, 90));
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.p99", name),
+                           stats_histogram_percentile(h, 99));
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.p999", name),
+                           stats_histogram_percentile(h, 99.9));
+    admin_append_stats_row(rows, pid, g_strdup_printf("%s.max", name), h->max);
+}
+
+static void admin_append_latencies(GPtrArray* rows, const char* pid, stats_histogram_t* query_time,
+                                   stats_histogram_t* query_wait, stats_histogram_t* server_resp_time)
+{
+    admin_append_latency(rows, pid, "latency.query_time", query_time);
+    admin_append_latency(rows, pid, "latency.query_wait", query_wait);
+    int i;
+    for (i = 0; i < MAX_RESP_TIME_SERVER_NUM; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "latency.server.%d", i+1);
+        admin_append_latency(rows, pid, name, &server_resp_time[i]);
+    }
+}
+
+/* rows of @p for the statistics of one process */
+static void admin_append_stats(GPtrArray* rows, chassis* chas, const char* pid,
+                               query_stats_t* stats, char* p)
+{
+    if (strcasecmp(p, "client_query") == 0) {
+        admin_append_stats_row(rows, pid, g_strdup("client_query.ro"), stats->client_query.ro);
+        admin_append_stats_row(rows, pid, g_strdup("client_query.rw"), stats->client_query.rw);
+    } else if (strcasecmp(p, "proxyed_query") == 0) {
+        admin_append_stats_row(rows, pid, g_strdup("proxyed_query.ro"), stats->proxyed_query.ro);
+        admin_append_stats_row(rows, pid, g_strdup("proxyed_query.rw"), stats->proxyed_query.rw);
+    } else if (strcasecmp(p, "query_time_table") == 0) {
+        admin_append_histogram_table(rows, pid, "query_time_table", &stats->query_time);
+    } else if (strcasecmp(p, "query_wait_table") == 0) {
+        admin_append_histogram_table(rows, pid, "query_wait_table", &stats->query_wait);
+    } else if (strcasecmp(p, "latency") == 0) {
+        admin_append_latencies(rows, pid, &stats->query_time, &stats->query_wait, stats->server_resp_time);
+    } else if (strcasecmp(p, "server_query_details") == 0) {
+        /* the admin process has no backends, show up to the last one used */
+        int backends_num = 0;
+        int i;
+        for (i = 0; i < MAX_SERVER_NUM; ++i) {
+            if (stats->server_query_details[i].ro || stats->server_query_details[i].rw) {
+                backends_num = i + 1;
+            }
+        }
+        for (i = 0; i < backends_num; ++i) {
+            admin_append_stats_row(rows, pid, g_strdup_printf("server_query_details.%d.ro", i+1),
+                                   stats->server_query_details[i].ro);
+            admin_append_stats_row(rows, pid, g_strdup_printf("server_query_details.%d.rw", i+1),
+                                   stats->server_query_details[i].rw);
+        }
+    } else if (strcasecmp(p, "plan_cache") == 0) {
+        admin_append_stats_row(rows, pid, g_strdup("plan_cache.hits"), stats->plan_cache.hits);
+        admin_append_stats_row(rows, pid, g_strdup("plan_cache.misses"), stats->plan_cache.misses);
+        admin_append_stats_row(rows, pid, g_strdup("plan_cache.inserts"), stats->plan_cache.inserts);
+    } else if (strcasecmp(p, "stmt_cache") == 0) {
+        admin_append_stats_row(rows, pid, g_strdup("stmt_cache.hits"), stats->stmt_cache.hits);
+        admin_append_stats_row(rows, pid, g_strdup("stmt_cache.reprepares"), stats->stmt_cache.reprepares);
+        admin_append_stats_row(rows, pid, g_strdup("stmt_cache.evictions"), stats->stmt_cache.evictions);
+    } else if (strcasecmp(p, "query_cache") == 0) {
+        query_cache_t *cache = chas->query_cache;
+        if (cache) {
+            struct {
+                const char *name;
+                guint64 value;
+            } items[] = {
+                {"query_cache.hits", cache->stats.hits},
+                {"query_cache.misses", cache->stats.misses},
+                {"query_cache.inserts", cache->stats.inserts},
+                {"query_cache.evictions", cache->stats.evictions},
+                {"query_cache.expirations", cache->stats.expirations},
+                {"query_cache.rejects", cache->stats.rejects},
+                {"query_cache.invalidations", cache->stats.invalidations},
+                {"query_cache.entries", cache->entry_num},
+                {"query_cache.bytes", cache->bytes},
+            };
+            int i;
+            for (i = 0; i < sizeof(items) / sizeof(items[0]); ++i) {
+                admin_append_stats_row(rows, pid, g_strdup(items[i].name), items[i].value);
+            }
+        }
+    } else {
+        /* "reset" or unknown, the pid buffer doesn't outlive the row */
+        gboolean is_reset = strcasecmp(p, "reset") == 0;
+        GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(row, g_strdup(pid));
+        g_ptr_array_add(row, g_strdup(is_reset ? "reset" : p));
+        g_ptr_array_add(row, g_strdup(is_reset ? "0" : p));
+        g_ptr_array_add(rows, row);
+    }
+}
+
+/**
+ * read the slots of all workers from shared memory
+ *
+ * latency percentiles can't be merged from the per worker values, so they
+ * are also computed over the merged histograms, with "all" as PID
+ */
+static void admin_append_shared_stats(GPtrArray* rows, chassis* chas, char* p)
+{
+    /* query_time, query_wait, then the servers */
+    stats_histogram_t* total = NULL;
+    if (strcasecmp(p, "latency") == 0) {
+        total = g_new0(stats_histogram_t, MAX_RESP_TIME_SERVER_NUM + 2);
+    }
+
+    int i;
+    for (i = 1; i < chas->query_stats_slot_num; ++i) {
+        query_stats_t* stats = &(chas->query_stats_slots[i]);
+        if (stats->pid == 0) {
+            continue;
+        }
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%d", stats->pid);
+        admin_append_stats(rows, chas, buffer, stats, p);
+
+        if (total) {
+            int j;
+            stats_histogram_merge(&total[0], &stats->query_time);
+            stats_histogram_merge(&total[1], &stats->query_wait);
+            for (j = 0; j < MAX_RESP_TIME_SERVER_NUM; ++j) {
+                stats_histogram_merge(&total[j + 2], &stats->server_resp_time[j]);
+            }
+        }
+    }
+
+    if (total) {
+        admin_append_latencies(rows, "all", &total[0], &total[1], &total[2]);
+        g_free(total);
+    }
+}
+
 void admin_get_stats(network_mysqld_con* con, char* p)
 {
     if (!p) { /* just "stats get", no argument */
         admin_supported_stats(con);
         return;
     }
-    
-    if (con->is_processed_by_subordinate) {
+
+    chassis *chas = con->srv;
+    gboolean is_shared = chas->query_stats_shared && strcasecmp(p, "query_cache") != 0;
+    if (con->is_processed_by_subordinate && !is_shared) {
         con->admin_read_merge = 1;
         return;
     }
-    char buffer[32];
-    cetus_pid_t process_id = getpid();
-    sprintf(buffer, "%d", process_id);
 
     GPtrArray* fields = network_mysqld_proto_fielddefs_new();
     MAKE_FIELD_DEF_3_COL(fields, "PID", "name", "value");
     GPtrArray *rows = g_ptr_array_new_with_free_func(
         (void*)network_mysqld_mysql_field_row_free);
-    chassis *chas = con->srv;
-    query_stats_t* stats = &(chas->query_stats);
-    char buf1[32] = {0};
-    char buf2[32] = {0};
-    if (strcasecmp(p, "client_query") == 0) {
-        snprintf(buf1, 32, "%lu", stats->client_query.ro);
-        snprintf(buf2, 32, "%lu", stats->client_query.rw);
-        APPEND_ROW_3_COL(rows, buffer, "client_query.ro", buf1);
-        APPEND_ROW_3_COL(rows, buffer, "client_query.rw", buf2);
-    } else if (strcasecmp(p, "proxyed_query") == 0) {
-        snprintf(buf1, 32, "%lu", stats->proxyed_query.ro);
-        snprintf(buf2, 32, "%lu", stats->proxyed_query.rw);
-        APPEND_ROW_3_COL(rows, buffer, "proxyed_query.ro", buf1);
-        APPEND_ROW_3_COL(rows, buffer, "proxyed_query.rw", buf2);
-    } else if (strcasecmp(p, "query_time_table") == 0) {
-        int i = 0;
-        for (i; i < MAX_QUERY_TIME && stats->query_time_table[i]; ++i) {
-            GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(row, g_strdup(buffer));
-            g_ptr_array_add(row, g_strdup_printf("query_time_table.%d", i+1));
-            g_ptr_array_add(row, g_strdup_printf("%lu", stats->query_time_table[i]));
-            g_ptr_array_add(rows, row);
-        }
-    } else if (strcasecmp(p, "query_wait_table") == 0) {
-        int i = 0;
-        for (i; i < MAX_WAIT_TIME && stats->query_wait_table[i]; ++i) {
-            GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(row, g_strdup(buffer));
-            g_ptr_array_add(row, g_strdup_printf("query_wait_table.%d", i+1));
-            g_ptr_array_add(row, g_strdup_printf("%lu", stats->query_wait_table[i]));
-            g_ptr_array_add(rows, row);
-        }
-    } else if (strcasecmp(p, "server_query_details") == 0) {
-        int i = 0;
-        int  backends_num = network_backends_count(chas->priv->backends);
-        for (i; i < backends_num && i < MAX_SERVER_NUM; ++i) {
-            GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(row, g_strdup(buffer));
-            g_ptr_array_add(row, g_strdup_printf("server_query_details.%d.ro", i+1));
-            g_ptr_array_add(row, g_strdup_printf("%lu", stats->server_query_details[i].ro));
-            g_ptr_array_add(rows, row);
-            row = g_ptr_array_new_with_free_func(g_free);
-            g_ptr_array_add(row, g_strdup(buffer));
-            g_ptr_array_add(row, g_strdup_printf("server_query_details.%d.rw", i+1));
-            g_ptr_array_add(row, g_strdup_printf("%lu", stats->server_query_details[i].rw));
-            g_ptr_array_add(rows, row);
-        }
-    } else if (strcasecmp(p, "reset") == 0) {
-        APPEND_ROW_3_COL(rows, buffer, "reset", "0");
+    if (con->is_processed_by_subordinate) {
+        /* no need to ask the workers */
+        con->direct_answer = 1;
+        admin_append_shared_stats(rows, chas, p);
     } else {
-        APPEND_ROW_3_COL(rows, buffer, (char*)p, (char*)p);
+        char buffer[32];
+        cetus_pid_t process_id = getpid();
+        sprintf(buffer, "%d", process_id);
+        admin_append_stats(rows, chas, buffer, chas->query_stats, p);
+    }
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+}
+
+/**
+ * fingerprints of all workers merged, the most expensive first
+ */
+void admin_show_digest(network_mysqld_con* con, int show_count)
+{
+    con->direct_answer = 1;
+    query_digest_t* qd = con->srv->query_digest;
+    if (qd == NULL) {
+        network_mysqld_con_send_error(con->client, C("digest table is disabled"));
+        return;
+    }
+
+    int number = show_count > 0 ? show_count : 20;
+    guint64 evicted = 0, lost = 0;
+    GPtrArray* entries = query_digest_top(qd, number, &evicted, &lost);
+
+    static char* names[] = {
+        "digest", "count", "total_usec", "avg_usec", "max_usec", "rows", "bytes",
+        "errors", "avg_fanout", "max_fanout", "first_seen", "last_seen", "fingerprint"
+    };
+    GPtrArray* fields = network_mysqld_proto_fielddefs_new();
+    int i;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        MAKE_FIELD_DEF_1_COL(fields, names[i]);
+    }
+    GPtrArray *rows = g_ptr_array_new_with_free_func(
+        (void*)network_mysqld_mysql_field_row_free);
+    for (i = 0; i < entries->len; ++i) {
+        query_digest_entry_t* e = g_ptr_array_index(entries, i);
+        GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
+        char first_seen[32], last_seen[32];
+        chassis_epoch_to_string(&e->first_seen, C(first_seen));
+        chassis_epoch_to_string(&e->last_seen, C(last_seen));
+        g_ptr_array_add(row, g_strdup_printf("%016lx", e->digest));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->count));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->total_usec));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->total_usec / e->count));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->max_usec));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->rows));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->bytes));
+        g_ptr_array_add(row, g_strdup_printf("%lu", e->errors));
+        g_ptr_array_add(row, g_strdup_printf("%.2f", (double)e->fanout / e->count));
+        g_ptr_array_add(row, g_strdup_printf("%u", e->max_fanout));
+        g_ptr_array_add(row, g_strdup(first_seen));
+        g_ptr_array_add(row, g_strdup(last_seen));
+        g_ptr_array_add(row, g_strdup(e->text));
+        g_ptr_array_add(rows, row);
+    }
+    if (evicted > 0) {
+        /* statements of fingerprints evicted from the tables */
+        GPtrArray* row = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(row, g_strdup("-"));
+        g_ptr_array_add(row, g_strdup_printf("%lu", lost));
+        for (i = 2; i < sizeof(names) / sizeof(names[0]) - 1; ++i) {
+            g_ptr_array_add(row, NULL);
+        }
+        g_ptr_array_add(row, g_strdup_printf("(%lu fingerprints evicted, digest table is full)", evicted));
+        g_ptr_array_add(rows, row);
     }
     network_mysqld_con_send_resultset(con->client, fields, rows);
 
+    network_mysqld_proto_fielddefs_free(fields);
+    g_ptr_array_free(rows, TRUE);
+    g_ptr_array_free(entries, TRUE);
+}
+
+static void
+admission_append_rows(GPtrArray *rows, cetus_pid_t pid, const char *type, GHashTable *tenants)
+{
+    GHashTableIter iter;
+    admission_tenant_t *t;
+    g_hash_table_iter_init(&iter, tenants);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&t)) {
+        GPtrArray *row = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(row, g_strdup_printf("%d", pid));
+        g_ptr_array_add(row, g_strdup(type));
+        g_ptr_array_add(row, g_strdup(t->name));
+        g_ptr_array_add(row, g_strdup_printf("%d", t->limit));
+        g_ptr_array_add(row, g_strdup_printf("%u", t->weight));
+        g_ptr_array_add(row, g_strdup_printf("%d", t->running));
+        g_ptr_array_add(row, g_strdup_printf("%d", t->queued));
+        g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)t->admitted));
+        g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)t->delayed));
+        g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)t->timeouts));
+        g_ptr_array_add(row, g_strdup_printf("%llu", (unsigned long long)t->rejected));
+        g_ptr_array_add(row, g_strdup_printf("%llu",
+                    (unsigned long long)(t->delayed ? t->wait_usec / t->delayed : 0)));
+        g_ptr_array_add(rows, row);
+    }
+}
+
+/**
+ * running and queued queries of each user and db in every worker
+ */
+void admin_show_admission(network_mysqld_con* con)
+{
+    if (con->is_processed_by_subordinate) {
+        con->admin_read_merge = 1;
+        return;
+    }
+
+    static char* names[] = {
+        "PID", "type", "name", "limit", "weight", "running", "queued",
+        "admitted", "delayed", "timeouts", "rejected", "avg_wait_usec"
+    };
+    GPtrArray* fields = network_mysqld_proto_fielddefs_new();
+    int i;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        MAKE_FIELD_DEF_1_COL(fields, names[i]);
+    }
+    GPtrArray *rows = g_ptr_array_new_with_free_func(
+        (void*)network_mysqld_mysql_field_row_free);
+
+    query_admission_t *adm = con->srv->admission;
+    cetus_pid_t process_id = getpid();
+    admission_append_rows(rows, process_id, "user", adm->users);
+    admission_append_rows(rows, process_id, "db", adm->dbs);
+
+    network_mysqld_con_send_resultset(con->client, fields, rows);
+
     network_mysqld_proto_fielddefs_free(fields);
     g_ptr_array_free(rows, TRUE);
 }
@@ -1994,14 +2271,45 @@ void admin_kill_query(network_mysqld_con* con, guint32 thread_id)
 
 }
 
+void admin_flush_query_cache(network_mysqld_con* con, char* schema, char* table)
+{
+    if (con->is_processed_by_subordinate) {
+        return;
+    }
+
+    query_cache_t* cache = con->srv->query_cache;
+    guint affected = 0;
+    if (cache) {
+        if (schema && table) {
+            gchar* name = query_cache_table_name(schema, table);
+            affected = query_cache_invalidate_table(cache, name);
+            g_free(name);
+        } else {
+            affected = cache->entry_num;
+            query_cache_clear(cache);
+        }
+    }
+    network_mysqld_con_send_ok_full(con->client, affected, 0,
+                                    SERVER_STATUS_AUTOCOMMIT, 0);
+}
+
 void admin_reset_stats(network_mysqld_con* con)
 {
     if (con->is_processed_by_subordinate) {
+        if (con->srv->query_digest) {
+            /* the workers clear their own digest tables */
+            query_digest_reset(con->srv->query_digest);
+        }
         return;
     }
 
-    query_stats_t* stats = &con->srv->query_stats;
+    query_stats_t* stats = con->srv->query_stats;
+    pid_t pid = stats->pid;
     memset(stats, 0, sizeof(*stats));
+    stats->pid = pid;
+    if (con->srv->query_cache) {
+        memset(&con->srv->query_cache->stats, 0, sizeof(query_cache_stats_t));
+    }
     network_mysqld_con_send_ok_full(con->client, 1, 0,
                                     SERVER_STATUS_AUTOCOMMIT, 0);
 }
@@ -2066,11 +2374,12 @@ static struct sql_help_entry_t {
     {"config set key=value", "e.g. config set log-level = message; ", ALL_HELP},
     {"create sharded table schema.table vdb id shardkey key", "e.g. create sharded table test.tb1 vdb 1 shardkey id; ", SHARD_HELP},
     {"create single table schema.table on group", "e.g. create single table test.tb1 on data1; ", SHARD_HELP},
-    {"create vdb id (groupA:xx, groupB:xx) using method", "Method example: hash(int,4) range(str)", SHARD_HELP},
+    {"create vdb id (groupA:xx, groupB:xx) using method", "Method example: hash(int,4) range(str) jump(str) ketama(int)", SHARD_HELP},
     {"delete allow_ip|deny_ip 'user@address'", "delete address from white or black list", ALL_HELP},
     {"delete from user_pwd where user='name'", "delete from user_pwd where user='lede'; ", ALL_HELP},
     {"delete from app_user_pwd where user='name'", "delete from user_pwd where user='lede'; ", ALL_HELP},
     {"delete from backends where [backend_ndx=index|address='ip:port']", "e.g. delete from backends where backend_ndx = 1; ", ALL_HELP},
+    {"flush query cache [table schema.table]", "drop cached query results, e.g. flush query cache table test.tb1; ", ALL_HELP},
     {"insert into backends values ('ip:port', '[ro|rw]', 'state')", "add mysql instance to backends list", RW_HELP},
     {"insert into backends values ('ip:port@group', '[ro|rw]', 'state')", "add mysql instance to backends list", SHARD_HELP},
     {"kill query tid", "kill session when the thread id is equal to tid. e.g. kill query 1; ", ALL_HELP},
@@ -2094,6 +2403,8 @@ static struct sql_help_entry_t {
     {"set charset_check [true|false]", "check the client charset is equal to the default charset", ALL_HELP},
     {"show allow_ip|deny_ip", "show allow_ip|deny_ip rules. e.g. show allow_ip; ", ALL_HELP},
     {"show connectionlist [num]", "show num connections. e.g. show connectionlist; ", ALL_HELP},
+    {"show digest [num]", "show num statement fingerprints by total time. e.g. show digest 10; ", ALL_HELP},
+    {"show admission", "show running and queued queries of each user and db. e.g. show admission; ", ALL_HELP},
     {"show maintain status", "e.g. show maintain status; ", ALL_HELP},
     {"show variables [like '%pattern%']", "e.g. show variables like '%proxy%'; ", ALL_HELP},
     {"sql log status", "show sql log status", ALL_HELP},
@@ -2176,7 +2487,7 @@ void admin_send_overview(network_mysqld_con* con)
     snprintf(buf3, bsize, "%d", g->cons->len - 1);
     APPEND_ROW_3_COL(rows, buffer, "Client connections", buf3);
 
-    query_stats_t* stats = &(con->srv->query_stats);
+    query_stats_t* stats = con->srv->query_stats;
     char qcount[32];
     snprintf(qcount, 32, "%ld", stats->client_query.ro+stats->client_query.rw);
     APPEND_ROW_3_COL(rows, buffer, "Query count", qcount);
@@ -2205,6 +2516,9 @@ void admin_send_overview(network_mysqld_con* con)
 */
 static gboolean convert_datetime_partitions(GPtrArray *partitions, sharding_vdb_t *vdb)
 {
+    if (vdb->method == SHARD_METHOD_JUMP || vdb->method == SHARD_METHOD_KETAMA) {
+        return TRUE; /* partition values are order or weight, not dates */
+    }
     if (vdb->key_type == SHARD_DATA_TYPE_DATE
         || vdb->key_type == SHARD_DATA_TYPE_DATETIME)
     {
@@ -2310,7 +2624,22 @@ void admin_create_vdb(network_mysqld_con* con, int id, GPtrArray* partitions,
     }
 
     /* some verifcations */
+    if (vdb->method == SHARD_METHOD_UNKNOWN) {
+        network_mysqld_con_send_error(con->client, C("unknown method"));
+        sharding_vdb_free(vdb);
+        return;
+    }
     sharding_partition_t* part = g_ptr_array_index(vdb->partitions, 0);
+    if (vdb->method == SHARD_METHOD_JUMP || vdb->method == SHARD_METHOD_KETAMA) {
+        /* "group:N" is parsed as an int range, N is the order or the weight */
+        if (part->method == SHARD_METHOD_RANGE && part->key_type == SHARD_DATA_TYPE_INT) {
+            for (i = 0; i < partitions->len; ++i) {
+                sharding_partition_t* p = g_ptr_array_index(partitions, i);
+                p->method = vdb->method;
+                p->key_type = key_type;
+            }
+        }
+    }
     if (vdb->method != part->method) {
         network_mysqld_con_send_error(con->client, C("method mismatch"));
         sharding_vdb_free(vdb);
@@ -2390,7 +2719,7 @@ void admin_select_vdb(network_mysqld_con* con)
         sharding_vdb_t* vdb = l->data;
         char* vdb_id = g_strdup_printf("%d", vdb->id);
         char* method = g_strdup_printf("%s(%s)",
-                 vdb->method == SHARD_METHOD_HASH?"hash":"range",
+                 sharding_method_str(vdb->method),
                  sharding_key_type_str(vdb->key_type));
         sharding_vdb_partitions_to_string(vdb, str);
         char* partitions = g_strdup(str->str);
@@ -2707,13 +3036,24 @@ void admin_sql_log_status(network_mysqld_con* con) {
             con->srv->sql_mgr->sql_log_action == SQL_LOG_START ? "running": "stopped", "Internal");
     gchar *cached = NULL;
     if (con->srv->sql_mgr->fifo && (con->srv->sql_mgr->sql_log_action == SQL_LOG_START)) {
-        cached = g_strdup_printf("%u", con->srv->sql_mgr->fifo->in - con->srv->sql_mgr->fifo->in);
+        cached = g_strdup_printf("%u", sql_log_cached_bytes(con->srv->sql_mgr));
     } else {
         cached = g_strdup("NULL");
     }
+    freelist = g_list_append(freelist, cached);
     APPEND_ROW_4_COL(rows, buffer, "sql-log-cached", cached, "Internal");
     gchar *cursize = g_strdup_printf("%lu", con->srv->sql_mgr->sql_log_cursize);
+    freelist = g_list_append(freelist, cursize);
     APPEND_ROW_4_COL(rows, buffer, "sql-log-cursize", cursize, "Internal");
+    gchar *dropped = g_strdup_printf("%" G_GUINT64_FORMAT, con->srv->sql_mgr->sql_log_dropped);
+    freelist = g_list_append(freelist, dropped);
+    APPEND_ROW_4_COL(rows, buffer, "sql-log-dropped", dropped, "Internal");
+    gchar *dropped_bytes = g_strdup_printf("%" G_GUINT64_FORMAT, con->srv->sql_mgr->sql_log_dropped_bytes);
+    freelist = g_list_append(freelist, dropped_bytes);
+    APPEND_ROW_4_COL(rows, buffer, "sql-log-dropped-bytes", dropped_bytes, "Internal");
+    gchar *waits = g_strdup_printf("%" G_GUINT64_FORMAT, con->srv->sql_mgr->sql_log_waits);
+    freelist = g_list_append(freelist, waits);
+    APPEND_ROW_4_COL(rows, buffer, "sql-log-waits", waits, "Internal");
 
     APPEND_ROW_4_COL(rows, buffer, "sql-log-fullname",
             con->srv->sql_mgr->sql_log_fullname == NULL ? "NULL" : con->srv->sql_mgr->sql_log_fullname, "Internal");
@@ -18,6 +18,8 @@ void admin_select_conn_details(network_mysqld_con* con);
 void admin_select_all_backends(network_mysqld_con*);
 void admin_select_all_groups(network_mysqld_con* con);
 void admin_show_connectionlist(network_mysqld_con *admin_con, int show_count);
+void admin_show_digest(network_mysqld_con *admin_con, int show_count);
+void admin_show_admission(network_mysqld_con *admin_con);
 void admin_acl_show_rules(network_mysqld_con *con, gboolean is_white);
 void admin_acl_add_rule(network_mysqld_con *con, gboolean is_white, char *addr);
 void admin_acl_delete_rule(network_mysqld_con *con, gboolean is_white, char* ip);
@@ -63,6 +65,7 @@ void admin_sql_log_start(network_mysqld_con* con);
 void admin_sql_log_stop(network_mysqld_con* con);
 void admin_sql_log_status(network_mysqld_con* con);
 void admin_kill_query(network_mysqld_con* con, guint32);
+void admin_flush_query_cache(network_mysqld_con* con, char* schema, char* table);
 void admin_comment_handle(network_mysqld_con* con);
 void admin_select_version_comment(network_mysqld_con* con);
 char* admin_get_value_by_key(network_mysqld_con* con, const char *key);
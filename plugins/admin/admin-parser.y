@@ -112,7 +112,7 @@ input ::= cmd.
 %fallback ID
   CONN_DETAILS BACKENDS AT_SIGN REDUCE_CONNS ADD MAINTAIN STATUS
   CONN_NUM BACKEND_NDX RESET CETUS VDB HASH RANGE SHARDKEY RELOAD
-  SAVE SETTINGS SINGLE.
+  SAVE SETTINGS SINGLE FLUSH CACHE.
 
 %wildcard ANY.
 
@@ -179,6 +179,12 @@ cmd ::= SELECT STAR FROM GROUPS SEMI. {
 cmd ::= SHOW CONNECTIONLIST opt_integer(X) SEMI. {
   admin_show_connectionlist(con, X);
 }
+cmd ::= SHOW DIGEST opt_integer(X) SEMI. {
+  admin_show_digest(con, X);
+}
+cmd ::= SHOW ADMISSION SEMI. {
+  admin_show_admission(con);
+}
 cmd ::= SHOW ALLOW_IP SEMI. {
   admin_acl_show_rules(con, TRUE);
 }
@@ -431,6 +437,15 @@ method(A) ::= RANGE LP ID(X) RP. {
   A.key_type = sharding_key_type(key);
   g_free(key);
 }
+method(A) ::= ID(M) LP ID(X) RP. {
+  char* name = token_strdup(M);
+  A.method = sharding_method(name);
+  g_free(name);
+  A.logic_shard_num = 0;
+  char* key = token_strdup(X);
+  A.key_type = sharding_key_type(key);
+  g_free(key);
+}
 
 cmd ::= CREATE SHARDED TABLE ids(X) DOT ids(Y) VDB INTEGER(Z) SHARDKEY ids(W) SEMI. {
   char* schema = token_strdup(X);
@@ -474,6 +489,16 @@ cmd ::= SQL LOG STOP SEMI. {
 cmd ::= KILL QUERY INTEGER(X) SEMI. {
   admin_kill_query(con, token2int(X));
 }
+cmd ::= FLUSH QUERY CACHE SEMI. {
+  admin_flush_query_cache(con, NULL, NULL);
+}
+cmd ::= FLUSH QUERY CACHE TABLE ids(X) DOT ids(Y) SEMI. {
+  char* schema = token_strdup(X);
+  char* table = token_strdup(Y);
+  admin_flush_query_cache(con, schema, table);
+  free(schema);
+  free(table);
+}
 cmd ::= STARTCOM ENDCOM SEMI. {
   admin_comment_handle(con);
 }
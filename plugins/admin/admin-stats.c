@@ -38,7 +38,7 @@ struct admin_stats_t {
 static void sql_stats_sampling_func(int fd, short what, void *arg)
 {
     admin_stats_t* a = arg;
-    query_stats_t* stats = &(a->chas->query_stats);
+    query_stats_t* stats = a->chas->query_stats;
     ring_buffer_add(&a->sql_count_ring,
                     stats->client_query.ro + stats->client_query.rw);
     ring_buffer_add(&a->trx_count_ring, stats->xa_count);
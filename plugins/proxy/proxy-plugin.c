@@ -51,11 +51,13 @@ typedef int socklen_t;
 
 #include "network-conn-pool.h"
 #include "network-conn-pool-wrap.h"
+#include "network-stmt-cache.h"
 
 #include "sys-pedantic.h"
 #include "network-injection.h"
 #include "network-backend.h"
 #include "sql-context.h"
+#include "sql-property.h"
 #include "sql-filter-variables.h"
 #include "glib-ext.h"
 #include "chassis-timings.h"
@@ -95,8 +97,26 @@ typedef enum {
     INJ_ID_CHANGE_SQL_MODE,
     INJ_ID_CHANGE_USER,
     INJ_ID_RESET_CONNECTION,
+    INJ_ID_STMT_REPREPARE,
 } proxy_inj_id_t;
 
+/**
+ * A statement prepared by the client, with enable-stmt-multiplexing.
+ *
+ * It is not tied to a server connection, each execute is routed like a
+ * query and the statement is prepared again on connections which have
+ * not seen it yet.
+ */
+typedef struct proxy_stmt_t {
+    guint32 id;                 /* id seen by the client */
+    GString *sql;
+    guint16 num_params;
+    GString *param_types;       /* 2 bytes per parameter, from the last execute binding them */
+    GQueue long_data;           /* COM_STMT_SEND_LONG_DATA payloads for the next execute */
+    unsigned int is_read:1;
+    unsigned int has_cursor:1;
+} proxy_stmt_t;
+
 struct chassis_plugin_config {
     /**< listening address of the proxy */
     gchar *address;
@@ -124,6 +144,7 @@ struct chassis_plugin_config {
 };
 
 static gboolean proxy_get_backend_ndx(network_mysqld_con *con, int type, gboolean force_slave);
+static gboolean proxy_is_slave_fresh(network_mysqld_con *con, network_backend_t *backend, gboolean force_slave);
 
 void
 g_fast_stream_hexdump(const char *msg, const void *_s, size_t len)
@@ -266,6 +287,169 @@ store_server_ndx_in_prepared_resp(proxy_resultset_t *res, int index)
     return 0;
 }
 
+static void
+proxy_stmt_free(proxy_stmt_t *stmt)
+{
+    GString *data;
+    while ((data = g_queue_pop_head(&(stmt->long_data)))) {
+        g_string_free(data, TRUE);
+    }
+    g_string_free(stmt->sql, TRUE);
+    g_string_free(stmt->param_types, TRUE);
+    g_free(stmt);
+}
+
+static network_stmt_cache_t *
+proxy_server_stmt_cache(network_socket *server)
+{
+    if (server->stmt_cache == NULL) {
+        server->stmt_cache = network_stmt_cache_new();
+    }
+    return server->stmt_cache;
+}
+
+/**
+ * COM_STMT_CLOSE and COM_STMT_SEND_LONG_DATA get no response, they are
+ * written ahead of the next command
+ */
+static void
+proxy_flush_stmt_pending(network_socket *server)
+{
+    if (server->stmt_cache == NULL) {
+        return;
+    }
+
+    GString *payload;
+    while ((payload = g_queue_pop_head(&(server->stmt_cache->pending)))) {
+        network_mysqld_queue_reset(server);
+        network_mysqld_queue_append(server, server->send_queue, S(payload));
+        g_string_free(payload, TRUE);
+    }
+}
+
+/* the stmt id follows the command byte in payloads and the status in COM_STMT_PREPARE_OK */
+static void
+proxy_stmt_write_id(GString *payload, guint32 stmt_id)
+{
+    if (payload->len < 5) {
+        return;
+    }
+    payload->str[1] = (char)(stmt_id & 0xff);
+    payload->str[2] = (char)((stmt_id >> 8) & 0xff);
+    payload->str[3] = (char)((stmt_id >> 16) & 0xff);
+    payload->str[4] = (char)((stmt_id >> 24) & 0xff);
+}
+
+static int
+proxy_get_stmt_prepare_ok(GString *data, network_mysqld_stmt_prep_ok_pack_t *ok)
+{
+    network_packet packet;
+    guint8 status = 0xff;
+    int err = 0;
+
+    if (data == NULL) {
+        return -1;
+    }
+    packet.data = data;
+    packet.offset = NET_HEADER_SIZE;
+
+    err = err || network_mysqld_proto_get_int8(&packet, &status);
+    if (err || status != 0x00) {
+        return -1;
+    }
+    err = err || network_mysqld_proto_get_int32(&packet, &ok->stmt_id);
+    err = err || network_mysqld_proto_get_int16(&packet, &ok->num_columns);
+    err = err || network_mysqld_proto_get_int16(&packet, &ok->num_params);
+
+    return err ? -1 : 0;
+}
+
+/**
+ * point @payload at the server statement, the long data sent by the client
+ * goes out right before it
+ */
+static void
+proxy_stmt_set_server_id(network_stmt_cache_t *cache, proxy_stmt_t *stmt, GString *payload, guint32 server_id)
+{
+    proxy_stmt_write_id(payload, server_id);
+
+    GString *data;
+    while ((data = g_queue_pop_head(&(stmt->long_data)))) {
+        proxy_stmt_write_id(data, server_id);
+        network_stmt_cache_add_pending(cache, data);
+    }
+}
+
+/**
+ * give the client its own id for the statement just prepared, the server
+ * connection is not kept for it
+ */
+static void
+proxy_stmt_register(network_mysqld_con *con, proxy_plugin_con_t *st)
+{
+    network_mysqld_stmt_prep_ok_pack_t ok = { 0 };
+    GString *packet = g_queue_peek_head(con->server->recv_queue->chunks);
+
+    if (proxy_get_stmt_prepare_ok(packet, &ok) != 0) {
+        return;
+    }
+
+    sql_context_t *context = st->sql_context;
+    proxy_stmt_t *stmt = g_new0(proxy_stmt_t, 1);
+    if (++st->last_stmt_id == 0) {
+        st->last_stmt_id++;
+    }
+    stmt->id = st->last_stmt_id;
+    /* 2 NULs are appended for the lexer */
+    stmt->sql = g_string_new_len(con->orig_sql->str, con->orig_sql->len - 2);
+    stmt->num_params = ok.num_params;
+    stmt->param_types = g_string_new(NULL);
+    g_queue_init(&(stmt->long_data));
+    stmt->is_read = (context->stmt_type == STMT_SELECT && !(context->rw_flag & (CF_WRITE | CF_FORCE_MASTER)));
+    g_hash_table_insert(st->stmts, &(stmt->id), stmt);
+
+    network_stmt_cache_t *cache = proxy_server_stmt_cache(con->server);
+    con->srv->query_stats->stmt_cache.evictions +=
+        network_stmt_cache_insert(cache, con->client->default_db->str, S(stmt->sql), ok.stmt_id);
+
+    GString ok_payload;
+    ok_payload.str = packet->str + NET_HEADER_SIZE;
+    ok_payload.len = packet->len - NET_HEADER_SIZE;
+    proxy_stmt_write_id(&ok_payload, stmt->id);
+
+    g_debug("%s: stmt:%u prepared as %u for con:%p", G_STRLOC, stmt->id, ok.stmt_id, con);
+
+    if (!con->is_in_transaction && con->is_auto_commit && !con->is_prepared &&
+        !con->is_in_sess_context && !con->is_calc_found_rows) {
+        con->client->is_server_conn_reserved = 0;
+    }
+}
+
+/**
+ * the statement is prepared on a connection for the pending execute
+ */
+static network_mysqld_stmt_ret
+proxy_stmt_reprepared(network_mysqld_con *con, proxy_plugin_con_t *st)
+{
+    network_mysqld_stmt_prep_ok_pack_t ok = { 0 };
+    GString *packet = g_queue_peek_head(con->server->recv_queue->chunks);
+    injection *inj = g_queue_peek_head(st->injected.queries);
+
+    if (st->stmt == NULL || inj == NULL || proxy_get_stmt_prepare_ok(packet, &ok) != 0) {
+        /* e.g. the table is gone, the client gets the error instead */
+        g_message("%s: prepare stmt again failed for con:%p", G_STRLOC, con);
+        network_injection_queue_reset(st->injected.queries);
+        return PROXY_NO_DECISION;
+    }
+
+    network_stmt_cache_t *cache = proxy_server_stmt_cache(con->server);
+    con->srv->query_stats->stmt_cache.evictions +=
+        network_stmt_cache_insert(cache, con->client->default_db->str, S(st->stmt->sql), ok.stmt_id);
+    proxy_stmt_set_server_id(cache, st->stmt, inj->query, ok.stmt_id);
+
+    return PROXY_IGNORE_RESULT;
+}
+
 static network_mysqld_stmt_ret
 proxy_c_read_query_result(network_mysqld_con *con)
 {
@@ -301,9 +485,17 @@ proxy_c_read_query_result(network_mysqld_con *con)
     switch (inj->id) {
     case INJ_ID_COM_DEFAULT:
     case INJ_ID_COM_QUERY:
+        is_continue = TRUE;
+        break;
     case INJ_ID_COM_STMT_PREPARE:
+        if (st->stmts) {
+            proxy_stmt_register(con, st);
+        }
         is_continue = TRUE;
         break;
+    case INJ_ID_STMT_REPREPARE:
+        ret = proxy_stmt_reprepared(con, st);
+        break;
     case INJ_ID_RESET_CONNECTION:
         ret = PROXY_IGNORE_RESULT;
         break;
@@ -560,6 +752,25 @@ process_other_set_command(network_mysqld_con *con, const char *key, const char *
     return 0;
 }
 
+/* SET cetus_max_lag = N, answered by proxy */
+static gboolean
+process_cetus_set_command(network_mysqld_con *con, sql_expr_t *left, sql_expr_t *right)
+{
+    if (!sql_expr_is_id(left, "cetus_max_lag")) {
+        return FALSE;
+    }
+
+    gint64 value = 0;
+    if (sql_expr_get_int(right, &value) && value >= 0 && value <= G_MAXINT32) {
+        con->max_replica_lag_msec = value;
+        g_debug("%s: max replica lag:%d for con:%p", G_STRLOC, con->max_replica_lag_msec, con);
+        network_mysqld_con_send_ok(con->client);
+    } else {
+        network_mysqld_con_send_error(con->client, C("(proxy) invalid value for cetus_max_lag"));
+    }
+    return TRUE;
+}
+
 static int
 process_set_names(network_mysqld_con *con, char *s, mysqld_query_attr_t *query_attr)
 {
@@ -637,6 +848,10 @@ process_filter_for_trans_query(network_mysqld_con *con, sql_context_t *context,
                 if (!left || !right)
                     break;
 
+                if (process_cetus_set_command(con, left, right)) {
+                    return PROXY_SEND_RESULT;
+                }
+
                 if (sql_filter_vars_is_silent(left->token_text, right->token_text)) {
                     network_mysqld_con_send_ok(con->client);
                     g_message("silent variable: %s", left->token_text);
@@ -715,6 +930,10 @@ process_non_trans_query(network_mysqld_con *con, sql_context_t *context, mysqld_
                 if (!left || !right)
                     break;
 
+                if (process_cetus_set_command(con, left, right)) {
+                    return PROXY_SEND_RESULT;
+                }
+
                 if (sql_filter_vars_is_silent(left->token_text, right->token_text)) {
                     network_mysqld_con_send_ok(con->client);
                     g_message("silent variable: %s", left->token_text);
@@ -764,7 +983,7 @@ process_non_trans_query(network_mysqld_con *con, sql_context_t *context, mysqld_
     if (con->srv->master_preferred || context->rw_flag & CF_WRITE || need_to_visit_master) {
         g_debug("%s:rw here", G_STRLOC);
         /* rw operation */
-        con->srv->query_stats.client_query.rw++;
+        con->srv->query_stats->client_query.rw++;
         if (is_orig_ro_server) {
             gboolean success = proxy_get_backend_ndx(con, BACKEND_TYPE_RW, FALSE);
             if (!success) {
@@ -775,18 +994,18 @@ process_non_trans_query(network_mysqld_con *con, sql_context_t *context, mysqld_
         }
     } else {                    /* ro operation */
         g_debug("%s:ro here", G_STRLOC);
-        con->srv->query_stats.client_query.ro++;
+        con->srv->query_stats->client_query.ro++;
         con->is_read_ro_server_allowed = 1;
         if (con->srv->query_cache_enabled) {
             if (sql_context_is_cacheable(st->sql_context)) {
-                if (try_to_get_resp_from_query_cache(con)) {
+                if (try_to_get_resp_from_query_cache(con, st->sql_context)) {
                     return PROXY_SEND_RESULT;
                 }
             }
         }
 
         if (con->config->read_master_percentage != 100) {
-            if (!is_orig_ro_server) {
+            if (!is_orig_ro_server || !proxy_is_slave_fresh(con, st->backend, FALSE)) {
                 gboolean success = proxy_get_backend_ndx(con, BACKEND_TYPE_RO, FALSE);
                 if (!success) {
                     con->slave_conn_shortaged = 1;
@@ -1063,6 +1282,10 @@ reset_connection(network_mysqld_con *con)
     proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_RESET_CONNECTION, packet, TRUE, FALSE);
 
     con->server->is_in_sess_context = 0;
+    /* the server drops all prepared statements */
+    if (con->server->stmt_cache) {
+        network_stmt_cache_clear(con->server->stmt_cache);
+    }
 
     return 0;
 }
@@ -1101,6 +1324,9 @@ adjust_user(network_mysqld_con *con)
         proxy_inject_packet(con, PROXY_QUEUE_ADD_PREPEND, INJ_ID_CHANGE_USER, payload, TRUE, FALSE);
 
         con->server->is_in_sess_context = 0;
+        if (con->server->stmt_cache) {
+            network_stmt_cache_clear(con->server->stmt_cache);
+        }
         g_string_free(hashed_password, TRUE);
         return 0;
     }
@@ -1215,7 +1441,8 @@ forced_visit(network_mysqld_con *con, proxy_plugin_con_t *st, sql_context_t *con
         con->use_slave_forced = 1;
     }
 
-    if (st->backend == NULL || (st->backend && st->backend->type != type)) {
+    if (st->backend == NULL || (st->backend && st->backend->type != type)
+        || (type == BACKEND_TYPE_RO && !proxy_is_slave_fresh(con, st->backend, context->rw_flag & CF_FORCE_SLAVE))) {
         gboolean success = proxy_get_backend_ndx(con, type,
                                                  context->rw_flag & CF_FORCE_SLAVE);
         if (!success) {
@@ -1263,16 +1490,19 @@ process_rw_split(network_mysqld_con *con, proxy_plugin_con_t *st,
                 return 0;
             }
         }
-        con->srv->query_stats.client_query.rw++;
+        con->srv->query_stats->client_query.rw++;
         if (con->is_in_transaction) {
             query_attr->conn_reserved = 1;
             if (command == COM_QUERY) {
                 process_trans_query(con);
-            } else if (command == COM_STMT_PREPARE) {
+            } else if (command == COM_STMT_PREPARE && st->stmts == NULL) {
                 con->is_prepared = 1;
             }
         } else {
-            if (command == COM_STMT_PREPARE) {
+            if (command == COM_STMT_PREPARE && st->stmts) {
+                /* prepared again wherever it is executed, the connection is not kept */
+                g_debug("%s: multiplexed prepare for con:%p", G_STRLOC, con);
+            } else if (command == COM_STMT_PREPARE) {
                 query_attr->conn_reserved = 1;
                 con->is_prepared = 1;
                 if (process_non_trans_prepare_stmt(con) == PROXY_NO_CONNECTION) {
@@ -1300,7 +1530,9 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
     g_string_append_c(con->orig_sql, '\0');
 
     sql_context_t *context = st->sql_context;
+    sql_context_set_digest(context, con->srv->query_digest != NULL);
     sql_context_parse_len(context, con->orig_sql);
+    con->digest = context->digest;
 
     g_debug("%s process query:%s", G_STRLOC, con->orig_sql->str);
 
@@ -1348,7 +1580,7 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
     }
 
     /* query statistics */
-    query_stats_t *stats = &(con->srv->query_stats);
+    query_stats_t *stats = con->srv->query_stats;
     switch (context->stmt_type) {
     case STMT_SHOW_WARNINGS:
         if (con->last_warning_met) {
@@ -1367,6 +1599,10 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
         break;
     }
 
+    if (con->srv->query_cache_enabled) {
+        query_cache_record_write(con, context, command == COM_STMT_PREPARE);
+    }
+
     if (context->rw_flag & (CF_FORCE_MASTER | CF_FORCE_SLAVE)) {
         if (!forced_visit(con, st, context, disp_flag)) {
             return 0;
@@ -1414,6 +1650,201 @@ process_query_or_stmt_prepare(network_mysqld_con *con, proxy_plugin_con_t *st,
     return 1;
 }
 
+static proxy_stmt_t *
+proxy_stmt_lookup(proxy_plugin_con_t *st, network_packet *packet)
+{
+    guint32 stmt_id;
+
+    packet->offset = NET_HEADER_SIZE + 1;
+    if (network_mysqld_proto_get_int32(packet, &stmt_id) != 0) {
+        return NULL;
+    }
+
+    return g_hash_table_lookup(st->stmts, &stmt_id);
+}
+
+static void
+proxy_stmt_reset(network_mysqld_con *con, proxy_plugin_con_t *st, proxy_stmt_t *stmt)
+{
+    GString *data;
+    while ((data = g_queue_pop_head(&(stmt->long_data)))) {
+        g_string_free(data, TRUE);
+    }
+
+    if (stmt->has_cursor) {
+        stmt->has_cursor = 0;
+        st->stmt_cursors--;
+        if (st->stmt_cursors == 0) {
+            con->is_prepared = 0;
+        }
+    }
+}
+
+/**
+ * route a multiplexed execute like a query
+ */
+static int
+process_stmt_execute(network_mysqld_con *con, proxy_plugin_con_t *st, network_packet *packet,
+                     mysqld_query_attr_t *query_attr, int *disp_flag)
+{
+    proxy_stmt_t *stmt = proxy_stmt_lookup(st, packet);
+    if (stmt == NULL) {
+        network_mysqld_con_send_error_full(con->client,
+                                           C("Unknown prepared statement handler"), ER_UNKNOWN_STMT_HANDLER, "HY000");
+        *disp_flag = PROXY_SEND_RESULT;
+        return 0;
+    }
+    st->stmt = stmt;
+
+    guint8 flags = 0;
+    network_mysqld_proto_get_int8(packet, &flags);
+    if (flags & CURSOR_TYPE_READ_ONLY) {
+        /* COM_STMT_FETCH has to reach the same connection */
+        if (!stmt->has_cursor) {
+            stmt->has_cursor = 1;
+            st->stmt_cursors++;
+        }
+        con->is_prepared = 1;
+        query_attr->conn_reserved = 1;
+    }
+
+    if (con->server && (con->client->is_server_conn_reserved || con->is_in_transaction || !con->is_auto_commit)) {
+        return 1;
+    }
+
+    gboolean is_orig_ro_server = (con->server && st->backend && st->backend->type == BACKEND_TYPE_RO);
+    if (stmt->is_read && !con->srv->master_preferred && !con->last_record_updated
+        && con->config->read_master_percentage != 100) {
+        if (!is_orig_ro_server || !proxy_is_slave_fresh(con, st->backend, FALSE)) {
+            if (!proxy_get_backend_ndx(con, BACKEND_TYPE_RO, FALSE)) {
+                con->slave_conn_shortaged = 1;
+                g_debug("%s:slave_conn_shortaged is true", G_STRLOC);
+            }
+        }
+    } else if (is_orig_ro_server) {
+        if (!proxy_get_backend_ndx(con, BACKEND_TYPE_RW, FALSE)) {
+            con->master_conn_shortaged = 1;
+            g_debug("%s:PROXY_NO_CONNECTION", G_STRLOC);
+            *disp_flag = PROXY_NO_CONNECTION;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * statement commands touching only the client side of a multiplexed
+ * statement are answered here, COM_STMT_SEND_LONG_DATA is held until
+ * the next execute, COM_STMT_RESET of a statement with a cursor is sent
+ * to its server instead
+ */
+static network_mysqld_stmt_ret
+process_stmt_local(network_mysqld_con *con, proxy_plugin_con_t *st, network_packet *packet, int command)
+{
+    proxy_stmt_t *stmt = proxy_stmt_lookup(st, packet);
+
+    switch (command) {
+    case COM_STMT_SEND_LONG_DATA:
+        if (stmt) {
+            /* a payload over 16M comes in several packets */
+            GString *data = g_string_new(NULL);
+            GList *chunk;
+            for (chunk = con->client->recv_queue->chunks->head; chunk; chunk = chunk->next) {
+                GString *s = chunk->data;
+                g_string_append_len(data, s->str + NET_HEADER_SIZE, s->len - NET_HEADER_SIZE);
+            }
+            g_queue_push_tail(&(stmt->long_data), data);
+        }
+        break;
+    case COM_STMT_RESET:
+        if (stmt == NULL) {
+            network_mysqld_con_send_error_full(con->client,
+                                               C("Unknown prepared statement handler"), ER_UNKNOWN_STMT_HANDLER,
+                                               "HY000");
+            break;
+        }
+        proxy_stmt_reset(con, st, stmt);
+        network_mysqld_con_send_ok(con->client);
+        break;
+    case COM_STMT_CLOSE:
+        if (stmt) {
+            proxy_stmt_reset(con, st, stmt);
+            g_hash_table_remove(st->stmts, &(stmt->id));
+        }
+        break;
+    default:
+        break;
+    }
+
+    /* nothing to send for the commands without response */
+    return PROXY_SEND_RESULT;
+}
+
+/**
+ * the statement on the server may have been bound by another client, send
+ * the parameter types with every execute
+ */
+static void
+proxy_stmt_bind_params(proxy_stmt_t *stmt, GString *payload)
+{
+    if (stmt->num_params == 0) {
+        return;
+    }
+
+    /* command, stmt id, flags, iteration count, null bitmap */
+    gsize bound_pos = 1 + 4 + 1 + 4 + (stmt->num_params + 7) / 8;
+    gsize types_len = stmt->num_params * 2;
+    if (payload->len <= bound_pos) {
+        return;
+    }
+
+    if (payload->str[bound_pos]) {
+        if (payload->len >= bound_pos + 1 + types_len) {
+            g_string_truncate(stmt->param_types, 0);
+            g_string_append_len(stmt->param_types, payload->str + bound_pos + 1, types_len);
+        }
+    } else if (stmt->param_types->len == types_len) {
+        payload->str[bound_pos] = 1;
+        g_string_insert_len(payload, bound_pos + 1, S(stmt->param_types));
+    }
+}
+
+/**
+ * point the command at the statement prepared on con->server, prepare it
+ * there first if the connection has not seen it yet
+ */
+static void
+proxy_stmt_bind(network_mysqld_con *con, proxy_plugin_con_t *st)
+{
+    proxy_stmt_t *stmt = st->stmt;
+    injection *inj = g_queue_peek_tail(st->injected.queries);
+    query_stats_t *stats = con->srv->query_stats;
+
+    if (inj->query->len > 0 && inj->query->str[0] == COM_STMT_EXECUTE) {
+        proxy_stmt_bind_params(stmt, inj->query);
+    }
+
+    network_stmt_cache_t *cache = proxy_server_stmt_cache(con->server);
+    guint32 server_id = network_stmt_cache_lookup(cache, con->client->default_db->str, S(stmt->sql));
+    if (server_id) {
+        stats->stmt_cache.hits++;
+        proxy_stmt_set_server_id(cache, stmt, inj->query, server_id);
+        return;
+    }
+
+    stats->stmt_cache.reprepares++;
+    g_debug("%s: prepare stmt:%u again on server:%p for con:%p", G_STRLOC, stmt->id, con->server, con);
+
+    GString *payload = g_string_sized_new(stmt->sql->len + 1);
+    g_string_append_c(payload, (char)COM_STMT_PREPARE);
+    g_string_append_len(payload, S(stmt->sql));
+
+    g_queue_pop_tail(st->injected.queries);
+    proxy_inject_packet(con, PROXY_QUEUE_ADD_APPEND, INJ_ID_STMT_REPREPARE, payload, TRUE, FALSE);
+    network_injection_queue_append(st->injected.queries, inj);
+}
+
 static network_mysqld_stmt_ret
 network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
 {
@@ -1445,6 +1876,7 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
     con->candidate_tcp_streamed = 1;
 
     network_injection_queue_reset(st->injected.queries);
+    st->stmt = NULL;
 
     int backend_ndx = st->backend_ndx;
 
@@ -1488,6 +1920,43 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
     case COM_CHANGE_USER:
         network_mysqld_con_send_error(con->client, C("(proxy) unable to process change user"));
         return PROXY_SEND_RESULT;
+    case COM_STMT_EXECUTE:
+        if (con->srv->query_cache_enabled) {
+            query_cache_record_execute(con);
+        }
+        if (st->stmts && !process_stmt_execute(con, st, &packet, &query_attr, &disp_flag)) {
+            return disp_flag;
+        }
+        break;
+    case COM_STMT_FETCH:
+        if (st->stmts) {
+            st->stmt = proxy_stmt_lookup(st, &packet);
+            if (st->stmt == NULL) {
+                network_mysqld_con_send_error_full(con->client,
+                                                   C("Unknown prepared statement handler"),
+                                                   ER_UNKNOWN_STMT_HANDLER, "HY000");
+                return PROXY_SEND_RESULT;
+            }
+        }
+        break;
+    case COM_STMT_RESET:
+        if (st->stmts) {
+            proxy_stmt_t *stmt = proxy_stmt_lookup(st, &packet);
+            if (stmt && stmt->has_cursor) {
+                /* the cursor open on the server is closed by the server */
+                proxy_stmt_reset(con, st, stmt);
+                st->stmt = stmt;
+                break;
+            }
+            return process_stmt_local(con, st, &packet, command);
+        }
+        break;
+    case COM_STMT_SEND_LONG_DATA:
+    case COM_STMT_CLOSE:
+        if (st->stmts) {
+            return process_stmt_local(con, st, &packet, command);
+        }
+        break;
     default:
         break;
     }                           /* end switch */
@@ -1547,13 +2016,14 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
         }
     } else {
         if (backend->type == BACKEND_TYPE_RW) {
-            con->srv->query_stats.proxyed_query.rw++;
-            con->srv->query_stats.server_query_details[st->backend_ndx].rw++;
+            con->srv->query_stats->proxyed_query.rw++;
+            con->srv->query_stats->server_query_details[st->backend_ndx].rw++;
         } else {
-            con->srv->query_stats.proxyed_query.ro++;
-            con->srv->query_stats.server_query_details[st->backend_ndx].ro++;
+            con->srv->query_stats->proxyed_query.ro++;
+            con->srv->query_stats->server_query_details[st->backend_ndx].ro++;
             con->server->is_read_only = 1;
         }
+        network_mysqld_con_backend_request_begin(con, backend);
     }
 
     con->last_record_updated = 0;
@@ -1644,6 +2114,10 @@ network_read_query(network_mysqld_con *con, proxy_plugin_con_t *st)
         }
     }
 
+    if (st->stmt) {
+        proxy_stmt_bind(con, st);
+    }
+
     return PROXY_SEND_INJECTION;
 }
 
@@ -1809,6 +2283,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
 
         send_sock = con->server;
 
+        proxy_flush_stmt_pending(send_sock);
         network_mysqld_queue_reset(send_sock);
         network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
 
@@ -1853,6 +2328,44 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * oldest slave position acceptable for the current read, 0 if any slave is
+ *
+ * The position is the master time(ms) of the last heartbeat a slave applied.
+ * A max_lag hint or the session's cetus_max_lag bounds it by staleness, and
+ * within read-after-write-window a slave must have applied the last write of
+ * the session. A forced slave read only honours the staleness bound.
+ */
+static guint64
+proxy_slave_applied_bound(network_mysqld_con *con, gboolean force_slave)
+{
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    sql_property_t *property = st->sql_context->property;
+    guint64 now = (guint64)con->req_recv_time.tv_sec * 1000 + con->req_recv_time.tv_usec / 1000;
+    guint64 bound = 0;
+
+    int max_lag = con->max_replica_lag_msec;
+    if (property && property->max_lag > 0) {
+        max_lag = property->max_lag;
+    }
+    if (max_lag > 0 && now > (guint64)max_lag) {
+        bound = now - max_lag;
+    }
+
+    int window = con->srv->read_after_write_window;
+    if (!force_slave && window > 0 && con->last_write_msec + window > now) {
+        bound = MAX(bound, con->last_write_msec);
+    }
+
+    return bound;
+}
+
+static gboolean
+proxy_is_slave_fresh(network_mysqld_con *con, network_backend_t *backend, gboolean force_slave)
+{
+    return backend->slave_applied_msec >= proxy_slave_applied_bound(con, force_slave);
+}
+
 static gboolean
 proxy_get_backend_ndx(network_mysqld_con *con, int type, gboolean force_slave)
 {
@@ -1864,18 +2377,23 @@ proxy_get_backend_ndx(network_mysqld_con *con, int type, gboolean force_slave)
 
     int idx;
     if (type == BACKEND_TYPE_RO) {
+        guint64 min_applied = proxy_slave_applied_bound(con, force_slave);
         if (force_slave) {
-            idx = network_backends_get_ro_ndx(g->backends);
+            idx = network_backends_get_fresh_ro_ndx(g->backends, min_applied);
         } else {
             int x = g_random_int_range(0, 100);
             if (x < con->config->read_master_percentage) {
                 idx = network_backends_get_rw_ndx(g->backends);
             } else {
-                idx = network_backends_get_ro_ndx(g->backends);
+                idx = network_backends_get_fresh_ro_ndx(g->backends, min_applied);
             }
             g_debug(G_STRLOC ": %d, read_master_percentage: %d, read: %d",
                     x, con->config->read_master_percentage, idx);
         }
+        if (idx == -1 && min_applied > 0) {
+            g_debug("%s: no slave applied %llu, read from master", G_STRLOC, (unsigned long long)min_applied);
+            idx = network_backends_get_rw_ndx(g->backends);
+        }
     } else {                    /* type == BACKEND_TYPE_RW */
         idx = network_backends_get_rw_ndx(g->backends);
     }
@@ -2010,6 +2528,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result)
     g_assert(inj);
     g_assert(send_sock);
 
+    proxy_flush_stmt_pending(send_sock);
     network_mysqld_queue_reset(send_sock);
     network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
 
@@ -2077,7 +2596,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result)
         case COM_STMT_PREPARE:{
             network_mysqld_com_stmt_prep_result_t *r = con->parse.data;
             if (r->status == MYSQLD_PACKET_OK) {
-                con->prepare_stmt_count++;
+                /* multiplexed statements don't keep the connection */
+                if (st->stmts == NULL) {
+                    con->prepare_stmt_count++;
+                }
             } else {
                 g_warning("%s: prepare stmt not ok for con:%p", G_STRLOC, con);
             }
@@ -2140,6 +2662,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result)
             inj->ts_read_query_result_last = get_timer_microseconds();
             log_sql_backend(con, inj);
         }
+        if (inj->id == INJ_ID_COM_DEFAULT || inj->id == INJ_ID_COM_QUERY) {
+            network_mysqld_con_backend_request_done(con, st->backend, TRUE);
+        }
     }
 
     /* reset the packet-id checks as the server-side is finished */
@@ -2214,6 +2739,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init)
     sql_context_init(st->sql_context);
     st->trx_read_write = TF_READ_WRITE;
     st->trx_isolation_level = con->srv->internal_trx_isolation_level;
+    if (con->srv->stmt_multiplexing_enabled) {
+        st->stmts = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, (GDestroyNotify)proxy_stmt_free);
+    }
 
     con->plugin_con_state = st;
 
@@ -2323,6 +2851,9 @@ proxy_plugin_con_free(network_mysqld_con *con, proxy_plugin_con_t *st)
         return;
 
     network_injection_queue_free(st->injected.queries);
+    if (st->stmts) {
+        g_hash_table_destroy(st->stmts);
+    }
 
     /* If con still has server list, then all are closed */
     if (con->servers != NULL) {
@@ -2394,6 +2925,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client)
 
     /* TODO: this should inside "st"_free, but now "st" shared by many plugins */
     if (st->sql_context) {
+        sql_context_set_digest(st->sql_context, FALSE);
         sql_context_destroy(st->sql_context);
         g_free(st->sql_context);
         st->sql_context = NULL;
@@ -2889,7 +3421,7 @@ network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *c
 
         network_connection_pool_create_conns(chas);
         evtimer_set(&chas->auto_create_conns_event, check_and_create_conns_func, chas);
-        struct timeval check_interval = {30, 0};
+        struct timeval check_interval = {POOL_CHECK_INTERVAL_SEC, 0};
         chassis_event_add_with_timeout(chas, &chas->auto_create_conns_event, &check_interval);
         g_debug("%s:set callback check_and_create_conns_func", G_STRLOC);
     }
@@ -46,6 +46,7 @@
 #include "shard-plugin-con.h"
 #include "sharding-config.h"
 #include "sharding-parser.h"
+#include "sharding-plan-cache.h"
 #include "sharding-query-plan.h"
 #include "sql-filter-variables.h"
 #include "cetus-log.h"
@@ -88,6 +89,10 @@ struct chassis_plugin_config {
     gchar *deny_ip;
 
     int allow_nested_subquery;
+
+    /* max statement shapes with a compiled plan, 0 to disable */
+    int plan_cache_size;
+    sharding_plan_cache_t *plan_cache;
 };
 
 /**
@@ -302,7 +307,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query)
         if (sql_context_is_cacheable(st->sql_context)) {
             if (!con->is_in_transaction && !con->srv->master_preferred &&
                 !(st->sql_context->rw_flag & CF_FORCE_MASTER) && !(st->sql_context->rw_flag & CF_FORCE_SLAVE)) {
-                if (try_to_get_resp_from_query_cache(con)) {
+                if (try_to_get_resp_from_query_cache(con, st->sql_context)) {
                     return NETWORK_SOCKET_SUCCESS;
                 }
             }
@@ -420,7 +425,7 @@ explain_shard_sql(network_mysqld_con *con, sharding_plan_t *plan)
 
     shard_plugin_con_t *st = con->plugin_con_state;
 
-    rv = sharding_parse_groups(con->client->default_db, st->sql_context, &(con->srv->query_stats),
+    rv = sharding_parse_groups(con->client->default_db, st->sql_context, con->srv->query_stats,
             con->key, plan);
 
     con->modified_sql = sharding_modify_sql(st->sql_context, &(con->hav_condi),
@@ -428,6 +433,8 @@ explain_shard_sql(network_mysqld_con *con, sharding_plan_t *plan)
     if (con->modified_sql) {
         sharding_plan_set_modified_sql(plan, con->modified_sql);
     }
+    sharding_prune_IN_list(st->sql_context, &(con->hav_condi), con->srv->is_groupby_need_reconstruct,
+            con->client->default_db, plan, con->modified_sql != NULL);
 
     sharding_plan_sort_groups(plan);
     int abnormal = 0;
@@ -509,6 +516,12 @@ analysis_query(network_mysqld_con *con, mysqld_query_attr_t *query_attr)
             }
         }
         sql_select_t *select = (sql_select_t *)context->sql_statement;
+        if (select == NULL) {   /* routed by the plan cache */
+            if (st->cached_has_aggregate) {
+                con->could_be_tcp_streamed = 0;
+            }
+            break;
+        }
 
         if (con->could_be_tcp_streamed) {
             if (sql_expr_list_find_aggregate(select->columns, NULL) != -1) {
@@ -630,6 +643,31 @@ shard_handle_local_query(network_mysqld_con *con, sql_context_t *context)
     return PROXY_SEND_RESULT;
 }
 
+/* compiled plans don't record the tables read for the query cache */
+static sharding_plan_cache_t *
+shard_plan_cache(network_mysqld_con *con)
+{
+    chassis_plugin_config *config = con->config;
+    if (con->srv->query_cache_enabled || con->srv->is_partition_mode) {
+        return NULL;
+    }
+    return config->plan_cache;
+}
+
+/**
+ * only a plain SELECT may be found in the plan cache, anything else is
+ * parsed right away instead of being lexed twice on the miss
+ */
+static gboolean
+shard_plan_cache_may_hit(GString *sql)
+{
+    const char *p = sql->str;
+    while (g_ascii_isspace(*p)) {
+        p++;
+    }
+    return g_ascii_strncasecmp(p, "select", 6) == 0 && !g_ascii_isalnum(p[6]) && p[6] != '_';
+}
+
 static int
 proxy_parse_query(network_mysqld_con *con)
 {
@@ -692,7 +730,29 @@ proxy_parse_query(network_mysqld_con *con)
 
             g_debug("%s: sql:%s", G_STRLOC, con->orig_sql->str);
             sql_context_t *context = st->sql_context;
-            sql_context_parse_len(context, con->orig_sql);
+            sharding_plan_cache_t *plan_cache = shard_plan_cache(con);
+            st->cached_group = NULL;
+            if (plan_cache && shard_plan_cache_may_hit(con->orig_sql)) {
+                /* the shape of the statement decides if it needs parsing */
+                sql_context_set_digest(context, TRUE);
+                sql_context_scan_len(context, con->orig_sql);
+                /* the default db is only set while routing the first query */
+                const char *db = con->client->default_db->len > 0 ? con->client->default_db->str
+                    : (con->srv->default_db ? con->srv->default_db : "");
+                gboolean has_aggregate = FALSE;
+                st->cached_group = sharding_plan_cache_lookup(plan_cache, db, context, &has_aggregate);
+                if (st->cached_group) {
+                    st->cached_has_aggregate = has_aggregate;
+                    con->srv->query_stats->plan_cache.hits++;
+                } else {
+                    con->srv->query_stats->plan_cache.misses++;
+                    sql_context_parse_scanned(context, con->orig_sql);
+                }
+            } else {
+                sql_context_set_digest(context, con->srv->query_digest != NULL);
+                sql_context_parse_len(context, con->orig_sql);
+            }
+            con->digest = context->digest;
 
             if (context->rc == PARSE_SYNTAX_ERR) {
                 if (con->srv->is_sql_special_processed) {
@@ -726,6 +786,10 @@ proxy_parse_query(network_mysqld_con *con)
             if (context->clause_flags & CF_LOCAL_QUERY) {
                 return shard_handle_local_query(con, context);
             }
+
+            if (con->srv->query_cache_enabled) {
+                query_cache_record_write(con, context, FALSE);
+            }
             memset(&(con->query_attr), 0, sizeof(mysqld_query_attr_t));
             return analysis_query(con, &(con->query_attr));
         }
@@ -789,6 +853,9 @@ wrap_check_sql(network_mysqld_con *con, struct sql_context_t *sql_context)
         sharding_plan_set_modified_sql(con->sharding_plan, con->modified_sql);
     }
 
+    sharding_prune_IN_list(sql_context, &(con->hav_condi), con->srv->is_groupby_need_reconstruct,
+            con->client->default_db, con->sharding_plan, con->modified_sql != NULL);
+
     return con->sql_modified;
 }
 
@@ -1232,7 +1299,7 @@ make_decisions(network_mysqld_con *con, int rv, int *disp_flag)
 {
     shard_plugin_con_t *st = con->plugin_con_state;
 
-    query_stats_t *stats = &(con->srv->query_stats);
+    query_stats_t *stats = con->srv->query_stats;
 
     switch (rv) {               /* TODO: move these inside to give specific reasons */
     case ERROR_UNPARSABLE:
@@ -1292,9 +1359,10 @@ proxy_get_server_list(network_mysqld_con *con)
     }
 
     con->write_flag = 0;
+    con->lock_read_flag = 0;
     con->use_all_prev_servers = 0;
 
-    query_stats_t *stats = &(con->srv->query_stats);
+    query_stats_t *stats = con->srv->query_stats;
     sharding_plan_t *plan = sharding_plan_new(con->orig_sql);
     plan->is_partition_mode = con->srv->is_partition_mode;
     int rv = 0, disp_flag = 0;
@@ -1307,6 +1375,15 @@ proxy_get_server_list(network_mysqld_con *con)
 
         if (st->sql_context->rw_flag & CF_WRITE) {
             con->write_flag = 1;
+        } else if (st->sql_context->stmt_type == STMT_SELECT) {
+            /* locks taken by a participant are kept until the whole transaction is decided */
+            sql_select_t *select = st->sql_context->sql_statement;
+            for (; select; select = select->prior) {
+                if (select->lock_read) {
+                    con->lock_read_flag = 1;
+                    break;
+                }
+            }
         }
 
         switch (con->parse.command) {
@@ -1316,8 +1393,18 @@ proxy_get_server_list(network_mysqld_con *con)
                 }
                 break;
             default:
+                if (st->cached_group) {
+                    sharding_plan_add_group(plan, st->cached_group);
+                    rv = USE_SHARDING;
+                    break;
+                }
                 rv = sharding_parse_groups(con->client->default_db, st->sql_context,
                         stats, con->key, plan);
+                sharding_plan_cache_t *plan_cache = shard_plan_cache(con);
+                if (plan_cache && sharding_plan_cache_learn(plan_cache, con->client->default_db->str,
+                                                            st->sql_context, rv, plan)) {
+                    stats->plan_cache.inserts++;
+                }
                 break;
         }
     }
@@ -1406,7 +1493,7 @@ proxy_get_pooled_connection(network_mysqld_con *con,
     }
 
     if (type == BACKEND_TYPE_RO) {
-        backend = network_group_pick_slave_backend(backend_group);
+        backend = network_group_pick_slave_backend(backend_group, g->backends->read_balance_mode);
         if (backend == NULL) {  /* fallback to readwrite backend */
             type = BACKEND_TYPE_RW;
         }
@@ -1431,7 +1518,7 @@ proxy_get_pooled_connection(network_mysqld_con *con,
         return FALSE;
     }
 
-    *sock = network_connection_pool_get(backend->pool, con->client->response->username, is_robbed);
+    *sock = network_connection_pool_get(backend->pool, con->client, is_robbed);
     if (*sock == NULL) {
         if (type == BACKEND_TYPE_RW) {
             con->master_conn_shortaged = 1;
@@ -1439,10 +1526,15 @@ proxy_get_pooled_connection(network_mysqld_con *con,
             con->slave_conn_shortaged = 1;
         }
 
+        if (con->retry_serv_cnt >= con->max_retry_serv_cnt) {
+            network_connection_pool_record_wait_failed(backend->pool);
+        }
+
         g_debug("%s: conn shortaged, type:%d", G_STRLOC, type);
         return FALSE;
     }
 
+    network_connection_pool_record_wait(backend->pool, con->is_wait_server ? &(con->pool_wait_begin) : NULL);
     (*sock)->is_read_only = (type == BACKEND_TYPE_RO) ? 1 : 0;
     st->backend = backend;
 
@@ -1482,6 +1574,7 @@ proxy_add_server_connection(network_mysqld_con *con, GString *group, int *server
                         }
                         ss->dist_tran_participated = 1;
                     }
+                    network_mysqld_con_backend_request_begin(con, ss->backend);
                     return TRUE;
                 }
             }
@@ -1530,6 +1623,7 @@ proxy_add_server_connection(network_mysqld_con *con, GString *group, int *server
         }
 
         g_ptr_array_add(con->servers, ss); /* TODO: CHANGE SQL */
+        network_mysqld_con_backend_request_begin(con, ss->backend);
     }
 
     return ok;
@@ -1944,6 +2038,14 @@ build_xa_end_command(network_mysqld_con *con, server_session_t *ss, int first)
 
     g_queue_push_tail(ss->server->send_queue->chunks, srv_packet);
 
+    if (ss->dist_tran_state == NEXT_ST_XA_PREPARE) {
+        /* commit, the prepare goes out in the same write */
+        network_mysqld_con_dist_tran_state_t state = shard_build_xa_prepare_after_end(con, ss);
+        if (first) {
+            con->dist_tran_state = state;
+        }
+    }
+
     ss->state = NET_RW_STATE_NONE;
 }
 
@@ -1984,15 +2086,8 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
             con->is_attr_adjust = 1;
             if (con->unmatched_attribute & ATTR_DIF_CHANGE_USER) {
                 check_user_consistant(con);
-            } else if (con->unmatched_attribute & ATTR_DIF_DEFAULT_DB) {
-                shard_set_default_db_consistant(con);
-                con->attr_adj_state = ATTR_DIF_DEFAULT_DB;
-            } else if (con->unmatched_attribute & ATTR_DIF_CHARSET) {
-                shard_set_charset_consistant(con);
-                con->attr_adj_state = ATTR_DIF_CHARSET;
-            } else if (con->unmatched_attribute & ATTR_DIF_SET_OPTION) {
-                shard_set_multi_stmt_consistant(con);
-                con->attr_adj_state = ATTR_DIF_SET_OPTION;
+            } else if (con->unmatched_attribute & (ATTR_DIF_DEFAULT_DB | ATTR_DIF_CHARSET | ATTR_DIF_SET_OPTION)) {
+                shard_set_attrs_pipelined(con);
             } else if (con->unmatched_attribute & ATTR_DIF_SET_AUTOCOMMIT) {
                 g_debug("%s: autocommit adjust", G_STRLOC);
                 shard_set_autocommit(con);
@@ -2037,12 +2132,19 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
 
         gboolean xa_start_phase = FALSE;
         if (con->dist_tran) {
-            for (i = 0; i < con->servers->len; i++) {
-                server_session_t *ss = g_ptr_array_index(con->servers, i);
-                if (!ss->xa_start_already_sent) {
-                    xa_start_phase = TRUE;
-                    g_debug("%s: start phase is true:%d", G_STRLOC, (int)i);
-                    break;
+            shard_count_xa_write_servers(con);
+            /*
+             * a statement written behind XA START runs outside the branch
+             * if XA START fails, only plain reads are harmless there
+             */
+            if (con->is_commit_or_rollback || con->dist_tran_failed || con->write_flag || con->lock_read_flag) {
+                for (i = 0; i < con->servers->len; i++) {
+                    server_session_t *ss = g_ptr_array_index(con->servers, i);
+                    if (!ss->xa_start_already_sent) {
+                        xa_start_phase = TRUE;
+                        g_debug("%s: start phase is true:%d", G_STRLOC, (int)i);
+                        break;
+                    }
                 }
             }
         }
@@ -2076,6 +2178,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
                     g_debug("%s:ss not start phase:%d", G_STRLOC, (int)i);
                 }
 
+                int xa_query = 0;
                 if (ss->dist_tran_state == NEXT_ST_XA_START) {
                     if (con->srv->is_partition_mode) {
                         generate_or_retrieve_xid_str(con, ss->server, 1);
@@ -2085,9 +2188,16 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
                         network_mysqld_send_xa_start(ss->server, con->xid_str);
                     }
                     ss->dist_tran_state = NEXT_ST_XA_QUERY;
-                    ss->xa_start_already_sent = 0;
-                    con->xa_start_phase = 1;
-                    g_debug("%s:ss start phase:%d", G_STRLOC, (int)i);
+                    if (xa_start_phase) {
+                        ss->xa_start_already_sent = 0;
+                        con->xa_start_phase = 1;
+                        g_debug("%s:ss start phase:%d", G_STRLOC, (int)i);
+                    } else {
+                        /* the statement follows in the same write, the answer of XA START is dropped when reading */
+                        ss->server->xa_resp_pending++;
+                        xa_query = 1;
+                        g_debug("%s:ss start pipelined:%d", G_STRLOC, (int)i);
+                    }
                 } else if (ss->dist_tran_state == NEXT_ST_XA_OVER) {
                     g_debug("%s:omit here for server:%p", G_STRLOC, ss->server);
                     continue;
@@ -2111,27 +2221,31 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_get_server_conn_list)
                             g_debug("%s:omit here for server:%p", G_STRLOC, ss->server);
                             continue;
                         }
-                        ss->dist_tran_state = NEXT_ST_XA_QUERY;
-                        if (is_first_xa_query) {
-                            p_xa_log_buffer[0] = ',';
-                            p_xa_log_buffer++;
-                        } else {
-                            is_first_xa_query = 1;
-                        }
-                        snprintf(p_xa_log_buffer, XA_LOG_BUF_LEN - (p_xa_log_buffer - xa_log_buffer),
-                                 "%s@%d", ss->server->dst->name->str, ss->server->challenge->thread_id);
-                        p_xa_log_buffer = p_xa_log_buffer + strlen(p_xa_log_buffer);
-                        if (shard_build_xa_query(con, ss) == -1) {
-                            g_warning("%s:shard_build_xa_query failed for con:%p", G_STRLOC, con);
-                            con->server_to_be_closed = 1;
-                            con->dist_tran_state = NEXT_ST_XA_OVER;
-                            return NETWORK_SOCKET_ERROR;
-                        }
-                        is_xa_query = 1;
-                        if (con->is_auto_commit) {
-                            ss->dist_tran_state = NEXT_ST_XA_END;
-                            g_debug("%s:set dist_tran_state xa end for con:%p", G_STRLOC, con);
-                        }
+                        xa_query = 1;
+                    }
+                }
+
+                if (xa_query) {
+                    ss->dist_tran_state = NEXT_ST_XA_QUERY;
+                    if (is_first_xa_query) {
+                        p_xa_log_buffer[0] = ',';
+                        p_xa_log_buffer++;
+                    } else {
+                        is_first_xa_query = 1;
+                    }
+                    snprintf(p_xa_log_buffer, XA_LOG_BUF_LEN - (p_xa_log_buffer - xa_log_buffer),
+                             "%s@%d", ss->server->dst->name->str, ss->server->challenge->thread_id);
+                    p_xa_log_buffer = p_xa_log_buffer + strlen(p_xa_log_buffer);
+                    if (shard_build_xa_query(con, ss) == -1) {
+                        g_warning("%s:shard_build_xa_query failed for con:%p", G_STRLOC, con);
+                        con->server_to_be_closed = 1;
+                        con->dist_tran_state = NEXT_ST_XA_OVER;
+                        return NETWORK_SOCKET_ERROR;
+                    }
+                    is_xa_query = 1;
+                    if (con->is_auto_commit) {
+                        ss->dist_tran_state = NEXT_ST_XA_END;
+                        g_debug("%s:set dist_tran_state xa end for con:%p", G_STRLOC, con);
                     }
                 }
             } else {
@@ -2211,6 +2325,13 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result)
         }
     }
 
+    if (con->resp_cut_off && con->servers != NULL) {
+        g_debug("%s:drain abandoned resp for con:%p", G_STRLOC, con);
+        /* shards finished before the cut-off may still hold rows past the limit */
+        remove_mul_server_recv_packets(con);
+        proxy_put_shard_conn_to_pool(con);
+    }
+
     if (con->is_changed_user_failed) {
         con->is_changed_user_failed = 0;
         con->state = ST_ERROR;
@@ -2330,6 +2451,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client)
 
     /* TODO: this should inside "st"_free, but now "st" shared by many plugins */
     if (st->sql_context) {
+        sql_context_set_digest(st->sql_context, FALSE);
         sql_context_destroy(st->sql_context);
         g_free(st->sql_context);
         st->sql_context = NULL;
@@ -2374,6 +2496,7 @@ network_mysqld_shard_plugin_new(void)
     config->read_timeout_dbl = -1.0;
     config->dist_tran_decided_read_timeout_dbl = -1.0;
     config->write_timeout_dbl = -1.0;
+    config->plan_cache_size = SHARDING_PLAN_CACHE_DEF_SIZE;
 
     return config;
 }
@@ -2398,6 +2521,7 @@ network_mysqld_shard_plugin_free(chassis *chas, chassis_plugin_config *config)
     }
     sql_filter_vars_destroy();
     shard_conf_destroy();
+    sharding_plan_cache_free(config->plan_cache);
 
     g_free(config);
 }
@@ -2510,6 +2634,15 @@ static gchar* show_allow_nested_subquery(gpointer param) {
     return NULL;
 }
 
+static gchar* show_sharding_plan_cache_size(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    gint opt_type = opt_param->opt_type;
+    if(CAN_SHOW_OPTS_PROPERTY(opt_type) || CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d", config->plan_cache_size);
+    }
+    return NULL;
+}
+
 static gint
 assign_proxy_connect_timeout(const gchar *newval, gpointer param) {
     gint ret = ASSIGN_ERROR;
@@ -2726,6 +2859,11 @@ network_mysqld_shard_plugin_get_options(chassis_plugin_config *config)
                         "Use this on your own risk, data integrity is not guaranteed", NULL,
                         NULL, show_allow_nested_subquery, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
 
+    chassis_options_add(&opts, "sharding-plan-cache-size",
+                        0, 0, OPTION_ARG_INT, &(config->plan_cache_size),
+                        "max statement shapes with a compiled routing plan per worker, 0 to disable (default: 1024)",
+                        "<int>", NULL, show_sharding_plan_cache_size, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
     chassis_options_add(&opts, "proxy-read-timeout",
                         0, 0, OPTION_ARG_DOUBLE, &(config->read_timeout_dbl),
                         "read timeout in seconds (default: 600 seconds)", NULL,
@@ -2816,6 +2954,10 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
     }
     g_free(shard_json);
 
+    if (config->plan_cache_size > 0 && !chas->is_partition_mode) {
+        config->plan_cache = sharding_plan_cache_new(config->plan_cache_size);
+    }
+
     g_assert(chas->priv->monitor);
 
     /**
@@ -2834,7 +2976,7 @@ network_mysqld_shard_plugin_apply_config(chassis *chas, chassis_plugin_config *c
 
         network_connection_pool_create_conns(chas);
         evtimer_set(&chas->auto_create_conns_event, check_and_create_conns_func, chas);
-        struct timeval check_interval = {10, 0};
+        struct timeval check_interval = {POOL_CHECK_INTERVAL_SEC, 0};
         chassis_event_add_with_timeout(chas, &chas->auto_create_conns_event, &check_interval);
     }
     chassis_config_register_service(chas->config_manager, config->address, "shard");
@@ -210,7 +210,9 @@ modify_select(sql_context_t *context, having_condition_t *hav_condi, int is_grou
         need_reconstruct = TRUE;
     }
 
-    if (is_groupby_need_reconstruct && select->groupby_clause != NULL && select->orderby_clause == NULL) {
+    /* aggregates are merged by hash, groups are only needed in order to cut them by LIMIT */
+    if (is_groupby_need_reconstruct && select->groupby_clause != NULL && select->orderby_clause == NULL
+        && (select->limit || sql_expr_list_find_aggregate(select->columns, NULL) == -1)) {
         select->flags |= SF_REWRITE_ORDERBY;
     }
 
@@ -350,6 +352,14 @@ static gboolean
 partition_satisfies(sharding_partition_t *partition, struct condition_t cond)
 {
     /* partition value -> (low, high] */
+    if (partition->method == SHARD_METHOD_JUMP || partition->method == SHARD_METHOD_KETAMA) {
+        if (cond.op != TK_EQ) {
+            return TRUE;
+        }
+        guint64 key_hash = (partition->key_type == SHARD_DATA_TYPE_STR)
+            ? sharding_key_hash_str(cond.v.str) : sharding_key_hash_int(cond.v.num);
+        return sharding_vdb_locate(partition->vdb, key_hash) == partition->bucket;
+    }
     if (partition->method == SHARD_METHOD_HASH) {
         int64_t hash_value = (partition->key_type == SHARD_DATA_TYPE_STR)
             ? cetus_str_hash((const unsigned char *)cond.v.str) : cond.v.num;
@@ -414,29 +424,87 @@ partition_satisfies(sharding_partition_t *partition, struct condition_t cond)
     return FALSE;
 }
 
-/* filter out those which not satisfy cond */
-static void
-partitions_filter(GPtrArray *partitions, struct condition_t cond)
+/**
+ * the partition holding the value of an equation, from the lookup tables
+ * compiled for the vdb, NULL if no partition holds it
+ */
+static sharding_partition_t *
+partition_locate(const sharding_vdb_t *vdb, struct condition_t cond)
+{
+    if (vdb->method == SHARD_METHOD_JUMP || vdb->method == SHARD_METHOD_KETAMA) {
+        guint64 key_hash = (vdb->key_type == SHARD_DATA_TYPE_STR)
+            ? sharding_key_hash_str(cond.v.str) : sharding_key_hash_int(cond.v.num);
+        return sharding_vdb_get_by_key_hash(vdb, key_hash);
+    }
+    if (vdb->method == SHARD_METHOD_HASH) {
+        int64_t hash_value = (vdb->key_type == SHARD_DATA_TYPE_STR)
+            ? cetus_str_hash((const unsigned char *)cond.v.str) : cond.v.num;
+        return sharding_vdb_get_by_hash(vdb, modulo(hash_value, vdb->logic_shard_num));
+    }
+    if (vdb->key_type == SHARD_DATA_TYPE_STR) {
+        return sharding_vdb_get_by_range_str(vdb, cond.v.str);
+    }
+    return sharding_vdb_get_by_range_int(vdb, cond.v.num);
+}
+
+/**
+ * an equation is satisfied by one partition at most, look it up directly
+ * instead of testing the partitions one by one
+ *
+ * @return FALSE if the partitions don't come from one compiled vdb
+ */
+static gboolean
+partitions_locate(GPtrArray *partitions, struct condition_t cond, sharding_partition_t **found)
 {
+    if (cond.op != TK_EQ || partitions->len == 0) {
+        return FALSE;
+    }
+    sharding_partition_t *first = g_ptr_array_index(partitions, 0);
+    const sharding_vdb_t *vdb = first->vdb;
+    if (vdb == NULL || (vdb->method == SHARD_METHOD_HASH && vdb->hash_map == NULL)) {
+        return FALSE;
+    }
+
+    sharding_partition_t *part = partition_locate(vdb, cond);
+    *found = NULL;
+    if (part == NULL) {
+        return TRUE;
+    }
+    /* usually all partitions of the vdb, then there is nothing to check,
+       the arrays never hold a partition twice */
+    if (partitions->len == vdb->partitions->len && first == g_ptr_array_index(vdb->partitions, 0)) {
+        *found = part;
+        return TRUE;
+    }
     int i;
     for (i = 0; i < partitions->len; ++i) {
-        sharding_partition_t *gp = g_ptr_array_index(partitions, i);
-        if (!partition_satisfies(gp, cond)) {
-            g_ptr_array_remove_index(partitions, i);
-            --i;
+        if (g_ptr_array_index(partitions, i) == part) {
+            *found = part;
+            break;
         }
     }
+    return TRUE;
 }
 
-/* collect those which satisfy cond */
+/* filter out those which not satisfy cond */
 static void
-partitions_collect(GPtrArray *from_partitions, struct condition_t cond, GPtrArray *to_partitions)
+partitions_filter(GPtrArray *partitions, struct condition_t cond)
 {
+    sharding_partition_t *found;
+    if (partitions_locate(partitions, cond, &found)) {
+        g_ptr_array_set_size(partitions, 0);
+        if (found) {
+            g_ptr_array_add(partitions, found);
+        }
+        return;
+    }
+
     int i;
-    for (i = 0; i < from_partitions->len; ++i) {
-        sharding_partition_t *gp = g_ptr_array_index(from_partitions, i);
-        if (partition_satisfies(gp, cond)) {
-            g_ptr_array_add(to_partitions, gp);
+    for (i = 0; i < partitions->len; ++i) {
+        sharding_partition_t *gp = g_ptr_array_index(partitions, i);
+        if (!partition_satisfies(gp, cond)) {
+            g_ptr_array_remove_index(partitions, i);
+            --i;
         }
     }
 }
@@ -445,6 +513,11 @@ partitions_collect(GPtrArray *from_partitions, struct condition_t cond, GPtrArra
 sharding_partition_t *
 partitions_get(GPtrArray *from_partitions, struct condition_t cond)
 {
+    sharding_partition_t *found;
+    if (partitions_locate(from_partitions, cond, &found)) {
+        return found;
+    }
+
     int i;
     for (i = 0; i < from_partitions->len; ++i) {
         sharding_partition_t *gp = g_ptr_array_index(from_partitions, i);
@@ -458,11 +531,18 @@ partitions_get(GPtrArray *from_partitions, struct condition_t cond)
 static void
 partitions_merge(GPtrArray *partitions, GPtrArray *other)
 {
-    int i;
+    int len = partitions->len;
+    int i, j;
     for (i = 0; i < other->len; ++i) {
         sharding_partition_t *gp = g_ptr_array_index(other, i);
-        g_ptr_array_add(partitions, gp);
-        /* duplication check is performed later */
+        for (j = 0; j < len; ++j) {
+            if (g_ptr_array_index(partitions, j) == gp) {
+                break;
+            }
+        }
+        if (j == len) {
+            g_ptr_array_add(partitions, gp);
+        }
     }
 }
 
@@ -602,6 +682,8 @@ partitions_collect_IN_expr(GPtrArray *partitions, sql_expr_t *expr)
     struct condition_t cond = { 0 };
     if (expr->list && expr->list->len > 0) {
         GPtrArray *collected = g_ptr_array_new();
+        /* many values land in the same partition, collect it once */
+        GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
 
         sql_expr_list_t *args = expr->list;
         int i;
@@ -610,11 +692,17 @@ partitions_collect_IN_expr(GPtrArray *partitions, sql_expr_t *expr)
             cond.op = TK_EQ;
             int rc = expr_parse_sharding_value(arg, part->key_type, &cond);
             if (rc != PARSE_OK) {
+                g_hash_table_destroy(seen);
                 g_ptr_array_free(collected, TRUE);
                 return rc;
             }
-            partitions_collect(partitions, cond, collected);
+            sharding_partition_t *gp = partitions_get(partitions, cond);
+            if (gp && !g_hash_table_lookup(seen, gp)) {
+                g_hash_table_insert(seen, gp, gp);
+                g_ptr_array_add(collected, gp);
+            }
         }
+        g_hash_table_destroy(seen);
 
         /* transfer collected to partitions as output */
         g_ptr_array_remove_range(partitions, 0, partitions->len);
@@ -778,6 +866,283 @@ partitions_get_group_names(GPtrArray *partitions, GPtrArray *groups)
     }
 }
 
+/**
+ * the group of the rows of db.table whose sharding key equals the literal
+ * token @z of type @code, same as the routing of "key = literal" would get
+ *
+ * @return NULL if the literal isn't usable as a sharding value, or it
+ *   doesn't lead to exactly one group
+ */
+GString *
+sharding_get_literal_group(const char *db, const char *table, int code, const char *z, int n)
+{
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, table);
+    if (partitions->len == 0) {
+        g_ptr_array_free(partitions, TRUE);
+        return NULL;
+    }
+    sharding_partition_t *part = g_ptr_array_index(partitions, 0);
+
+    struct condition_t cond = { 0 };
+    cond.op = TK_EQ;
+    char *str = NULL;
+    int rc = PARSE_ERROR;
+    if (code == TK_INTEGER && part->key_type == SHARD_DATA_TYPE_INT) {
+        /* hex integers are left to the parser */
+        int i = 0;
+        while (i < n && g_ascii_isdigit(z[i])) {
+            i++;
+        }
+        if (i == n) {
+            str = g_strndup(z, n);
+            rc = string_to_sharding_value(str, SHARD_DATA_TYPE_INT, &cond);
+        }
+    } else if (code == TK_STRING) {
+        sql_token_t token = { (char *)z, n };
+        str = sql_token_dup(token);
+        rc = string_to_sharding_value(str, part->key_type, &cond);
+    }
+
+    GString *group = NULL;
+    if (rc == PARSE_OK) {
+        partitions_filter(partitions, cond);
+        int i;
+        for (i = 0; i < partitions->len; ++i) {
+            sharding_partition_t *gp = g_ptr_array_index(partitions, i);
+            if (group && !g_string_equal(group, gp->group_name)) {
+                group = NULL;
+                break;
+            }
+            group = gp->group_name;
+        }
+    }
+    g_free(str);
+    g_ptr_array_free(partitions, TRUE);
+    return group;
+}
+
+/* the only sharding IN-list in the WHERE tree, NULL if there is none or more */
+static sql_expr_t *
+find_sharding_IN_expr(sql_expr_t *where)
+{
+    sql_expr_t *found = NULL;
+    GQueue *stack = g_queue_new();
+    g_queue_push_head(stack, where);
+
+    while (!g_queue_is_empty(stack)) {
+        sql_expr_t *p = g_queue_pop_head(stack);
+        if (is_logical_op(p->op)) {
+            if (p->right)
+                g_queue_push_head(stack, p->right);
+            if (p->left)
+                g_queue_push_head(stack, p->left);
+            continue;
+        }
+        if (p->op == TK_IN && (p->flags & EP_SHARD_COND) && p->list) {
+            if (found) {
+                found = NULL;
+                break;
+            }
+            found = p;
+        }
+    }
+    g_queue_free(stack);
+    return found;
+}
+
+/**
+ * the list is copied verbatim from the original text, only plain
+ * literals have their exact text between start and end
+ */
+static gboolean
+IN_list_is_spliceable(sql_expr_list_t *args, const GString *sql)
+{
+    int i;
+    for (i = 0; i < args->len; ++i) {
+        sql_expr_t *arg = g_ptr_array_index(args, i);
+        if ((arg->op != TK_INTEGER && arg->op != TK_STRING) || arg->start == NULL || arg->end == NULL) {
+            return FALSE;
+        }
+        if (arg->start < sql->str || arg->end > sql->str + sql->len) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static GString *
+splice_IN_list(const GString *sql, sql_expr_list_t *args, GPtrArray *values)
+{
+    sql_expr_t *first = g_ptr_array_index(args, 0);
+    sql_expr_t *last = g_ptr_array_index(args, args->len - 1);
+
+    GString *new_sql = g_string_sized_new(sql->len);
+    g_string_append_len(new_sql, sql->str, first->start - sql->str);
+    int i;
+    for (i = 0; i < values->len; ++i) {
+        sql_expr_t *arg = g_ptr_array_index(values, i);
+        if (i > 0) {
+            g_string_append_c(new_sql, ',');
+        }
+        g_string_append_len(new_sql, arg->start, arg->end - arg->start);
+    }
+    g_string_append_len(new_sql, last->end, sql->str + sql->len - last->end);
+    return new_sql;
+}
+
+/**
+ * give each group only the values of "key IN (...)" routed to it
+ *
+ * Applies to a single sharded table in SELECT, UPDATE and DELETE with one
+ * IN-list on the sharding key. Rows of a group only carry keys routed to
+ * it, so dropping the other values keeps the result of every group, even
+ * under OR and NOT. A group getting no value keeps the whole list.
+ *
+ * If nothing else in the statement is rewritten (@is_modified is false) and
+ * the list holds plain literals, the values are spliced into the original
+ * text, which keeps long lists cheap; otherwise a SELECT is rebuilt and an
+ * UPDATE or DELETE is sent whole.
+ *
+ * @return number of groups given their own sql
+ */
+int
+sharding_prune_IN_list(sql_context_t *context, having_condition_t *hav_condi, int is_groupby_need_reconstruct,
+                       GString *default_db, sharding_plan_t *plan, int is_modified)
+{
+    if (plan->is_partition_mode || plan->is_sql_rewrite_completely || plan->groups->len < 2) {
+        return 0;
+    }
+
+    if (context->rc != PARSE_OK || context->explain == TK_EXPLAIN || context->sql_statement == NULL) {
+        return 0;
+    }
+
+    sql_src_list_t *sources = NULL;
+    sql_expr_t *where = NULL;
+    switch (context->stmt_type) {
+    case STMT_SELECT:{
+        sql_select_t *select = context->sql_statement;
+        if (select->prior) {
+            return 0;
+        }
+        sources = select->from_src;
+        where = select->where_clause;
+        break;
+    }
+    case STMT_UPDATE:{
+        sql_update_t *update = context->sql_statement;
+        sources = update->table_reference ? update->table_reference->table_list : NULL;
+        where = update->where_clause;
+        break;
+    }
+    case STMT_DELETE:{
+        sql_delete_t *delete = context->sql_statement;
+        sources = delete->from_src;
+        where = delete->where_clause;
+        break;
+    }
+    default:
+        return 0;
+    }
+
+    if (sources == NULL || sources->len != 1 || where == NULL) {
+        return 0;
+    }
+    sql_src_item_t *src = g_ptr_array_index(sources, 0);
+    if (src->select || src->table_name == NULL) {
+        return 0;
+    }
+    char *db = src->dbname ? src->dbname : default_db->str;
+    if (!shard_conf_is_shard_table(db, src->table_name)) {
+        return 0;
+    }
+
+    sql_expr_t *in_expr = find_sharding_IN_expr(where);
+    if (in_expr == NULL || in_expr->list->len < 2) {
+        return 0;
+    }
+    sql_expr_list_t *args = in_expr->list;
+
+    /*
+     * sql_construct_update()/sql_construct_delete() know nothing of ORDER BY,
+     * LIMIT or aliases, a rebuilt UPDATE or DELETE would lose them
+     */
+    gboolean spliced = !is_modified && IN_list_is_spliceable(args, plan->orig_sql);
+    if (!spliced && context->stmt_type != STMT_SELECT) {
+        return 0;
+    }
+
+    GPtrArray *partitions = g_ptr_array_new();
+    shard_conf_table_partitions(partitions, db, src->table_name);
+    if (partitions->len == 0) {
+        g_ptr_array_free(partitions, TRUE);
+        return 0;
+    }
+    sharding_partition_t *first = g_ptr_array_index(partitions, 0);
+
+    /* group name -> GPtrArray<sql_expr_t *>, the values routed to it */
+    GHashTable *group_values = g_hash_table_new_full((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal,
+                                                     NULL, (GDestroyNotify)g_ptr_array_unref);
+    int i;
+    for (i = 0; i < args->len; ++i) {
+        sql_expr_t *arg = g_ptr_array_index(args, i);
+        struct condition_t cond = { TK_EQ, {0} };
+        if (expr_parse_sharding_value(arg, first->key_type, &cond) != PARSE_OK) {
+            break;
+        }
+        sharding_partition_t *part = partitions_get(partitions, cond);
+        if (part == NULL) {
+            break;
+        }
+        GPtrArray *values = g_hash_table_lookup(group_values, part->group_name);
+        if (values == NULL) {
+            values = g_ptr_array_new();
+            g_hash_table_insert(group_values, part->group_name, values);
+        }
+        g_ptr_array_add(values, arg);
+    }
+    g_ptr_array_free(partitions, TRUE);
+
+    int pruned = 0;
+    if (i < args->len) {
+        g_hash_table_destroy(group_values);
+        return 0;
+    }
+
+    for (i = 0; i < plan->groups->len; ++i) {
+        GString *group = g_ptr_array_index(plan->groups, i);
+        GPtrArray *values = g_hash_table_lookup(group_values, group);
+        if (values == NULL || values->len == args->len) {
+            continue;
+        }
+
+        GString *sql = NULL;
+        if (spliced) {
+            sql = splice_IN_list(plan->orig_sql, args, values);
+        } else {
+            in_expr->list = values;
+            if (context->stmt_type == STMT_SELECT) {
+                int needs_reconstruct = context->sql_needs_reconstruct;
+                context->sql_needs_reconstruct = 1;
+                sql = modify_select(context, hav_condi, is_groupby_need_reconstruct, plan->groups->len);
+                context->sql_needs_reconstruct = needs_reconstruct;
+            }
+            in_expr->list = args;
+        }
+
+        if (sql) {
+            sharding_plan_add_group_sql(plan, group, sql);
+            pruned++;
+        }
+    }
+    g_hash_table_destroy(group_values);
+
+    g_debug("%s: IN-list of %d values pruned for %d groups, spliced:%d",
+            G_STRLOC, (int)args->len, pruned, spliced);
+    return pruned;
+}
+
 /**
  * find out which 2 tables are connected by expression 'p', then
  * 1. record it in linkage array
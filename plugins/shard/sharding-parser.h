@@ -45,6 +45,10 @@ NETWORK_API int sharding_parse_groups(GString *, sql_context_t *, query_stats_t
 
 NETWORK_API GString *sharding_modify_sql(sql_context_t *, having_condition_t *, int, int, int);
 
+NETWORK_API int sharding_prune_IN_list(sql_context_t *, having_condition_t *, int, GString *, sharding_plan_t *, int);
+
 NETWORK_API void sharding_filter_sql(sql_context_t *);
 
+NETWORK_API GString *sharding_get_literal_group(const char *, const char *, int, const char *, int);
+
 #endif //__SHARDING_PARSER_H__
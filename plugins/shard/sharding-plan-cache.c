@@ -0,0 +1,242 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include "sharding-plan-cache.h"
+
+#include <string.h>
+
+#include "cetus-util.h"
+#include "sharding-config.h"
+#include "sharding-parser.h"
+#include "sql-digest.h"
+
+static void
+sharding_plan_entry_free(sharding_plan_entry_t *entry)
+{
+    g_free(entry->default_db);
+    g_free(entry->db);
+    g_free(entry->table);
+    g_free(entry);
+}
+
+sharding_plan_cache_t *
+sharding_plan_cache_new(guint max_entries)
+{
+    sharding_plan_cache_t *cache = g_new0(sharding_plan_cache_t, 1);
+    cache->entries = g_hash_table_new(g_int64_hash, g_int64_equal);
+    g_queue_init(&(cache->lru));
+    cache->max_entries = max_entries;
+    return cache;
+}
+
+static void
+sharding_plan_cache_remove(sharding_plan_cache_t *cache, sharding_plan_entry_t *entry)
+{
+    g_hash_table_remove(cache->entries, &(entry->key));
+    g_queue_unlink(&(cache->lru), &(entry->lru_link));
+    sharding_plan_entry_free(entry);
+}
+
+void
+sharding_plan_cache_free(sharding_plan_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    while (cache->lru.head) {
+        sharding_plan_cache_remove(cache, cache->lru.head->data);
+    }
+    g_hash_table_destroy(cache->entries);
+    g_free(cache);
+}
+
+static guint64
+sharding_plan_cache_key(sql_digest_t *digest, const char *default_db)
+{
+    return cetus_hash64(default_db, strlen(default_db), digest->shape);
+}
+
+GString *
+sharding_plan_cache_lookup(sharding_plan_cache_t *cache, const char *default_db,
+                           sql_context_t *context, gboolean *has_aggregate)
+{
+    sql_digest_t *digest = context->digest;
+    if (digest->has_property) {
+        return NULL;
+    }
+
+    guint64 key = sharding_plan_cache_key(digest, default_db);
+    sharding_plan_entry_t *entry = g_hash_table_lookup(cache->entries, &key);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    if (entry->conf_version != shard_conf_version()) {
+        g_debug("%s:sharding config changed, drop plan of %s", G_STRLOC, entry->table);
+        sharding_plan_cache_remove(cache, entry);
+        return NULL;
+    }
+
+    if (entry->digest != digest->hash || entry->literal_num != digest->literals->len
+        || strcmp(entry->default_db, default_db) != 0) {
+        return NULL;
+    }
+
+    sql_digest_literal_t *literal = &g_array_index(digest->literals, sql_digest_literal_t, entry->key_literal);
+    if (literal->code != entry->key_code) {
+        return NULL;
+    }
+
+    /* values out of the partitions and the like are reported by the parser */
+    GString *group = sharding_get_literal_group(entry->db, entry->table, literal->code, literal->z, literal->n);
+    if (group == NULL) {
+        return NULL;
+    }
+
+    if (cache->lru.head != &(entry->lru_link)) {
+        g_queue_unlink(&(cache->lru), &(entry->lru_link));
+        g_queue_push_head_link(&(cache->lru), &(entry->lru_link));
+    }
+
+    context->rc = PARSE_OK;
+    context->stmt_type = entry->stmt_type;
+    context->stmt_count = 1;
+    context->rw_flag = entry->rw_flag;
+    context->clause_flags = entry->clause_flags;
+    *has_aggregate = entry->has_aggregate;
+
+    return group;
+}
+
+/* collect the conditions on the sharding key, marked while routing */
+static void
+sharding_plan_find_key_cond(sql_expr_t *p, gboolean and_only, sql_expr_t **cond, int *cond_num)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    if (p->flags & EP_SHARD_COND) {
+        *cond_num += 1;
+        if (and_only) {
+            *cond = p;
+        }
+    }
+    and_only = and_only && p->op == TK_AND;
+    sharding_plan_find_key_cond(p->left, and_only, cond, cond_num);
+    sharding_plan_find_key_cond(p->right, and_only, cond, cond_num);
+}
+
+gboolean
+sharding_plan_cache_learn(sharding_plan_cache_t *cache, const char *default_db,
+                          sql_context_t *context, int rv, sharding_plan_t *plan)
+{
+    sql_digest_t *digest = context->digest;
+    if (digest == NULL || digest->has_property) {
+        return FALSE;
+    }
+
+    if (rv != USE_SHARDING || plan->is_partition_mode || plan->groups->len != 1) {
+        return FALSE;
+    }
+
+    if (context->rc != PARSE_OK || context->stmt_type != STMT_SELECT || context->explain
+        || context->property || context->sql_needs_reconstruct
+        || (context->clause_flags & (CF_LOCAL_QUERY | CF_SUBQUERY))) {
+        return FALSE;
+    }
+
+    /*
+     * nothing to rewrite for a single group,
+     * a hit has no statement to tell a locking read from a plain one
+     */
+    sql_select_t *select = context->sql_statement;
+    if (select == NULL || select->prior || select->groupby_clause || select->having_clause
+        || (select->flags & SF_REWRITE_ORDERBY) || select->lock_read) {
+        return FALSE;
+    }
+
+    sql_src_list_t *sources = select->from_src;
+    if (sources == NULL || sources->len != 1) {
+        return FALSE;
+    }
+    sql_src_item_t *src = g_ptr_array_index(sources, 0);
+    if (src->select || src->table_name == NULL) {
+        return FALSE;
+    }
+    const char *db = src->dbname ? src->dbname : default_db;
+    if (!shard_conf_is_shard_table(db, src->table_name)) {
+        return FALSE;
+    }
+
+    sql_expr_t *cond = NULL;
+    int cond_num = 0;
+    sharding_plan_find_key_cond(select->where_clause, TRUE, &cond, &cond_num);
+    if (cond_num != 1 || cond == NULL || cond->op != TK_EQ || cond->right == NULL) {
+        return FALSE;
+    }
+
+    sql_expr_t *value = cond->right;
+    if (value->op != TK_INTEGER && value->op != TK_STRING) {
+        return FALSE;
+    }
+    guint i;
+    for (i = 0; i < digest->literals->len; ++i) {
+        sql_digest_literal_t *literal = &g_array_index(digest->literals, sql_digest_literal_t, i);
+        if (literal->z == value->start && literal->code == value->op) {
+            break;
+        }
+    }
+    if (i == digest->literals->len) {
+        return FALSE;
+    }
+
+    guint64 key = sharding_plan_cache_key(digest, default_db);
+    sharding_plan_entry_t *old = g_hash_table_lookup(cache->entries, &key);
+    if (old) {
+        sharding_plan_cache_remove(cache, old);
+    }
+    while (cache->lru.tail && g_hash_table_size(cache->entries) >= cache->max_entries) {
+        sharding_plan_cache_remove(cache, cache->lru.tail->data);
+    }
+
+    sharding_plan_entry_t *entry = g_new0(sharding_plan_entry_t, 1);
+    entry->key = key;
+    entry->digest = digest->hash;
+    entry->default_db = g_strdup(default_db);
+    entry->db = g_strdup(db);
+    entry->table = g_strdup(src->table_name);
+    entry->literal_num = digest->literals->len;
+    entry->key_literal = i;
+    entry->key_code = value->op;
+    entry->stmt_type = context->stmt_type;
+    entry->rw_flag = context->rw_flag;
+    entry->clause_flags = context->clause_flags;
+    entry->conf_version = shard_conf_version();
+    entry->has_aggregate = sql_expr_list_find_aggregate(select->columns, NULL) != -1;
+    entry->lru_link.data = entry;
+
+    g_hash_table_insert(cache->entries, &(entry->key), entry);
+    g_queue_push_head_link(&(cache->lru), &(entry->lru_link));
+    g_debug("%s:compiled plan for %s.%s, key value at literal %u", G_STRLOC, db, src->table_name, i);
+
+    return TRUE;
+}
@@ -0,0 +1,85 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef __SHARDING_PLAN_CACHE_H__
+#define __SHARDING_PLAN_CACHE_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+#include "sharding-query-plan.h"
+#include "sql-context.h"
+
+#define SHARDING_PLAN_CACHE_DEF_SIZE 1024
+
+/**
+ * Routing of one statement shape, compiled from a full parse.
+ *
+ * Only statements reading one sharded table by "key = literal" are
+ * compiled. They go to the single group holding the literal and their
+ * sql is sent unchanged, so a statement of the same shape is routed
+ * from its literals only, without building the statement.
+ */
+typedef struct sharding_plan_entry_t {
+    guint64 key;                /* shape and default db */
+    guint64 digest;
+    gchar *default_db;
+    gchar *db;
+    gchar *table;
+    guint literal_num;
+    guint key_literal;          /* index of the sharding value in the literals */
+    int key_code;
+    sql_stmt_type_t stmt_type;
+    enum sql_clause_flag_t rw_flag;
+    enum sql_clause_flag_t clause_flags;
+    guint64 conf_version;       /* sharding config the plan was compiled with */
+    GList lru_link;
+    unsigned int has_aggregate:1;
+} sharding_plan_entry_t;
+
+typedef struct sharding_plan_cache_t {
+    /* guint64 key -> sharding_plan_entry_t */
+    GHashTable *entries;
+    /* head is the most recently used entry */
+    GQueue lru;
+    guint max_entries;
+} sharding_plan_cache_t;
+
+NETWORK_API sharding_plan_cache_t *sharding_plan_cache_new(guint max_entries);
+NETWORK_API void sharding_plan_cache_free(sharding_plan_cache_t *cache);
+
+/**
+ * route a statement passed to sql_context_scan_len()
+ *
+ * @return the group of the statement and fill @context as the parser
+ *   would, or NULL if it must be parsed
+ */
+NETWORK_API GString *sharding_plan_cache_lookup(sharding_plan_cache_t *cache, const char *default_db,
+                                                sql_context_t *context, gboolean *has_aggregate);
+
+/**
+ * compile the routing of a parsed statement, if it is simple enough
+ *
+ * @return TRUE if a plan was added
+ */
+NETWORK_API gboolean sharding_plan_cache_learn(sharding_plan_cache_t *cache, const char *default_db,
+                                               sql_context_t *context, int rv, sharding_plan_t *plan);
+
+#endif /* __SHARDING_PLAN_CACHE_H__ */
@@ -36,7 +36,7 @@ cetus_write_channel(int s, cetus_channel_t *ch, size_t size)
         cmsg.cm.cmsg_level = SOL_SOCKET;
         cmsg.cm.cmsg_type = SCM_RIGHTS;
 
-        /* memcpy(CMSG_DATA(&cmsg.cm), &ch->basics.fd, sizeof(int)); */
+        memcpy(CMSG_DATA(&cmsg.cm), &ch->basics.fd, sizeof(int));
     }
 
     msg.msg_flags = 0;
@@ -127,6 +127,7 @@ cetus_read_channel(int s, cetus_channel_t *ch, size_t size)
         case CETUS_CMD_ADMIN:
         case CETUS_CMD_ADMIN_RESP:
         case CETUS_CMD_OPEN_CHANNEL: 
+        case CETUS_CMD_LEND_CONN:
             if (cmsg.cm.cmsg_len < (socklen_t) CMSG_LEN(sizeof(int))) {
                 g_critical("%s:recvmsg() returned too small ancillary data:%d", 
                         G_STRLOC, (int) n);
@@ -11,6 +11,8 @@
 #define CETUS_CMD_TERMINATE      4
 #define CETUS_CMD_ADMIN          5
 #define CETUS_CMD_ADMIN_RESP     6
+#define CETUS_CMD_LEND_CONN_REQ  7
+#define CETUS_CMD_LEND_CONN      8
 
 #define MAX_ADMIN_SQL_LEN 512
 typedef struct {
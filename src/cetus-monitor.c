@@ -24,12 +24,16 @@
 #include "config.h"
 #endif
 
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <mysql.h>
+#include <mysqld_error.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
@@ -40,6 +44,7 @@
 #include "chassis-event.h"
 #include "glib-ext.h"
 #include "sharding-config.h"
+#include "cetus-xa-log.h"
 
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -47,6 +52,7 @@
 #define CHECK_ALIVE_INTERVAL 1
 #define CHECK_ALIVE_TIMES 2
 #define CHECK_DELAY_INTERVAL 500 * 1000 /* 500ms */
+#define XA_RECOVER_INTERVAL 60
 
 #define ADDRESS_LEN 64
 
@@ -62,6 +68,7 @@ struct cetus_monitor_t {
     struct event write_master_timer;
     struct event read_slave_timer;
     struct event check_config_timer;
+    struct event xa_recover_timer;
 
     GString *db_passwd;
     GHashTable *backend_conns;
@@ -69,6 +76,12 @@ struct cetus_monitor_t {
     GList *registered_objects;
     char *config_id;
 
+    /* probe results shared with the other workers, NULL if not mapped */
+    monitor_shm_t *shm;
+    /* generation of shm last applied by a following worker */
+    guint64 shm_generation;
+    ev_prepare shm_watcher;
+
     unsigned int mysql_init_called:1;
 };
 
@@ -417,6 +430,223 @@ group_replication_detect(network_backends_t *bs, cetus_monitor_t *monitor)
     g_list_free_full(slave_list, g_free);
 }
 
+static void
+monitor_shm_fill(cetus_monitor_t *monitor, network_backend_t *backend, monitor_shm_backend_t *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->state = backend->state;
+    entry->type = backend->type;
+    entry->slave_delay_msec = backend->slave_delay_msec;
+    entry->slave_applied_msec = backend->slave_applied_msec;
+    g_strlcpy(entry->address, backend->addr->name->str, sizeof(entry->address));
+    if (backend->server_group && backend->server_group->len) {
+        g_strlcpy(entry->group, backend->server_group->str, sizeof(entry->group));
+    }
+
+    /* no connections yet before the monitor thread runs */
+    MYSQL *conn = NULL;
+    if (monitor->backend_conns) {
+        conn = g_hash_table_lookup(monitor->backend_conns, backend->addr->name->str);
+    }
+    if (conn) {
+        const char *version = mysql_get_server_info(conn);
+        if (version) {
+            g_strlcpy(entry->version, version, sizeof(entry->version));
+        }
+    }
+}
+
+/*
+ * the sequence is taken from an even base, so an entry left odd by a
+ * writer that died in the middle is rewritten as if it was not
+ */
+static void
+monitor_shm_write(monitor_shm_backend_t *entry, const monitor_shm_backend_t *fresh)
+{
+    guint32 seq = entry->seq & ~1U;
+    entry->seq = seq + 1;
+    __sync_synchronize();
+    memcpy((char *)entry + sizeof(entry->seq), (const char *)fresh + sizeof(fresh->seq),
+           sizeof(*fresh) - sizeof(fresh->seq));
+    __sync_synchronize();
+    entry->seq = seq + 2;
+}
+
+/**
+ * publish the probe results of this worker to the others
+ *
+ * only entries that changed are rewritten, the generation is bumped
+ * once per round so idle readers are not disturbed
+ */
+static void
+monitor_shm_publish(cetus_monitor_t *monitor)
+{
+    monitor_shm_t *shm = monitor->shm;
+    if (shm == NULL) {
+        return;
+    }
+
+    network_backends_t *bs = monitor->chas->priv->backends;
+    guint num = MIN(network_backends_count(bs), MAX_SERVER_NUM);
+    gboolean changed = shm->num != num;
+    guint i;
+
+    for (i = 0; i < num; i++) {
+        monitor_shm_backend_t fresh;
+        monitor_shm_fill(monitor, network_backends_get(bs, i), &fresh);
+
+        monitor_shm_backend_t *entry = &(shm->backends[i]);
+        if (!(entry->seq & 1) && memcmp((char *)&fresh + sizeof(fresh.seq), (char *)entry + sizeof(entry->seq),
+                                        sizeof(fresh) - sizeof(fresh.seq)) == 0) {
+            continue;
+        }
+
+        monitor_shm_write(entry, &fresh);
+        changed = TRUE;
+    }
+
+    if (changed) {
+        shm->num = num;
+        __sync_fetch_and_add(&(shm->generation), 1);
+    }
+}
+
+/**
+ * the entries a previous probing worker left half written
+ *
+ * they are refilled from the configured backends before the new monitor
+ * thread starts, so followers need not wait for the first probe round
+ */
+static void
+monitor_shm_reset(cetus_monitor_t *monitor)
+{
+    monitor_shm_t *shm = monitor->shm;
+    if (shm == NULL) {
+        return;
+    }
+
+    network_backends_t *bs = monitor->chas->priv->backends;
+    guint num = MIN(MIN(shm->num, network_backends_count(bs)), MAX_SERVER_NUM);
+    gboolean changed = FALSE;
+    guint i;
+
+    for (i = 0; i < num; i++) {
+        monitor_shm_backend_t *entry = &(shm->backends[i]);
+        if (!(entry->seq & 1)) {
+            continue;
+        }
+
+        monitor_shm_backend_t fresh;
+        monitor_shm_fill(monitor, network_backends_get(bs, i), &fresh);
+        monitor_shm_write(entry, &fresh);
+        changed = TRUE;
+        g_message("%s: reset monitor table entry of %s left by the previous worker", G_STRLOC, fresh.address);
+    }
+
+    if (changed) {
+        __sync_fetch_and_add(&(shm->generation), 1);
+    }
+}
+
+/* a writer dead in the middle leaves seq odd, so the tries are bounded */
+static gboolean
+monitor_shm_read(monitor_shm_backend_t *entry, monitor_shm_backend_t *snap)
+{
+    int tries;
+    for (tries = 0; tries < 64; tries++) {
+        guint32 seq = entry->seq;
+        if (seq & 1) {
+            continue;
+        }
+        __sync_synchronize();
+        memcpy(snap, entry, sizeof(*snap));
+        __sync_synchronize();
+        if (entry->seq == seq) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean
+monitor_state_is_manual(int state)
+{
+    return state == BACKEND_STATE_MAINTAINING || state == BACKEND_STATE_DELETED;
+}
+
+/**
+ * bring the backends of a following worker in line with the shared table
+ *
+ * maintaining and deleted states are set by admin in every worker and are
+ * never overwritten from here
+ */
+static void
+monitor_shm_apply(cetus_monitor_t *monitor)
+{
+    monitor_shm_t *shm = monitor->shm;
+    guint64 generation = shm->generation;
+    if (generation == monitor->shm_generation) {
+        return;
+    }
+    __sync_synchronize();
+
+    chassis *chas = monitor->chas;
+    network_backends_t *bs = chas->priv->backends;
+    guint num = MIN(shm->num, MAX_SERVER_NUM);
+    gboolean is_stale = FALSE;
+    guint i;
+
+    for (i = 0; i < num; i++) {
+        monitor_shm_backend_t snap;
+        if (!monitor_shm_read(&(shm->backends[i]), &snap)) {
+            /* the writer is busy or gone, the other entries are still taken */
+            is_stale = TRUE;
+            continue;
+        }
+        snap.address[MONITOR_SHM_ADDR_LEN - 1] = '\0';
+        snap.group[MONITOR_SHM_ADDR_LEN - 1] = '\0';
+        snap.version[MONITOR_SHM_VERSION_LEN - 1] = '\0';
+
+        if (i >= network_backends_count(bs)) {
+            /* discovered by group replication detection of the probing worker */
+            gchar addr[MONITOR_SHM_ADDR_LEN * 2];
+            if (snap.group[0]) {
+                snprintf(addr, sizeof(addr), "%s@%s", snap.address, snap.group);
+            } else {
+                snprintf(addr, sizeof(addr), "%s", snap.address);
+            }
+            network_backends_add(bs, addr, snap.type, snap.state, chas);
+            continue;
+        }
+
+        network_backend_t *backend = network_backends_get(bs, i);
+        if (strcmp(backend->addr->name->str, snap.address) != 0) {
+            /* backend list is changing by admin, the slots will match again later */
+            continue;
+        }
+
+        if (!monitor_state_is_manual(backend->state) && !monitor_state_is_manual(snap.state) &&
+            (backend->state != snap.state || backend->type != snap.type)) {
+            network_backends_modify(bs, i, snap.type, snap.state, NO_PREVIOUS_STATE);
+        }
+        backend->slave_delay_msec = snap.slave_delay_msec;
+        backend->slave_applied_msec = snap.slave_applied_msec;
+        if (backend->server_version->len == 0 && snap.version[0]) {
+            g_string_assign(backend->server_version, snap.version);
+        }
+    }
+
+    if (!is_stale) {
+        monitor->shm_generation = generation;
+    }
+}
+
+static void
+monitor_shm_prepare_cb(struct ev_loop *loop, ev_prepare *w, int revents)
+{
+    monitor_shm_apply(w->data);
+}
+
 #define ADD_MONITOR_TIMER(ev_struct, ev_cb, timeout) \
     ev_now_update((struct ev_loop *) monitor->evloop);\
     evtimer_set(&(monitor->ev_struct), ev_cb, monitor);\
@@ -505,6 +735,8 @@ hostnameloop:
         }
     }
 
+    monitor_shm_publish(monitor);
+
     struct timeval timeout = { 0 };
     timeout.tv_sec = CHECK_ALIVE_INTERVAL;
     ADD_MONITOR_TIMER(check_alive_timer, check_backend_alive, timeout);
@@ -665,8 +897,10 @@ hostnameloop:;
                 double ts_now = tv.tv_sec + ((double)tv.tv_usec) / 1000000;
                 delay_secs = ts_now - ts_slave;
                 backend->slave_delay_msec = (int)(delay_secs *1000);
+                backend->slave_applied_msec = (guint64)(ts_slave * 1000);
             } else {
                 backend->slave_delay_msec = G_MAXINT32;
+                backend->slave_applied_msec = 0;
             }
             if (delay_secs > chas->slave_delay_down_threshold_sec && backend->state != BACKEND_STATE_DOWN) {
                 ret = network_backends_modify(bs, i, backend->type, BACKEND_STATE_DOWN, oldstate);
@@ -686,11 +920,182 @@ hostnameloop:;
             mysql_free_result(rs_set);
         }
     }
+    monitor_shm_publish(monitor);
+
     struct timeval timeout = { 0 };
     timeout.tv_usec = CHECK_DELAY_INTERVAL;
     ADD_MONITOR_TIMER(write_master_timer, update_master_timestamp, timeout);
 }
 
+#ifndef SIMPLE_PARSER
+/**
+ * resolve the prepared branches of this proxy on one backend whose
+ * worker is gone or gave up on them: committed if its decision was
+ * logged, else rolled back
+ *
+ * @param live_tokens  the branch qualifiers of the running workers
+ * @return FALSE if some branch may be left unresolved
+ */
+static gboolean
+xa_recover_backend(MYSQL *conn, char *backend_addr, const char *instance, GHashTable *decisions,
+                   GHashTable *live_tokens)
+{
+    if (mysql_real_query(conn, L("XA RECOVER"))) {
+        g_warning("XA RECOVER error: %d, text: %s, backend: %s",
+                  mysql_errno(conn), mysql_error(conn), backend_addr);
+        return FALSE;
+    }
+
+    MYSQL_RES *rs_set = mysql_store_result(conn);
+    if (rs_set == NULL) {
+        g_warning("fetch XA RECOVER result failed, errno:%d, errmsg:%s", mysql_errno(conn), mysql_error(conn));
+        return FALSE;
+    }
+
+    /* columns: formatID, gtrid_length, bqual_length, data */
+    GPtrArray *xids = g_ptr_array_new_with_free_func(g_free);
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(rs_set)) != NULL) {
+        unsigned long *lengths = mysql_fetch_lengths(rs_set);
+        if (row[1] == NULL || row[2] == NULL || row[3] == NULL) {
+            continue;
+        }
+        int gtrid_len = atoi(row[1]);
+        int bqual_len = atoi(row[2]);
+        /* the bqual is the token of the worker, branches without one are older */
+        if (gtrid_len <= 0 || bqual_len <= 0 || gtrid_len + bqual_len > lengths[3]) {
+            continue;
+        }
+        if (gtrid_len > strlen(instance) && strncmp(row[3], instance, strlen(instance)) == 0) {
+            /* quoted the way xid_str is, see generate_or_retrieve_xid_str() */
+            g_ptr_array_add(xids, g_strdup_printf("%.*s','%.*s", gtrid_len, row[3], bqual_len, row[3] + gtrid_len));
+        }
+    }
+    mysql_free_result(rs_set);
+
+    gboolean resolved = TRUE;
+    guint i;
+    for (i = 0; i < xids->len; i++) {
+        char *xid = g_ptr_array_index(xids, i);
+        const char *token = strstr(xid, "','") + 3;
+
+        /* branches of partition mode are <gtrid>@<n> */
+        gchar *key;
+        char *at = strchr(xid, '@');
+        if (at && at < token) {
+            key = g_strdup_printf("%.*s','%s", (int)(at - xid), xid, token);
+        } else {
+            key = g_strdup(xid);
+        }
+        int flags = GPOINTER_TO_INT(g_hash_table_lookup(decisions, key));
+        g_free(key);
+
+        /* the worker is alive and the transaction is still in flight */
+        if (g_hash_table_contains(live_tokens, token) && !(flags & XA_LOG_ORPHANED)) {
+            continue;
+        }
+        gboolean committed = flags & XA_LOG_COMMITTED;
+
+        char sql[256];
+        snprintf(sql, sizeof(sql), "XA %s '%s'", committed ? "COMMIT" : "ROLLBACK", xid);
+        if (mysql_real_query(conn, L(sql)) && mysql_errno(conn) != ER_XAER_NOTA) {
+            g_critical("recover xa error: %d, text: %s, sql: %s, backend: %s",
+                       mysql_errno(conn), mysql_error(conn), sql, backend_addr);
+            resolved = FALSE;
+        } else {
+            g_message("recovered xa of worker %s: %s, backend: %s", token, sql, backend_addr);
+        }
+    }
+    g_ptr_array_free(xids, TRUE);
+
+    return resolved;
+}
+
+/**
+ * run XA RECOVER on every master group, once at startup and then
+ * periodically, the logs of gone workers are removed once all their
+ * branches are resolved
+ *
+ * a worker is told alive by the lock on its log, not by its pid, which
+ * a later worker may have got
+ */
+static void
+xa_recover_backends(int fd, short what, void *arg)
+{
+    cetus_monitor_t *monitor = arg;
+    chassis *chas = monitor->chas;
+    network_backends_t *bs = chas->priv->backends;
+
+    /* xids are <instance><pid>_<hour>_<id>','<token>, see generate_or_retrieve_xid_str() */
+    gchar *instance = g_strdup(chas->dist_tran_prefix);
+    char *pid_pos = strrchr(instance, '-');
+    if (pid_pos) {
+        pid_pos[1] = '\0';
+    }
+
+    GHashTable *files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    GHashTable *decisions = cetus_xa_log_load(chas->xa_decision_log_path, files);
+
+    /*
+     * a worker without a log can not commit two phase, its branches are
+     * rolled back whether it runs or not
+     */
+    GHashTable *live_tokens = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    gchar *path;
+    gchar *token;
+    g_hash_table_iter_init(&iter, files);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&path, (gpointer *)&token)) {
+        if (cetus_xa_log_in_use(path)) {
+            g_hash_table_add(live_tokens, token);
+        }
+    }
+
+    gboolean complete = TRUE;
+    int i;
+    int backends_num = network_backends_count(bs);
+    for (i = 0; i < backends_num; i++) {
+        network_backend_t *backend = network_backends_get(bs, i);
+        if (backend->type != BACKEND_TYPE_RW || backend->state == BACKEND_STATE_DELETED) {
+            continue;
+        }
+
+        char *backend_addr = backend->addr->name->str;
+        MYSQL *conn = NULL;
+        if (backend->state == BACKEND_STATE_UP) {
+            conn = get_mysql_connection(monitor, backend_addr);
+        }
+        if (conn == NULL) {
+            g_message("xa recovery skips backend: %s", backend_addr);
+            complete = FALSE;
+            continue;
+        }
+        if (!xa_recover_backend(conn, backend_addr, instance, decisions, live_tokens)) {
+            complete = FALSE;
+        }
+    }
+
+    if (complete) {
+        g_hash_table_iter_init(&iter, files);
+        while (g_hash_table_iter_next(&iter, (gpointer *)&path, (gpointer *)&token)) {
+            if (!g_hash_table_contains(live_tokens, token)) {
+                g_message("remove xa decision log of gone worker: %s", path);
+                unlink(path);
+            }
+        }
+    }
+
+    g_hash_table_destroy(live_tokens);
+    g_hash_table_destroy(decisions);
+    g_hash_table_destroy(files);
+    g_free(instance);
+
+    struct timeval timeout = { 0 };
+    timeout.tv_sec = XA_RECOVER_INTERVAL;
+    ADD_MONITOR_TIMER(xa_recover_timer, xa_recover_backends, timeout);
+}
+#endif
+
 #define MON_MAX_NAME_LEN 128
 struct monitored_object_t {
     char name[MON_MAX_NAME_LEN];
@@ -715,6 +1120,14 @@ cetus_monitor_open(cetus_monitor_t *monitor, monitor_type_t monitor_type)
         ADD_MONITOR_TIMER(write_master_timer, update_master_timestamp, timeout);
         g_message("check_slave monitor open.");
         break;
+#ifndef SIMPLE_PARSER
+    case MONITOR_TYPE_XA_RECOVER:
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 1000;
+        ADD_MONITOR_TIMER(xa_recover_timer, xa_recover_backends, timeout);
+        g_message("xa recover monitor open.");
+        break;
+#endif
     default:
         break;
     }
@@ -749,6 +1162,11 @@ cetus_monitor_mainloop(void *data)
     if (chas->check_slave_delay) {
         cetus_monitor_open(monitor, MONITOR_TYPE_CHECK_DELAY);
     }
+#ifndef SIMPLE_PARSER
+    if (chas->xa_decision_log_path) {
+        cetus_monitor_open(monitor, MONITOR_TYPE_XA_RECOVER);
+    }
+#endif
     chassis_event_loop(loop, NULL);
 
     g_message("monitor thread closing %d mysql conns", g_hash_table_size(monitor->backend_conns));
@@ -774,6 +1192,7 @@ cetus_monitor_start_thread(cetus_monitor_t *monitor, chassis *chas)
     }
 
     g_assert(monitor->thread == 0);
+    monitor_shm_reset(monitor);
 
     GThread *new_thread = NULL;
 #if !GLIB_CHECK_VERSION(2, 32, 0)
@@ -794,6 +1213,29 @@ cetus_monitor_start_thread(cetus_monitor_t *monitor, chassis *chas)
     g_message("monitor thread started");
 }
 
+/**
+ * take the probe results of the probing worker instead of probing
+ *
+ * the shared table is checked before the worker loop polls, which is
+ * a single load while nothing changes, so a state change reaches every
+ * worker before it routes its next query
+ */
+void
+cetus_monitor_follow(cetus_monitor_t *monitor, chassis *chas)
+{
+    if (monitor->shm == NULL) {
+        cetus_monitor_start_thread(monitor, chas);
+        return;
+    }
+
+    monitor->chas = chas;
+    ev_prepare_init(&(monitor->shm_watcher), monitor_shm_prepare_cb);
+    monitor->shm_watcher.data = monitor;
+    ev_prepare_start((struct ev_loop *) chas->event_base, &(monitor->shm_watcher));
+    ev_unref((struct ev_loop *) chas->event_base);
+    g_message("monitor follows the probing worker");
+}
+
 void
 cetus_monitor_stop_thread(cetus_monitor_t *monitor)
 {
@@ -810,6 +1252,16 @@ cetus_monitor_new()
     cetus_monitor_t *monitor = g_new0(cetus_monitor_t, 1);
 
     monitor->db_passwd = g_string_new(0);
+
+    /* mapped before the workers fork, so all of them share it */
+    void *shm = mmap(NULL, sizeof(monitor_shm_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shm == MAP_FAILED) {
+        g_warning("%s:mmap monitor table failed:%s, every worker probes backends itself",
+                  G_STRLOC, strerror(errno));
+    } else {
+        monitor->shm = shm;
+    }
     return monitor;
 }
 
@@ -821,6 +1273,8 @@ cetus_monitor_free(cetus_monitor_t *monitor)
     g_list_free_full(monitor->registered_objects, g_free);
     if (monitor->config_id)
         g_free(monitor->config_id);
+    if (monitor->shm)
+        munmap(monitor->shm, sizeof(monitor_shm_t));
     g_free(monitor);
 }
 
@@ -29,10 +29,43 @@ typedef struct cetus_monitor_t cetus_monitor_t;
 typedef enum {
     MONITOR_TYPE_CHECK_ALIVE,
     MONITOR_TYPE_CHECK_DELAY,
+    MONITOR_TYPE_XA_RECOVER,
 } monitor_type_t;
 
 typedef void (*monitor_callback_fn) (int, short, void *);
 
+#define MONITOR_SHM_ADDR_LEN 64
+#define MONITOR_SHM_VERSION_LEN 64
+
+/**
+ * Probe result of one backend, written by the probing worker only.
+ *
+ * seq is odd while the entry is being written, readers copy the entry
+ * and retry when seq was odd or changed meanwhile (a seqlock). Readers
+ * give up after a few tries and take the entry on a later round, a
+ * restarted probing worker rewrites entries its predecessor left odd.
+ */
+typedef struct monitor_shm_backend_t {
+    volatile guint32 seq;
+    int state;                  /* backend_state_t */
+    int type;                   /* backend_type_t */
+    int slave_delay_msec;
+    guint64 slave_applied_msec;
+    char address[MONITOR_SHM_ADDR_LEN];     /* "ip:port", identifies the slot */
+    char group[MONITOR_SHM_ADDR_LEN];       /* server group, may be empty */
+    char version[MONITOR_SHM_VERSION_LEN];
+} monitor_shm_backend_t;
+
+/**
+ * Backend states shared by all workers, mapped before the workers fork.
+ */
+typedef struct monitor_shm_t {
+    /* bumped after every published change, so readers check a single word */
+    volatile guint64 generation;
+    volatile guint num;
+    monitor_shm_backend_t backends[MAX_SERVER_NUM];
+} monitor_shm_t;
+
 cetus_monitor_t *cetus_monitor_new();
 
 void cetus_monitor_free(cetus_monitor_t *);
@@ -41,6 +74,8 @@ void cetus_monitor_open(cetus_monitor_t *, monitor_type_t);
 
 void cetus_monitor_start_thread(cetus_monitor_t *, chassis *data);
 
+void cetus_monitor_follow(cetus_monitor_t *, chassis *data);
+
 void cetus_monitor_stop_thread(cetus_monitor_t *);
 
 #endif
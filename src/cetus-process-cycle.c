@@ -14,6 +14,9 @@
 
 #include "chassis-sql-log.h"
 #include "cetus-monitor.h"
+#include "cetus-xa-log.h"
+#include "network-conn-budget.h"
+#include "query-digest.h"
 #include "network-mysqld.h"
 #include "cetus-channel.h"
 #include "cetus-process.h"
@@ -216,6 +219,14 @@ cetus_master_process_cycle(cetus_cycle_t *cycle)
     cycle->cpus = sysconf(_SC_NPROCESSORS_ONLN);
     cycle->active_worker_processes = cycle->worker_processes;
 
+    if (cycle->max_backend_conns > 0) {
+        cycle->conn_budget = network_conn_budget_new(cycle->max_backend_conns, cycle->worker_processes);
+    }
+
+    if (cycle->digest_table_size > 0) {
+        cycle->query_digest = query_digest_new(cycle->digest_table_size, cycle->worker_processes);
+    }
+
     cetus_start_worker_processes(cycle, cycle->worker_processes, CETUS_PROCESS_RESPAWN);
 
     if (open_plugins(cycle) == -1) {
@@ -563,6 +574,10 @@ cetus_reap_children(cetus_cycle_t *cycle)
 
         if (cetus_processes[i].exited) {
 
+            if (cycle->conn_budget && cetus_processes[i].proc == cetus_worker_process_cycle) {
+                network_conn_budget_detach(cycle->conn_budget, (intptr_t) cetus_processes[i].data);
+            }
+
             if (cycle->config_changed) {
                 cetus_processes[i].respawn = 0;
             }
@@ -667,6 +682,21 @@ cetus_worker_process_cycle(cetus_cycle_t *cycle, void *data)
     cetus_process = CETUS_PROCESS_WORKER;
     cetus_worker = worker;
 
+    if (worker + 1 < cycle->query_stats_slot_num) {
+        /* a respawned worker starts over with the slot of its predecessor */
+        cycle->query_stats = &(cycle->query_stats_slots[worker + 1]);
+        memset(cycle->query_stats, 0, sizeof(query_stats_t));
+        cycle->query_stats->pid = getpid();
+    }
+
+    if (cycle->conn_budget) {
+        network_conn_budget_attach(cycle->conn_budget, worker, cetus_process_slot);
+    }
+
+    if (cycle->query_digest) {
+        query_digest_attach(cycle->query_digest, worker);
+    }
+
     cetus_worker_process_init(cycle, worker);
 
     int i;
@@ -717,8 +747,17 @@ cetus_worker_process_cycle(cetus_cycle_t *cycle, void *data)
     }
 
     g_message("Initial dist_tran_id:%llu", cycle->dist_tran_id);
-    g_message("dist_tran_prefix:%s, process id:%d", cycle->dist_tran_prefix, cetus_process_id);
+    /* a respawned worker may get the pid of a crashed one, the start time tells them apart */
+    snprintf(cycle->dist_tran_token, MAX_DIST_TRAN_TOKEN, "%d-%llx",
+             getpid(), (unsigned long long)g_get_real_time());
+    g_message("dist_tran_prefix:%s, token:%s, process id:%d", cycle->dist_tran_prefix,
+              cycle->dist_tran_token, cetus_process_id);
     incremental_guid_init(&(cycle->guid_state));
+
+    if (cycle->xa_decision_log_path) {
+        cycle->xa_decision_log = cetus_xa_log_open(cycle->xa_decision_log_path, cycle->dist_tran_token,
+                                                   cycle->event_base);
+    }
 #endif
 
 #ifdef BPF_ENABLED
@@ -734,7 +773,12 @@ cetus_worker_process_cycle(cetus_cycle_t *cycle, void *data)
     }
 #endif
 
-    cetus_monitor_start_thread(cycle->priv->monitor, cycle);
+    if (worker == 0) {
+        /* the first worker probes backends on behalf of all workers */
+        cetus_monitor_start_thread(cycle->priv->monitor, cycle);
+    } else {
+        cetus_monitor_follow(cycle->priv->monitor, cycle);
+    }
     cetus_remote_config_start_thread(cycle);
     cetus_sql_log_start_thread_once(cycle->sql_mgr);
 
@@ -830,7 +874,7 @@ cetus_worker_process_init(cetus_cycle_t *cycle, int worker)
     g_debug("%s: channel fd for recving:%d, n:%d", 
             G_STRLOC, cetus_processes[cetus_process_slot].parent_child_channel[1], cetus_process_slot);
 
-    chassis_event_loop_t *mainloop = chassis_event_loop_new();
+    chassis_event_loop_t *mainloop = chassis_event_loop_new_with_backend(cycle->event_backend);
     cycle->event_base = mainloop;
     g_assert(cycle->event_base);
 
@@ -847,6 +891,11 @@ cetus_worker_process_exit(cetus_cycle_t *cycle)
 {
     cetus_monitor_stop_thread(cycle->priv->monitor);
 
+#ifndef SIMPLE_PARSER
+    cetus_xa_log_free(cycle->xa_decision_log);
+    cycle->xa_decision_log = NULL;
+#endif
+
     g_message("%s: exit", G_STRLOC);
 
     exit(0);
@@ -981,6 +1030,12 @@ cetus_channel_handler(int fd, short events, void *user_data)
         case CETUS_CMD_ADMIN:
             process_admin_sql(user_data, &ch);
             break;
+        case CETUS_CMD_LEND_CONN_REQ:
+            network_conn_budget_lend(user_data, &ch);
+            break;
+        case CETUS_CMD_LEND_CONN:
+            network_conn_budget_adopt(user_data, &ch);
+            break;
         case CETUS_CMD_QUIT:
             cetus_quit = 1;
             break;
@@ -0,0 +1,321 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * print a binary sql log (sql-log-format = BINARY) in the text log format
+ *
+ *   cetus-sql-log-decode [-d] [-s] file...
+ *
+ *   -d  append the statement fingerprint to every record
+ *   -s  print block and record counts to stderr when done
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "chassis-sql-log-format.h"
+
+static const char *command_names[] = {
+    "Sleep", "Quit", "Init DB", "Query", "Field List", "Create DB", "Drop DB",
+    "Refresh", "Shutdown", "Statistics", "Processlist", "Connect", "Kill",
+    "Debug", "Ping", "Time", "Delayed insert", "Change user", "Binlog Dump",
+    "Table Dump", "Connect Out", "Register Slave", "Prepare", "Execute",
+    "Long Data", "Close stmt", "Reset stmt", "Set option", "Fetch", "Daemon",
+    "Binlog Dump GTID", "Error"
+};
+
+static const char *xa_state_names[] = {
+    "UNKNOWN", "NEXT_ST_XA_START", "NEXT_ST_XA_QUERY", "NEXT_ST_XA_END",
+    "NEXT_ST_XA_PREPARE", "NEXT_ST_XA_COMMIT", "NEXT_ST_XA_ROLLBACK",
+    "NEXT_ST_XA_CANDIDATE_OVER", "NEXT_ST_XA_OVER"
+};
+
+typedef struct decode_stats_t {
+    guint64 blocks;
+    guint64 records;
+    guint64 lost;
+    guint64 raw_bytes;
+    guint64 data_bytes;
+} decode_stats_t;
+
+static gboolean show_digest = FALSE;
+
+static const char *
+command_name(guint8 command)
+{
+    return command < G_N_ELEMENTS(command_names) ? command_names[command] : "UNKNOWN TYPE";
+}
+
+static void
+print_time(guint64 ts_usec)
+{
+    char buf[32];
+    time_t t = ts_usec / G_USEC_PER_SEC;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%.3d", buf, (int)(ts_usec % G_USEC_PER_SEC / 1000));
+}
+
+/**
+ * @return FALSE if the record is malformed
+ */
+static gboolean
+print_record(const guchar *p, guint32 len)
+{
+    sql_log_record_t rec;
+    if (len < sizeof(rec)) {
+        return FALSE;
+    }
+    memcpy(&rec, p, sizeof(rec));
+
+    /* the fields as NUL terminated strings */
+    gchar *f[SQL_LOG_FIELD_NUM];
+    gsize off = sizeof(rec);
+    int i;
+    for (i = 0; i < SQL_LOG_FIELD_NUM; i++) {
+        if (off + rec.field_len[i] > len) {
+            for (i--; i >= 0; i--) g_free(f[i]);
+            return FALSE;
+        }
+        f[i] = g_strndup((const gchar *)p + off, rec.field_len[i]);
+        off += rec.field_len[i];
+    }
+    gboolean ok = (off + rec.text_len == len);
+    const char *text = (const char *)p + off;
+    int text_len = ok ? (int)rec.text_len : 0;
+    const char *in_tx = (rec.flags & SQL_LOG_F_IN_TX) ? "true" : "false";
+    const char *xa_state = rec.xa_state < G_N_ELEMENTS(xa_state_names) ? xa_state_names[rec.xa_state] : "UNKNOWN";
+
+    if (ok) {
+        print_time(rec.ts_usec);
+        switch (rec.type) {
+        case SQL_LOG_REC_CONNECT:
+            printf(": #connect# %s@%s Connect Cetus %s msg:%.*s, C_id:%u C_db:%s C_charset:%u C_auth_plugin:%s "
+                   "C_ssl:%s C_cap:%x S_cap:%x",
+                   f[SQL_LOG_FIELD_CLIENT_USER], f[SQL_LOG_FIELD_CLIENT_ADDR],
+                   (rec.flags & SQL_LOG_F_ERR) ? "failed" : "success", text_len, text,
+                   rec.client_id, f[SQL_LOG_FIELD_CLIENT_DB], (guint)rec.extra, f[SQL_LOG_FIELD_AUTH_PLUGIN],
+                   (rec.flags & SQL_LOG_F_SSL) ? "true" : "false", rec.client_caps, rec.server_caps);
+            break;
+        case SQL_LOG_REC_CLIENT:
+            printf(": #client# C_ip:%s C_db:%s C_usr:%s C_tx:%s C_retry:%d C_id:%u type:%s %.*s",
+                   f[SQL_LOG_FIELD_CLIENT_ADDR], f[SQL_LOG_FIELD_CLIENT_DB], f[SQL_LOG_FIELD_CLIENT_USER],
+                   in_tx, rec.extra, rec.client_id, command_name(rec.command), text_len, text);
+            break;
+        case SQL_LOG_REC_BACKEND:
+            printf(": #backend-rw# C_ip:%s C_db:%s C_usr:%s C_tx:%s C_id:%u S_ip:%s S_db:%s S_usr:%s S_id:%u "
+                   "inj(type:%d bytes:%" G_GUINT64_FORMAT " rows:%" G_GUINT64_FORMAT ") latency:%.3lf(ms) %s type:%s %.*s",
+                   f[SQL_LOG_FIELD_CLIENT_ADDR], f[SQL_LOG_FIELD_CLIENT_DB], f[SQL_LOG_FIELD_CLIENT_USER],
+                   in_tx, rec.client_id, f[SQL_LOG_FIELD_SERVER_ADDR], f[SQL_LOG_FIELD_SERVER_DB],
+                   f[SQL_LOG_FIELD_SERVER_USER], rec.server_id, rec.extra, rec.bytes, rec.rows,
+                   rec.latency_usec / 1000.0, (rec.flags & SQL_LOG_F_ERR) ? "ERR" : "OK",
+                   command_name(rec.command), text_len, text);
+            break;
+        case SQL_LOG_REC_SHARDING:
+            if (rec.flags & SQL_LOG_F_ATTR_ADJ) {
+                printf(": #backend-sharding# C_ip:%s C_db:%s C_usr:%s C_tx:%s C_id:%u "
+                       "trans(in_xa:%s xa_state:%s) attr_adj_state:%d",
+                       f[SQL_LOG_FIELD_CLIENT_ADDR], f[SQL_LOG_FIELD_CLIENT_DB], f[SQL_LOG_FIELD_CLIENT_USER],
+                       in_tx, rec.client_id, (rec.flags & SQL_LOG_F_IN_XA) ? "true" : "false", xa_state,
+                       rec.extra);
+            } else {
+                printf(": #backend-sharding# C_ip:%s C_db:%s C_usr:%s C_tx:%s C_id:%u S_ip:%s S_db:%s S_usr:%s S_id:%u "
+                       "trans(in_xa:%s xa_state:%s) latency:%.3lf(ms) %s type:%s %.*s",
+                       f[SQL_LOG_FIELD_CLIENT_ADDR], f[SQL_LOG_FIELD_CLIENT_DB], f[SQL_LOG_FIELD_CLIENT_USER],
+                       in_tx, rec.client_id, f[SQL_LOG_FIELD_SERVER_ADDR], f[SQL_LOG_FIELD_SERVER_DB],
+                       f[SQL_LOG_FIELD_SERVER_USER], rec.server_id,
+                       (rec.flags & SQL_LOG_F_IN_XA) ? "true" : "false", xa_state,
+                       rec.latency_usec / 1000.0, (rec.flags & SQL_LOG_F_ERR) ? "ERR" : "OK",
+                       command_name(rec.command), text_len, text);
+            }
+            break;
+        default:
+            printf(": #unknown# type:%d", rec.type);
+            break;
+        }
+        if (show_digest) {
+            printf(" digest:%016" G_GINT64_MODIFIER "x", rec.digest);
+        }
+        printf("\n");
+    }
+
+    for (i = 0; i < SQL_LOG_FIELD_NUM; i++) {
+        g_free(f[i]);
+    }
+    return ok;
+}
+
+static gboolean
+decompress_block(const sql_log_block_t *block, const guchar *data, guchar *raw)
+{
+    switch (block->codec) {
+    case SQL_LOG_CODEC_NONE:
+        if (block->data_len != block->raw_len) {
+            return FALSE;
+        }
+        memcpy(raw, data, block->raw_len);
+        return TRUE;
+    case SQL_LOG_CODEC_ZLIB: {
+        uLongf n = block->raw_len;
+        return uncompress(raw, &n, data, block->data_len) == Z_OK && n == block->raw_len;
+    }
+#ifdef HAVE_LZ4
+    case SQL_LOG_CODEC_LZ4:
+        return LZ4_decompress_safe((const char *)data, (char *)raw, block->data_len, block->raw_len)
+            == (int)block->raw_len;
+#endif
+    default:
+        fprintf(stderr, "codec %d is not supported by this build\n", block->codec);
+        return FALSE;
+    }
+}
+
+/**
+ * @return 0 if the whole file was decoded
+ */
+static int
+decode_file(const char *filename, decode_stats_t *stats)
+{
+    FILE *fp = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "can not open %s\n", filename);
+        return 1;
+    }
+
+    int ret = 0;
+    long offset = 0;
+    sql_log_block_t block;
+    GString *data = g_string_sized_new(SQL_LOG_BLOCK_SIZE);
+    GString *raw = g_string_sized_new(SQL_LOG_BLOCK_SIZE);
+
+    while (fread(&block, sizeof(block), 1, fp) == 1) {
+        if (block.magic != SQL_LOG_BLOCK_MAGIC || block.version != SQL_LOG_BLOCK_VERSION) {
+            fprintf(stderr, "%s: bad block header at offset %ld\n", filename, offset);
+            ret = 1;
+            break;
+        }
+        g_string_set_size(data, block.data_len);
+        if (fread(data->str, 1, block.data_len, fp) != block.data_len) {
+            fprintf(stderr, "%s: truncated block at offset %ld\n", filename, offset);
+            ret = 1;
+            break;
+        }
+        if (crc32(0L, (guchar *)data->str, block.data_len) != block.checksum) {
+            fprintf(stderr, "%s: checksum mismatch at offset %ld\n", filename, offset);
+            ret = 1;
+            break;
+        }
+        g_string_set_size(raw, block.raw_len);
+        if (!decompress_block(&block, (guchar *)data->str, (guchar *)raw->str)) {
+            fprintf(stderr, "%s: can not decompress block at offset %ld\n", filename, offset);
+            ret = 1;
+            break;
+        }
+        if (block.lost > 0) {
+            printf("#lost# %u records dropped by cetus\n", block.lost);
+        }
+
+        guint32 pos = 0;
+        guint32 num = 0;
+        while (pos + sizeof(guint32) <= block.raw_len) {
+            guint32 len;
+            memcpy(&len, raw->str + pos, sizeof(len));
+            if (len > block.raw_len - pos || !print_record((guchar *)raw->str + pos, len)) {
+                fprintf(stderr, "%s: bad record in block at offset %ld\n", filename, offset);
+                ret = 1;
+                break;
+            }
+            pos += len;
+            num++;
+        }
+        if (ret != 0) {
+            break;
+        }
+        if (num != block.record_num) {
+            fprintf(stderr, "%s: block at offset %ld has %u records, expected %u\n",
+                    filename, offset, num, block.record_num);
+        }
+
+        stats->blocks++;
+        stats->records += num;
+        stats->lost += block.lost;
+        stats->raw_bytes += block.raw_len;
+        stats->data_bytes += block.data_len;
+        offset += sizeof(block) + block.data_len;
+    }
+
+    g_string_free(data, TRUE);
+    g_string_free(raw, TRUE);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    gboolean show_stats = FALSE;
+    int c;
+    while ((c = getopt(argc, argv, "dsh")) != -1) {
+        switch (c) {
+        case 'd':
+            show_digest = TRUE;
+            break;
+        case 's':
+            show_stats = TRUE;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d] [-s] file...\n", argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-d] [-s] file...\n", argv[0]);
+        return 1;
+    }
+
+    decode_stats_t stats = {0};
+    int ret = 0;
+    for (; optind < argc; optind++) {
+        ret |= decode_file(argv[optind], &stats);
+    }
+
+    if (show_stats) {
+        fprintf(stderr, "blocks:%" G_GUINT64_FORMAT " records:%" G_GUINT64_FORMAT " lost:%" G_GUINT64_FORMAT
+                " raw bytes:%" G_GUINT64_FORMAT " stored bytes:%" G_GUINT64_FORMAT "\n",
+                stats.blocks, stats.records, stats.lost, stats.raw_bytes, stats.data_bytes);
+    }
+    return ret;
+}
@@ -117,3 +117,44 @@ void bytes_to_hex_str(char* pin, int len, char* pout)
     }
     *pout = 0;
 }
+
+/* MurmurHash64A, the whole key takes part in the hash */
+guint64 cetus_hash64(const void *key, size_t len, guint64 seed)
+{
+    const guint64 m = G_GUINT64_CONSTANT(0xc6a4a7935bd1e995);
+    const int r = 47;
+    guint64 h = seed ^ (len * m);
+
+    const unsigned char *data = key;
+    const unsigned char *end = data + (len & ~(size_t)7);
+
+    while (data != end) {
+        guint64 k;
+        memcpy(&k, data, sizeof(k));
+        data += sizeof(k);
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= (guint64)data[6] << 48;
+    case 6: h ^= (guint64)data[5] << 40;
+    case 5: h ^= (guint64)data[4] << 32;
+    case 4: h ^= (guint64)data[3] << 24;
+    case 3: h ^= (guint64)data[2] << 16;
+    case 2: h ^= (guint64)data[1] << 8;
+    case 1: h ^= (guint64)data[0];
+        h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
@@ -51,4 +51,6 @@ guint64 get_timer_microseconds();
 
 void bytes_to_hex_str(char* pin, int len, char* pout);
 
+guint64 cetus_hash64(const void *key, size_t len, guint64 seed);
+
 #endif
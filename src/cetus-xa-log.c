@@ -0,0 +1,526 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <glib.h>
+#include <zlib.h>
+
+#include "glib-ext.h"
+#include "chassis-event.h"
+#include "cetus-xa-log.h"
+
+struct cetus_xa_log_t {
+    int fd;
+    gchar *path;
+    gsize file_size;
+
+    /* records waiting for the next sync */
+    GString *batch;
+    /* network_mysqld_con waiting for their decisions to be durable */
+    GPtrArray *waiters;
+    /* xid -> xa_log_flags_t, committed and not known to be finished, or orphaned */
+    GHashTable *undone;
+
+    struct event_base *event_base;
+    struct event flush_event;
+
+    guint64 batches;
+    guint64 commits;
+
+    unsigned int flush_scheduled:1;
+    unsigned int broken:1;
+};
+
+static guint32
+xa_log_checksum(xa_log_record_t *rec, const char *xid)
+{
+    guint32 checksum = rec->checksum;
+    rec->checksum = 0;
+    guint32 crc = crc32(0L, (guchar *)rec, sizeof(*rec));
+    crc = crc32(crc, (guchar *)xid, rec->xid_len);
+    rec->checksum = checksum;
+    return crc;
+}
+
+static void
+xa_log_append_record(GString *buf, enum xa_log_record_type_t type, const char *xid, gsize xid_len)
+{
+    xa_log_record_t rec = { 0 };
+    rec.magic = XA_LOG_RECORD_MAGIC;
+    rec.type = type;
+    rec.xid_len = xid_len;
+    rec.ts_usec = g_get_real_time();
+    rec.checksum = xa_log_checksum(&rec, xid);
+
+    g_string_append_len(buf, (const char *)&rec, sizeof(rec));
+    g_string_append_len(buf, xid, xid_len);
+}
+
+/* xid_str is quoted for the sql, the log keeps the bare xid */
+static gchar *
+xa_log_strip_xid(const char *xid_str)
+{
+    gsize len = strlen(xid_str);
+    if (len >= 2 && xid_str[0] == '\'' && xid_str[len - 1] == '\'') {
+        return g_strndup(xid_str + 1, len - 2);
+    }
+    return g_strdup(xid_str);
+}
+
+static int
+xa_log_write_all(int fd, const char *data, gsize len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* makes a created or renamed file durable */
+static void
+xa_log_sync_dir(const char *path)
+{
+    gchar *dir = g_path_get_dirname(path);
+    int fd = open(dir, O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+    g_free(dir);
+}
+
+static void
+xa_log_disable(cetus_xa_log_t *log, const char *what)
+{
+    g_critical("%s:%s xa decision log %s failed:%s, distributed transactions are rolled back",
+               G_STRLOC, what, log->path, strerror(errno));
+    log->broken = 1;
+    g_string_truncate(log->batch, 0);
+}
+
+/**
+ * rewrite the file with the decisions still needed by a recovery
+ */
+static void
+xa_log_checkpoint(cetus_xa_log_t *log)
+{
+    gchar *tmp_path = g_strdup_printf("%s.tmp", log->path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        g_warning("%s:open %s failed:%s", G_STRLOC, tmp_path, strerror(errno));
+        g_free(tmp_path);
+        return;
+    }
+    /* the recovery must see the file in use once it is renamed */
+    flock(fd, LOCK_EX | LOCK_NB);
+
+    GString *buf = g_string_sized_new(g_hash_table_size(log->undone) * 64 + 1);
+    GHashTableIter iter;
+    gchar *xid;
+    gpointer flags;
+    g_hash_table_iter_init(&iter, log->undone);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&xid, &flags)) {
+        if (GPOINTER_TO_INT(flags) & XA_LOG_COMMITTED) {
+            xa_log_append_record(buf, XA_LOG_REC_COMMIT, xid, strlen(xid));
+        }
+        if (GPOINTER_TO_INT(flags) & XA_LOG_ORPHANED) {
+            xa_log_append_record(buf, XA_LOG_REC_ORPHAN, xid, strlen(xid));
+        }
+    }
+
+    if (xa_log_write_all(fd, buf->str, buf->len) == -1 || fdatasync(fd) == -1
+        || rename(tmp_path, log->path) == -1)
+    {
+        g_warning("%s:checkpoint %s failed:%s", G_STRLOC, log->path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+    } else {
+        xa_log_sync_dir(log->path);
+        close(log->fd);
+        log->fd = fd;
+        log->file_size = buf->len;
+        g_message("%s:checkpoint xa decision log %s, %u unfinished", G_STRLOC, log->path,
+                  g_hash_table_size(log->undone));
+    }
+
+    g_string_free(buf, TRUE);
+    g_free(tmp_path);
+}
+
+static int
+xa_log_sync(cetus_xa_log_t *log)
+{
+    if (log->batch->len == 0) {
+        return 0;
+    }
+
+    if (xa_log_write_all(log->fd, log->batch->str, log->batch->len) == -1) {
+        xa_log_disable(log, "write");
+        return -1;
+    }
+    if (fdatasync(log->fd) == -1) {
+        xa_log_disable(log, "sync");
+        return -1;
+    }
+
+    log->file_size += log->batch->len;
+    log->batches++;
+    g_string_truncate(log->batch, 0);
+
+    if (log->file_size > XA_LOG_CHECKPOINT_SIZE) {
+        xa_log_checkpoint(log);
+    }
+    return 0;
+}
+
+/**
+ * one write and one sync for all decisions made since the last flush,
+ * then the XA COMMITs of every waiting transaction go out
+ */
+static void
+xa_log_flush(int fd, short what, void *arg)
+{
+    cetus_xa_log_t *log = arg;
+    log->flush_scheduled = 0;
+
+    g_debug("%s:sync %d bytes for %u waiting cons", G_STRLOC, (int)log->batch->len, log->waiters->len);
+    int lost = xa_log_sync(log) == -1 || log->broken;
+
+    /* the resumed cons may start the next batch */
+    GPtrArray *waiters = log->waiters;
+    log->waiters = g_ptr_array_new();
+
+    guint i;
+    for (i = 0; i < waiters->len; i++) {
+        network_mysqld_con *con = g_ptr_array_index(waiters, i);
+        con->xa_decision_waiting = 0;
+        if (lost) {
+            con->xa_decision_logged = 0;
+            con->xa_decision_lost = 1;
+        }
+        network_mysqld_con_handle(-1, 0, con);
+    }
+    g_ptr_array_free(waiters, TRUE);
+}
+
+static void
+xa_log_schedule_flush(cetus_xa_log_t *log)
+{
+    if (log->flush_scheduled) {
+        return;
+    }
+
+    /* runs after the events of this loop iteration, which join the batch */
+    struct timeval timeout = { 0, 0 };
+    evtimer_set(&log->flush_event, xa_log_flush, log);
+    event_base_set(log->event_base, &log->flush_event);
+    evtimer_add(&log->flush_event, &timeout);
+    log->flush_scheduled = 1;
+}
+
+/**
+ * the file is named after @token, the log of an earlier worker with the
+ * same pid is never reused, it is left to the recovery
+ */
+cetus_xa_log_t *
+cetus_xa_log_open(const char *prefix, const char *token, struct event_base *base)
+{
+    gchar *path = g_strdup_printf("%s.%s", prefix, token);
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+    if (fd == -1) {
+        g_critical("%s:open xa decision log %s failed:%s", G_STRLOC, path, strerror(errno));
+        g_free(path);
+        return NULL;
+    }
+    /* held until the worker exits, the recovery tells a live owner by it */
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        g_critical("%s:lock xa decision log %s failed:%s", G_STRLOC, path, strerror(errno));
+        close(fd);
+        unlink(path);
+        g_free(path);
+        return NULL;
+    }
+    xa_log_sync_dir(path);
+
+    cetus_xa_log_t *log = g_new0(cetus_xa_log_t, 1);
+    log->fd = fd;
+    log->path = path;
+    log->batch = g_string_sized_new(4096);
+    log->waiters = g_ptr_array_new();
+    log->undone = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    log->event_base = base;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        log->file_size = st.st_size;
+    }
+
+    g_message("%s:xa decision log:%s", G_STRLOC, path);
+    return log;
+}
+
+/**
+ * the file is removed when every committed transaction finished, there is
+ * nothing left for a recovery then
+ */
+void
+cetus_xa_log_free(cetus_xa_log_t *log)
+{
+    if (log == NULL) {
+        return;
+    }
+
+    if (log->flush_scheduled) {
+        evtimer_del(&log->flush_event);
+    }
+    if (!log->broken) {
+        xa_log_sync(log);
+    }
+    close(log->fd);
+
+    if (g_hash_table_size(log->undone) == 0 && log->waiters->len == 0) {
+        unlink(log->path);
+    } else {
+        g_message("%s:%u decisions kept in %s for recovery", G_STRLOC,
+                  g_hash_table_size(log->undone), log->path);
+    }
+    g_message("%s:xa decision log, commits:%llu, syncs:%llu", G_STRLOC,
+              (unsigned long long)log->commits, (unsigned long long)log->batches);
+
+    g_hash_table_destroy(log->undone);
+    g_ptr_array_free(log->waiters, TRUE);
+    g_string_free(log->batch, TRUE);
+    g_free(log->path);
+    g_free(log);
+}
+
+/**
+ * record the commit decision of @con, @log is NULL if it failed to open
+ *
+ * @return TRUE if @con has to wait for the decision to be durable, it is
+ *         resumed in ST_SEND_QUERY then, xa_decision_lost is set if the
+ *         decision could not be recorded
+ */
+gboolean
+cetus_xa_log_commit(cetus_xa_log_t *log, network_mysqld_con *con)
+{
+    if (log == NULL || log->broken) {
+        con->xa_decision_lost = 1;
+        return FALSE;
+    }
+
+    gchar *xid = xa_log_strip_xid(con->xid_str);
+    xa_log_append_record(log->batch, XA_LOG_REC_COMMIT, xid, strlen(xid));
+    g_hash_table_replace(log->undone, xid, GINT_TO_POINTER(XA_LOG_COMMITTED));
+    log->commits++;
+
+    con->xa_decision_logged = 1;
+    con->xa_decision_waiting = 1;
+    g_ptr_array_add(log->waiters, con);
+    xa_log_schedule_flush(log);
+
+    return TRUE;
+}
+
+/**
+ * all branches committed, the record rides along with the next batch
+ */
+void
+cetus_xa_log_done(cetus_xa_log_t *log, const char *xid_str)
+{
+    if (log->broken) {
+        return;
+    }
+
+    gchar *xid = xa_log_strip_xid(xid_str);
+    if (g_hash_table_remove(log->undone, xid)) {
+        xa_log_append_record(log->batch, XA_LOG_REC_DONE, xid, strlen(xid));
+    }
+    g_free(xid);
+}
+
+/**
+ * @con gives up a decided transaction whose branches may be left
+ * prepared, a failed XA COMMIT or a con freed before it sent them,
+ * the recovery resolves it although this worker lives on
+ */
+void
+cetus_xa_log_orphan(cetus_xa_log_t *log, network_mysqld_con *con)
+{
+    if (con->xa_decision_waiting) {
+        g_ptr_array_remove_fast(log->waiters, con);
+        con->xa_decision_waiting = 0;
+    }
+    con->xa_decision_logged = 0;
+
+    if (log->broken) {
+        return;
+    }
+
+    gchar *xid = xa_log_strip_xid(con->xid_str);
+    int flags = GPOINTER_TO_INT(g_hash_table_lookup(log->undone, xid));
+    g_warning("%s:xa %s is left to the recovery", G_STRLOC, xid);
+    xa_log_append_record(log->batch, XA_LOG_REC_ORPHAN, xid, strlen(xid));
+    g_hash_table_replace(log->undone, xid, GINT_TO_POINTER(flags | XA_LOG_ORPHANED));
+    xa_log_schedule_flush(log);
+}
+
+static void
+xa_log_load_file(const char *path, GHashTable *decisions)
+{
+    gchar *content = NULL;
+    gsize len = 0;
+    GError *err = NULL;
+    if (!g_file_get_contents(path, &content, &len, &err)) {
+        g_warning("%s:read %s failed:%s", G_STRLOC, path, err->message);
+        g_clear_error(&err);
+        return;
+    }
+
+    gsize pos = 0;
+    while (pos + sizeof(xa_log_record_t) <= len) {
+        xa_log_record_t rec;
+        memcpy(&rec, content + pos, sizeof(rec));
+        const char *xid = content + pos + sizeof(rec);
+        if (rec.magic != XA_LOG_RECORD_MAGIC || pos + sizeof(rec) + rec.xid_len > len
+            || xa_log_checksum(&rec, xid) != rec.checksum)
+        {
+            /* a torn or ongoing write, nothing after it was synced */
+            g_debug("%s:%s ends with %d bad bytes", G_STRLOC, path, (int)(len - pos));
+            break;
+        }
+        int flag = 0;
+        if (rec.type == XA_LOG_REC_COMMIT) {
+            flag = XA_LOG_COMMITTED;
+        } else if (rec.type == XA_LOG_REC_ORPHAN) {
+            flag = XA_LOG_ORPHANED;
+        }
+        if (flag) {
+            gchar *key = g_strndup(xid, rec.xid_len);
+            flag |= GPOINTER_TO_INT(g_hash_table_lookup(decisions, key));
+            g_hash_table_replace(decisions, key, GINT_TO_POINTER(flag));
+        }
+        pos += sizeof(rec) + rec.xid_len;
+    }
+    g_free(content);
+}
+
+/* <pid>-<hex start time>, see cetus_worker_process_init() */
+static gboolean
+xa_log_token_valid(const char *token)
+{
+    const char *p = token;
+    while (g_ascii_isdigit(*p)) {
+        p++;
+    }
+    if (p == token || *p != '-' || p[1] == '\0') {
+        return FALSE;
+    }
+    for (p++; *p; p++) {
+        if (!g_ascii_isxdigit(*p)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * read the decision logs of all workers
+ *
+ * @param files  if not NULL, gets the path -> token of every file read
+ * @return xid -> xa_log_flags_t, the xids are <gtrid>','<bqual>
+ */
+GHashTable *
+cetus_xa_log_load(const char *prefix, GHashTable *files)
+{
+    GHashTable *decisions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    gchar *dir_name = g_path_get_dirname(prefix);
+    gchar *base_name = g_path_get_basename(prefix);
+    gsize base_len = strlen(base_name);
+
+    GDir *dir = g_dir_open(dir_name, 0, NULL);
+    if (dir) {
+        const gchar *name;
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            if (strncmp(name, base_name, base_len) != 0 || name[base_len] != '.') {
+                continue;
+            }
+            const char *token = name + base_len + 1;
+            if (!xa_log_token_valid(token)) {
+                continue;
+            }
+            gchar *path = g_build_filename(dir_name, name, NULL);
+            xa_log_load_file(path, decisions);
+            if (files) {
+                g_hash_table_insert(files, path, g_strdup(token));
+            } else {
+                g_free(path);
+            }
+        }
+        g_dir_close(dir);
+    }
+
+    g_free(base_name);
+    g_free(dir_name);
+    return decisions;
+}
+
+/**
+ * @return TRUE if the worker which wrote @path is still running, it keeps
+ *         the file locked
+ */
+gboolean
+cetus_xa_log_in_use(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return FALSE;
+    }
+
+    gboolean in_use = FALSE;
+    if (flock(fd, LOCK_SH | LOCK_NB) == -1) {
+        in_use = errno == EWOULDBLOCK;
+        if (!in_use) {
+            g_warning("%s:lock %s failed:%s", G_STRLOC, path, strerror(errno));
+            /* can not tell, never resolve behind a live worker */
+            in_use = TRUE;
+        }
+    }
+    close(fd);
+    return in_use;
+}
@@ -0,0 +1,86 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CETUS_XA_LOG_H_
+#define _CETUS_XA_LOG_H_
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+
+/*
+ * Layout of the xa decision log.
+ *
+ * Each worker appends to its own file, <xa-decision-log>.<token>, where the
+ * token, <pid>-<hex start time>, is also the branch qualifier of its xids.
+ * The worker keeps the file locked while it runs. A commit
+ * decision is made durable before any XA COMMIT of the transaction is
+ * sent, so a prepared branch without a decision was never committed
+ * anywhere and is rolled back by the recovery. A transaction whose
+ * decision can not be written is rolled back as well. All integers are in host
+ * byte order, a torn record at the tail is detected by its checksum.
+ */
+
+#define XA_LOG_RECORD_MAGIC 0x4c445843  /* "CXDL" */
+/* the file is rewritten with the unfinished decisions beyond this size */
+#define XA_LOG_CHECKPOINT_SIZE (4 * 1024 * 1024)
+
+enum xa_log_record_type_t {
+    XA_LOG_REC_COMMIT = 1,
+    /* all branches of a committed transaction are committed */
+    XA_LOG_REC_DONE = 2,
+    /* the worker gave up on the transaction, its branches may be prepared */
+    XA_LOG_REC_ORPHAN = 3,
+};
+
+typedef enum {
+    XA_LOG_COMMITTED = 1,
+    /* resolved by the recovery even if the worker is alive */
+    XA_LOG_ORPHANED = 2,
+} xa_log_flags_t;
+
+/**
+ * Record header, followed by the xid without quotes.
+ */
+typedef struct xa_log_record_t {
+    guint32 magic;
+    guint8 type;
+    guint8 reserved;
+    guint16 xid_len;
+    guint64 ts_usec;            /* wall clock */
+    guint32 checksum;           /* crc32 of the record with this field zeroed */
+    guint32 reserved2;
+} xa_log_record_t;
+
+G_STATIC_ASSERT(sizeof(xa_log_record_t) == 24);
+
+typedef struct cetus_xa_log_t cetus_xa_log_t;
+
+NETWORK_API cetus_xa_log_t *cetus_xa_log_open(const char *prefix, const char *token, struct event_base *base);
+NETWORK_API void cetus_xa_log_free(cetus_xa_log_t *log);
+
+NETWORK_API gboolean cetus_xa_log_commit(cetus_xa_log_t *log, network_mysqld_con *con);
+NETWORK_API void cetus_xa_log_done(cetus_xa_log_t *log, const char *xid_str);
+NETWORK_API void cetus_xa_log_orphan(cetus_xa_log_t *log, network_mysqld_con *con);
+
+NETWORK_API GHashTable *cetus_xa_log_load(const char *prefix, GHashTable *files);
+NETWORK_API gboolean cetus_xa_log_in_use(const char *path);
+
+#endif
@@ -83,6 +83,27 @@ chassis_event_loop_new()
     return event_base_new();
 }
 
+/**
+ * create a loop on @backend ("epoll" or "iouring")
+ *
+ * io_uring needs linux 5.11+ and may be disabled by seccomp or sysctl,
+ * the default backend is used when it can not be set up
+ */
+chassis_event_loop_t *
+chassis_event_loop_new_with_backend(const char *backend)
+{
+    if (backend != NULL && strcmp(backend, "iouring") == 0) {
+        chassis_event_loop_t *loop = event_base_new_with_backend(EVBACKEND_IOURING);
+        if (loop) {
+            g_message("%s:event loop uses io_uring", G_STRLOC);
+            return loop;
+        }
+        g_message("%s:io_uring is not available, use the default event backend", G_STRLOC);
+    }
+
+    return event_base_new();
+}
+
 void
 chassis_event_loop_free(chassis_event_loop_t *event)
 {
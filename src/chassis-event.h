@@ -37,6 +37,7 @@ CHASSIS_API void chassis_event_add_with_timeout(chassis *chas, struct event *ev,
 typedef struct event_base chassis_event_loop_t;
 
 CHASSIS_API chassis_event_loop_t *chassis_event_loop_new();
+CHASSIS_API chassis_event_loop_t *chassis_event_loop_new_with_backend(const char *backend);
 CHASSIS_API void chassis_event_loop_free(chassis_event_loop_t *e);
 CHASSIS_API void chassis_event_set_event_base(chassis_event_loop_t *e, struct event_base *event_base);
 CHASSIS_API void *chassis_event_loop(chassis_event_loop_t *, int *);
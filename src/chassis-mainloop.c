@@ -50,6 +50,10 @@
 #include "chassis-timings.h"
 #include "cetus-process-cycle.h"
 #include "chassis-sql-log.h"
+#include "query-cache.h"
+#include "network-conn-budget.h"
+#include "query-digest.h"
+#include "query-admission.h"
 
 static volatile sig_atomic_t signal_shutdown;
 extern int cetus_process_id;
@@ -115,22 +119,52 @@ chassis_new()
 
     chas->sql_mgr = sql_log_alloc();
 
+    chassis_query_stats_init(chas, 1);
+
     return chas;
 }
 
 static void
-g_queue_free_cache_index(gpointer q)
+chassis_query_stats_free(chassis *chas)
 {
-    GQueue *queue = q;
-
-    query_cache_index_item *index;
+    if (chas->query_stats_slots == NULL) {
+        return;
+    }
 
-    while ((index = g_queue_pop_head(queue))) {
-        g_free(index->key);
-        g_free(index);
+    if (chas->query_stats_shared) {
+        chassis_shm_free(chas->query_stats_slots, sizeof(query_stats_t) * chas->query_stats_slot_num);
+    } else {
+        free(chas->query_stats_slots);
     }
+    chas->query_stats_slots = NULL;
+    chas->query_stats = NULL;
+}
 
-    g_queue_free(queue);
+/**
+ * allocate one zeroed statistics slot per process, slot 0 is used by the
+ * current process until the workers take theirs
+ *
+ * must be called before forking for the slots to be shared
+ */
+void
+chassis_query_stats_init(chassis *chas, int slot_num)
+{
+    chassis_query_stats_free(chas);
+
+    gsize size = sizeof(query_stats_t) * slot_num;
+    chas->query_stats_slots = chassis_shm_alloc(size);
+    chas->query_stats_shared = (chas->query_stats_slots != NULL);
+    if (!chas->query_stats_shared) {
+        g_warning("%s:statistics will be collected from each worker", G_STRLOC);
+        void *mem = NULL;
+        if (posix_memalign(&mem, CHASSIS_CACHE_LINE_SIZE, size) != 0) {
+            g_error("%s:alloc statistics failed", G_STRLOC);
+        }
+        memset(mem, 0, size);
+        chas->query_stats_slots = mem;
+    }
+    chas->query_stats_slot_num = slot_num;
+    chas->query_stats = &(chas->query_stats_slots[0]);
 }
 
 /**
@@ -190,10 +224,16 @@ chassis_free(chassis *chas)
         g_free(chas->default_username);
     if (chas->default_hashed_pwd)
         g_free(chas->default_hashed_pwd);
-    if (chas->query_cache_table)
-        g_hash_table_destroy(chas->query_cache_table);
-    if (chas->cache_index)
-        g_queue_free_cache_index(chas->cache_index);
+    if (chas->query_cache)
+        query_cache_free(chas->query_cache);
+    if (chas->conn_budget)
+        network_conn_budget_free(chas->conn_budget);
+    if (chas->query_digest)
+        query_digest_free(chas->query_digest);
+    if (chas->admission)
+        query_admission_free(chas->admission);
+    g_free(chas->user_query_limits);
+    g_free(chas->db_query_limits);
     if  (chas->unix_socket_name) {
         g_free(chas->unix_socket_name);
     }
@@ -203,6 +243,9 @@ chassis_free(chassis *chas)
     if (chas->default_charset) {
        g_free(chas->default_charset);
     }
+    if (chas->event_backend) {
+        g_free(chas->event_backend);
+    }
 
     g_free(chas->event_hdr_version);
 
@@ -251,6 +294,10 @@ chassis_free(chassis *chas)
         g_free(chas->log_xa_filename);
     }
 
+    if(chas->xa_decision_log_path) {
+        g_free(chas->xa_decision_log_path);
+    }
+
     if(chas->remote_config_url) {
         g_free(chas->remote_config_url);
     }
@@ -263,6 +310,8 @@ chassis_free(chassis *chas)
         sql_log_free(chas->sql_mgr);
     }
 
+    chassis_query_stats_free(chas);
+
     if (chas->argv) {
         for (i = 0; i < chas->argc; i++) {
             free(chas->argv[i]);
@@ -367,6 +416,9 @@ chassis_mainloop(void *_chas)
         return 1;
     }
 
+    /* one slot for the master and each worker */
+    chassis_query_stats_init(chas, chas->worker_processes + 1);
+
     cetus_master_process_cycle(chas);
 
     return 0;
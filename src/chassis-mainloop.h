@@ -41,6 +41,7 @@
 #include "chassis-shutdown-hooks.h"
 #include "cetus-util.h"
 #include "chassis-config.h"
+#include "chassis-stats.h"
 
 /** @defgroup chassis Chassis
  *
@@ -63,9 +64,12 @@ typedef struct chassis chassis;
 #define MAX_WORK_PROCESSES_SHIFT 6
 #define MAX_QUERY_TIME 65536
 #define MAX_WAIT_TIME 1024
+/* backends with a response time histogram, counted by backend index */
+#define MAX_RESP_TIME_SERVER_NUM 64
 #define MAX_TRY_NUM 6
 #define MAX_CREATE_CONN_NUM 256
 #define MAX_DIST_TRAN_PREFIX 64
+#define MAX_DIST_TRAN_TOKEN 32
 #define DEFAULT_LIVE_TIME 7200
 
 #define DEFAULT_POOL_SIZE 10
@@ -73,6 +77,8 @@ typedef struct chassis chassis;
 #define MAX_ALLOWED_PACKET_DEFAULT (32 * MB)
 #define MAX_ALLOWED_PACKET_FLOOR   (1 * KB)
 
+#define DEFAULT_AGGR_MEM_LIMIT (64 * MB)
+
 enum asynchronous_admin_type {
     ASYNCHRONOUS_RELOAD = 1,
     ASYNCHRONOUS_RELOAD_VARIABLES,
@@ -88,14 +94,42 @@ typedef struct rw_op_t {
     uint64_t rw;
 } rw_op_t;
 
+typedef struct plan_cache_op_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+} plan_cache_op_t;
+
+typedef struct stmt_cache_op_t {
+    uint64_t hits;
+    uint64_t reprepares;
+    uint64_t evictions;
+} stmt_cache_op_t;
+
+/**
+ * Statistics of one process.
+ *
+ * The slots of all processes live in one shared mapping created before the
+ * workers are forked, each process only writes its own slot and the admin
+ * reads all of them without asking the workers. Slots are cache line
+ * aligned so that workers never write to the same line.
+ */
 typedef struct query_stats_t {
+    /* owner of the slot, 0 for the master or an unused slot */
+    pid_t pid;
     rw_op_t client_query;
     rw_op_t proxyed_query;
     uint64_t xa_count;
-    uint64_t query_time_table[MAX_QUERY_TIME];
-    uint64_t query_wait_table[MAX_WAIT_TIME];
+    /* latency in microseconds */
+    stats_histogram_t query_time;
+    stats_histogram_t query_wait;
     rw_op_t server_query_details[MAX_SERVER_NUM];
-} query_stats_t;
+    stats_histogram_t server_resp_time[MAX_RESP_TIME_SERVER_NUM];
+    /* statements routed by the compiled sharding plans */
+    plan_cache_op_t plan_cache;
+    /* prepared statements executed over pooled connections */
+    stmt_cache_op_t stmt_cache;
+} __attribute__ ((aligned(CHASSIS_CACHE_LINE_SIZE))) query_stats_t;
 
 #ifndef SIMPLE_PARSER
 /* For generating unique global ids for MySQL */
@@ -141,10 +175,12 @@ struct chassis {
     unsigned int ssl:1;
     unsigned int is_tcp_stream_enabled:1;
     unsigned int is_fast_stream_enabled:1;
+    unsigned int splice_stream_enabled:1;
     unsigned int is_partition_mode:1;
     unsigned int check_sql_loosely:1;
     unsigned int is_sql_special_processed:1;
     unsigned int query_cache_enabled:1;
+    unsigned int stmt_multiplexing_enabled:1;
     unsigned int is_back_compressed:1;
     unsigned int is_groupby_need_reconstruct:1;
     unsigned int compress_support:1;
@@ -190,11 +226,17 @@ struct chassis {
     int mid_idle_connections;
 
     long long max_resp_len;
+    long long query_cache_size;
+    long long aggr_mem_limit;
+    int read_balance_mode;
+    int read_after_write_window;
     unsigned long long dist_tran_id;
     double slave_delay_recover_threshold_sec;
     double slave_delay_down_threshold_sec;
 
     char dist_tran_prefix[MAX_DIST_TRAN_PREFIX];
+    /* unique per worker start, the branch qualifier of its xids */
+    char dist_tran_token[MAX_DIST_TRAN_TOKEN];
 
     chassis_private *priv;
     void (*priv_shutdown) (chassis *chas, chassis_private *priv);
@@ -205,7 +247,12 @@ struct chassis {
 
     chassis_shutdown_hooks_t *shutdown_hooks;
 
-    query_stats_t query_stats;
+    /* slot of this process in query_stats_slots */
+    query_stats_t *query_stats;
+    query_stats_t *query_stats_slots;
+    int query_stats_slot_num;
+    /* query_stats_slots are visible to all processes */
+    gboolean query_stats_shared;
 
 
 #ifndef SIMPLE_PARSER
@@ -217,9 +264,17 @@ struct chassis {
     time_t server_conn_refresh_time;
     struct chassis_options_t *options;
     chassis_config_t *config_manager;
-    GHashTable *query_cache_table;
-    GQueue *cache_index;
-    unsigned long long last_cache_purge_time;
+    struct query_cache_t *query_cache;
+    /* max connections to each backend from all workers, 0 for no limit */
+    int max_backend_conns;
+    struct network_conn_budget_t *conn_budget;
+    /* fingerprints kept by each worker, 0 to disable the digest table */
+    int digest_table_size;
+    struct query_digest_t *query_digest;
+    /* running query limits of the worker */
+    struct query_admission_t *admission;
+    gchar *user_query_limits;
+    gchar *db_query_limits;
     gboolean allow_new_conns;
 
     gint verbose_shutdown;
@@ -231,10 +286,15 @@ struct chassis {
     gchar *log_level;
     gchar **plugin_names;
     gchar *log_xa_filename;
+    /* path prefix of the xa decision logs, NULL if disabled */
+    gchar *xa_decision_log_path;
+    struct cetus_xa_log_t *xa_decision_log;
     guint invoke_dbg_on_crash;
     gint max_files_number;
     char *remote_config_url;
     char *trx_isolation_level;
+    /* "epoll" or "iouring", backend of the worker event loops */
+    char *event_backend;
     gchar *default_file;
     gint print_version;
 
@@ -250,6 +310,7 @@ struct chassis {
 
 CHASSIS_API chassis *chassis_new(void);
 CHASSIS_API void chassis_free(chassis *chas);
+CHASSIS_API void chassis_query_stats_init(chassis *chas, int slot_num);
 CHASSIS_API int chassis_check_version(const char *lib_version, const char *hdr_version);
 
 /**
@@ -24,6 +24,9 @@
 #include "cetus-util.h"
 #include "chassis-sql-log.h"
 #include "network-backend.h"
+#include "query-cache.h"
+#include "query-digest.h"
+#include "query-admission.h"
 #include <glib-ext.h>
 #include <errno.h>
 
@@ -238,6 +241,22 @@ show_log_xa_file(gpointer param) {
     return NULL;
 }
 
+gchar*
+show_xa_decision_log(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%s", srv->xa_decision_log_path != NULL ? srv->xa_decision_log_path:"NULL");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->xa_decision_log_path) {
+            return g_strdup_printf("%s", srv->xa_decision_log_path);
+        }
+    }
+    return NULL;
+}
+
 gchar*
 show_log_backtrace_on_crash(gpointer param) {
     struct external_param *opt_param = (struct external_param *)param;
@@ -594,6 +613,39 @@ assign_worker_processes(const gchar *newval, gpointer param) {
     return ret;
 }
 
+gchar*
+show_max_backend_conns(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d", srv->max_backend_conns);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->max_backend_conns > 0) {
+            return g_strdup_printf("%d", srv->max_backend_conns);
+        }
+    }
+    return NULL;
+}
+
+gchar*
+show_digest_table_size(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d", srv->digest_table_size);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (QUERY_DIGEST_DEF_SIZE == srv->digest_table_size) {
+            return NULL;
+        }
+        return g_strdup_printf("%d", srv->digest_table_size);
+    }
+    return NULL;
+}
+
 gchar*
 show_max_resp_len(gpointer param) {
     struct external_param *opt_param = (struct external_param *)param;
@@ -974,6 +1026,367 @@ assign_default_query_cache_timeout(const gchar *newval, gpointer param) {
     return ret;
 }
 
+gchar*
+show_query_cache_size(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%lld", srv->query_cache_size);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (QUERY_CACHE_DEF_SIZE == srv->query_cache_size) {
+            return NULL;
+        }
+        return g_strdup_printf("%lld", srv->query_cache_size);
+    }
+    return NULL;
+}
+
+gint
+assign_query_cache_size(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            long long value = 0;
+            if (try_get_long_value(newval, &value)) {
+                if (value >= 0) {
+                    srv->query_cache_size = value;
+                    if (srv->query_cache) {
+                        query_cache_set_max_bytes(srv->query_cache, value);
+                    }
+                    ret = ASSIGN_OK;
+                } else {
+                    ret = ASSIGN_VALUE_INVALID;
+                }
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_aggr_mem_limit(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%lld", srv->aggr_mem_limit);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (DEFAULT_AGGR_MEM_LIMIT == srv->aggr_mem_limit) {
+            return NULL;
+        }
+        return g_strdup_printf("%lld", srv->aggr_mem_limit);
+    }
+    return NULL;
+}
+
+gint
+assign_aggr_mem_limit(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            long long value = 0;
+            if (try_get_long_value(newval, &value)) {
+                if (value >= 0) {
+                    srv->aggr_mem_limit = value;
+                    ret = ASSIGN_OK;
+                } else {
+                    ret = ASSIGN_VALUE_INVALID;
+                }
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_read_balance(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup(network_backends_balance_mode_name(srv->read_balance_mode));
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->read_balance_mode == READ_BALANCE_ROUND_ROBIN) {
+            return NULL;
+        }
+        return g_strdup(network_backends_balance_mode_name(srv->read_balance_mode));
+    }
+    return NULL;
+}
+
+gint
+assign_read_balance(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            int mode = network_backends_parse_balance_mode(newval);
+            if (mode >= 0) {
+                srv->read_balance_mode = mode;
+                if (srv->priv && srv->priv->backends) {
+                    srv->priv->backends->read_balance_mode = mode;
+                }
+                ret = ASSIGN_OK;
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_max_running_queries(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d", srv->admission->max_running);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->admission->max_running == 0) {
+            return NULL;
+        }
+        return g_strdup_printf("%d", srv->admission->max_running);
+    }
+    return NULL;
+}
+
+gint
+assign_max_running_queries(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            int value = 0;
+            if (try_get_int_value(newval, &value) && value >= 0) {
+                query_admission_set_max_running(srv->admission, value);
+                ret = ASSIGN_OK;
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_max_queued_queries(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d", srv->admission->max_queued);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->admission->max_queued == ADMISSION_DEF_MAX_QUEUED) {
+            return NULL;
+        }
+        return g_strdup_printf("%d", srv->admission->max_queued);
+    }
+    return NULL;
+}
+
+gint
+assign_max_queued_queries(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            int value = 0;
+            if (try_get_int_value(newval, &value) && value >= 0) {
+                srv->admission->max_queued = value;
+                ret = ASSIGN_OK;
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_query_queue_timeout(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d (ms)", srv->admission->queue_timeout);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->admission->queue_timeout == ADMISSION_DEF_QUEUE_TIMEOUT) {
+            return NULL;
+        }
+        return g_strdup_printf("%d", srv->admission->queue_timeout);
+    }
+    return NULL;
+}
+
+gint
+assign_query_queue_timeout(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            int value = 0;
+            if (try_get_int_value(newval, &value) && value >= 0) {
+                srv->admission->queue_timeout = value;
+                ret = ASSIGN_OK;
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_user_query_limits(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup(srv->user_query_limits ? srv->user_query_limits : "NULL");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->user_query_limits) {
+            return g_strdup(srv->user_query_limits);
+        }
+    }
+    return NULL;
+}
+
+gint
+assign_user_query_limits(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval && query_admission_check_limits(newval)) {
+            g_free(srv->user_query_limits);
+            srv->user_query_limits = *newval ? g_strdup(newval) : NULL;
+            query_admission_set_user_limits(srv->admission, srv->user_query_limits);
+            ret = ASSIGN_OK;
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_db_query_limits(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup(srv->db_query_limits ? srv->db_query_limits : "NULL");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->db_query_limits) {
+            return g_strdup(srv->db_query_limits);
+        }
+    }
+    return NULL;
+}
+
+gint
+assign_db_query_limits(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval && query_admission_check_limits(newval)) {
+            g_free(srv->db_query_limits);
+            srv->db_query_limits = *newval ? g_strdup(newval) : NULL;
+            query_admission_set_db_limits(srv->admission, srv->db_query_limits);
+            ret = ASSIGN_OK;
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
+gchar*
+show_read_after_write_window(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%d (ms)", srv->read_after_write_window);
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->read_after_write_window == 0) {
+            return NULL;
+        }
+        return g_strdup_printf("%d", srv->read_after_write_window);
+    }
+    return NULL;
+}
+
+gint
+assign_read_after_write_window(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_ERROR;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (NULL != newval) {
+            int value = 0;
+            if (try_get_int_value(newval, &value)) {
+                if (value >= 0) {
+                    srv->read_after_write_window = value;
+                    ret = ASSIGN_OK;
+                } else {
+                    ret = ASSIGN_VALUE_INVALID;
+                }
+            } else {
+                ret = ASSIGN_VALUE_INVALID;
+            }
+        } else {
+            ret = ASSIGN_VALUE_INVALID;
+        }
+    }
+    return ret;
+}
+
 gchar*
 show_default_maintained_client_idle_timeout(gpointer param) {
     struct external_param *opt_param = (struct external_param *)param;
@@ -1188,6 +1601,20 @@ show_enable_query_cache(gpointer param) {
     return NULL;
 }
 
+gchar*
+show_enable_stmt_multiplexing(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%s", srv->stmt_multiplexing_enabled ? "true" : "false");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        return srv->stmt_multiplexing_enabled ? g_strdup("true") : NULL;
+    }
+    return NULL;
+}
+
 gchar*
 show_enable_fast_stream(gpointer param) {
     struct external_param *opt_param = (struct external_param *)param;
@@ -1202,6 +1629,20 @@ show_enable_fast_stream(gpointer param) {
     return NULL;
 }
 
+gchar*
+show_enable_splice_stream(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%s", srv->splice_stream_enabled ? "true" : "false");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        return srv->splice_stream_enabled ? g_strdup("true") : NULL;
+    }
+    return NULL;
+}
+
 gchar*
 show_enable_partition(gpointer param) {
     struct external_param *opt_param = (struct external_param *)param;
@@ -1366,6 +1807,22 @@ show_trx_isolation_level(gpointer param) {
     return NULL;
 }
 
+gchar*
+show_event_backend(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup_printf("%s", srv->event_backend != NULL ? srv->event_backend : "NULL");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->event_backend && strcmp(srv->event_backend, "epoll") != 0) {
+            return g_strdup_printf("%s", srv->event_backend);
+        }
+    }
+    return NULL;
+}
+
 
 gchar*
 show_group_replication_mode(gpointer param) {
@@ -1613,6 +2070,65 @@ assign_sql_log_idletime(const gchar *newval, gpointer param) {
     return ret;
 }
 
+gchar*
+show_sql_log_format(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup(srv->sql_mgr->sql_log_format == SQL_LOG_BINARY ? "BINARY" : "TEXT");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->sql_mgr->sql_log_format == SQL_LOG_TEXT) return NULL;
+        return g_strdup("BINARY");
+    }
+    return NULL;
+}
+
+gchar*
+show_sql_log_compression(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type) || CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        return g_strdup(sql_log_codec_name(srv->sql_mgr->sql_log_codec));
+    }
+    return NULL;
+}
+
+gchar*
+show_sql_log_overflow(gpointer param) {
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_SHOW_OPTS_PROPERTY(opt_type)) {
+        return g_strdup(srv->sql_mgr->sql_log_overflow == SQL_LOG_OVERFLOW_WAIT ? "WAIT" : "DROP");
+    }
+    if (CAN_SAVE_OPTS_PROPERTY(opt_type)) {
+        if (srv->sql_mgr->sql_log_overflow == SQL_LOG_OVERFLOW_DROP) return NULL;
+        return g_strdup("WAIT");
+    }
+    return NULL;
+}
+
+gint
+assign_sql_log_overflow(const gchar *newval, gpointer param) {
+    gint ret = ASSIGN_VALUE_INVALID;
+    struct external_param *opt_param = (struct external_param *)param;
+    chassis *srv = opt_param->chas;
+    gint opt_type = opt_param->opt_type;
+    if (CAN_ASSIGN_OPTS_PROPERTY(opt_type)) {
+        if (strcasecmp(newval, "DROP") == 0) {
+            srv->sql_mgr->sql_log_overflow = SQL_LOG_OVERFLOW_DROP;
+            ret = ASSIGN_OK;
+        } else if (strcasecmp(newval, "WAIT") == 0) {
+            srv->sql_mgr->sql_log_overflow = SQL_LOG_OVERFLOW_WAIT;
+            ret = ASSIGN_OK;
+        }
+    }
+    return ret;
+}
+
 gchar*
 show_sql_log_maxnum(gpointer param) {
     struct external_param *opt_param = (struct external_param *)param;
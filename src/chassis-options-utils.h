@@ -59,6 +59,7 @@ CHASSIS_API gchar* show_plugins(gpointer param);
 CHASSIS_API gchar* show_log_level(gpointer param);
 CHASSIS_API gchar* show_log_file(gpointer param);
 CHASSIS_API gchar* show_log_xa_file(gpointer param);
+CHASSIS_API gchar* show_xa_decision_log(gpointer param);
 CHASSIS_API gchar* show_log_backtrace_on_crash(gpointer param);
 CHASSIS_API gchar* show_keepalive(gpointer param);
 CHASSIS_API gchar* show_max_open_files(gpointer param);
@@ -69,6 +70,8 @@ CHASSIS_API gchar* show_ifname(gpointer param);
 CHASSIS_API gchar* show_default_pool_size(gpointer param);
 CHASSIS_API gchar* show_max_pool_size(gpointer param);
 CHASSIS_API gchar* show_worker_processes(gpointer param);
+CHASSIS_API gchar* show_max_backend_conns(gpointer param);
+CHASSIS_API gchar* show_digest_table_size(gpointer param);
 CHASSIS_API gchar* show_max_resp_len(gpointer param);
 CHASSIS_API gchar* show_max_alive_time(gpointer param);
 CHASSIS_API gchar* show_merged_output_size(gpointer param);
@@ -81,6 +84,15 @@ CHASSIS_API gchar* show_check_slave_delay(gpointer param);
 CHASSIS_API gchar* show_slave_delay_down(gpointer param);
 CHASSIS_API gchar* show_slave_delay_recover(gpointer param);
 CHASSIS_API gchar* show_default_query_cache_timeout(gpointer param);
+CHASSIS_API gchar* show_query_cache_size(gpointer param);
+CHASSIS_API gchar* show_aggr_mem_limit(gpointer param);
+CHASSIS_API gchar* show_read_balance(gpointer param);
+CHASSIS_API gchar* show_max_running_queries(gpointer param);
+CHASSIS_API gchar* show_max_queued_queries(gpointer param);
+CHASSIS_API gchar* show_query_queue_timeout(gpointer param);
+CHASSIS_API gchar* show_user_query_limits(gpointer param);
+CHASSIS_API gchar* show_db_query_limits(gpointer param);
+CHASSIS_API gchar* show_read_after_write_window(gpointer param);
 CHASSIS_API gchar* show_default_client_idle_timeout(gpointer param);
 CHASSIS_API gchar* show_default_incomplete_tran_idle_timeout(gpointer param);
 CHASSIS_API gchar* show_default_maintained_client_idle_timeout(gpointer param);
@@ -88,8 +100,10 @@ CHASSIS_API gchar* show_long_query_time(gpointer param);
 CHASSIS_API gchar* show_enable_client_found_rows(gpointer param);
 CHASSIS_API gchar* show_reduce_connections(gpointer param);
 CHASSIS_API gchar* show_enable_query_cache(gpointer param);
+CHASSIS_API gchar* show_enable_stmt_multiplexing(gpointer param);
 CHASSIS_API gchar* show_enable_tcp_stream(gpointer param);
 CHASSIS_API gchar* show_enable_fast_stream(gpointer param);
+CHASSIS_API gchar* show_enable_splice_stream(gpointer param);
 CHASSIS_API gchar* show_enable_partition(gpointer param);
 CHASSIS_API gchar* show_enable_sql_special_processed(gpointer param);
 CHASSIS_API gchar* show_check_sql_loosely(gpointer param);
@@ -99,6 +113,7 @@ CHASSIS_API gchar* show_master_preferred(gpointer param);
 CHASSIS_API gchar* show_max_allowed_packet(gpointer param);
 CHASSIS_API gchar* show_remote_conf_url(gpointer param);
 CHASSIS_API gchar* show_trx_isolation_level(gpointer param);
+CHASSIS_API gchar* show_event_backend(gpointer param);
 CHASSIS_API gchar* show_group_replication_mode(gpointer param);
 CHASSIS_API gchar* show_sql_log_bufsize(gpointer param);
 CHASSIS_API gchar* show_sql_log_switch(gpointer param);
@@ -108,6 +123,9 @@ CHASSIS_API gchar* show_sql_log_maxsize(gpointer param);
 CHASSIS_API gchar* show_sql_log_mode(gpointer param);
 CHASSIS_API gchar* show_sql_log_idletime(gpointer param);
 CHASSIS_API gchar* show_sql_log_maxnum(gpointer param);
+CHASSIS_API gchar* show_sql_log_format(gpointer param);
+CHASSIS_API gchar* show_sql_log_compression(gpointer param);
+CHASSIS_API gchar* show_sql_log_overflow(gpointer param);
 CHASSIS_API gchar* show_check_dns(gpointer param);
 CHASSIS_API gchar* show_ssl(gpointer param);
 
@@ -127,6 +145,15 @@ CHASSIS_API gint assign_max_header_size(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_slave_delay_recover(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_slave_delay_down(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_default_query_cache_timeout(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_query_cache_size(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_aggr_mem_limit(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_read_balance(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_max_running_queries(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_max_queued_queries(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_query_queue_timeout(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_user_query_limits(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_db_query_limits(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_read_after_write_window(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_default_client_idle_timeout(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_default_incomplete_tran_idle_timeout(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_default_maintained_client_idle_timeout(const gchar *newval, gpointer param);
@@ -137,6 +164,7 @@ CHASSIS_API gint assign_sql_log_switch(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_sql_log_mode(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_sql_log_idletime(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_sql_log_maxnum(const gchar *newval, gpointer param);
+CHASSIS_API gint assign_sql_log_overflow(const gchar *newval, gpointer param);
 CHASSIS_API gint assign_check_dns(const gchar *newval, gpointer param);
 
 CHASSIS_API gint chassis_options_save(GKeyFile *keyfile, chassis_options_t *opts, chassis  *chas);
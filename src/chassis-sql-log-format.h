@@ -0,0 +1,117 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CHASSIS_SQL_LOG_FORMAT_H_
+#define _CHASSIS_SQL_LOG_FORMAT_H_
+
+#include <glib.h>
+
+/*
+ * Layout of the binary sql log (sql-log-format = BINARY).
+ *
+ * The file is a sequence of self-describing blocks, so files may be
+ * appended to across restarts and a torn block at the tail is detected
+ * by its checksum. Each block holds whole records, compressed together.
+ * All integers are in host byte order.
+ */
+
+#define SQL_LOG_BLOCK_MAGIC 0x4c425343  /* "CSBL" */
+#define SQL_LOG_BLOCK_VERSION 1
+/* records are gathered until a block holds this many raw bytes */
+#define SQL_LOG_BLOCK_SIZE (64 * 1024)
+
+enum sql_log_codec_t {
+    SQL_LOG_CODEC_NONE = 0,
+    SQL_LOG_CODEC_ZLIB = 1,
+    SQL_LOG_CODEC_LZ4 = 2,
+};
+
+typedef struct sql_log_block_t {
+    guint32 magic;
+    guint8 version;
+    guint8 codec;
+    guint16 reserved;
+    guint32 raw_len;            /* records bytes before compression */
+    guint32 data_len;           /* bytes following this header */
+    guint32 record_num;
+    guint32 lost;               /* records dropped since the previous block */
+    guint32 checksum;           /* crc32 of the data */
+    guint32 reserved2;
+} sql_log_block_t;
+
+enum sql_log_record_type_t {
+    SQL_LOG_REC_CONNECT = 1,
+    SQL_LOG_REC_CLIENT = 2,
+    SQL_LOG_REC_BACKEND = 3,
+    SQL_LOG_REC_SHARDING = 4,
+};
+
+#define SQL_LOG_F_IN_TX    0x01
+#define SQL_LOG_F_ERR      0x02
+#define SQL_LOG_F_IN_XA    0x04
+#define SQL_LOG_F_SSL      0x08
+#define SQL_LOG_F_ATTR_ADJ 0x10  /* sharding record for a session attribute adjustment */
+
+enum sql_log_field_t {
+    SQL_LOG_FIELD_CLIENT_ADDR,
+    SQL_LOG_FIELD_CLIENT_DB,
+    SQL_LOG_FIELD_CLIENT_USER,
+    SQL_LOG_FIELD_SERVER_ADDR,
+    SQL_LOG_FIELD_SERVER_DB,
+    SQL_LOG_FIELD_SERVER_USER,
+    SQL_LOG_FIELD_AUTH_PLUGIN,
+    SQL_LOG_FIELD_NUM
+};
+
+/**
+ * Fixed part of a record, followed by the fields in sql_log_field_t
+ * order and then the text (sql, or the error message of a connect).
+ * Strings are not NUL terminated.
+ */
+typedef struct sql_log_record_t {
+    guint32 len;                /* whole record, header included */
+    guint8 type;
+    guint8 flags;
+    guint8 command;
+    guint8 xa_state;
+    guint64 ts_usec;            /* wall clock */
+    guint64 digest;             /* fingerprint of the client statement, 0 if unknown */
+    guint64 bytes;
+    guint64 rows;
+    guint32 latency_usec;
+    guint32 client_id;
+    guint32 server_id;
+    /*
+     * connect: charset, client: retry count,
+     * backend: injection id, sharding: attr_adj_state
+     */
+    gint32 extra;
+    guint32 client_caps;
+    guint32 server_caps;
+    guint16 field_len[SQL_LOG_FIELD_NUM];
+    guint16 reserved;
+    guint32 text_len;
+    guint32 reserved2;
+} sql_log_record_t;
+
+G_STATIC_ASSERT(sizeof(sql_log_block_t) == 32);
+G_STATIC_ASSERT(sizeof(sql_log_record_t) == 88);
+
+#endif
@@ -1,9 +1,18 @@
+#include "config.h"
 #include "chassis-sql-log.h"
+#include "chassis-sql-log-format.h"
 #include "network-mysqld-packet.h"
 #include "cetus-process.h"
+#include "sql-digest.h"
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
 
 const COM_STRING com_command_name[]={
     { C("Sleep") },
@@ -105,52 +114,338 @@ static void rfifo_free(struct rfifo *fifo) {
     g_free(fifo);
 }
 
-static guint rfifo_write(struct rfifo *fifo, guchar *buffer, guint len) {
+static guint
+rfifo_free_space(struct rfifo *fifo)
+{
+    guint out = __atomic_load_n(&fifo->out, __ATOMIC_ACQUIRE);
+    return fifo->size - (fifo->in - out);
+}
+
+/* copy @buffer to the ring at @pos, it is not visible until in is published */
+static void
+rfifo_put(struct rfifo *fifo, guint *pos, const void *buffer, guint len)
+{
+    if (len == 0) {
+        return;
+    }
+    guint off = *pos & (fifo->size - 1);
+    guint l = min(len, fifo->size - off);
+    memcpy(fifo->buffer + off, buffer, l);
+    memcpy(fifo->buffer, (const guchar *)buffer + l, len - l);
+    *pos += len;
+}
+
+static void
+rfifo_get(struct rfifo *fifo, guint pos, void *buffer, guint len)
+{
+    guint off = pos & (fifo->size - 1);
+    guint l = min(len, fifo->size - off);
+    memcpy(buffer, fifo->buffer + off, l);
+    memcpy((guchar *)buffer + l, fifo->buffer, len - l);
+}
+
+guint
+sql_log_cached_bytes(struct sql_log_mgr *mgr)
+{
+    struct rfifo *fifo = mgr->fifo;
+    if (!fifo) return 0;
+    guint in = __atomic_load_n(&fifo->in, __ATOMIC_ACQUIRE);
+    return in - __atomic_load_n(&fifo->out, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * make room for a message of @len bytes
+ *
+ * A message never gets truncated: when the ring stays full it is either
+ * dropped and counted, or with sql-log-overflow = WAIT the worker sleeps
+ * until the sql log thread has written enough out.
+ */
+static gboolean
+sql_log_reserve(struct sql_log_mgr *mgr, guint len)
+{
+    struct rfifo *fifo = mgr->fifo;
+    if (len <= fifo->size) {
+        if (rfifo_free_space(fifo) >= len) {
+            return TRUE;
+        }
+        if (mgr->sql_log_overflow == SQL_LOG_OVERFLOW_WAIT) {
+            mgr->sql_log_waits++;
+            while (mgr->sql_log_action == SQL_LOG_START && !chassis_is_shutdown()) {
+                usleep(SQL_LOG_WAIT_USEC);
+                if (rfifo_free_space(fifo) >= len) {
+                    return TRUE;
+                }
+            }
+        }
+    }
+    mgr->sql_log_dropped++;
+    mgr->sql_log_dropped_bytes += len;
+    __atomic_add_fetch(&mgr->sql_log_lost, 1, __ATOMIC_RELAXED);
+    return FALSE;
+}
+
+static guint rfifo_write(struct sql_log_mgr *mgr, const guchar *buffer, guint len) {
+    struct rfifo *fifo = mgr->fifo;
     if (!fifo) {
         g_critical("struct fifo is NULL when call rfifo_write()");
-        return -1;
-    }
-    guint l;
-    len = min(len, (fifo->size - fifo->in + fifo->out));
-    l = min(len, fifo->size - (fifo->in & (fifo->size -1)));
-    memcpy(fifo->buffer + (fifo->in & (fifo->size -1)), buffer, l);//g_strlcpy
-    memcpy(fifo->buffer, buffer + l, len - l);
-    fifo->in += len;
+        return 0;
+    }
+    if (!sql_log_reserve(mgr, len)) {
+        return 0;
+    }
+    guint in = fifo->in;
+    rfifo_put(fifo, &in, buffer, len);
+    __atomic_store_n(&fifo->in, in, __ATOMIC_RELEASE);
     return len;
 }
 
 static guint rfifo_flush(struct sql_log_mgr *mgr) {
     if (!mgr) {
         g_critical("struct mgr is NULL when call rfifo_flush()");
-        return -1;
+        return 0;
     }
 
     struct rfifo *fifo = mgr->fifo;
     if (!fifo) {
         g_critical("struct fifo is NULL when call rfifo_flush()");
-        return -1;
+        return 0;
     }
     if (!mgr->sql_log_fp) {
         g_critical("sql_log_fp is NULL when call rfifo_flush()");
-        return -1;
+        return 0;
     }
 
-    guint len = fifo->in - fifo->out;
-    guint l = min(len, fifo->size - (fifo->out & (fifo->size -1)));
+    guint in = __atomic_load_n(&fifo->in, __ATOMIC_ACQUIRE);
+    guint out = fifo->out;
+    guint len = in - out;
+    if (len == 0) {
+        return 0;
+    }
+    guint l = min(len, fifo->size - (out & (fifo->size -1)));
     gint fd = fileno(mgr->sql_log_fp);
-    guint s1 = pwrite(fd, fifo->buffer + (fifo->out & (fifo->size - 1)),
+    ssize_t s1 = pwrite(fd, fifo->buffer + (out & (fifo->size - 1)),
             l, (off_t)mgr->sql_log_cursize);
+    if (s1 < 0) {
+        g_critical("%s: write sql log failed: %s", G_STRLOC, g_strerror(errno));
+        return 0;
+    }
     mgr->sql_log_cursize += s1;
-    fifo->out += s1;
-    guint s2 = pwrite(fd, fifo->buffer, len -l, (off_t)mgr->sql_log_cursize);
-    mgr->sql_log_cursize += s2;
-    fifo->out += s2;
+    ssize_t s2 = 0;
+    if (s1 == l && len > l) {
+        s2 = pwrite(fd, fifo->buffer, len - l, (off_t)mgr->sql_log_cursize);
+        if (s2 < 0) {
+            g_critical("%s: write sql log failed: %s", G_STRLOC, g_strerror(errno));
+            s2 = 0;
+        }
+        mgr->sql_log_cursize += s2;
+    }
+    __atomic_store_n(&fifo->out, out + s1 + s2, __ATOMIC_RELEASE);
     if(mgr->sql_log_switch == REALTIME) {
         fsync(fd);
     }
     return (s1 + s2);
 }
 
+static gsize
+sql_log_compress(gint codec, const guchar *src, gsize len, guchar *dst, gsize cap)
+{
+    switch (codec) {
+    case SQL_LOG_CODEC_ZLIB: {
+        uLongf n = cap;
+        if (compress2(dst, &n, src, len, Z_BEST_SPEED) != Z_OK) {
+            return 0;
+        }
+        return n;
+    }
+#ifdef HAVE_LZ4
+    case SQL_LOG_CODEC_LZ4: {
+        int n = LZ4_compress_default((const char *)src, (char *)dst, len, cap);
+        return n > 0 ? n : 0;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ * move whole records out of the ring into one compressed block
+ *
+ * The ring space is given back as soon as the records are copied, so
+ * workers never wait for the compression or the disk.
+ *
+ * @return the bytes written, 0 if there was nothing to write
+ */
+static guint
+rfifo_flush_block(struct sql_log_mgr *mgr)
+{
+    struct rfifo *fifo = mgr->fifo;
+    if (!fifo || !mgr->sql_log_fp) {
+        g_critical("fifo or sql_log_fp is NULL when call rfifo_flush_block()");
+        return 0;
+    }
+
+    guint in = __atomic_load_n(&fifo->in, __ATOMIC_ACQUIRE);
+    guint out = fifo->out;
+    guint32 lost = __atomic_exchange_n(&mgr->sql_log_lost, 0, __ATOMIC_RELAXED);
+    if (in == out && lost == 0) {
+        return 0;
+    }
+
+    guint len = 0;
+    guint num = 0;
+    while (len < in - out) {
+        guint32 rec_len;
+        rfifo_get(fifo, out + len, &rec_len, sizeof(rec_len));
+        if (len > 0 && len + rec_len > SQL_LOG_BLOCK_SIZE) {
+            break;
+        }
+        len += rec_len;
+        num++;
+    }
+    GString *raw = mgr->block_raw;
+    g_string_set_size(raw, len);
+    rfifo_get(fifo, out, raw->str, len);
+    __atomic_store_n(&fifo->out, out + len, __ATOMIC_RELEASE);
+
+    sql_log_block_t block = {0};
+    block.magic = SQL_LOG_BLOCK_MAGIC;
+    block.version = SQL_LOG_BLOCK_VERSION;
+    block.codec = mgr->sql_log_codec;
+    block.raw_len = len;
+    block.record_num = num;
+    block.lost = lost;
+
+    /* room for the header and the worst case of both codecs */
+    gsize cap = len + len / 64 + 64;
+    GString *data = mgr->block_data;
+    g_string_set_size(data, sizeof(block) + cap);
+    guchar *payload = (guchar *)data->str + sizeof(block);
+    gsize data_len = 0;
+    if (len > 0 && block.codec != SQL_LOG_CODEC_NONE) {
+        data_len = sql_log_compress(block.codec, (guchar *)raw->str, len, payload, cap);
+    }
+    if (data_len == 0 || data_len >= len) {
+        block.codec = SQL_LOG_CODEC_NONE;
+        memcpy(payload, raw->str, len);
+        data_len = len;
+    }
+    block.data_len = data_len;
+    block.checksum = crc32(0L, payload, data_len);
+    memcpy(data->str, &block, sizeof(block));
+
+    gint fd = fileno(mgr->sql_log_fp);
+    gsize total = sizeof(block) + data_len;
+    ssize_t s = pwrite(fd, data->str, total, (off_t)mgr->sql_log_cursize);
+    if (s < 0) {
+        g_critical("%s: write sql log block failed: %s, %u records lost", G_STRLOC, g_strerror(errno), num);
+        return 0;
+    }
+    mgr->sql_log_cursize += s;
+    if(mgr->sql_log_switch == REALTIME) {
+        fsync(fd);
+    }
+    return s;
+}
+
+static guint
+sql_log_flush(struct sql_log_mgr *mgr)
+{
+    if (mgr->sql_log_format == SQL_LOG_BINARY) {
+        return rfifo_flush_block(mgr);
+    }
+    return rfifo_flush(mgr);
+}
+
+gint
+sql_log_codec_from_name(const gchar *name)
+{
+    if (strcasecmp(name, "NONE") == 0) {
+        return SQL_LOG_CODEC_NONE;
+    } else if (strcasecmp(name, "ZLIB") == 0) {
+        return SQL_LOG_CODEC_ZLIB;
+#ifdef HAVE_LZ4
+    } else if (strcasecmp(name, "LZ4") == 0) {
+        return SQL_LOG_CODEC_LZ4;
+#endif
+    }
+    return -1;
+}
+
+const gchar *
+sql_log_codec_name(gint codec)
+{
+    switch (codec) {
+    case SQL_LOG_CODEC_NONE:
+        return "NONE";
+    case SQL_LOG_CODEC_ZLIB:
+        return "ZLIB";
+    case SQL_LOG_CODEC_LZ4:
+        return "LZ4";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+static const gchar *
+sql_log_suffix(struct sql_log_mgr *mgr)
+{
+    return mgr->sql_log_format == SQL_LOG_BINARY ? SQL_LOG_BINARY_SUFFIX : SQL_LOG_DEF_SUFFIX;
+}
+
+/**
+ * append a binary record, @fields are indexed by sql_log_field_t
+ */
+static void
+sql_log_write_record(struct sql_log_mgr *mgr, sql_log_record_t *rec,
+                     const char **fields, const char *text, gsize text_len)
+{
+    if (!mgr->fifo) {
+        g_critical("struct fifo is NULL when call sql_log_write_record()");
+        return;
+    }
+    gsize len = sizeof(*rec);
+    int i;
+    for (i = 0; i < SQL_LOG_FIELD_NUM; i++) {
+        gsize l = fields[i] ? strlen(fields[i]) : 0;
+        rec->field_len[i] = min(l, G_MAXUINT16);
+        len += rec->field_len[i];
+    }
+    if (text_len > mgr->fifo->size) {
+        /* can never fit, counted as dropped */
+        text_len = mgr->fifo->size;
+    }
+    rec->text_len = text_len;
+    len += text_len;
+    rec->len = len;
+    rec->ts_usec = g_get_real_time();
+
+    if (!sql_log_reserve(mgr, len)) {
+        return;
+    }
+    struct rfifo *fifo = mgr->fifo;
+    guint in = fifo->in;
+    rfifo_put(fifo, &in, rec, sizeof(*rec));
+    for (i = 0; i < SQL_LOG_FIELD_NUM; i++) {
+        rfifo_put(fifo, &in, fields[i], rec->field_len[i]);
+    }
+    rfifo_put(fifo, &in, text, text_len);
+    __atomic_store_n(&fifo->in, in, __ATOMIC_RELEASE);
+}
+
+static guint64
+sql_log_digest(network_mysqld_con *con)
+{
+    return con->digest ? con->digest->hash : 0;
+}
+
+static guint32
+sql_log_latency(guint64 begin, guint64 end)
+{
+    guint64 usec = end > begin ? end - begin : 0;
+    return min(usec, G_MAXUINT32);
+}
+
 struct sql_log_mgr *sql_log_alloc() {
     struct sql_log_mgr *mgr = (struct sql_log_mgr *)g_malloc0(sizeof(struct sql_log_mgr));
 
@@ -171,6 +466,13 @@ struct sql_log_mgr *sql_log_alloc() {
     mgr->fifo = NULL;
     mgr->sql_log_filelist = NULL;
     mgr->sql_log_maxnum = 3;
+    mgr->sql_log_format = SQL_LOG_TEXT;
+#ifdef HAVE_LZ4
+    mgr->sql_log_codec = SQL_LOG_CODEC_LZ4;
+#else
+    mgr->sql_log_codec = SQL_LOG_CODEC_ZLIB;
+#endif
+    mgr->sql_log_overflow = SQL_LOG_OVERFLOW_DROP;
     return mgr;
 }
 
@@ -199,6 +501,13 @@ void sql_log_free(struct sql_log_mgr *mgr) {
 
     mgr->sql_log_filelist = NULL;
 
+    if (mgr->block_raw) {
+        g_string_free(mgr->block_raw, TRUE);
+    }
+    if (mgr->block_data) {
+        g_string_free(mgr->block_data, TRUE);
+    }
+
     g_free(mgr);
 }
 
@@ -247,7 +556,7 @@ static void sql_log_check_rotate(struct sql_log_mgr *mgr) {
     gchar *rotate_filename = g_strdup_printf("%s/%s-%d-%04d%02d%02d%02d%02d%02d.%s",
             mgr->sql_log_path, mgr->sql_log_prefix, cetus_pid,
             cur_tm.tm_year + 1900, cur_tm.tm_mon + 1, cur_tm.tm_mday, cur_tm.tm_hour,
-            cur_tm.tm_min, cur_tm.tm_sec, SQL_LOG_DEF_SUFFIX);
+            cur_tm.tm_min, cur_tm.tm_sec, sql_log_suffix(mgr));
     if (!rotate_filename) {
         g_critical("can not get the rotate filename");
         return ;
@@ -288,7 +597,7 @@ static void sql_log_check_rotate(struct sql_log_mgr *mgr) {
     mgr->sql_log_action = SQL_LOG_START;
 
     while(!chassis_is_shutdown()) {
-        guint len = rfifo_flush(mgr);
+        guint len = sql_log_flush(mgr);
         if (!len) {
             usleep(mgr->sql_log_idletime);
         } else {
@@ -299,6 +608,12 @@ static void sql_log_check_rotate(struct sql_log_mgr *mgr) {
         }
     }
 sql_log_exit:
+    /* write out what the worker has already handed over */
+    while (sql_log_flush(mgr) > 0);
+    if (mgr->sql_log_dropped > 0) {
+        g_message("sql log dropped %" G_GUINT64_FORMAT " records, %" G_GUINT64_FORMAT " bytes",
+                  mgr->sql_log_dropped, mgr->sql_log_dropped_bytes);
+    }
     fclose(mgr->sql_log_fp);
     g_message("sql log thread stopped");
     mgr->sql_log_cursize = 0;
@@ -354,9 +669,13 @@ sql_log_thread_start(struct sql_log_mgr *mgr) {
      }
      if (mgr->sql_log_fullname == NULL) {
          mgr->sql_log_fullname = g_strdup_printf("%s/%s-%d.%s",
-                 mgr->sql_log_path, mgr->sql_log_prefix, cetus_pid, SQL_LOG_DEF_SUFFIX);
+                 mgr->sql_log_path, mgr->sql_log_prefix, cetus_pid, sql_log_suffix(mgr));
      }
      mgr->fifo = rfifo_alloc(mgr->sql_log_bufsize);
+     if (mgr->sql_log_format == SQL_LOG_BINARY) {
+         mgr->block_raw = g_string_sized_new(SQL_LOG_BLOCK_SIZE);
+         mgr->block_data = g_string_sized_new(SQL_LOG_BLOCK_SIZE);
+     }
      mgr->sql_log_filelist = g_queue_new();
 
      if (mgr->sql_log_switch == OFF) {
@@ -383,6 +702,23 @@ log_sql_client(network_mysqld_con *con)
         (mgr->sql_log_action != SQL_LOG_START)) {
         return;
     }
+    if (mgr->sql_log_format == SQL_LOG_BINARY) {
+        sql_log_record_t rec = {0};
+        const char *fields[SQL_LOG_FIELD_NUM] = {
+            [SQL_LOG_FIELD_CLIENT_ADDR] = con->client->src->name->str,
+            [SQL_LOG_FIELD_CLIENT_DB] = con->client->default_db->str,
+            [SQL_LOG_FIELD_CLIENT_USER] = con->client->response->username->str,
+        };
+        rec.type = SQL_LOG_REC_CLIENT;
+        rec.flags = con->is_in_transaction ? SQL_LOG_F_IN_TX : 0;
+        rec.command = con->parse.command;
+        rec.digest = sql_log_digest(con);
+        rec.client_id = con->client->challenge->thread_id;
+        rec.extra = con->retry_serv_cnt;
+        sql_log_write_record(mgr, &rec, fields, con->orig_sql ? con->orig_sql->str : NULL,
+                             con->orig_sql ? con->orig_sql->len : 0);
+        return;
+    }
     GString *message = g_string_sized_new(sizeof("2004-01-01T00:00:00.000Z"));
     get_current_time_str(message);
     g_string_append_printf(message, ": #client# C_ip:%s C_db:%s C_usr:%s C_tx:%s C_retry:%d C_id:%u type:%s %s\n",
@@ -395,7 +731,7 @@ log_sql_client(network_mysqld_con *con)
                                              GET_COM_NAME(con->parse.command),//type
                                              con->orig_sql != NULL ? con->orig_sql->str : "");//sql
 
-    rfifo_write(mgr->fifo, message->str, message->len);
+    rfifo_write(mgr, (guchar *)message->str, message->len);
     g_string_free(message, TRUE);
 }
 
@@ -416,6 +752,34 @@ log_sql_backend(network_mysqld_con *con, injection *inj)
          (mgr->sql_log_action != SQL_LOG_START)) {
          return;
      }
+     if (mgr->sql_log_format == SQL_LOG_BINARY) {
+         sql_log_record_t rec = {0};
+         const char *fields[SQL_LOG_FIELD_NUM] = {
+             [SQL_LOG_FIELD_CLIENT_ADDR] = con->client->src->name->str,
+             [SQL_LOG_FIELD_CLIENT_DB] = con->client->default_db->str,
+             [SQL_LOG_FIELD_CLIENT_USER] = con->client->response->username->str,
+             [SQL_LOG_FIELD_SERVER_ADDR] = con->server->dst->name->str,
+             [SQL_LOG_FIELD_SERVER_DB] = con->server->default_db->str,
+             [SQL_LOG_FIELD_SERVER_USER] = con->server->response->username->str,
+         };
+         rec.type = SQL_LOG_REC_BACKEND;
+         rec.flags = (con->is_in_transaction ? SQL_LOG_F_IN_TX : 0) |
+             (inj->qstat.query_status == MYSQLD_PACKET_OK ? 0 : SQL_LOG_F_ERR);
+         rec.command = con->parse.command;
+         rec.digest = sql_log_digest(con);
+         rec.bytes = inj->bytes;
+         rec.rows = inj->rows;
+         rec.latency_usec = sql_log_latency(inj->ts_read_query, inj->ts_read_query_result_last);
+         rec.client_id = con->client->challenge->thread_id;
+         rec.server_id = con->server->challenge->thread_id;
+         rec.extra = inj->id;
+         if (con->parse.command == COM_STMT_EXECUTE || inj->query == NULL || inj->query->len <= 1) {
+             sql_log_write_record(mgr, &rec, fields, NULL, 0);
+         } else {
+             sql_log_write_record(mgr, &rec, fields, inj->query->str + 1, inj->query->len - 1);
+         }
+         return;
+     }
      gdouble latency_ms = (inj->ts_read_query_result_last - inj->ts_read_query)/1000.0;
      GString *message = g_string_sized_new(sizeof("2004-01-01T00:00:00.000Z"));
      get_current_time_str(message);
@@ -435,7 +799,7 @@ log_sql_backend(network_mysqld_con *con, injection *inj)
                                               GET_COM_NAME(con->parse.command),//type
                                               con->parse.command == COM_STMT_EXECUTE ? "" : (inj->query != NULL ? GET_COM_STRING(inj->query) : ""));//sql
 
-     rfifo_write(mgr->fifo, message->str, message->len);
+     rfifo_write(mgr, (guchar *)message->str, message->len);
      g_string_free(message, TRUE);
 }
 
@@ -456,13 +820,48 @@ log_sql_backend_sharding(network_mysqld_con *con, server_session_t *session)
          (mgr->sql_log_action != SQL_LOG_START)) {
          return;
      }
-     gdouble latency_ms = (session->ts_read_query_result_last - session->ts_read_query)/1000.0;
-     GString *message = g_string_sized_new(sizeof("2004-01-01T00:00:00.000Z"));
-     get_current_time_str(message);
      gint xa_state = 0;
      if (session->dist_tran_state > 0 && session->dist_tran_state <= 8) {
          xa_state = session->dist_tran_state;
      }
+     if (mgr->sql_log_format == SQL_LOG_BINARY) {
+         sql_log_record_t rec = {0};
+         const char *fields[SQL_LOG_FIELD_NUM] = {
+             [SQL_LOG_FIELD_CLIENT_ADDR] = con->client->src->name->str,
+             [SQL_LOG_FIELD_CLIENT_DB] = con->client->default_db->str,
+             [SQL_LOG_FIELD_CLIENT_USER] = con->client->response->username->str,
+         };
+         rec.type = SQL_LOG_REC_SHARDING;
+         rec.flags = (con->is_in_transaction ? SQL_LOG_F_IN_TX : 0) |
+             (session->is_in_xa ? SQL_LOG_F_IN_XA : 0);
+         rec.xa_state = xa_state;
+         rec.command = con->parse.command;
+         rec.digest = sql_log_digest(con);
+         rec.client_id = con->client->challenge->thread_id;
+         if (con->attr_adj_state != 0) {
+             rec.flags |= SQL_LOG_F_ATTR_ADJ;
+             rec.extra = con->attr_adj_state;
+             sql_log_write_record(mgr, &rec, fields, NULL, 0);
+             return;
+         }
+         fields[SQL_LOG_FIELD_SERVER_ADDR] = session->server->dst->name->str;
+         fields[SQL_LOG_FIELD_SERVER_DB] = session->server->default_db->str;
+         fields[SQL_LOG_FIELD_SERVER_USER] = session->server->response->username->str;
+         if (session->query_status != MYSQLD_PACKET_OK) {
+             rec.flags |= SQL_LOG_F_ERR;
+         }
+         rec.latency_usec = sql_log_latency(session->ts_read_query, session->ts_read_query_result_last);
+         rec.server_id = session->server->challenge->thread_id;
+         if (con->parse.command == COM_STMT_EXECUTE || session->sql == NULL) {
+             sql_log_write_record(mgr, &rec, fields, NULL, 0);
+         } else {
+             sql_log_write_record(mgr, &rec, fields, session->sql->str, session->sql->len);
+         }
+         return;
+     }
+     gdouble latency_ms = (session->ts_read_query_result_last - session->ts_read_query)/1000.0;
+     GString *message = g_string_sized_new(sizeof("2004-01-01T00:00:00.000Z"));
+     get_current_time_str(message);
      if (con->attr_adj_state != 0) {
          g_string_append_printf(message, ": #backend-sharding# C_ip:%s C_db:%s C_usr:%s C_tx:%s C_id:%u "
                                              "trans(in_xa:%s xa_state:%s) attr_adj_state:%d\n",
@@ -491,7 +890,7 @@ log_sql_backend_sharding(network_mysqld_con *con, server_session_t *session)
                                               GET_COM_NAME(con->parse.command),//type
                                               con->parse.command == COM_STMT_EXECUTE ? "" : (session->sql != NULL ? session->sql->str : ""));//sql
      }
-     rfifo_write(mgr->fifo, message->str, message->len);
+     rfifo_write(mgr, (guchar *)message->str, message->len);
      g_string_free(message, TRUE);
 }
 
@@ -512,6 +911,24 @@ log_sql_backend_sharding(network_mysqld_con *con, server_session_t *session)
          (mgr->sql_log_action != SQL_LOG_START)) {
          return;
      }
+     if (mgr->sql_log_format == SQL_LOG_BINARY) {
+         sql_log_record_t rec = {0};
+         const char *fields[SQL_LOG_FIELD_NUM] = {
+             [SQL_LOG_FIELD_CLIENT_ADDR] = con->client->src->name->str,
+             [SQL_LOG_FIELD_CLIENT_DB] = con->client->response->database->str,
+             [SQL_LOG_FIELD_CLIENT_USER] = con->client->response->username->str,
+             [SQL_LOG_FIELD_AUTH_PLUGIN] = con->client->response->auth_plugin_name->str,
+         };
+         rec.type = SQL_LOG_REC_CONNECT;
+         rec.flags = (errmsg ? SQL_LOG_F_ERR : 0) |
+             (con->client->response->ssl_request ? SQL_LOG_F_SSL : 0);
+         rec.client_id = con->client->challenge->thread_id;
+         rec.extra = con->client->response->charset;
+         rec.client_caps = con->client->response->client_capabilities;
+         rec.server_caps = con->client->response->server_capabilities;
+         sql_log_write_record(mgr, &rec, fields, errmsg, errmsg ? strlen(errmsg) : 0);
+         return;
+     }
      GString *message = g_string_sized_new(sizeof("2004-01-01T00:00:00.000Z"));
      get_current_time_str(message);
      g_string_append_printf(message, ": #connect# %s@%s Connect Cetus %s msg:%s, C_id:%u C_db:%s C_charset:%u C_auth_plugin:%s C_ssl:%s C_cap:%x S_cap:%x\n",
@@ -528,6 +945,6 @@ log_sql_backend_sharding(network_mysqld_con *con, server_session_t *session)
                                               con->client->response->server_capabilities
                                               );
 
-     rfifo_write(mgr->fifo, message->str, message->len);
+     rfifo_write(mgr, (guchar *)message->str, message->len);
      g_string_free(message, TRUE);
  }
@@ -10,8 +10,11 @@
 #define SQL_LOG_BUFFER_DEF_SIZE 1024*1024*10
 #define SQL_LOG_DEF_FILE_PREFIX "cetus"
 #define SQL_LOG_DEF_SUFFIX "clg"
+#define SQL_LOG_BINARY_SUFFIX "clb"
 #define SQL_LOG_DEF_PATH "/var/log/"
 #define SQL_LOG_DEF_IDLETIME 10000
+/* how long a worker sleeps while waiting for room in a full buffer */
+#define SQL_LOG_WAIT_USEC 100
 #define MEGABYTES 1024*1024
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -46,11 +49,29 @@ typedef enum {
     SQL_LOG_STOP
 } SQL_LOG_ACTION;
 
+typedef enum {
+    SQL_LOG_TEXT,
+    SQL_LOG_BINARY
+} SQL_LOG_FORMAT;
+
+typedef enum {
+    SQL_LOG_OVERFLOW_DROP,
+    SQL_LOG_OVERFLOW_WAIT
+} SQL_LOG_OVERFLOW;
+
+/**
+ * single producer (the worker) single consumer (the sql log thread) ring
+ *
+ * Messages are published whole: the producer copies a message and then
+ * advances in with release semantics, the consumer advances out the same
+ * way once the bytes are written out. Each index is only written by one
+ * side and lives on its own cache line.
+ */
 struct rfifo {
     guchar *buffer;
     guint size;
-    guint in;
-    guint out;
+    guint in __attribute__((aligned(64)));
+    guint out __attribute__((aligned(64)));
 };
 
 struct sql_log_mgr {
@@ -71,6 +92,19 @@ struct sql_log_mgr {
     gchar *sql_log_fullname;
     struct rfifo *fifo;
     GQueue *sql_log_filelist;
+
+    SQL_LOG_FORMAT sql_log_format;
+    gint sql_log_codec;
+    volatile SQL_LOG_OVERFLOW sql_log_overflow;
+    /* written by the worker only */
+    guint64 sql_log_dropped;
+    guint64 sql_log_dropped_bytes;
+    guint64 sql_log_waits;
+    /* dropped records not yet reported in a block header */
+    guint32 sql_log_lost;
+    /* writer thread buffers for binary blocks */
+    GString *block_raw;
+    GString *block_data;
 };
 
 struct sql_log_mgr *sql_log_alloc();
@@ -79,6 +113,9 @@ void sql_log_free(struct sql_log_mgr *mgr);
 gpointer sql_log_mainloop(gpointer user_data);
 void cetus_sql_log_start_thread_once(struct sql_log_mgr *mgr);
 void sql_log_thread_start(struct sql_log_mgr *mgr);
+guint sql_log_cached_bytes(struct sql_log_mgr *mgr);
+gint sql_log_codec_from_name(const gchar *name);
+const gchar *sql_log_codec_name(gint codec);
 
 void log_sql_connect(network_mysqld_con *con, gchar *errmsg);
 void log_sql_client(network_mysqld_con *con);
@@ -0,0 +1,143 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chassis-stats.h"
+
+static guint
+stats_histogram_index(guint64 v)
+{
+    if (v > G_MAXUINT32) {
+        v = G_MAXUINT32;
+    }
+    if (v < (1 << STATS_HIST_SUB_BITS)) {
+        return (guint)v;
+    }
+
+    int shift = (63 - __builtin_clzll(v)) - STATS_HIST_SUB_BITS + 1;
+    return shift * STATS_HIST_HALF + (guint)(v >> shift);
+}
+
+/**
+ * the largest value falling into bucket @index
+ */
+guint64
+stats_histogram_bucket_high(guint index)
+{
+    if (index < (1 << STATS_HIST_SUB_BITS)) {
+        return index;
+    }
+
+    int shift = index / STATS_HIST_HALF - 1;
+    guint64 m = index % STATS_HIST_HALF + STATS_HIST_HALF;
+    return ((m + 1) << shift) - 1;
+}
+
+/**
+ * only called by the owning process, readers in other processes may
+ * see a sample counted in a bucket but not yet in count, which is fine
+ * for statistics
+ */
+void
+stats_histogram_record(stats_histogram_t *h, guint64 usec)
+{
+    h->buckets[stats_histogram_index(usec)]++;
+    h->count++;
+    h->sum += usec;
+    if (usec > h->max) {
+        h->max = usec;
+    }
+}
+
+void
+stats_histogram_merge(stats_histogram_t *dst, const stats_histogram_t *src)
+{
+    if (src->count == 0) {
+        return;
+    }
+
+    guint i;
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->max = MAX(dst->max, src->max);
+}
+
+/**
+ * @param percent  0 < percent <= 100
+ * @return the highest value equivalent to the percentile, 0 if empty
+ */
+guint64
+stats_histogram_percentile(const stats_histogram_t *h, double percent)
+{
+    guint64 total = 0;
+    guint i;
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        total += h->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    guint64 rank = (guint64)(percent / 100.0 * total + 0.5);
+    rank = CLAMP(rank, 1, total);
+
+    guint64 seen = 0;
+    for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            return MIN(stats_histogram_bucket_high(i), h->max);
+        }
+    }
+    return h->max;
+}
+
+/**
+ * zeroed memory shared with the processes forked afterwards
+ *
+ * @return NULL if it could not be mapped
+ */
+void *
+chassis_shm_alloc(gsize size)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        g_warning("%s:mmap %lu bytes failed:%s", G_STRLOC, (unsigned long)size, strerror(errno));
+        return NULL;
+    }
+    return mem;
+}
+
+void
+chassis_shm_free(void *mem, gsize size)
+{
+    if (mem) {
+        munmap(mem, size);
+    }
+}
@@ -0,0 +1,57 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _CHASSIS_STATS_H_
+#define _CHASSIS_STATS_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+
+#define CHASSIS_CACHE_LINE_SIZE 64
+
+/*
+ * Log-linear latency histogram in microseconds, in the manner of HDR
+ * histograms: values below 2^STATS_HIST_SUB_BITS are exact, larger ones
+ * fall in one of STATS_HIST_HALF buckets per power of two, so the
+ * relative error stays below 1/STATS_HIST_HALF (~6%).
+ *
+ * Values are clamped to 2^32 - 1 us (about 71 minutes).
+ */
+#define STATS_HIST_SUB_BITS 5
+#define STATS_HIST_HALF (1 << (STATS_HIST_SUB_BITS - 1))
+#define STATS_HIST_BUCKETS ((32 - STATS_HIST_SUB_BITS + 2) * STATS_HIST_HALF)
+
+typedef struct stats_histogram_t {
+    guint64 count;
+    guint64 sum;
+    guint64 max;
+    guint64 buckets[STATS_HIST_BUCKETS];
+} stats_histogram_t;
+
+CHASSIS_API void stats_histogram_record(stats_histogram_t *h, guint64 usec);
+CHASSIS_API void stats_histogram_merge(stats_histogram_t *dst, const stats_histogram_t *src);
+CHASSIS_API guint64 stats_histogram_percentile(const stats_histogram_t *h, double percent);
+CHASSIS_API guint64 stats_histogram_bucket_high(guint index);
+
+CHASSIS_API void *chassis_shm_alloc(gsize size);
+CHASSIS_API void chassis_shm_free(void *mem, gsize size);
+
+#endif
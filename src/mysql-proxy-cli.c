@@ -80,6 +80,9 @@
 #include "chassis-options.h"
 #include "cetus-monitor.h"
 #include "chassis-sql-log.h"
+#include "query-cache.h"
+#include "query-digest.h"
+#include "query-admission.h"
 #include "lib/sql-expression.h"
 
 #define GETTEXT_PACKAGE "cetus"
@@ -98,6 +101,8 @@ struct chassis_frontend_t {
     int default_pool_size;
     int max_pool_size;
     int worker_processes;
+    int max_backend_conns;
+    int digest_table_size;
     int merged_output_size;
     int max_header_size;
     int max_alive_time;
@@ -109,6 +114,7 @@ struct chassis_frontend_t {
     int disable_threads;
     int is_tcp_stream_enabled;
     int is_fast_stream_enabled;
+    int splice_stream_enabled;
     int is_partition_mode;
     int check_sql_loosely;
     int is_sql_special_processed;
@@ -124,8 +130,18 @@ struct chassis_frontend_t {
     int incomplete_tran_idle_timeout;
     int maintained_client_idle_timeout;
     int query_cache_enabled;
+    int stmt_multiplexing_enabled;
     int disable_dns_cache;
     long long max_resp_len;
+    long long query_cache_size;
+    long long aggr_mem_limit;
+    gchar *read_balance;
+    int read_after_write_window;
+    int max_running_queries;
+    int max_queued_queries;
+    int query_queue_timeout;
+    gchar *user_query_limits;
+    gchar *db_query_limits;
     double slave_delay_down_threshold_sec;
     double slave_delay_recover_threshold_sec;
 
@@ -152,6 +168,7 @@ struct chassis_frontend_t {
     gchar *log_level;
     gchar *log_filename;
     gchar *log_xa_filename;
+    gchar *xa_decision_log;
     char *default_username;
     char *default_charset;
     char *default_db;
@@ -159,6 +176,7 @@ struct chassis_frontend_t {
 
     char *remote_config_url;
     char *trx_isolation_level;
+    char *event_backend;
 
     gint group_replication_mode;
 
@@ -170,6 +188,9 @@ struct chassis_frontend_t {
     gchar *sql_log_mode;
     guint sql_log_idletime;
     gint sql_log_maxnum;
+    gchar *sql_log_format;
+    gchar *sql_log_compression;
+    gchar *sql_log_overflow;
 
     gint ssl;
 
@@ -202,6 +223,11 @@ chassis_frontend_new(void)
     frontend->check_slave_delay = 1;
     frontend->slave_delay_down_threshold_sec = 10.0;
     frontend->default_query_cache_timeout = 100;
+    frontend->query_cache_size = QUERY_CACHE_DEF_SIZE;
+    frontend->digest_table_size = QUERY_DIGEST_DEF_SIZE;
+    frontend->max_queued_queries = ADMISSION_DEF_MAX_QUEUED;
+    frontend->query_queue_timeout = ADMISSION_DEF_QUEUE_TIMEOUT;
+    frontend->aggr_mem_limit = DEFAULT_AGGR_MEM_LIMIT;
     frontend->client_idle_timeout = 8 * HOURS;
     frontend->incomplete_tran_idle_timeout = 3600;
     frontend->maintained_client_idle_timeout = 30;
@@ -227,6 +253,9 @@ chassis_frontend_new(void)
     frontend->sql_log_mode = NULL;
     frontend->sql_log_idletime = 0;
     frontend->sql_log_maxnum = -1;
+    frontend->sql_log_format = NULL;
+    frontend->sql_log_compression = NULL;
+    frontend->sql_log_overflow = NULL;
 
     frontend->check_dns = 0;
 
@@ -248,6 +277,7 @@ chassis_frontend_free(struct chassis_frontend_t *frontend)
         g_key_file_free(frontend->keyfile);
     g_free(frontend->default_file);
     g_free(frontend->log_xa_filename);
+    g_free(frontend->xa_decision_log);
     g_free(frontend->log_filename);
 
     g_free(frontend->base_dir);
@@ -267,10 +297,17 @@ chassis_frontend_free(struct chassis_frontend_t *frontend)
 
     g_free(frontend->remote_config_url);
     g_free(frontend->trx_isolation_level);
+    g_free(frontend->event_backend);
     g_free(frontend->sql_log_switch);
     g_free(frontend->sql_log_prefix);
     g_free(frontend->sql_log_path);
     g_free(frontend->sql_log_mode);
+    g_free(frontend->sql_log_format);
+    g_free(frontend->sql_log_compression);
+    g_free(frontend->sql_log_overflow);
+    g_free(frontend->read_balance);
+    g_free(frontend->user_query_limits);
+    g_free(frontend->db_query_limits);
 
     g_slice_free(struct chassis_frontend_t, frontend);
 }
@@ -337,6 +374,12 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                         "Log all xa messages in a file", "<file>",
                         NULL, show_log_xa_file, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
 
+    chassis_options_add(opts,
+                        "xa-decision-log",
+                        0, 0, OPTION_ARG_STRING, &(frontend->xa_decision_log),
+                        "Make xa commit decisions durable in files with this prefix, empty to disable", "<file>",
+                        NULL, show_xa_decision_log, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
     chassis_options_add(opts,
                         "log-backtrace-on-crash",
                         0, 0, OPTION_ARG_NONE, &(frontend->invoke_dbg_on_crash),
@@ -391,12 +434,36 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                         "Set worker processes for processing client requests", "<integer>",
                         assign_worker_processes, show_worker_processes, ALL_OPTS_PROPERTY);
 
+    chassis_options_add(opts,
+                        "max-backend-conns",
+                        0, 0, OPTION_ARG_INT, &(frontend->max_backend_conns),
+                        "Set the max connections to each backend from all worker processes", "<integer>",
+                        NULL, show_max_backend_conns, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "digest-table-size",
+                        0, 0, OPTION_ARG_INT, &(frontend->digest_table_size),
+                        "Set the max statement fingerprints kept by each worker process, 0 to disable", "<integer>",
+                        NULL, show_digest_table_size, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "event-backend",
+                        0, 0, OPTION_ARG_STRING, &(frontend->event_backend),
+                        "Event backend of worker processes, epoll(default) or iouring", "<string>",
+                        NULL, show_event_backend, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
     chassis_options_add(opts,
                         "max-resp-size",
                         0, 0, OPTION_ARG_INT64, &(frontend->max_resp_len),
                         "Set the max response size for one backend", "<integer(64)>",
                         assign_max_resp_len, show_max_resp_len, ALL_OPTS_PROPERTY);
 
+    chassis_options_add(opts,
+                        "aggr-mem-limit",
+                        0, 0, OPTION_ARG_INT64, &(frontend->aggr_mem_limit),
+                        "Set the max memory of the GROUP BY hash table, new groups spill to disk beyond", "<integer(64)>",
+                        assign_aggr_mem_limit, show_aggr_mem_limit, ALL_OPTS_PROPERTY);
+
     chassis_options_add(opts,
                         "max-alive-time",
                         0, 0, OPTION_ARG_INT, &(frontend->max_alive_time),
@@ -470,6 +537,54 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                         "default query cache timeout in ms", "<integer>",
                         assign_default_query_cache_timeout, show_default_query_cache_timeout, ALL_OPTS_PROPERTY);
 
+    chassis_options_add(opts,
+                        "query-cache-size",
+                        0, 0, OPTION_ARG_INT64, &(frontend->query_cache_size),
+                        "max memory in bytes used by query cache of each worker", "<integer(64)>",
+                        assign_query_cache_size, show_query_cache_size, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "max-running-queries",
+                        0, 0, OPTION_ARG_INT, &(frontend->max_running_queries),
+                        "max queries running at a time in each worker, 0 for no limit", "<integer>",
+                        assign_max_running_queries, show_max_running_queries, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "max-queued-queries",
+                        0, 0, OPTION_ARG_INT, &(frontend->max_queued_queries),
+                        "max queries waiting for a running slot in each worker", "<integer>",
+                        assign_max_queued_queries, show_max_queued_queries, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "query-queue-timeout",
+                        0, 0, OPTION_ARG_INT, &(frontend->query_queue_timeout),
+                        "max time in ms a query waits for a running slot", "<integer>",
+                        assign_query_queue_timeout, show_query_queue_timeout, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "user-query-limits",
+                        0, 0, OPTION_ARG_STRING, &(frontend->user_query_limits),
+                        "running queries limit and weight of users, e.g. app:20:2,batch:4,*:10", "<string>",
+                        assign_user_query_limits, show_user_query_limits, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "db-query-limits",
+                        0, 0, OPTION_ARG_STRING, &(frontend->db_query_limits),
+                        "running queries limit of databases, e.g. report:8,*:0", "<string>",
+                        assign_db_query_limits, show_db_query_limits, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "read-balance",
+                        0, 0, OPTION_ARG_STRING, &(frontend->read_balance),
+                        "read balance mode: round-robin|least-outstanding|p2c|weighted", "<string>",
+                        assign_read_balance, show_read_balance, ALL_OPTS_PROPERTY);
+
+    chassis_options_add(opts,
+                        "read-after-write-window",
+                        0, 0, OPTION_ARG_INT, &(frontend->read_after_write_window),
+                        "reads after a write use master or caught-up slaves within the window in ms", "<integer>",
+                        assign_read_after_write_window, show_read_after_write_window, ALL_OPTS_PROPERTY);
+
     chassis_options_add(opts,
                         "default-client-idle-timeout",
                         0, 0, OPTION_ARG_INT, &(frontend->client_idle_timeout),
@@ -508,12 +623,20 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
     chassis_options_add(opts, "enable-query-cache", 0, 0, OPTION_ARG_NONE, &(frontend->query_cache_enabled), "", NULL,
                         NULL, show_enable_query_cache, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
 
+    chassis_options_add(opts, "enable-stmt-multiplexing", 0, 0, OPTION_ARG_NONE,
+                        &(frontend->stmt_multiplexing_enabled), "Share prepared statements over pooled connections",
+                        NULL, NULL, show_enable_stmt_multiplexing, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
     chassis_options_add(opts, "enable-tcp-stream", 0, 0, OPTION_ARG_NONE, &(frontend->is_tcp_stream_enabled), "", NULL,
                         NULL, show_enable_tcp_stream, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
 
     chassis_options_add(opts, "enable-fast-stream", 0, 0, OPTION_ARG_NONE, &(frontend->is_fast_stream_enabled), "", NULL,
                         NULL, show_enable_fast_stream, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
 
+    chassis_options_add(opts, "enable-splice-stream", 0, 0, OPTION_ARG_NONE,
+                        &(frontend->splice_stream_enabled), "Forward fast streamed responses with splice",
+                        NULL, NULL, show_enable_splice_stream, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+
     chassis_options_add(opts, "enable-sql-special-processed", 0, 0, OPTION_ARG_NONE, &(frontend->is_sql_special_processed), "", NULL,
                         NULL, show_enable_sql_special_processed, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
 
@@ -598,6 +721,21 @@ chassis_frontend_set_chassis_options(struct chassis_frontend_t *frontend, chassi
                           0, 0, OPTION_ARG_INT, &(frontend->sql_log_maxnum),
                           "aximum number of sql log files","<int>",
                           assign_sql_log_maxnum, show_sql_log_maxnum, ALL_OPTS_PROPERTY);
+    chassis_options_add(opts,
+                          "sql-log-format",
+                          0, 0, OPTION_ARG_STRING, &(frontend->sql_log_format),
+                          "format of sql log records, TEXT(default)/BINARY","<string>",
+                          NULL, show_sql_log_format, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+    chassis_options_add(opts,
+                          "sql-log-compression",
+                          0, 0, OPTION_ARG_STRING, &(frontend->sql_log_compression),
+                          "compression of binary sql log blocks, NONE/ZLIB/LZ4","<string>",
+                          NULL, show_sql_log_compression, SHOW_OPTS_PROPERTY|SAVE_OPTS_PROPERTY);
+    chassis_options_add(opts,
+                          "sql-log-overflow",
+                          0, 0, OPTION_ARG_STRING, &(frontend->sql_log_overflow),
+                          "what to do when sql log buffer is full, DROP(default)/WAIT","<string>",
+                          assign_sql_log_overflow, show_sql_log_overflow, ALL_OPTS_PROPERTY);
     chassis_options_add(opts,
                           "check-dns",
                           0, 0, OPTION_ARG_NONE, &(frontend->check_dns),
@@ -670,14 +808,6 @@ check_plugin_mode_valid(struct chassis_frontend_t *frontend, chassis *srv)
     return TRUE;
 }
 
-static void
-g_query_cache_item_free(gpointer q)
-{
-    query_cache_item *item = q;
-    network_queue_free(item->queue);
-    g_free(item);
-}
-
 /* strdup with 1) default value & 2) NULL check */
 #define DUP_STRING(STR, DEFAULT) \
         (STR) ? g_strdup(STR) : ((DEFAULT) ? g_strdup(DEFAULT) : NULL)
@@ -727,9 +857,23 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     }
     g_message("set max pool size:%d", srv->max_idle_connections);
 
+    if (frontend->max_backend_conns > 0) {
+        srv->max_backend_conns = frontend->max_backend_conns;
+        if (srv->max_backend_conns < srv->worker_processes) {
+            g_warning("max backend conns:%d is less than worker processes", srv->max_backend_conns);
+        }
+        g_message("set max backend conns:%d", srv->max_backend_conns);
+    }
+
+    srv->digest_table_size = MAX(frontend->digest_table_size, 0);
+    g_message("set digest table size:%d", srv->digest_table_size);
+
     srv->max_resp_len = frontend->max_resp_len;
     g_message("set max resp len:%lld", srv->max_resp_len);
 
+    srv->aggr_mem_limit = MAX(frontend->aggr_mem_limit, 0);
+    g_message("set aggr mem limit:%lld", srv->aggr_mem_limit);
+
     srv->current_time = time(0);
     if (frontend->max_alive_time < 60) {
         frontend->max_alive_time = 60;
@@ -770,10 +914,53 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
         g_message("%s:xa_log_detailed false", G_STRLOC);
     }
     srv->query_cache_enabled = frontend->query_cache_enabled;
+    srv->query_cache_size = MAX(frontend->query_cache_size, 0);
     if (srv->query_cache_enabled) {
-        srv->query_cache_table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_query_cache_item_free);
-        srv->cache_index = g_queue_new();
+        srv->query_cache = query_cache_new(srv->query_cache_size);
+        g_message("%s:query cache size:%lld", G_STRLOC, srv->query_cache_size);
+    }
+#ifdef SIMPLE_PARSER
+    srv->stmt_multiplexing_enabled = frontend->stmt_multiplexing_enabled;
+    if (srv->stmt_multiplexing_enabled) {
+        g_message("%s:prepared statements are multiplexed", G_STRLOC);
+    }
+#endif
+    srv->admission = query_admission_new();
+    query_admission_set_max_running(srv->admission, frontend->max_running_queries);
+    srv->admission->max_queued = MAX(frontend->max_queued_queries, 0);
+    srv->admission->queue_timeout = MAX(frontend->query_queue_timeout, 0);
+    if (frontend->user_query_limits) {
+        if (query_admission_check_limits(frontend->user_query_limits)) {
+            srv->user_query_limits = g_strdup(frontend->user_query_limits);
+            query_admission_set_user_limits(srv->admission, srv->user_query_limits);
+        } else {
+            g_critical("user-query-limits is invalid, current value is %s", frontend->user_query_limits);
+        }
     }
+    if (frontend->db_query_limits) {
+        if (query_admission_check_limits(frontend->db_query_limits)) {
+            srv->db_query_limits = g_strdup(frontend->db_query_limits);
+            query_admission_set_db_limits(srv->admission, srv->db_query_limits);
+        } else {
+            g_critical("db-query-limits is invalid, current value is %s", frontend->db_query_limits);
+        }
+    }
+    if (query_admission_enabled(srv->admission)) {
+        g_message("%s:max running queries:%d, queued:%d, queue timeout:%d ms", G_STRLOC,
+                  srv->admission->max_running, srv->admission->max_queued, srv->admission->queue_timeout);
+    }
+
+    srv->read_balance_mode = READ_BALANCE_ROUND_ROBIN;
+    if (frontend->read_balance) {
+        int mode = network_backends_parse_balance_mode(frontend->read_balance);
+        if (mode >= 0) {
+            srv->read_balance_mode = mode;
+        } else {
+            g_critical("read-balance is invalid, current value is %s", frontend->read_balance);
+        }
+    }
+    g_message("%s:read balance mode:%s", G_STRLOC, network_backends_balance_mode_name(srv->read_balance_mode));
+    srv->read_after_write_window = MAX(frontend->read_after_write_window, 0);
     srv->is_tcp_stream_enabled = frontend->is_tcp_stream_enabled;
     if (srv->is_tcp_stream_enabled) {
         g_message("%s:tcp stream enabled", G_STRLOC);
@@ -782,6 +969,12 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     if (srv->is_fast_stream_enabled) {
         g_message("%s:fast stream enabled", G_STRLOC);
     }
+#ifdef SIMPLE_PARSER
+    srv->splice_stream_enabled = frontend->splice_stream_enabled;
+    if (srv->splice_stream_enabled) {
+        g_message("%s:splice stream enabled", G_STRLOC);
+    }
+#endif
 #ifndef SIMPLE_PARSER
     srv->is_partition_mode = frontend->is_partition_mode;
     if (srv->is_partition_mode) {
@@ -853,6 +1046,18 @@ init_parameters(struct chassis_frontend_t *frontend, chassis *srv)
     }
     
     g_message("trx isolation level value:%s", srv->trx_isolation_level);
+
+    if (frontend->event_backend == NULL || strcasecmp(frontend->event_backend, "epoll") == 0) {
+        srv->event_backend = g_strdup("epoll");
+    } else if (strcasecmp(frontend->event_backend, "iouring") == 0 ||
+            strcasecmp(frontend->event_backend, "io_uring") == 0)
+    {
+        srv->event_backend = g_strdup("iouring");
+    } else {
+        g_warning("event backend:%s is not expected, use epoll instead", frontend->event_backend);
+        srv->event_backend = g_strdup("epoll");
+    }
+    g_message("set event backend:%s", srv->event_backend);
 }
 
 static void
@@ -1261,6 +1466,21 @@ main_cmdline(int argc, char **argv)
     if (tc_log_init(srv->log_xa_filename) == -1) {
         GOTO_EXIT(EXIT_FAILURE);
     }
+
+    if (!frontend->xa_decision_log)
+        frontend->xa_decision_log = g_strdup("logs/xa-decision.log");
+
+    if (frontend->xa_decision_log[0] != '\0') {
+        srv->xa_decision_log_path = g_strdup(frontend->xa_decision_log);
+        new_path = chassis_resolve_path(srv->base_dir, srv->xa_decision_log_path);
+        if (new_path && new_path != srv->xa_decision_log_path) {
+            g_free(srv->xa_decision_log_path);
+            srv->xa_decision_log_path = new_path;
+        }
+        g_message("XA decision log: %s.<pid>-<start time>", srv->xa_decision_log_path);
+    } else {
+        g_message("XA decision log disabled");
+    }
 #endif
 
     slow_query_log_fp = init_slow_query_log(log->log_filename);
@@ -1330,6 +1550,35 @@ main_cmdline(int argc, char **argv)
         if (frontend->sql_log_maxnum >= 0) {
             srv->sql_mgr->sql_log_maxnum = frontend->sql_log_maxnum;
         }
+        if (frontend->sql_log_format) {
+            if (strcasecmp(frontend->sql_log_format, "TEXT") == 0) {
+                srv->sql_mgr->sql_log_format = SQL_LOG_TEXT;
+            } else if (strcasecmp(frontend->sql_log_format, "BINARY") == 0) {
+                srv->sql_mgr->sql_log_format = SQL_LOG_BINARY;
+            } else {
+                g_critical("sql-log-format is invalid, current value is %s", frontend->sql_log_format);
+                GOTO_EXIT(EXIT_FAILURE);
+            }
+        }
+        if (frontend->sql_log_compression) {
+            gint codec = sql_log_codec_from_name(frontend->sql_log_compression);
+            if (codec < 0) {
+                g_critical("sql-log-compression is invalid or not supported by this build, current value is %s",
+                           frontend->sql_log_compression);
+                GOTO_EXIT(EXIT_FAILURE);
+            }
+            srv->sql_mgr->sql_log_codec = codec;
+        }
+        if (frontend->sql_log_overflow) {
+            if (strcasecmp(frontend->sql_log_overflow, "DROP") == 0) {
+                srv->sql_mgr->sql_log_overflow = SQL_LOG_OVERFLOW_DROP;
+            } else if (strcasecmp(frontend->sql_log_overflow, "WAIT") == 0) {
+                srv->sql_mgr->sql_log_overflow = SQL_LOG_OVERFLOW_WAIT;
+            } else {
+                g_critical("sql-log-overflow is invalid, current value is %s", frontend->sql_log_overflow);
+                GOTO_EXIT(EXIT_FAILURE);
+            }
+        }
     }
     srv->check_dns = frontend->check_dns;
 
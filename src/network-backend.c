@@ -249,6 +249,7 @@ network_backends_add(network_backends_t *bs, const gchar *address,
         return BACKEND_OPERATE_2MASTER;
     }
 
+    new_backend->ndx = bs->backends->len;
     g_ptr_array_add(bs->backends, new_backend);
     if (type == BACKEND_TYPE_RO) {
         bs->ro_server_num += 1;
@@ -551,72 +552,191 @@ network_group_update(network_group_t *gp)
     g_list_free(backends);
 }
 
-static int network_backends_get_ro_ndx_by_priority(network_backends_t *bs) {
-  GArray *active_ro_indices = g_array_sized_new(FALSE, TRUE, sizeof(int), 4);
-  int count = network_backends_count(bs);
-  int weight[MAX_WEIGHT_VALUE + 1];
-  int i;
-
-  memset(weight, 0, sizeof(int) * (MAX_WEIGHT_VALUE + 1));
-  for (i = 0; i < count; i++) {
-    network_backend_t *backend = network_backends_get(bs, i);
-    if ((backend->type == BACKEND_TYPE_RO) &&
-        (backend->state == BACKEND_STATE_UP ||
-         backend->state == BACKEND_STATE_UNKNOWN)) {
-      weight[backend->server_weight] = 1;
-    }
-  }
-
-  int max_weight = 0;
-  for (i = 0; i <= MAX_WEIGHT_VALUE; i++) {
-    if (weight[i]) {
-      max_weight = i;
-    }
-  }
-
-  for (i = 0; i < count; i++) {
-    network_backend_t *backend = network_backends_get(bs, i);
-    if ((backend->type == BACKEND_TYPE_RO) &&
-        (backend->state == BACKEND_STATE_UP ||
-         backend->state == BACKEND_STATE_UNKNOWN)) {
-      if (backend->server_weight == max_weight) {
-        g_array_append_val(active_ro_indices, i);
-      }
-    }
-  }
-  int num = active_ro_indices->len;
-  int result = -1;
-  if (num > 0) {
-    result = g_array_index(active_ro_indices, int, (bs->read_count++) % num);
-  }
-  g_array_free(active_ro_indices, TRUE);
-  return result;
-}
-
-int network_backends_get_ro_ndx(network_backends_t *bs)
-{
-  if (bs->priority_mode) {
-    return network_backends_get_ro_ndx_by_priority(bs);
-  } else {
-    /* round robin choose read only backend */
-    GArray* active_ro_indices = g_array_sized_new(FALSE, TRUE, sizeof(int), 4);
+static const char *read_balance_mode_names[] = {
+    "round-robin",
+    "least-outstanding",
+    "p2c",
+    "weighted"
+};
+
+int
+network_backends_parse_balance_mode(const char *name)
+{
+    guint i;
+    for (i = 0; i < G_N_ELEMENTS(read_balance_mode_names); i++) {
+        if (strcasecmp(name, read_balance_mode_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *
+network_backends_balance_mode_name(read_balance_mode_t mode)
+{
+    if ((guint)mode >= G_N_ELEMENTS(read_balance_mode_names)) {
+        return "unknown";
+    }
+    return read_balance_mode_names[mode];
+}
+
+void
+network_backend_request_begin(network_backend_t *b)
+{
+    b->pending_requests++;
+}
+
+/**
+ * @param resp_usec response time of the request, negative if unknown
+ */
+void
+network_backend_request_end(network_backend_t *b, gint64 resp_usec)
+{
+    if (b->pending_requests > 0) {
+        b->pending_requests--;
+    }
+
+    if (resp_usec < 0) {
+        return;
+    }
+
+    /* ewma with alpha = 1/8, kept scaled by 8 as tcp srtt */
+    if (b->resp_time_ewma == 0) {
+        b->resp_time_ewma = resp_usec << 3;
+    } else {
+        b->resp_time_ewma += resp_usec - (b->resp_time_ewma >> 3);
+    }
+}
+
+/* expected wait for a new request, a backend without samples costs the least */
+static guint64
+network_backend_balance_cost(network_backend_t *b)
+{
+    return (guint64)(b->pending_requests + 1) * ((b->resp_time_ewma >> 3) + 1);
+}
+
+/**
+ * choose one of the @num candidates
+ *
+ * @param visit_cnt  rotated on each call, for round robin and for breaking ties
+ * @return position in @candidates
+ */
+static int
+network_backends_balance(network_backend_t **candidates, int num, read_balance_mode_t mode,
+                         unsigned int *visit_cnt)
+{
+    int i, chosen;
+
+    if (num == 1) {
+        return 0;
+    }
+
+    switch (mode) {
+    case READ_BALANCE_LEAST_OUTSTANDING:{
+        int start = (*visit_cnt)++ % num;
+        guint64 min_cost = G_MAXUINT64;
+        chosen = start;
+        for (i = 0; i < num; i++) {
+            int pos = (start + i) % num;
+            guint64 cost = network_backend_balance_cost(candidates[pos]);
+            if (cost < min_cost) {
+                min_cost = cost;
+                chosen = pos;
+            }
+        }
+        break;
+    }
+    case READ_BALANCE_P2C:{
+        int first = g_random_int_range(0, num);
+        int second = g_random_int_range(0, num - 1);
+        if (second >= first) {
+            second++;
+        }
+        if (network_backend_balance_cost(candidates[second]) < network_backend_balance_cost(candidates[first])) {
+            chosen = second;
+        } else {
+            chosen = first;
+        }
+        break;
+    }
+    case READ_BALANCE_WEIGHTED:{
+        /* smooth weighted round robin, weight 0 counts as 1 */
+        int total = 0;
+        chosen = 0;
+        for (i = 0; i < num; i++) {
+            network_backend_t *b = candidates[i];
+            int weight = MAX(b->server_weight, 1);
+            b->balance_weight += weight;
+            total += weight;
+            if (b->balance_weight > candidates[chosen]->balance_weight) {
+                chosen = i;
+            }
+        }
+        candidates[chosen]->balance_weight -= total;
+        break;
+    }
+    default:
+        chosen = (*visit_cnt)++ % num;
+        break;
+    }
+
+    return chosen;
+}
+
+int
+network_backends_get_ro_ndx(network_backends_t *bs)
+{
+    return network_backends_get_fresh_ro_ndx(bs, 0);
+}
+
+/**
+ * choose a read only backend, no allocation is made here
+ *
+ * If weights are given(priority mode), only backends with the highest
+ * weight are used, except in weighted mode where weights are shares.
+ *
+ * @param min_applied_msec  only slaves which applied the heartbeat written
+ *                          at this time are used, 0 for no bound
+ */
+int
+network_backends_get_fresh_ro_ndx(network_backends_t *bs, guint64 min_applied_msec)
+{
+    network_backend_t *candidates[MAX_SERVER_NUM];
+    int indices[MAX_SERVER_NUM];
+    gboolean by_priority = bs->priority_mode && bs->read_balance_mode != READ_BALANCE_WEIGHTED;
     int count = network_backends_count(bs);
-    int i = 0;
-    for (i = 0; i < count; i++) {
+    int max_weight = 0;
+    int num = 0;
+    int i;
+
+    for (i = 0; i < count && num < MAX_SERVER_NUM; i++) {
         network_backend_t *backend = network_backends_get(bs, i);
-        if ((backend->type == BACKEND_TYPE_RO)
-            && (backend->state == BACKEND_STATE_UP || backend->state == BACKEND_STATE_UNKNOWN)) {
-            g_array_append_val(active_ro_indices, i);
+        if ((backend->type != BACKEND_TYPE_RO)
+            || (backend->state != BACKEND_STATE_UP && backend->state != BACKEND_STATE_UNKNOWN)) {
+            continue;
+        }
+        if (backend->slave_applied_msec < min_applied_msec) {
+            continue;
         }
+        if (by_priority) {
+            if (backend->server_weight < max_weight) {
+                continue;
+            }
+            if (backend->server_weight > max_weight) {
+                max_weight = backend->server_weight;
+                num = 0;
+            }
+        }
+        candidates[num] = backend;
+        indices[num] = i;
+        num++;
     }
-    int num = active_ro_indices->len;
-    int result = -1;
-    if (num > 0) {
-        result = g_array_index(active_ro_indices, int, (bs->read_count++) % num);
+
+    if (num == 0) {
+        return -1;
     }
-    g_array_free(active_ro_indices, TRUE);
-    return result;
-  }
+
+    return indices[network_backends_balance(candidates, num, bs->read_balance_mode, &(bs->read_count))];
 }
 
 int
@@ -655,15 +775,14 @@ void network_backends_server_version(network_backends_t *bs, GString* version)
         g_string_assign_len(version, b->server_version->str, b->server_version->len);
 }
 
-/* round robin pick */
 network_backend_t *
-network_group_pick_slave_backend(network_group_t *group)
+network_group_pick_slave_backend(network_group_t *group, read_balance_mode_t mode)
 {
+    network_backend_t *candidates[MAX_GROUP_SLAVES];
+    int num = 0;
     int i;
-    network_backend_t *backend = NULL;
     for (i = 0; i < group->nslaves; i++) {
-        size_t index = (group->slave_visit_cnt++) % group->nslaves;
-        backend = group->slaves[index];
+        network_backend_t *backend = group->slaves[i];
         if (backend->state != BACKEND_STATE_UP && backend->state != BACKEND_STATE_UNKNOWN) {
             g_debug(G_STRLOC ": skip dead backend(slave): %d", i);
             continue;
@@ -674,17 +793,19 @@ network_group_pick_slave_backend(network_group_t *group)
         int cur_idle = total - connected_clts;
         int max_idle_conns = backend->config->max_conn_pool;
 
-        g_debug("%s, slave:%d, total:%d, connected:%d, idle:%d, max:%d",
-                G_STRLOC, (int)i, total, connected_clts, cur_idle, max_idle_conns);
+        g_debug("%s, slave:%d, total:%d, connected:%d, idle:%d, max:%d, pending:%d",
+                G_STRLOC, (int)i, total, connected_clts, cur_idle, max_idle_conns, backend->pending_requests);
 
         if (cur_idle || total <= max_idle_conns) {
-            break;
+            candidates[num++] = backend;
         }
     }
-    if (i == group->nslaves) {
-        backend = NULL;
+
+    if (num == 0) {
+        return NULL;
     }
-    return backend;
+
+    return candidates[network_backends_balance(candidates, num, mode, &(group->slave_visit_cnt))];
 }
 
 void
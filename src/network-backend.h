@@ -50,6 +50,13 @@ typedef enum {
     BACKEND_TYPE_RO
 } backend_type_t;
 
+typedef enum {
+    READ_BALANCE_ROUND_ROBIN,
+    READ_BALANCE_LEAST_OUTSTANDING,
+    READ_BALANCE_P2C,               /* power of two random choices */
+    READ_BALANCE_WEIGHTED
+} read_balance_mode_t;
+
 typedef enum {
     BACKEND_OPERATE_SUCCESS,
     BACKEND_OPERATE_NETERR,
@@ -87,20 +94,32 @@ typedef struct {
 
     time_t last_check_time;
     int slave_delay_msec;       /* valid if this is a ReadOnly slave */
+    /* master time(ms) of the last heartbeat applied on the slave, 0 if unknown */
+    guint64 slave_applied_msec;
     int server_weight;
     GString *server_version;
+
+    /* for read balancing */
+    int pending_requests;       /* queries sent and not answered yet */
+    guint64 resp_time_ewma;     /* average response time(us), scaled by 8 */
+    int balance_weight;         /* current weight of smooth weighted round robin */
+
+    guint ndx;                  /* position in network_backends_t.backends */
 } network_backend_t;
 
 NETWORK_API network_backend_t *network_backend_new();
 NETWORK_API void network_backend_free(network_backend_t *b);
 NETWORK_API int network_backend_conns_count(network_backend_t *b);
 NETWORK_API int network_backend_init_extra(network_backend_t *b, chassis *chas);
+NETWORK_API void network_backend_request_begin(network_backend_t *b);
+NETWORK_API void network_backend_request_end(network_backend_t *b, gint64 resp_usec);
 
 typedef struct {
     int is_partition_mode;
     int priority_mode;
     unsigned int ro_server_num;
     unsigned int read_count;
+    read_balance_mode_t read_balance_mode;
     GPtrArray *backends;
 #ifdef HAVE_OPENSSL
     RSA *rsa;
@@ -141,12 +160,16 @@ typedef struct network_group_t {
 
 network_group_t *network_backends_get_group(network_backends_t *, const GString *name);
 
-/* round-robin pick a slave from group */
-network_backend_t *network_group_pick_slave_backend(network_group_t *);
+/* pick a slave from group by read balance mode */
+network_backend_t *network_group_pick_slave_backend(network_group_t *, read_balance_mode_t);
 
 void network_group_get_slave_names(network_group_t *, GString *);
 
 int network_backends_get_ro_ndx(network_backends_t *);
+int network_backends_get_fresh_ro_ndx(network_backends_t *, guint64 min_applied_msec);
+
+NETWORK_API int network_backends_parse_balance_mode(const char *name);
+NETWORK_API const char *network_backends_balance_mode_name(read_balance_mode_t mode);
 
 int network_backends_get_rw_ndx(network_backends_t *);
 
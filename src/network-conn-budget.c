@@ -0,0 +1,435 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include "network-conn-budget.h"
+#include "network-conn-pool.h"
+#include "network-conn-pool-wrap.h"
+#include "network-mysqld-packet.h"
+#include "cetus-process-cycle.h"
+#include "chassis-event.h"
+
+/* seconds between two borrow requests for one backend */
+#define BORROW_INTERVAL 1
+
+static time_t borrow_time[MAX_SERVER_NUM];
+
+/* carried in the admin_sql field of the channel message */
+G_STATIC_ASSERT(sizeof(network_conn_lend_t) <= MAX_ADMIN_SQL_LEN);
+
+static gsize
+network_conn_budget_size(int worker_num)
+{
+    return sizeof(network_conn_budget_t) + sizeof(network_conn_budget_worker_t) * worker_num;
+}
+
+/**
+ * must be created before forking the workers
+ *
+ * @param limit  max connections to each backend from all workers
+ */
+network_conn_budget_t *
+network_conn_budget_new(int limit, int worker_num)
+{
+    network_conn_budget_t *budget = chassis_shm_alloc(network_conn_budget_size(worker_num));
+    if (budget == NULL) {
+        g_critical("%s:connection budget disabled", G_STRLOC);
+        return NULL;
+    }
+    budget->limit = limit;
+    budget->worker_num = worker_num;
+
+    return budget;
+}
+
+void
+network_conn_budget_free(network_conn_budget_t *budget)
+{
+    if (budget) {
+        chassis_shm_free(budget, network_conn_budget_size(budget->worker_num));
+    }
+}
+
+/**
+ * called by a worker when it starts
+ */
+void
+network_conn_budget_attach(network_conn_budget_t *budget, int worker, int slot)
+{
+    if (worker >= budget->worker_num) {
+        return;
+    }
+    network_conn_budget_worker_t *w = &(budget->workers[worker]);
+    w->slot = slot;
+    w->pid = getpid();
+    memset(borrow_time, 0, sizeof(borrow_time));
+}
+
+/**
+ * called by the master when a worker exits, its connections are gone
+ */
+void
+network_conn_budget_detach(network_conn_budget_t *budget, int worker)
+{
+    if (worker >= budget->worker_num) {
+        return;
+    }
+    network_conn_budget_worker_t *w = &(budget->workers[worker]);
+    int i;
+    for (i = 0; i < MAX_SERVER_NUM; i++) {
+        gint owned = __sync_lock_test_and_set(&(w->owned[i]), 0);
+        if (owned) {
+            __sync_fetch_and_sub(&(budget->total[i]), owned);
+        }
+        w->idle[i] = 0;
+        w->incoming[i] = 0;
+    }
+    w->pid = 0;
+    g_message("%s:connection budget of worker:%d returned", G_STRLOC, worker);
+}
+
+static network_conn_budget_worker_t *
+network_conn_budget_self(network_conn_budget_t *budget)
+{
+    if (cetus_worker >= budget->worker_num) {
+        return NULL;
+    }
+    return &(budget->workers[cetus_worker]);
+}
+
+/**
+ * publish the connections this worker really has to @backend
+ */
+void
+network_conn_budget_sync(chassis *srv, network_backend_t *backend)
+{
+    network_conn_budget_t *budget = srv->conn_budget;
+    if (budget == NULL || backend->ndx >= MAX_SERVER_NUM) {
+        return;
+    }
+    network_conn_budget_worker_t *w = network_conn_budget_self(budget);
+    if (w == NULL) {
+        return;
+    }
+
+    guint ndx = backend->ndx;
+    /* lent connections not received yet are already ours */
+    gint count = backend->pool->cur_idle_connections + backend->connected_clients + w->incoming[ndx];
+    gint delta = count - w->owned[ndx];
+    if (delta != 0) {
+        __sync_fetch_and_add(&(w->owned[ndx]), delta);
+        __sync_fetch_and_add(&(budget->total[ndx]), delta);
+    }
+    w->idle[ndx] = backend->pool->cur_idle_connections;
+}
+
+void
+network_conn_budget_sync_all(chassis *srv)
+{
+    if (srv->conn_budget == NULL) {
+        return;
+    }
+
+    network_backends_t *bs = srv->priv->backends;
+    int i;
+    int count = network_backends_count(bs);
+    for (i = 0; i < count; i++) {
+        network_conn_budget_sync(srv, network_backends_get(bs, i));
+    }
+}
+
+/**
+ * reserve room for a new connection to @backend
+ *
+ * @return FALSE if all connections allowed are opened by the workers
+ */
+gboolean
+network_conn_budget_acquire(chassis *srv, network_backend_t *backend)
+{
+    network_conn_budget_t *budget = srv->conn_budget;
+    if (budget == NULL || backend->ndx >= MAX_SERVER_NUM) {
+        return TRUE;
+    }
+    network_conn_budget_worker_t *w = network_conn_budget_self(budget);
+    if (w == NULL) {
+        return TRUE;
+    }
+
+    network_conn_budget_sync(srv, backend);
+
+    guint ndx = backend->ndx;
+    gint total;
+    do {
+        total = budget->total[ndx];
+        if (total >= budget->limit) {
+            g_debug("%s:backend ndx:%u out of connection budget:%d", G_STRLOC, ndx, total);
+            return FALSE;
+        }
+    } while (!__sync_bool_compare_and_swap(&(budget->total[ndx]), total, total + 1));
+
+    /* the new connection is counted by connected_clients from now on */
+    __sync_fetch_and_add(&(w->owned[ndx]), 1);
+    return TRUE;
+}
+
+/**
+ * ask the worker with the most idle connections to @backend for one
+ */
+void
+network_conn_budget_borrow(chassis *srv, network_backend_t *backend, const char *username)
+{
+    network_conn_budget_t *budget = srv->conn_budget;
+    if (budget == NULL || backend->ndx >= MAX_SERVER_NUM) {
+        return;
+    }
+
+    guint ndx = backend->ndx;
+    if (srv->current_time - borrow_time[ndx] < BORROW_INTERVAL) {
+        return;
+    }
+
+    int i, lender = -1;
+    gint max_idle = 1;          /* the lender keeps one at least */
+    for (i = 0; i < budget->worker_num; i++) {
+        network_conn_budget_worker_t *w = &(budget->workers[i]);
+        if (i == cetus_worker || w->pid == 0) {
+            continue;
+        }
+        if (w->idle[ndx] > max_idle) {
+            max_idle = w->idle[ndx];
+            lender = i;
+        }
+    }
+    if (lender == -1) {
+        return;
+    }
+
+    int slot = budget->workers[lender].slot;
+    if (cetus_processes[slot].pid != budget->workers[lender].pid
+        || cetus_processes[slot].parent_child_channel[0] == -1)
+    {
+        return;
+    }
+
+    cetus_channel_t ch;
+    memset(&ch, 0, sizeof(ch));
+    ch.basics.command = CETUS_CMD_LEND_CONN_REQ;
+    ch.basics.pid = cetus_pid;
+    ch.basics.slot = cetus_process_slot;
+    ch.basics.fd = -1;
+
+    network_conn_lend_t req;
+    memset(&req, 0, sizeof(req));
+    req.backend_ndx = ndx;
+    req.worker = cetus_worker;
+    g_strlcpy(req.username, username, sizeof(req.username));
+    memcpy(ch.admin_sql, &req, sizeof(req));
+
+    borrow_time[ndx] = srv->current_time;
+    g_debug("%s:borrow a connection to backend ndx:%u from worker:%d", G_STRLOC, ndx, lender);
+    cetus_write_channel(cetus_processes[slot].parent_child_channel[0], &ch, sizeof(ch));
+}
+
+#define LEND_COPY(dst, src) \
+    do { \
+        if ((src)->len >= sizeof(dst)) return FALSE; \
+        memcpy((dst), (src)->str, (src)->len + 1); \
+    } while (0)
+
+static gboolean
+network_conn_lend_fill(network_conn_lend_t *lend, network_socket *sock)
+{
+    if (sock->ssl || sock->challenge == NULL || sock->response == NULL) {
+        return FALSE;
+    }
+    if (sock->challenge->server_version_str
+        && strlen(sock->challenge->server_version_str) >= sizeof(lend->server_version_str)) {
+        return FALSE;
+    }
+
+    LEND_COPY(lend->username, sock->response->username);
+    LEND_COPY(lend->default_db, sock->default_db);
+    LEND_COPY(lend->charset, sock->charset);
+    LEND_COPY(lend->charset_client, sock->charset_client);
+    LEND_COPY(lend->charset_connection, sock->charset_connection);
+    LEND_COPY(lend->charset_results, sock->charset_results);
+    LEND_COPY(lend->sql_mode, sock->sql_mode);
+    if (sock->challenge->server_version_str) {
+        g_strlcpy(lend->server_version_str, sock->challenge->server_version_str, sizeof(lend->server_version_str));
+    }
+
+    lend->create_time = sock->create_time;
+    lend->thread_id = sock->challenge->thread_id;
+    lend->server_version = sock->challenge->server_version;
+    lend->server_capabilities = sock->challenge->capabilities;
+    lend->client_capabilities = sock->response->client_capabilities;
+    lend->charset_code = sock->charset_code;
+    lend->is_reset_conn_supported = sock->is_reset_conn_supported;
+    lend->is_multi_stmt_set = sock->is_multi_stmt_set;
+    return TRUE;
+}
+
+/**
+ * move one connection from the budget of @from to @to, total is untouched
+ * so the connection is never counted twice or not at all
+ */
+static void
+network_conn_budget_transfer(network_conn_budget_t *budget, int from, int to, guint ndx)
+{
+    if (budget == NULL || from >= budget->worker_num || to < 0 || to >= budget->worker_num) {
+        return;
+    }
+    __sync_fetch_and_sub(&(budget->workers[from].owned[ndx]), 1);
+    __sync_fetch_and_add(&(budget->workers[to].incoming[ndx]), 1);
+    __sync_fetch_and_add(&(budget->workers[to].owned[ndx]), 1);
+}
+
+/**
+ * hand over an idle connection to the worker asking for it
+ */
+void
+network_conn_budget_lend(chassis *srv, cetus_channel_t *req_ch)
+{
+    network_conn_lend_t lend;
+    memcpy(&lend, req_ch->admin_sql, sizeof(lend));
+    lend.username[sizeof(lend.username) - 1] = '\0';
+
+    int slot = req_ch->basics.slot;
+    if (slot < 0 || slot >= CETUS_MAX_PROCESSES
+        || cetus_processes[slot].pid != req_ch->basics.pid
+        || cetus_processes[slot].parent_child_channel[0] == -1)
+    {
+        g_message("%s:borrower at slot:%d is unknown", G_STRLOC, slot);
+        return;
+    }
+
+    network_backend_t *backend = network_backends_get(srv->priv->backends, lend.backend_ndx);
+    if (backend == NULL || backend->state != BACKEND_STATE_UP) {
+        return;
+    }
+
+    GString *username = g_string_new(lend.username);
+    network_socket *sock = network_connection_pool_take(backend->pool, username);
+    g_string_free(username, TRUE);
+    if (sock == NULL) {
+        g_debug("%s:no idle connection to lend for backend ndx:%u", G_STRLOC, lend.backend_ndx);
+        return;
+    }
+
+    cetus_channel_t ch;
+    memset(&ch, 0, sizeof(ch));
+    ch.basics.command = CETUS_CMD_LEND_CONN;
+    ch.basics.pid = cetus_pid;
+    ch.basics.slot = cetus_process_slot;
+    ch.basics.fd = sock->fd;
+
+    if (!network_conn_lend_fill(&lend, sock)) {
+        network_pool_add_idle_conn(backend->pool, srv, sock);
+        return;
+    }
+    memcpy(ch.admin_sql, &lend, sizeof(lend));
+
+    if (cetus_write_channel(cetus_processes[slot].parent_child_channel[0], &ch, sizeof(ch)) != NETWORK_SOCKET_SUCCESS) {
+        network_pool_add_idle_conn(backend->pool, srv, sock);
+        return;
+    }
+
+    g_message("%s:lend connection:%u to backend ndx:%u to worker:%d",
+              G_STRLOC, lend.thread_id, lend.backend_ndx, lend.worker);
+    /* the borrower has its own copy of the fd, close ours without COM_QUIT */
+    network_socket_free(sock);
+    network_conn_budget_transfer(srv->conn_budget, cetus_worker, lend.worker, lend.backend_ndx);
+}
+
+/**
+ * put a connection lent by another worker into the pool
+ */
+void
+network_conn_budget_adopt(chassis *srv, cetus_channel_t *ch)
+{
+    network_conn_lend_t lend;
+    memcpy(&lend, ch->admin_sql, sizeof(lend));
+
+    network_backend_t *backend = network_backends_get(srv->priv->backends, lend.backend_ndx);
+    if (lend.worker != cetus_worker) {
+        g_warning("%s:unexpected lent connection for worker:%d", G_STRLOC, lend.worker);
+        close(ch->basics.fd);
+        return;
+    }
+
+    network_conn_budget_worker_t *w = srv->conn_budget ? network_conn_budget_self(srv->conn_budget) : NULL;
+    if (w && lend.backend_ndx < MAX_SERVER_NUM) {
+        __sync_fetch_and_sub(&(w->incoming[lend.backend_ndx]), 1);
+    }
+
+    if (backend == NULL) {
+        g_warning("%s:unexpected lent connection to backend ndx:%u", G_STRLOC, lend.backend_ndx);
+        close(ch->basics.fd);
+        return;
+    }
+
+    network_socket *sock = network_socket_new();
+    sock->fd = ch->basics.fd;
+    sock->socket_type = SOCK_STREAM;
+    sock->create_time = lend.create_time;
+    network_address_copy(sock->dst, backend->addr);
+
+    network_mysqld_auth_challenge *challenge = network_mysqld_auth_challenge_new();
+    challenge->server_version_str = g_strdup(lend.server_version_str);
+    challenge->server_version = lend.server_version;
+    challenge->thread_id = lend.thread_id;
+    challenge->capabilities = lend.server_capabilities;
+    challenge->charset = lend.charset_code;
+    sock->challenge = challenge;
+
+    network_mysqld_auth_response *auth = network_mysqld_auth_response_new(lend.server_capabilities);
+    auth->client_capabilities = lend.client_capabilities;
+    auth->max_packet_size = 0x01000000;
+    auth->charset = lend.charset_code;
+    g_string_assign(auth->username, lend.username);
+    g_string_assign(auth->database, lend.default_db);
+    sock->response = auth;
+
+    g_string_assign(sock->username, lend.username);
+    g_string_assign(sock->default_db, lend.default_db);
+    g_string_assign(sock->charset, lend.charset);
+    g_string_assign(sock->charset_client, lend.charset_client);
+    g_string_assign(sock->charset_connection, lend.charset_connection);
+    g_string_assign(sock->charset_results, lend.charset_results);
+    g_string_assign(sock->sql_mode, lend.sql_mode);
+    sock->charset_code = lend.charset_code;
+    sock->is_reset_conn_supported = lend.is_reset_conn_supported;
+    sock->is_multi_stmt_set = lend.is_multi_stmt_set;
+    if (srv->is_back_compressed) {
+        sock->do_compress = 1;
+    }
+
+    /* lent out of the budget of the lender, no need to acquire */
+    network_pool_add_idle_conn(backend->pool, srv, sock);
+    network_conn_budget_sync(srv, backend);
+
+    g_message("%s:adopt connection:%u to backend ndx:%u", G_STRLOC, lend.thread_id, lend.backend_ndx);
+}
@@ -0,0 +1,97 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _NETWORK_CONN_BUDGET_H_
+#define _NETWORK_CONN_BUDGET_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+#include "network-backend.h"
+#include "chassis-mainloop.h"
+#include "cetus-channel.h"
+
+/**
+ * Connections to one backend owned by one worker.
+ *
+ * owned is idle + in use + being created + incoming as last synced, idle
+ * is only a hint for choosing a lender.
+ */
+typedef struct {
+    pid_t pid;
+    int slot;                   /* process slot, for the channel */
+    gint owned[MAX_SERVER_NUM];
+    gint idle[MAX_SERVER_NUM];
+    gint incoming[MAX_SERVER_NUM];  /* lent to this worker, not received yet */
+} network_conn_budget_worker_t;
+
+/**
+ * Global per-backend connection budget, shared by all workers.
+ *
+ * A worker reserves room in total[] before it connects, so the number of
+ * connections to a backend never exceeds the limit. Closed connections are
+ * given back lazily when the worker syncs its own count. A worker out of
+ * budget borrows an idle connection from another one, the socket is passed
+ * over the channels with SCM_RIGHTS.
+ */
+typedef struct network_conn_budget_t {
+    int limit;
+    int worker_num;
+    gint total[MAX_SERVER_NUM];
+    network_conn_budget_worker_t workers[0];
+} network_conn_budget_t;
+
+/* state of an idle connection handed over to another worker */
+typedef struct {
+    guint backend_ndx;
+    int worker;                 /* the borrower */
+    time_t create_time;
+    guint32 thread_id;
+    guint32 server_version;
+    guint32 server_capabilities;
+    guint32 client_capabilities;
+    guint8 charset_code;
+    unsigned int is_reset_conn_supported:1;
+    unsigned int is_multi_stmt_set:1;
+    char username[64];
+    char default_db[64];
+    char server_version_str[48];
+    char charset[32];
+    char charset_client[32];
+    char charset_connection[32];
+    char charset_results[32];
+    char sql_mode[128];
+} network_conn_lend_t;
+
+NETWORK_API network_conn_budget_t *network_conn_budget_new(int limit, int worker_num);
+NETWORK_API void network_conn_budget_free(network_conn_budget_t *budget);
+
+NETWORK_API void network_conn_budget_attach(network_conn_budget_t *budget, int worker, int slot);
+NETWORK_API void network_conn_budget_detach(network_conn_budget_t *budget, int worker);
+
+NETWORK_API void network_conn_budget_sync(chassis *srv, network_backend_t *backend);
+NETWORK_API void network_conn_budget_sync_all(chassis *srv);
+NETWORK_API gboolean network_conn_budget_acquire(chassis *srv, network_backend_t *backend);
+
+NETWORK_API void network_conn_budget_borrow(chassis *srv, network_backend_t *backend, const char *username);
+NETWORK_API void network_conn_budget_lend(chassis *srv, cetus_channel_t *req);
+NETWORK_API void network_conn_budget_adopt(chassis *srv, cetus_channel_t *ch);
+
+#endif
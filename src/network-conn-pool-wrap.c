@@ -119,6 +119,159 @@ network_pool_add_idle_conn(network_connection_pool *pool, chassis *srv, network_
     return 0;
 }
 
+typedef struct {
+    network_connection_pool *pool;
+    chassis *srv;
+    network_socket *server;
+    gsize drained;
+} network_pool_drain_t;
+
+static void
+network_pool_drain_over(network_pool_drain_t *drain, int is_reusable)
+{
+    network_socket *server = drain->server;
+
+    if (is_reusable && server->recv_queue_raw->len == 0 && server->recv_queue_uncompress_raw->len == 0) {
+        g_debug("%s: drained %d bytes, server:%p back to pool", G_STRLOC, (int)drain->drained, server);
+        server->is_resp_abandoned = 0;
+        server->is_waiting = 0;
+        network_mysqld_queue_reset(server);
+        network_pool_add_idle_conn(drain->pool, drain->srv, server);
+    } else {
+        g_message("%s: close server:%p after draining %d bytes", G_STRLOC, server, (int)drain->drained);
+        network_socket_free(server);
+        drain->srv->complement_conn_flag = 1;
+    }
+    g_free(drain);
+}
+
+/**
+ * discard the packets already received
+ *
+ * only rows and the final EOF or ERR are left, so the connection is
+ * idle again once one of them is read
+ *
+ * @return TRUE if the drain is over and @drain is freed
+ */
+static gboolean
+network_pool_drain_packets(network_pool_drain_t *drain)
+{
+    network_socket *server = drain->server;
+    chassis *srv = drain->srv;
+
+    if (server->do_compress) {
+        network_mysqld_con_get_uncompressed_packet(srv, server);
+    }
+
+    network_socket_retval_t ret;
+    while ((ret = network_mysqld_con_get_packet(srv, server)) == NETWORK_SOCKET_SUCCESS) {
+        GString *packet = g_queue_pop_tail(server->recv_queue->chunks);
+        guchar pkt_type = (guchar)packet->str[NET_HEADER_SIZE];
+        int is_over = 0;
+        int is_reusable = 0;
+
+        if (pkt_type == MYSQLD_PACKET_ERR) {
+            is_over = 1;
+            is_reusable = 1;
+        } else if (pkt_type == MYSQLD_PACKET_EOF && packet->len == 9) {
+            network_packet p;
+            p.data = packet;
+            p.offset = NET_HEADER_SIZE;
+            network_mysqld_eof_packet_t *eof_packet = network_mysqld_eof_packet_new();
+            is_over = 1;
+            if (!network_mysqld_proto_get_eof_packet(&p, eof_packet)) {
+                /* another resultset follows, not worth parsing */
+                is_reusable = !(eof_packet->server_status & SERVER_MORE_RESULTS_EXISTS);
+            }
+            network_mysqld_eof_packet_free(eof_packet);
+        }
+        g_string_free(packet, TRUE);
+
+        if (is_over) {
+            network_pool_drain_over(drain, is_reusable);
+            return TRUE;
+        }
+    }
+
+    if (ret != NETWORK_SOCKET_WAIT_FOR_EVENT || drain->drained > NETWORK_POOL_DRAIN_MAX_LEN) {
+        network_pool_drain_over(drain, FALSE);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void network_pool_drain_handle(int event_fd, short events, void *user_data);
+
+static void
+network_pool_drain_wait(network_pool_drain_t *drain)
+{
+    network_socket *server = drain->server;
+
+    struct timeval timeout = { NETWORK_POOL_DRAIN_TIMEOUT, 0 };
+    event_set(&(server->event), server->fd, EV_READ, network_pool_drain_handle, drain);
+    chassis_event_add_with_timeout(drain->srv, &(server->event), &timeout);
+}
+
+/**
+ * discard the rest of an abandoned resultset
+ */
+static void
+network_pool_drain_handle(int event_fd, short events, void *user_data)
+{
+    network_pool_drain_t *drain = user_data;
+    network_socket *server = drain->server;
+
+    if (events == EV_TIMEOUT) {
+        g_message("%s: drain timeout for server:%p, fd:%d", G_STRLOC, server, event_fd);
+        network_pool_drain_over(drain, FALSE);
+        return;
+    }
+
+    if (network_socket_to_read(server) != NETWORK_SOCKET_SUCCESS || server->to_read == 0) {
+        network_pool_drain_over(drain, FALSE);
+        return;
+    }
+
+    drain->drained += server->to_read;
+    switch (network_socket_read(server)) {
+    case NETWORK_SOCKET_SUCCESS:
+    case NETWORK_SOCKET_WAIT_FOR_EVENT:
+        break;
+    default:
+        network_pool_drain_over(drain, FALSE);
+        return;
+    }
+
+    if (network_pool_drain_packets(drain)) {
+        return;
+    }
+
+    network_pool_drain_wait(drain);
+}
+
+/**
+ * take over a server whose query was abandoned before its resultset
+ * ended, the connection joins the pool after the rest is drained,
+ * it is closed if the rest is too long or does not arrive in time
+ */
+void
+network_pool_drain_conn(network_connection_pool *pool, chassis *srv, network_socket *server)
+{
+    network_pool_drain_t *drain = g_new0(network_pool_drain_t, 1);
+    drain->pool = pool;
+    drain->srv = srv;
+    drain->server = server;
+
+    /* the rows parsed but not merged are dropped, the end may be buffered */
+    network_queue_clear(server->recv_queue);
+    if (network_pool_drain_packets(drain)) {
+        return;
+    }
+
+    network_pool_drain_wait(drain);
+}
+
 /**
  * move the con->server into connection pool and disconnect the
  * proxy from its backend *only RW-edition
@@ -371,9 +524,7 @@ network_connection_pool_swap(network_mysqld_con *con, int backend_ndx)
      * - username has to match
      */
     int is_robbed = 0;
-    GString empty_name = { "", 0, 0 };
-    GString *name = con->client->response ? con->client->response->username : &empty_name;
-    network_socket *sock = network_connection_pool_get(backend->pool, name, &is_robbed);
+    network_socket *sock = network_connection_pool_get(backend->pool, con->client, &is_robbed);
     if (sock == NULL) {
         if (server_switch_need_add) {
             g_message("%s:retrieve master conn failed, but still hold read server", G_STRLOC);
@@ -390,9 +541,13 @@ network_connection_pool_swap(network_mysqld_con *con, int backend_ndx)
         st->backend_ndx = -1;
         st->backend = NULL;
         con->server = NULL;
+        if (con->retry_serv_cnt >= con->max_retry_serv_cnt) {
+            network_connection_pool_record_wait_failed(backend->pool);
+        }
         return NULL;
     }
     con->rob_other_conn = is_robbed;
+    network_connection_pool_record_wait(backend->pool, con->is_wait_server ? &(con->pool_wait_begin) : NULL);
 
     if (server_switch_need_add) {
         mysqld_con_reserved_connections_add(con, sock, backend_ndx);
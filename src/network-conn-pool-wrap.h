@@ -26,8 +26,13 @@
 
 #include "network-exports.h"
 
+/* an abandoned resultset longer than this is cheaper to close than to drain */
+#define NETWORK_POOL_DRAIN_MAX_LEN (1024 * 1024)
+#define NETWORK_POOL_DRAIN_TIMEOUT 5
+
 NETWORK_API int network_pool_add_conn(network_mysqld_con *con, int is_swap);
 NETWORK_API int network_pool_add_idle_conn(network_connection_pool *pool, chassis *srv, network_socket *server);
+NETWORK_API void network_pool_drain_conn(network_connection_pool *pool, chassis *srv, network_socket *server);
 NETWORK_API network_socket *network_connection_pool_swap(network_mysqld_con *con, int backend_ndx);
 
 #endif
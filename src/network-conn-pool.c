@@ -18,10 +18,13 @@
 
  $%ENDLICENSE%$ */
 
+#include <sys/time.h>
+
 #include <glib.h>
 
 #include "network-conn-pool.h"
 #include "network-mysqld-packet.h"
+#include "network-stmt-cache.h"
 #include "glib-ext.h"
 #include "sys-pedantic.h"
 
@@ -35,6 +38,36 @@
  * - ...  
  */
 
+/* username -> user id, shared by the pools of all backends */
+static GHashTable *pool_user_ids;
+static int pool_user_count;
+
+/**
+ * map @username to a small integer, so that a client resolves its pool
+ * bucket once instead of hashing the name on every checkout
+ *
+ * ids are only assigned when a backend connection of the user is pooled,
+ * backend connections log in as configured users only, so clients with
+ * arbitrary names cannot grow the ids and the bucket arrays
+ *
+ * @return id starting from 1, 0 if @username has none and !@assign
+ */
+int
+network_connection_pool_user_id(GString *username, gboolean assign)
+{
+    if (pool_user_ids == NULL) {
+        pool_user_ids = g_hash_table_new_full(g_hash_table_string_hash,
+                                              g_hash_table_string_equal, g_hash_table_string_free, NULL);
+    }
+
+    int id = GPOINTER_TO_INT(g_hash_table_lookup(pool_user_ids, username));
+    if (id == 0 && assign) {
+        id = ++pool_user_count;
+        g_hash_table_insert(pool_user_ids, g_string_dup(username), GINT_TO_POINTER(id));
+    }
+    return id;
+}
+
 /**
  * create a empty connection pool entry
  *
@@ -46,6 +79,8 @@ network_connection_pool_entry_new(void)
     network_connection_pool_entry *e;
 
     e = g_new0(network_connection_pool_entry, 1);
+    e->link.data = e;
+    e->attr_link.data = e;
 
     return e;
 }
@@ -71,26 +106,65 @@ network_connection_pool_entry_free(network_connection_pool_entry *e, gboolean fr
 }
 
 /**
- * free all pool entries of the queue
+ * free all pool entries of the bucket
  *
  * used as GDestroyFunc in the user-hash of the pool
  *
- * @param q a GQueue to free
- *
  * @see network_connection_pool_new
  * @see GDestroyFunc
  */
 static void
-g_queue_free_all(gpointer q)
+network_connection_pool_bucket_free(gpointer data)
 {
-    GQueue *queue = q;
-    network_connection_pool_entry *entry;
+    network_connection_pool_bucket *bucket = data;
+    GList *link;
+
+    while ((link = g_queue_pop_head_link(&(bucket->conns)))) {
+        network_connection_pool_entry_free(link->data, TRUE);
+    }
+
+    g_hash_table_destroy(bucket->attrs);
+    g_string_free(bucket->username, TRUE);
+    g_free(bucket);
+}
 
-    while ((entry = g_queue_pop_head(queue))) {
-        network_connection_pool_entry_free(entry, TRUE);
+/**
+ * keep pool->robbable in line with the bucket size
+ */
+static void
+network_connection_pool_bucket_update(network_connection_pool *pool, network_connection_pool_bucket *bucket)
+{
+    gboolean robbable = bucket->conns.length > pool->min_idle_connections;
+
+    if (robbable && !bucket->is_robbable) {
+        g_queue_push_tail_link(&(pool->robbable), &(bucket->robbable_link));
+        bucket->is_robbable = 1;
+    } else if (!robbable && bucket->is_robbable) {
+        g_queue_unlink(&(pool->robbable), &(bucket->robbable_link));
+        bucket->is_robbable = 0;
     }
+}
 
-    g_queue_free(queue);
+static network_connection_pool_bucket *
+network_connection_pool_get_bucket(network_connection_pool *pool, GString *username)
+{
+    network_connection_pool_bucket *bucket = g_hash_table_lookup(pool->users, username);
+    if (bucket == NULL) {
+        bucket = g_new0(network_connection_pool_bucket, 1);
+        bucket->username = g_string_dup(username);
+        bucket->user_id = network_connection_pool_user_id(username, TRUE);
+        bucket->robbable_link.data = bucket;
+        g_queue_init(&(bucket->conns));
+        /* the queues only hold intrusive links */
+        bucket->attrs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        g_hash_table_insert(pool->users, bucket->username, bucket);
+
+        if (pool->buckets->len <= bucket->user_id) {
+            g_ptr_array_set_size(pool->buckets, bucket->user_id + 1);
+        }
+        g_ptr_array_index(pool->buckets, bucket->user_id) = bucket;
+    }
+    return bucket;
 }
 
 /**
@@ -107,8 +181,11 @@ network_connection_pool_new(void)
     pool->mid_idle_connections = 10;
     pool->min_idle_connections = 1;
     pool->cur_idle_connections = 0;
+    /* key is owned by the bucket */
     pool->users = g_hash_table_new_full(g_hash_table_string_hash,
-                                        g_hash_table_string_equal, g_hash_table_string_free, g_queue_free_all);
+                                        g_hash_table_string_equal, NULL, network_connection_pool_bucket_free);
+    pool->buckets = g_ptr_array_new();
+    g_queue_init(&(pool->robbable));
 
     return pool;
 }
@@ -123,96 +200,140 @@ network_connection_pool_free(network_connection_pool *pool)
     if (!pool)
         return;
 
-    g_hash_table_foreach_remove(pool->users, g_hash_table_true, NULL);
-
     g_hash_table_destroy(pool->users);
+    g_ptr_array_free(pool->buckets, TRUE);
 
     g_free(pool);
 }
 
-/**
- * find the entry which has more than max_idle connections idling
- * 
- * @return TRUE for the first entry having more than _user_data idling connections
- * @see network_connection_pool_get_conns 
- */
-static gboolean
-find_idle_conns(gpointer UNUSED_PARAM(_key), gpointer _val, gpointer _user_data)
-{
-    guint idle_conns_threshold = *(gint *)_user_data;
-    GQueue *conns = _val;
-
-    g_debug("%s: conns length:%d, idle_conns_threshold:%d", G_STRLOC, conns->length, idle_conns_threshold);
-    return (conns->length > idle_conns_threshold);
-}
-
 GQueue *
 network_connection_pool_get_conns(network_connection_pool *pool, GString *username, int *is_robbed)
 {
-    GQueue *conns = NULL;
+    network_connection_pool_bucket *bucket = NULL;
 
     if (username && username->len > 0) {
-        conns = g_hash_table_lookup(pool->users, username);
-        /**
-         * if we know this use, return a authed connection 
-         */
-        g_debug("%s: get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, conns);
-        if (conns && conns->length > 0) {
-            return conns;
+        bucket = g_hash_table_lookup(pool->users, username);
+        g_debug("%s: get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, bucket);
+        if (bucket && bucket->conns.length > 0) {
+            return &(bucket->conns);
+        }
+    }
+
+    /* any user having more than min_idle waiting */
+    if (pool->robbable.head == NULL) {
+        return NULL;
+    }
+
+    bucket = pool->robbable.head->data;
+    if (is_robbed) {
+        *is_robbed = 1;
+    }
+    return &(bucket->conns);
+}
+
+/**
+ * find the bucket of the client's user, or one to rob a connection from
+ */
+static network_connection_pool_bucket *
+network_connection_pool_find_bucket(network_connection_pool *pool, network_socket *client, int *is_robbed)
+{
+    if (client && client->response && client->response->username->len > 0) {
+        if (client->pool_user_id == 0) {
+            client->pool_user_id = network_connection_pool_user_id(client->response->username, FALSE);
+        }
+        if (client->pool_user_id > 0 && client->pool_user_id < (int)pool->buckets->len) {
+            network_connection_pool_bucket *bucket = g_ptr_array_index(pool->buckets, client->pool_user_id);
+            if (bucket && bucket->conns.length > 0) {
+                return bucket;
+            }
         }
     }
 
     /**
-     * we don't have a entry yet, check the others if we have more than 
+     * we don't have a entry yet, check the others if we have more than
      * min_idle waiting
      */
+    if (pool->robbable.head == NULL) {
+        return NULL;
+    }
 
-    conns = g_hash_table_find(pool->users, find_idle_conns, &(pool->min_idle_connections));
-
-    g_debug("%s: (get_conns) try to find max-idling conns for user '%s' -> %p",
-            G_STRLOC, username ? username->str : "", conns);
-
-    if (conns != NULL && is_robbed) {
+    if (is_robbed) {
         *is_robbed = 1;
     }
+    return pool->robbable.head->data;
+}
+
+/**
+ * fingerprint of the session attributes a connection must share with
+ * the client to serve it without adjusting them first
+ */
+static guint
+network_connection_pool_attr_hash(network_socket *sock)
+{
+    guint hash = g_string_hash(sock->default_db);
+    hash = hash * 31 + g_string_hash(sock->charset);
+    return hash * 31 + sock->is_multi_stmt_set;
+}
+
+static gboolean
+network_connection_pool_attr_equal(network_socket *sock, network_socket *client)
+{
+    return sock->is_multi_stmt_set == client->is_multi_stmt_set &&
+        g_string_equal(sock->default_db, client->default_db) && g_string_equal(sock->charset, client->charset);
+}
 
-    return conns;
+static void
+network_connection_pool_attr_unlink(network_connection_pool_bucket *bucket, network_connection_pool_entry *entry)
+{
+    g_queue_unlink(entry->attr_conns, &(entry->attr_link));
+    if (entry->attr_conns->length == 0) {
+        g_hash_table_remove(bucket->attrs, GUINT_TO_POINTER(entry->attr_hash));
+    }
+    entry->attr_conns = NULL;
 }
 
 /**
- * get a connection from the pool
- *
- * make sure we have at least <min-conns> for each user
- * if we have more, reuse a connect to reauth it to another user
- *
- * @param pool connection pool to get the connection from
- * @param username (optional) name of the auth connection
- * @param default_db (unused) unused name of the default-db
+ * take the latest added connection having the client's session attributes,
+ * or the latest added one if there is none
  */
-network_socket *
-network_connection_pool_get(network_connection_pool *pool, GString *username, int *is_robbed)
+static GList *
+network_connection_pool_pick(network_connection_pool *pool, network_connection_pool_bucket *bucket,
+                             network_socket *client)
 {
-    network_connection_pool_entry *entry = NULL;
-    GQueue *conns = network_connection_pool_get_conns(pool, username, is_robbed);
-
-    if (conns) {
-        if (conns->length > 0) {
-            entry = g_queue_pop_head(conns);
-            g_debug("%s: (get) entry for user '%s' -> %p",
-                    G_STRLOC, username ? username->str : "", entry);
-        } else {
-            g_debug("%s: conns length is zero for user '%s'", G_STRLOC, username ? username->str : "");
-        }
-    } else {
-        g_debug("%s: conns is null for user '%s'", G_STRLOC, username ? username->str : "");
+    if (client == NULL) {
+        return bucket->conns.head;
     }
 
-    if (!entry) {
-        g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
-        return NULL;
+    GQueue *attr_conns = g_hash_table_lookup(bucket->attrs,
+                                             GUINT_TO_POINTER(network_connection_pool_attr_hash(client)));
+    if (attr_conns) {
+        GList *link;
+        for (link = attr_conns->head; link; link = link->next) {
+            network_connection_pool_entry *entry = link->data;
+            if (network_connection_pool_attr_equal(entry->sock, client)) {
+                pool->attr_matched++;
+                return &(entry->link);
+            }
+        }
     }
+
+    pool->attr_mismatched++;
+    return bucket->conns.head;
+}
+
+/**
+ * unlink the connection at @link from its bucket and stop watching it
+ */
+static network_socket *
+network_connection_pool_detach(network_connection_pool *pool, network_connection_pool_bucket *bucket, GList *link)
+{
+    network_connection_pool_entry *entry = link->data;
     network_socket *sock = entry->sock;
 
+    g_queue_unlink(&(bucket->conns), link);
+    network_connection_pool_attr_unlink(bucket, entry);
+    network_connection_pool_bucket_update(pool, bucket);
+
     if (sock->recv_queue->chunks->length > 0) {
         g_warning("%s: server recv queue not empty", G_STRLOC);
     }
@@ -225,19 +346,98 @@ network_connection_pool_get(network_connection_pool *pool, GString *username, in
     /* remove the idle handler from the socket */
     event_del(&(sock->event));
 
-    g_debug("%s: (get) got socket for user '%s' -> %p, charset:%s", G_STRLOC,
-            username ? username->str : "", sock, sock->charset->str);
+    pool->cur_idle_connections--;
+    g_debug("%s: cur_idle_connections sub:%d for sock:%p", G_STRLOC, pool->cur_idle_connections, sock);
 
-    if (sock->is_in_sess_context) {
-        g_message("%s: conn is in sess context for user:'%s'", G_STRLOC, username ? username->str : "");
+    return sock;
+}
+
+/**
+ * get a connection from the pool
+ *
+ * make sure we have at least <min-conns> for each user
+ * if we have more, reuse a connect to reauth it to another user
+ *
+ * @param pool connection pool to get the connection from
+ * @param client (optional) the client socket, giving user, default db and charset
+ */
+network_socket *
+network_connection_pool_get(network_connection_pool *pool, network_socket *client, int *is_robbed)
+{
+    const char *username = (client && client->response) ? client->response->username->str : "";
+    network_connection_pool_bucket *bucket = network_connection_pool_find_bucket(pool, client, is_robbed);
+
+    if (!bucket) {
+        g_debug("%s: (get) no entry for user '%s'", G_STRLOC, username);
+        return NULL;
     }
 
-    pool->cur_idle_connections--;
-    g_debug("%s: cur_idle_connections sub:%d for sock:%p", G_STRLOC, pool->cur_idle_connections, sock);
+    GList *link = network_connection_pool_pick(pool, bucket, client);
+    g_debug("%s: (get) entry for user '%s' -> %p", G_STRLOC, username, link->data);
+
+    network_socket *sock = network_connection_pool_detach(pool, bucket, link);
+
+    g_debug("%s: (get) got socket for user '%s' -> %p, charset:%s", G_STRLOC, username, sock, sock->charset->str);
+
+    if (sock->is_in_sess_context) {
+        g_message("%s: conn is in sess context for user:'%s'", G_STRLOC, username);
+    }
 
     return sock;
 }
 
+/**
+ * the least recently used connection of @bucket without prepared statements,
+ * the borrower could not close them nor reuse them
+ */
+static GList *
+network_connection_pool_lendable(network_connection_pool_bucket *bucket)
+{
+    GList *link;
+    for (link = bucket->conns.tail; link; link = link->prev) {
+        network_connection_pool_entry *entry = link->data;
+        network_stmt_cache_t *cache = entry->sock->stmt_cache;
+        if (cache == NULL || (g_hash_table_size(cache->stmts) == 0 && g_queue_is_empty(&(cache->pending)))) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * take an idle connection to be handed over to another worker
+ *
+ * a bucket is never emptied, @username's bucket must keep one connection
+ * and the others more than min_idle_connections
+ *
+ * @return NULL if none can be spared
+ */
+network_socket *
+network_connection_pool_take(network_connection_pool *pool, GString *username)
+{
+    network_connection_pool_bucket *bucket = NULL;
+    GList *link = NULL;
+
+    if (username && username->len > 0) {
+        bucket = g_hash_table_lookup(pool->users, username);
+        if (bucket && bucket->conns.length >= 2) {
+            link = network_connection_pool_lendable(bucket);
+        }
+    }
+
+    GList *l;
+    for (l = pool->robbable.head; link == NULL && l; l = l->next) {
+        bucket = l->data;
+        link = network_connection_pool_lendable(bucket);
+    }
+
+    if (link == NULL) {
+        return NULL;
+    }
+
+    return network_connection_pool_detach(pool, bucket, link);
+}
+
 /**
  * add a connection to the connection pool
  */
@@ -261,16 +461,19 @@ network_connection_pool_add(network_connection_pool *pool, network_socket *sock)
 
     g_debug("%s: (add) adding socket to pool for user '%s' -> %p", G_STRLOC, sock->response->username->str, sock);
 
-    GQueue *conns = NULL;
-    if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
-        conns = g_queue_new();
-        g_hash_table_insert(pool->users, g_string_dup(sock->response->username), conns);
-    }
+    network_connection_pool_bucket *bucket = network_connection_pool_get_bucket(pool, sock->response->username);
+    entry->bucket = bucket;
 
-    entry->conns = conns;
+    g_queue_push_head_link(&(bucket->conns), &(entry->link));
+    network_connection_pool_bucket_update(pool, bucket);
 
-    g_queue_push_head(conns, entry);
-    entry->link = conns->head;
+    entry->attr_hash = network_connection_pool_attr_hash(sock);
+    entry->attr_conns = g_hash_table_lookup(bucket->attrs, GUINT_TO_POINTER(entry->attr_hash));
+    if (entry->attr_conns == NULL) {
+        entry->attr_conns = g_new0(GQueue, 1);
+        g_hash_table_insert(bucket->attrs, GUINT_TO_POINTER(entry->attr_hash), entry->attr_conns);
+    }
+    g_queue_push_head_link(entry->attr_conns, &(entry->attr_link));
 
     pool->cur_idle_connections++;
     g_debug("%s: add cur_idle_connections:%d for sock:%p", G_STRLOC, pool->cur_idle_connections, sock);
@@ -284,11 +487,46 @@ network_connection_pool_add(network_connection_pool *pool, network_socket *sock)
 void
 network_connection_pool_remove(network_connection_pool_entry *entry)
 {
-    entry->pool->cur_idle_connections--;
-    g_queue_delete_link(entry->conns, entry->link);
+    network_connection_pool *pool = entry->pool;
+
+    pool->cur_idle_connections--;
+    g_queue_unlink(&(entry->bucket->conns), &(entry->link));
+    network_connection_pool_attr_unlink(entry->bucket, entry);
+    network_connection_pool_bucket_update(pool, entry->bucket);
     network_connection_pool_entry_free(entry, TRUE);
 }
 
+/**
+ * count a checkout which waited since @since, NULL if it got a connection
+ * at the first try
+ */
+void
+network_connection_pool_record_wait(network_connection_pool *pool, const struct timeval *since)
+{
+    gint64 wait_usec = 0;
+    if (since) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        wait_usec = (gint64)(now.tv_sec - since->tv_sec) * 1000000 + (now.tv_usec - since->tv_usec);
+    }
+
+    gint64 bound = 1000;
+    int i;
+    for (i = 0; i < POOL_WAIT_BUCKETS - 1 && wait_usec >= bound; i++) {
+        bound *= 10;
+    }
+    pool->wait_hist[i]++;
+}
+
+/**
+ * count a wait which ran out of retries without a connection
+ */
+void
+network_connection_pool_record_wait_failed(network_connection_pool *pool)
+{
+    pool->wait_failed++;
+}
+
 gboolean
 network_conn_pool_do_reduce_conns_verdict(network_connection_pool *pool, int connected_clients)
 {
@@ -309,11 +547,11 @@ network_connection_pool_total_conns_count(network_connection_pool *pool)
     if (users != NULL) {
         GHashTableIter iter;
         GString *key;
-        GQueue *queue;
+        network_connection_pool_bucket *bucket;
         g_hash_table_iter_init(&iter, users);
         /* count all users' pooled connections */
-        while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&queue)) {
-            total += queue->length;
+        while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&bucket)) {
+            total += bucket->conns.length;
         }
     }
 
@@ -26,9 +26,31 @@
 #include "network-socket.h"
 #include "network-exports.h"
 
+/* checkout wait buckets: <1ms, <10ms, <100ms, <1s, >=1s */
+#define POOL_WAIT_BUCKETS 5
+
+/**
+ * idle connections authed as one user
+ */
+typedef struct {
+    GString *username;
+    int user_id;
+    /* network_connection_pool_entry, head is the latest added(LIFO) */
+    GQueue conns;
+    /* guint attribute fingerprint -> GQueue of entries, head is the latest added */
+    GHashTable *attrs;
+    /* link in pool->robbable */
+    GList robbable_link;
+    unsigned int is_robbable:1;
+} network_connection_pool_bucket;
+
 typedef struct {
-    /** GHashTable<GString, GQueue<network_connection_pool_entry>> */
+    /** GHashTable<GString, network_connection_pool_bucket> */
     GHashTable *users;
+    /* network_connection_pool_bucket indexed by user id, may have holes */
+    GPtrArray *buckets;
+    /* buckets having more than min_idle_connections, robbed first-in first */
+    GQueue robbable;
     void *srv;
 
     int cur_idle_connections;
@@ -37,17 +59,30 @@ typedef struct {
     guint mid_idle_connections;
     guint min_idle_connections;
 
+    guint64 wait_hist[POOL_WAIT_BUCKETS];
+    /* waits given up without getting a connection */
+    guint64 wait_failed;
+    /* checkouts getting a connection with the client's db, charset and multi statement option */
+    guint64 attr_matched;
+    guint64 attr_mismatched;
 } network_connection_pool;
 
 typedef struct {
     network_socket *sock;          /** the idling socket */
     network_connection_pool *pool; /** a pointer back to the pool */
-    GQueue *conns;  /** a pointer back to the queue */
-    GList *link;  /** a pointer back to the link */
+    network_connection_pool_bucket *bucket;  /** a pointer back to the bucket */
+    GList link;  /** intrusive link in bucket->conns */
+    GList attr_link;  /** intrusive link in attr_conns */
+    GQueue *attr_conns;  /** entries of the bucket with the same attribute fingerprint */
+    guint attr_hash;
 } network_connection_pool_entry;
 
+NETWORK_API int network_connection_pool_user_id(GString *username, gboolean assign);
+
 NETWORK_API network_socket *network_connection_pool_get(network_connection_pool *pool,
-                                                        GString *username, int *is_robbed);
+                                                        network_socket *client, int *is_robbed);
+
+NETWORK_API network_socket *network_connection_pool_take(network_connection_pool *pool, GString *username);
 
 NETWORK_API network_connection_pool_entry *network_connection_pool_add(network_connection_pool *, network_socket *);
 
@@ -58,5 +93,8 @@ NETWORK_API network_connection_pool *network_connection_pool_new(void);
 NETWORK_API void network_connection_pool_free(network_connection_pool *pool);
 NETWORK_API int network_connection_pool_total_conns_count(network_connection_pool *pool);
 
+NETWORK_API void network_connection_pool_record_wait(network_connection_pool *pool, const struct timeval *since);
+NETWORK_API void network_connection_pool_record_wait_failed(network_connection_pool *pool);
+
 NETWORK_API gboolean network_conn_pool_do_reduce_conns_verdict(network_connection_pool *, int);
 #endif
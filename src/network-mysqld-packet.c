@@ -103,6 +103,7 @@ network_mysqld_proto_get_com_query_result(network_packet *packet,
                 g_debug("%s: server status in ok packet, got: %d", G_STRLOC, ok_packet->server_status);
                 query->warning_count = ok_packet->warnings;
                 query->affected_rows = ok_packet->affected_rows;
+                query->total_affected_rows += ok_packet->affected_rows;
                 query->insert_id = ok_packet->insert_id;
                 query->was_resultset = 0;
                 query->binary_encoded = use_binary_row_data;
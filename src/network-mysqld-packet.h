@@ -69,6 +69,8 @@ typedef struct {
 
     guint64 rows;
     guint64 bytes;
+    /* summed over the results of all groups in sharding */
+    guint64 total_affected_rows;
 
     guint8 query_status;
 } network_mysqld_com_query_result_t;
@@ -63,6 +63,7 @@
 #include "chassis-mainloop.h"
 #include "chassis-event.h"
 #include "cetus-log.h"
+#include "cetus-xa-log.h"
 #include "resultset_merge.h"
 #include "network-conn-pool-wrap.h"
 #include "sharding-query-plan.h"
@@ -76,6 +77,9 @@
 #include "network-ssl.h"
 #include "chassis-sql-log.h"
 #include "cetus-acl.h"
+#include "query-cache.h"
+#include "network-conn-budget.h"
+#include "query-digest.h"
 
 #ifdef HAVE_WRITEV
 #define USE_BUFFERED_NETIO
@@ -113,13 +117,14 @@ char *generate_or_retrieve_xid_str(network_mysqld_con *con, network_socket *serv
         if (need_generate_new) {
             if (server == NULL) {
                 con->xa_id = con->srv->dist_tran_id++;
-                snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu'",
-                        con->srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id);
+                snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu','%s'",
+                        con->srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id, con->srv->dist_tran_token);
                 con->internal_xa_id = 0;
             } else {
                 server->xa_id = con->internal_xa_id++;
-                snprintf(server->xid_str, XID_LEN, "'%s_%02d_%llu@%llu'", 
-                        con->srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id, server->xa_id);
+                snprintf(server->xid_str, XID_LEN, "'%s_%02d_%llu@%llu','%s'",
+                        con->srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id, server->xa_id,
+                        con->srv->dist_tran_token);
             }
         }
 
@@ -131,7 +136,8 @@ char *generate_or_retrieve_xid_str(network_mysqld_con *con, network_socket *serv
     } else {
         if (need_generate_new) {
             con->xa_id = con->srv->dist_tran_id++;
-            snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu'", con->srv->dist_tran_prefix, tc_get_log_hour(), con->xa_id);
+            snprintf(con->xid_str, XID_LEN, "'%s_%02d_%llu','%s'", con->srv->dist_tran_prefix, tc_get_log_hour(),
+                     con->xa_id, con->srv->dist_tran_token);
         }
 
         return con->xid_str;
@@ -279,6 +285,7 @@ network_mysqld_init(chassis *srv)
     srv->priv_shutdown = network_mysqld_priv_shutdown;
     srv->priv_finally_free_shared = network_mysqld_priv_finally_free_shared;
     srv->priv = network_mysqld_priv_init(srv->is_partition_mode);
+    srv->priv->backends->read_balance_mode = srv->read_balance_mode;
 
     cetus_users_read_json(srv->priv->users, srv->config_manager, 0);
 
@@ -383,6 +390,10 @@ cetus_clean_conn_data(network_mysqld_con *con)
         g_free(data->candidates);
     }
 
+    if (data->last_row) {
+        g_string_free(data->last_row, TRUE);
+    }
+
     if (data->recv_queues) {
         g_ptr_array_free(data->recv_queues, TRUE);
     }
@@ -391,6 +402,29 @@ cetus_clean_conn_data(network_mysqld_con *con)
     con->data = NULL;
 }
 
+/**
+ * give back the running slot of the last query, wake up queries admitted in turn
+ */
+static void
+network_mysqld_con_admission_leave(network_mysqld_con *con)
+{
+    if (!con->admission.admitted && !con->admission.queued) {
+        return;
+    }
+
+    GList *owners = query_admission_leave(con->srv->admission, &(con->admission), get_timer_microseconds());
+    GList *l;
+    for (l = owners; l; l = l->next) {
+        network_mysqld_con *waiter = l->data;
+        struct timeval timeout = { 0, 0 };
+        g_debug("%s: wake up con:%p admitted after con:%p", G_STRLOC, waiter, con);
+        CHECK_PENDING_EVENT(&(waiter->client->event));
+        event_set(&(waiter->client->event), waiter->client->fd, EV_TIMEOUT, network_mysqld_con_handle, waiter);
+        chassis_event_add_with_timeout(con->srv, &(waiter->client->event), &timeout);
+    }
+    g_list_free(owners);
+}
+
 /**
  * free a connection 
  *
@@ -428,8 +462,30 @@ network_mysqld_con_free(network_mysqld_con *con)
         g_string_free(con->modified_sql, TRUE);
     }
 
+    if (con->xa_decision_logged) {
+        /* the XA COMMITs may never have been sent */
+        cetus_xa_log_orphan(con->srv->xa_decision_log, con);
+    }
+
     g_string_free(con->orig_sql, TRUE);
 
+    g_strfreev(con->query_cache_tables);
+    if (con->query_cache_dirty_tables) {
+        /* the transaction state is unknown, invalidate anyway */
+        query_cache_flush_dirty_tables(con);
+        g_hash_table_destroy(con->query_cache_dirty_tables);
+    }
+    if (con->query_cache_prepared_tables) {
+        g_hash_table_destroy(con->query_cache_prepared_tables);
+    }
+
+    network_mysqld_con_admission_leave(con);
+
+    if (con->pending_backends) {
+        network_mysqld_con_backend_request_end(con, FALSE);
+        g_array_free(con->pending_backends, TRUE);
+    }
+
     if (con->data) {
         cetus_clean_conn_data(con);
     }
@@ -657,6 +713,7 @@ network_mysqld_con_send_error_full_all(network_socket *con,
 
     network_mysqld_queue_append(con, con->send_queue, S(packet));
     network_mysqld_queue_reset(con);
+    con->err_sent = 1;
 
     network_mysqld_err_packet_free(err_packet);
     g_string_free(packet, TRUE);
@@ -839,7 +896,7 @@ static GString* network_mysqld_get_compressed_packet(network_socket* sock)
 
         if (queue->offset >= s->len) {
             queue->offset -= s->len;
-            g_string_free(s, TRUE);
+            network_socket_release_sent_chunk(sock, s);
             g_queue_delete_link(queue->chunks, chunk);
 
             chunk = queue->chunks->head;
@@ -999,6 +1056,70 @@ disp_err_packet(network_mysqld_con *con, network_packet *packet)
     return;
 }
 
+/**
+ * consume the responses of pipelined attribute adjustments
+ *
+ * each adjustment is answered by a single packet, COM_SET_OPTION
+ * answers with an EOF packet
+ */
+static network_socket_retval_t
+network_mysqld_read_attr_resps(chassis *chas, network_mysqld_con *con, network_socket *server, int *is_finished)
+{
+    if (server->do_compress) {
+        network_mysqld_con_get_uncompressed_packet(chas, server);
+    }
+
+    while (server->attr_resp_pending > 0 && network_mysqld_con_get_packet(chas, server) == NETWORK_SOCKET_SUCCESS) {
+        GString *packet = g_queue_pop_tail(server->recv_queue->chunks);
+        if (packet->len <= NET_HEADER_SIZE || (guchar)packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+            g_message("%s: adjust attribute failed for server:%s, con:%p", G_STRLOC, server->dst->name->str, con);
+            con->resp_err_met = 1;
+        }
+        g_string_free(packet, TRUE);
+        server->attr_resp_pending--;
+        /* the next answer starts a new packet sequence */
+        network_mysqld_queue_reset(server);
+    }
+
+    *is_finished = (server->attr_resp_pending == 0);
+
+    return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * consume the answers of XA START or XA END pipelined ahead of the
+ * statement or the prepare, each is a single OK or ERR packet
+ *
+ * a failed one fails the transaction and its error is kept to answer the
+ * statement, the connection is not reused as its XA state is unknown
+ */
+static void
+network_mysqld_read_xa_resps(chassis *chas, network_mysqld_con *con, network_socket *server)
+{
+    if (server->do_compress) {
+        network_mysqld_con_get_uncompressed_packet(chas, server);
+    }
+
+    while (server->xa_resp_pending > 0 && network_mysqld_con_get_packet(chas, server) == NETWORK_SOCKET_SUCCESS) {
+        GString *packet = g_queue_pop_tail(server->recv_queue->chunks);
+        if (packet->len <= NET_HEADER_SIZE || (guchar)packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+            g_message("%s: pipelined xa command failed for server:%s, xid:%s",
+                      G_STRLOC, server->dst->name->str, con->xid_str);
+            con->dist_tran_failed = 1;
+            con->server_to_be_closed = 1;
+            if (server->xa_resp_err == NULL) {
+                server->xa_resp_err = packet;
+                packet = NULL;
+            }
+        }
+        if (packet) {
+            g_string_free(packet, TRUE);
+        }
+        server->xa_resp_pending--;
+        network_mysqld_queue_reset(server);
+    }
+}
+
 network_socket_retval_t
 network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas,
                                 network_mysqld_con *con, network_socket *server, int *is_finished)
@@ -1032,6 +1153,17 @@ network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas,
     server->is_waiting = 0;
     server->resp_len += to_read;
 
+    if (server->attr_resp_pending > 0) {
+        return network_mysqld_read_attr_resps(chas, con, server, is_finished);
+    }
+
+    if (server->xa_resp_pending > 0) {
+        network_mysqld_read_xa_resps(chas, con, server);
+        if (server->xa_resp_pending > 0) {
+            return NETWORK_SOCKET_WAIT_FOR_EVENT;
+        }
+    }
+
     g_debug("%s: befre checking network_mysqld_process_select_resp, resp len:%d, to read:%d",
             G_STRLOC, (int) server->resp_len, (int) to_read);
     if (con->candidate_fast_streamed && con->num_servers_visited == 1 && (!server->do_compress)) {
@@ -1110,7 +1242,7 @@ network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas,
         server->parse.qs_state = com_query->state;
     }
 
-    if (server->resp_len > con->srv->max_header_size) {
+    if (server->resp_len - server->resp_merged_len > con->srv->max_header_size) {
         server->max_header_size_reached = 1;
         g_debug("%s: reach max header size", G_STRLOC);
     }
@@ -1123,6 +1255,12 @@ network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas,
         g_message("%s: not finished for server:%p, orig server:%p", G_STRLOC, con->server, orig_server);
     }
 
+    if (*is_finished && server->xa_resp_err) {
+        network_queue_clear(server->recv_queue);
+        network_queue_append(server->recv_queue, server->xa_resp_err);
+        server->xa_resp_err = NULL;
+    }
+
     con->server = orig_server;
 
     return ret;
@@ -1571,114 +1709,75 @@ shard_set_autocommit(network_mysqld_con *con)
     return TRUE;
 }
 
-gboolean
-shard_set_multi_stmt_consistant(network_mysqld_con *con)
+static void
+append_set_option_packet(GQueue *chunks, gboolean multi_stmt_set)
 {
-    enum enum_server_command command = con->parse.command;
-
-    if (command == COM_SET_OPTION) {
-        return TRUE;
+    int len = NET_HEADER_SIZE + 12;
+    GString *packet = g_string_sized_new(calculate_alloc_len(len));
+    packet->len = NET_HEADER_SIZE;
+    g_string_append_c(packet, (char)COM_SET_OPTION);
+    if (multi_stmt_set) {
+        g_string_append_c(packet, (char)0);
+    } else {
+        g_string_append_c(packet, (char)1);
     }
+    g_string_append_c(packet, (char)0);
 
-    size_t i;
-    gboolean result = TRUE;
-
-    for (i = 0; i < con->servers->len; i++) {
-        server_session_t *ss = g_ptr_array_index(con->servers, i);
-        if (!ss->participated || ss->attr_consistent) {
-            continue;
-        }
-
-        ss->attr_adjusted_now = 0;
-        if ((ss->attr_diff & ATTR_DIF_SET_OPTION) == 0) {
-            continue;
-        }
-        if (con->client->is_multi_stmt_set != ss->server->is_multi_stmt_set) {
-            int len = NET_HEADER_SIZE + 12;
-            GString *new_packet = g_string_sized_new(calculate_alloc_len(len));
-            new_packet->len = NET_HEADER_SIZE;
-            g_string_append_c(new_packet, (char)COM_SET_OPTION);
-            if (con->client->is_multi_stmt_set) {
-                g_string_append_c(new_packet, (char)0);
-            } else {
-                g_string_append_c(new_packet, (char)1);
-            }
-            g_string_append_c(new_packet, (char)0);
-
-            network_mysqld_proto_set_packet_id(new_packet, 0);
-            network_mysqld_proto_set_packet_len(new_packet, 1 + 1 + 1);
+    network_mysqld_proto_set_packet_id(packet, 0);
+    network_mysqld_proto_set_packet_len(packet, 1 + 1 + 1);
+    g_queue_push_tail(chunks, packet);
+}
 
-            g_queue_push_tail(ss->server->send_queue->chunks, new_packet);
-            g_debug("%s: adjust multi stmt", G_STRLOC);
+static void
+append_set_names_packet(GQueue *chunks, network_socket *client)
+{
+    int len = client->charset->len + NET_HEADER_SIZE + 1 + 16;
+    GString *packet = g_string_sized_new(calculate_alloc_len(len));
+    packet->len = NET_HEADER_SIZE;
+    g_string_append_c(packet, (char)COM_QUERY);
+    char *command = "SET NAMES ";
+    g_string_append(packet, command);
 
-            ss->server->is_multi_stmt_set = con->client->is_multi_stmt_set;
-            ss->attr_adjusted_now = 1;
-            con->resp_expected_num++;
-            result = FALSE;
-        } else {
-            g_warning("%s:set option adjust warning:not consistant", G_STRLOC);
-        }
+    if (strcmp(client->charset->str, "") == 0) {
+        g_warning("%s: client charset is empty:%s", G_STRLOC, client->src->name->str);
+        g_string_append(packet, "''");
+        network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + 2);
+    } else {
+        g_string_append(packet, client->charset->str);
+        network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + client->charset->len);
     }
 
-    return result;
+    network_mysqld_proto_set_packet_id(packet, 0);
+    g_queue_push_tail(chunks, packet);
 }
 
-gboolean
-shard_set_charset_consistant(network_mysqld_con *con)
+static void
+append_init_db_packet(GQueue *chunks, GString *db)
 {
-    size_t i;
-    for (i = 0; i < con->servers->len; i++) {
-        server_session_t *ss = g_ptr_array_index(con->servers, i);
-        if (!ss->participated || ss->attr_consistent) {
-            continue;
-        }
-
-        ss->attr_adjusted_now = 0;
-        if ((ss->attr_diff & ATTR_DIF_CHARSET) == 0) {
-            continue;
-        }
-
-        int len = con->client->charset->len + NET_HEADER_SIZE + 1 + 16;
-        GString *packet = g_string_sized_new(calculate_alloc_len(len));
-        packet->len = NET_HEADER_SIZE;
-        g_string_append_c(packet, (char)COM_QUERY);
-        char *command = "SET NAMES ";
-        g_string_append(packet, command);
-
-        if (strcmp(con->client->charset->str, "") == 0) {
-            g_warning("%s: client charset is empty:%s", G_STRLOC, con->client->src->name->str);
-            g_string_append(packet, "''");
-            network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + 2);
-        } else {
-            g_string_append(packet, con->client->charset->str);
-            network_mysqld_proto_set_packet_len(packet, 1 + strlen(command) + con->client->charset->len);
-        }
-
-        network_mysqld_proto_set_packet_id(packet, 0);
-        g_queue_push_tail(ss->server->send_queue->chunks, packet);
-
-        ss->attr_adjusted_now = 1;
-        g_debug("%s: adjust default charset for server, clt:%s, srv:%s",
-                G_STRLOC, con->client->charset->str, ss->server->charset->str);
-        ss->server->parse.qs_state = PARSE_COM_QUERY_INIT;
-        con->resp_expected_num++;
-
-        g_string_assign(ss->server->charset, con->client->charset->str);
-    }
-    return TRUE;
+    int len = db->len + NET_HEADER_SIZE + 1;
+    GString *packet = g_string_sized_new(calculate_alloc_len(len));
+    packet->len = NET_HEADER_SIZE;
+    g_string_append_c(packet, (char)COM_INIT_DB);
+    g_string_append_len(packet, S(db));
+    network_mysqld_proto_set_packet_len(packet, 1 + db->len);
+    network_mysqld_proto_set_packet_id(packet, 0);
+    g_queue_push_tail(chunks, packet);
 }
 
+/**
+ * queue the default db, charset and multi statement adjustments together
+ *
+ * a server gets all its adjustments in one write and answers each of them
+ * with a single packet, so they cost one round trip however many of them
+ * differ. The server side attributes are taken as set right away, the
+ * connection is closed if any adjustment fails.
+ */
 gboolean
-shard_set_default_db_consistant(network_mysqld_con *con)
+shard_set_attrs_pipelined(network_mysqld_con *con)
 {
     enum enum_server_command command = con->parse.command;
-
-    if (command == COM_INIT_DB) {
-        return TRUE;
-    }
-
+    GString *clt_default_db = con->client->default_db;
     size_t i;
-    gboolean result = TRUE;
 
     for (i = 0; i < con->servers->len; i++) {
         server_session_t *ss = g_ptr_array_index(con->servers, i);
@@ -1686,41 +1785,52 @@ shard_set_default_db_consistant(network_mysqld_con *con)
             continue;
         }
 
-        ss->attr_adjusted_now = 0;
+        network_socket *server = ss->server;
+        GQueue *chunks = server->send_queue->chunks;
 
-        if ((ss->attr_diff & ATTR_DIF_DEFAULT_DB) == 0) {
-            continue;
-        }
+        ss->attr_adjusted_now = 0;
+        server->attr_resp_pending = 0;
 
-        GString *clt_default_db = con->client->default_db;
-        GString *srv_default_db = ss->server->default_db;
-
-        if (clt_default_db && clt_default_db->len > 0) {
-            if (!g_string_equal(clt_default_db, srv_default_db)) {
-                int len = clt_default_db->len + NET_HEADER_SIZE + 1;
-                GString *new_packet = g_string_sized_new(calculate_alloc_len(len));
-                new_packet->len = NET_HEADER_SIZE;
-                g_string_append_c(new_packet, (char)COM_INIT_DB);
-                g_string_append_len(new_packet, S(clt_default_db));
-                network_mysqld_proto_set_packet_len(new_packet, 1 + clt_default_db->len);
-                network_mysqld_proto_set_packet_id(new_packet, 0);
-                g_queue_push_tail(ss->server->send_queue->chunks, new_packet);
-                ss->attr_adjusted_now = 1;
+        if ((ss->attr_diff & ATTR_DIF_DEFAULT_DB) && command != COM_INIT_DB) {
+            if (clt_default_db->len == 0) {
+                g_warning("%s:client default db is empty ", G_STRLOC);
+            } else if (!g_string_equal(clt_default_db, server->default_db)) {
+                append_init_db_packet(chunks, clt_default_db);
                 g_debug("%s: adjust default db for server, clt:%s, srv:%s",
-                        G_STRLOC, clt_default_db->str, srv_default_db->str);
+                        G_STRLOC, clt_default_db->str, server->default_db->str);
+                g_string_assign_len(server->default_db, S(clt_default_db));
+                server->attr_resp_pending++;
+            }
+        }
 
-                con->resp_expected_num++;
+        if (ss->attr_diff & ATTR_DIF_CHARSET) {
+            append_set_names_packet(chunks, con->client);
+            g_debug("%s: adjust default charset for server, clt:%s, srv:%s",
+                    G_STRLOC, con->client->charset->str, server->charset->str);
+            g_string_assign(server->charset, con->client->charset->str);
+            server->attr_resp_pending++;
+        }
 
-                result = FALSE;
-            } else {
-                g_warning("%s:default db adjust warning:not consistant", G_STRLOC);
+        if ((ss->attr_diff & ATTR_DIF_SET_OPTION) && command != COM_SET_OPTION) {
+            if (con->client->is_multi_stmt_set != server->is_multi_stmt_set) {
+                append_set_option_packet(chunks, con->client->is_multi_stmt_set);
+                g_debug("%s: adjust multi stmt", G_STRLOC);
+                server->is_multi_stmt_set = con->client->is_multi_stmt_set;
+                server->attr_resp_pending++;
             }
-        } else {
-            g_warning("%s:client default db is empty ", G_STRLOC);
+        }
+
+        if (server->attr_resp_pending > 0) {
+            server->parse.qs_state = PARSE_COM_QUERY_INIT;
+            ss->attr_adjusted_now = 1;
+            con->resp_expected_num++;
         }
     }
 
-    return result;
+    /* continue with the attribute after the last one adjusted here */
+    con->attr_adj_state = ATTR_DIF_SET_OPTION;
+
+    return con->resp_expected_num == 0;
 }
 
 static session_attr_flags_t
@@ -1760,13 +1870,9 @@ build_attr_statements(network_mysqld_con *con)
 
     switch (con->attr_adj_state) {
     case ATTR_DIF_DEFAULT_DB:
-        shard_set_default_db_consistant(con);
-        break;
     case ATTR_DIF_CHARSET:
-        shard_set_charset_consistant(con);
-        break;
     case ATTR_DIF_SET_OPTION:
-        shard_set_multi_stmt_consistant(con);
+        shard_set_attrs_pipelined(con);
         break;
     case ATTR_DIF_SET_AUTOCOMMIT:
         shard_set_autocommit(con);
@@ -1830,9 +1936,94 @@ shard_build_xa_query(network_mysqld_con *con, server_session_t *ss)
         ss->has_xa_write = 1;
     }
 
+    if (con->lock_read_flag) {
+        ss->has_xa_lock = 1;
+    }
+
     return 0;
 }
 
+void
+shard_count_xa_write_servers(network_mysqld_con *con)
+{
+    int iter;
+
+    con->write_server_num = 0;
+    for (iter = 0; iter < con->servers->len; iter++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, iter);
+        if (ss->has_xa_write) {
+            con->write_server_num++;
+        }
+    }
+}
+
+static void
+append_xa_command(network_socket *server, const char *command)
+{
+    GString *srv_packet;
+
+    srv_packet = g_string_sized_new(64);
+    srv_packet->len = NET_HEADER_SIZE;
+    g_string_append_c(srv_packet, (char)COM_QUERY);
+    g_string_append(srv_packet, command);
+    network_mysqld_proto_set_packet_len(srv_packet, 1 + strlen(command));
+    network_mysqld_proto_set_packet_id(srv_packet, 0);
+
+    g_queue_push_tail(server->send_queue->chunks, srv_packet);
+}
+
+/**
+ * a participant is prepared only if it has to be: a lone writer commits
+ * in one phase, and so does a participant of a two phase commit which
+ * neither wrote nor locked rows, it has nothing to make durable
+ */
+static void
+build_xa_prepare(network_mysqld_con *con, server_session_t *ss, const char *xid_str, char *buffer)
+{
+    if (con->servers->len == 1 || con->write_server_num <= 1 ||
+            (con->srv->is_partition_mode && (!con->partition_dist_tran)))
+    {
+        snprintf(buffer, XA_CMD_BUF_LEN, "XA COMMIT %s ONE PHASE", xid_str);
+        ss->dist_tran_state = NEXT_ST_XA_CANDIDATE_OVER;
+        con->dist_tran_decided = 1;
+    } else if (!ss->has_xa_write && !ss->has_xa_lock && !con->srv->is_partition_mode) {
+        snprintf(buffer, XA_CMD_BUF_LEN, "XA COMMIT %s ONE PHASE", xid_str);
+        ss->dist_tran_state = NEXT_ST_XA_CANDIDATE_OVER;
+        ss->xa_committed_early = 1;
+    } else {
+        snprintf(buffer, XA_CMD_BUF_LEN, "XA PREPARE %s", xid_str);
+        ss->dist_tran_state = NEXT_ST_XA_COMMIT;
+    }
+}
+
+/* the state of the transaction as seen from a participant */
+static network_mysqld_con_dist_tran_state_t
+ss_dist_tran_state(server_session_t *ss)
+{
+    return ss->xa_committed_early ? NEXT_ST_XA_COMMIT : ss->dist_tran_state;
+}
+
+/**
+ * queue the prepare of a participant right behind its XA END, the
+ * answer of XA END is dropped when reading
+ *
+ * @return the state of the transaction after this round
+ */
+network_mysqld_con_dist_tran_state_t
+shard_build_xa_prepare_after_end(network_mysqld_con *con, server_session_t *ss)
+{
+    char buffer[XA_CMD_BUF_LEN];
+
+    char *xid_str = generate_or_retrieve_xid_str(con, ss->server, 0);
+    build_xa_prepare(con, ss, xid_str, buffer);
+    append_xa_command(ss->server, buffer);
+    ss->server->xa_resp_pending++;
+
+    g_debug("%s:%s pipelined after XA END, server:%s", G_STRLOC, buffer, ss->server->dst->name->str);
+
+    return ss_dist_tran_state(ss);
+}
+
 static void
 build_xa_command(network_mysqld_con *con, server_session_t *ss, int end, char *buffer_log)
 {
@@ -1842,28 +2033,26 @@ build_xa_command(network_mysqld_con *con, server_session_t *ss, int end, char *b
     switch (ss->dist_tran_state) {
     case NEXT_ST_XA_END:
         snprintf(buffer, XA_CMD_BUF_LEN, "XA END %s", xid_str);
+        g_debug("%s:XA END %s, server:%s", G_STRLOC, xid_str, ss->server->dst->name->str);
         if (con->dist_tran_failed) {
             ss->dist_tran_state = NEXT_ST_XA_ROLLBACK;
             con->is_commit_or_rollback = 1;
             g_debug("%s: set is_commit_or_rollback when xa end", G_STRLOC);
         } else {
-            ss->dist_tran_state = NEXT_ST_XA_PREPARE;
+            /* the prepare goes in the same write, the answer of XA END is dropped when reading */
+            if (!ss->server->unavailable) {
+                append_xa_command(ss->server, buffer);
+                ss->server->xa_resp_pending++;
+            }
+            build_xa_prepare(con, ss, xid_str, buffer);
+            con->xa_end_pipelined = 1;
+            if (buffer_log) {
+                strcpy(buffer_log, buffer);
+            }
         }
-
-        g_debug("%s:XA END %s, server:%s", G_STRLOC, xid_str, ss->server->dst->name->str);
-
         break;
     case NEXT_ST_XA_PREPARE:
-        if (con->servers->len == 1 || con->write_server_num <= 1 ||
-                (con->srv->is_partition_mode && (!con->partition_dist_tran)))
-        {
-            snprintf(buffer, XA_CMD_BUF_LEN, "XA COMMIT %s ONE PHASE", xid_str);
-            ss->dist_tran_state = NEXT_ST_XA_CANDIDATE_OVER;
-            con->dist_tran_decided = 1;
-        } else {
-            snprintf(buffer, XA_CMD_BUF_LEN, "XA PREPARE %s", xid_str);
-            ss->dist_tran_state = NEXT_ST_XA_COMMIT;
-        }
+        build_xa_prepare(con, ss, xid_str, buffer);
         if (buffer_log) {
             strcpy(buffer_log, buffer);
         }
@@ -1879,6 +2068,9 @@ build_xa_command(network_mysqld_con *con, server_session_t *ss, int end, char *b
             }
         }
         con->dist_tran_decided = 1;
+        if (con->srv->xa_decision_log_path) {
+            con->xa_decision_to_log = 1;
+        }
         break;
     case NEXT_ST_XA_ROLLBACK:
         snprintf(buffer, XA_CMD_BUF_LEN, "XA ROLLBACK %s", xid_str);
@@ -1899,6 +2091,15 @@ build_xa_command(network_mysqld_con *con, server_session_t *ss, int end, char *b
         if (end) {
             con->dist_tran_state = NEXT_ST_XA_OVER;
             g_debug("%s: set dist_tran_state NEXT_ST_XA_OVER for con:%p", G_STRLOC, con);
+            if (con->xa_decision_logged) {
+                if (con->dist_tran_failed) {
+                    /* a failed XA COMMIT leaves the decision to the recovery */
+                    cetus_xa_log_orphan(con->srv->xa_decision_log, con);
+                } else {
+                    cetus_xa_log_done(con->srv->xa_decision_log, con->xid_str);
+                }
+                con->xa_decision_logged = 0;
+            }
             if (con->is_start_tran_command) {
                 con->is_auto_commit = 1;
                 con->is_start_tran_command = 0;
@@ -1913,7 +2114,7 @@ build_xa_command(network_mysqld_con *con, server_session_t *ss, int end, char *b
 
     if (end) {
         g_debug("%s: set con dist_tran_state:%d", G_STRLOC, ss->dist_tran_state);
-        con->dist_tran_state = ss->dist_tran_state;
+        con->dist_tran_state = ss_dist_tran_state(ss);
         con->state = ST_SEND_QUERY;
     }
 
@@ -1925,16 +2126,7 @@ build_xa_command(network_mysqld_con *con, server_session_t *ss, int end, char *b
 
     ss->server->parse.qs_state = PARSE_COM_QUERY_INIT;
 
-    GString *srv_packet;
-
-    srv_packet = g_string_sized_new(64);
-    srv_packet->len = NET_HEADER_SIZE;
-    g_string_append_c(srv_packet, (char)COM_QUERY);
-    g_string_append(srv_packet, buffer);
-    network_mysqld_proto_set_packet_len(srv_packet, 1 + strlen(buffer));
-    network_mysqld_proto_set_packet_id(srv_packet, 0);
-
-    g_queue_push_tail(ss->server->send_queue->chunks, srv_packet);
+    append_xa_command(ss->server, buffer);
 
     ss->state = NET_RW_STATE_NONE;
 
@@ -2016,6 +2208,7 @@ disp_xa_according_state(network_mysqld_con *con, server_session_t *ss,
         }
     } else {
         switch (ss->dist_tran_state) {
+        case NEXT_ST_XA_END:
         case NEXT_ST_XA_PREPARE:
         case NEXT_ST_XA_COMMIT:
         case NEXT_ST_XA_ROLLBACK:
@@ -2053,6 +2246,7 @@ build_xa_statements(network_mysqld_con *con)
 
     con->resp_expected_num = 0;
     con->xa_start_phase = 0;
+    con->xa_end_pipelined = 0;
 
     int iter;
     int end = 0, workers = 0;
@@ -2062,13 +2256,12 @@ build_xa_statements(network_mysqld_con *con)
     char buffer[XA_BUF_LEN] = { 0 };
     char *p_buffer = buffer;
 
-    con->write_server_num = 0;
+    shard_count_xa_write_servers(con);
 
-    for (iter = 0; iter < len; iter++) {
-        server_session_t *ss = g_ptr_array_index(con->servers, iter);
-        if (ss->has_xa_write) {
-            con->write_server_num++;
-        }
+    /* participants committed early drop out, the round ends with the last one left */
+    int last = len - 1;
+    while (last > 0 && ((server_session_t *)g_ptr_array_index(con->servers, last))->xa_committed_early) {
+        last--;
     }
 
     for (iter = 0; iter < len; iter++) {
@@ -2084,6 +2277,16 @@ build_xa_statements(network_mysqld_con *con)
             continue;
         }
 
+        if (ss->xa_committed_early) {
+            g_debug("%s: read-only server:%d committed along with the prepare", G_STRLOC, iter);
+            ss->xa_committed_early = 0;
+            ss->dist_tran_state = NEXT_ST_XA_OVER;
+            ss->is_xa_over = 1;
+            ss->dist_tran_participated = 0;
+            ss->participated = 0;
+            continue;
+        }
+
         if (ss->server->unavailable) {
             g_message("%s: server unavailable and stop processing here:%d", G_STRLOC, iter);
             continue;
@@ -2091,7 +2294,7 @@ build_xa_statements(network_mysqld_con *con)
 
         workers++;
 
-        if ((iter + 1) == len) {
+        if (iter == last) {
             end = 1;
         }
 
@@ -2137,7 +2340,7 @@ build_xa_statements(network_mysqld_con *con)
             }
         }
 
-        global_xa_state = ss->dist_tran_state;
+        global_xa_state = ss_dist_tran_state(ss);
     }
 
     if (workers == 0) {
@@ -2384,21 +2587,115 @@ void log_slowquery(int interval_ms, char* ip, char* domain, char* user, char* sq
           "SET timestamp=%ld;\n%s;\n", time_str, user, user, domain == NULL? " ":domain, ip == NULL? " ":ip, interval, t.tv_sec, sql);
 }
 
+/**
+ * only the backends of this query tracked the result, a query answered
+ * by the proxy itself has no rows
+ */
+static void
+handle_query_digest_stats(network_mysqld_con *con, guint64 usec)
+{
+    guint fanout = con->pending_backends ? con->pending_backends->len : 0;
+    guint64 rows = 0;
+    if (fanout > 0 && con->parse.command == COM_QUERY && con->parse.data) {
+        network_mysqld_com_query_result_t *com_query = con->parse.data;
+        rows = com_query->rows + com_query->total_affected_rows;
+    }
+    gboolean is_err = con->client->err_sent || con->resp_err_met;
+
+    query_digest_record(con->srv->query_digest, con->digest, usec, rows,
+                        con->client->query_sent_bytes, is_err, fanout);
+}
+
 static void
 handle_query_time_stats(network_mysqld_con *con)
 {
-    int diff = (con->resp_send_time.tv_sec - con->req_recv_time.tv_sec) * 1000;
-    diff += (con->resp_send_time.tv_usec - con->req_recv_time.tv_usec) / 1000;
+    gint64 usec = (gint64)(con->resp_send_time.tv_sec - con->req_recv_time.tv_sec) * 1000000;
+    usec += con->resp_send_time.tv_usec - con->req_recv_time.tv_usec;
+    usec = MAX(0, usec);
 
-    diff = MAX(0, diff);
+    int diff = usec / 1000;
     if (diff >= con->srv->long_query_time) {
         gchar **ip = g_strsplit_set(con->client->src->name->str, ":", -1);
         log_slowquery(diff, ip[0], NULL,
                       con->client->response->username->str, con->orig_sql->str);
         g_strfreev(ip);
-        diff = con->srv->long_query_time - 1;
     }
-    con->srv->query_stats.query_time_table[diff]++;
+    stats_histogram_record(&(con->srv->query_stats->query_time), usec);
+
+    if (con->digest && con->srv->query_digest) {
+        handle_query_digest_stats(con, usec);
+    }
+}
+
+void
+network_mysqld_con_backend_request_begin(network_mysqld_con *con, network_backend_t *backend)
+{
+    if (con->pending_backends == NULL) {
+        con->pending_backends = g_array_sized_new(FALSE, FALSE, sizeof(backend_request_t), 4);
+    }
+    network_backend_request_begin(backend);
+
+    backend_request_t req = { backend, get_timer_microseconds(), 0 };
+    g_array_append_val(con->pending_backends, req);
+}
+
+/* the response time of a backend counts from its own begin */
+static void
+network_mysqld_con_backend_request_finish(network_mysqld_con *con, backend_request_t *req, gboolean is_answered)
+{
+    network_backend_t *backend = req->backend;
+    gint64 resp_usec = -1;
+    if (is_answered) {
+        resp_usec = MAX((gint64)(get_timer_microseconds() - req->ts_begin), 0);
+    }
+
+    network_backend_request_end(backend, resp_usec);
+    if (resp_usec >= 0 && backend->ndx < MAX_RESP_TIME_SERVER_NUM) {
+        stats_histogram_record(&(con->srv->query_stats->server_resp_time[backend->ndx]), resp_usec);
+    }
+    req->is_done = 1;
+}
+
+/**
+ * @backend has answered the current query, or its response is given up
+ */
+void
+network_mysqld_con_backend_request_done(network_mysqld_con *con, network_backend_t *backend, gboolean is_answered)
+{
+    if (con->pending_backends == NULL) {
+        return;
+    }
+
+    guint i;
+    for (i = 0; i < con->pending_backends->len; i++) {
+        backend_request_t *req = &g_array_index(con->pending_backends, backend_request_t, i);
+        if (req->backend == backend && !req->is_done) {
+            network_mysqld_con_backend_request_finish(con, req, is_answered);
+            return;
+        }
+    }
+}
+
+/**
+ * the current query is over, the backends not done yet are released
+ *
+ * @param is_answered FALSE if the query is abandoned
+ */
+void
+network_mysqld_con_backend_request_end(network_mysqld_con *con, gboolean is_answered)
+{
+    if (con->pending_backends == NULL || con->pending_backends->len == 0) {
+        return;
+    }
+
+    guint i;
+    for (i = 0; i < con->pending_backends->len; i++) {
+        backend_request_t *req = &g_array_index(con->pending_backends, backend_request_t, i);
+        if (!req->is_done) {
+            network_mysqld_con_backend_request_finish(con, req, is_answered);
+        }
+    }
+    g_array_set_size(con->pending_backends, 0);
 }
 
 static void
@@ -2407,15 +2704,15 @@ handle_query_wait_stats(network_mysqld_con *con)
     struct timeval cur;
     gettimeofday(&cur, NULL);
 
-    int diff = (cur.tv_sec - con->req_recv_time.tv_sec) * 1000;
-    diff += (cur.tv_usec - con->req_recv_time.tv_usec) / 1000;
+    gint64 usec = (gint64)(cur.tv_sec - con->req_recv_time.tv_sec) * 1000000;
+    usec += cur.tv_usec - con->req_recv_time.tv_usec;
 
-    if (diff < 0 || diff >= MAX_WAIT_TIME) {
-        g_message("%s: query waits too long:%d for con:%p", G_STRLOC, diff, con);
-        diff = MAX_WAIT_TIME - 1;
+    if (usec < 0 || usec >= MAX_WAIT_TIME * 1000) {
+        g_message("%s: query waits too long:%d ms for con:%p", G_STRLOC, (int)(usec / 1000), con);
+        usec = MAX(0, usec);
     }
 
-    con->srv->query_stats.query_wait_table[diff]++;
+    stats_histogram_record(&(con->srv->query_stats->query_wait), usec);
 }
 
 static void
@@ -2470,6 +2767,72 @@ process_service_unavailable(network_mysqld_con *con)
     network_mysqld_queue_reset(con->client);
 }
 
+/**
+ * take a running slot of the worker for the query just read
+ *
+ * queries of an open transaction already hold their backends and are
+ * never held back
+ */
+static gboolean
+process_query_admission(network_mysqld_con *con, int *disp_flag)
+{
+    query_admission_t *adm = con->srv->admission;
+    guint64 now = get_timer_microseconds();
+    admission_result_t result;
+
+    if (con->is_wait_admission) {
+        con->is_wait_admission = 0;
+        result = query_admission_poll(adm, &(con->admission), now);
+    } else {
+        if (!query_admission_enabled(adm) || con->is_admin_client || con->is_in_transaction) {
+            return TRUE;
+        }
+        GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+        if (packet == NULL || packet->len <= NET_HEADER_SIZE) {
+            return TRUE;
+        }
+        guchar command = packet->str[NET_HEADER_SIZE];
+        if (command != COM_QUERY && command != COM_STMT_EXECUTE) {
+            return TRUE;
+        }
+        con->admission.link.data = con;
+        result = query_admission_enter(adm, &(con->admission), con->client->response->username->str,
+                                       con->client->default_db->str, now);
+    }
+
+    switch (result) {
+    case ADMISSION_OK:
+        return TRUE;
+    case ADMISSION_QUEUED: {
+        guint64 left = con->admission.deadline_usec - now;
+        struct timeval timeout = { left / 1000000, left % 1000000 };
+        con->is_wait_admission = 1;
+        g_debug("%s: query queued for con:%p, %d ms left", G_STRLOC, con, (int)(left / 1000));
+        WAIT_FOR_EVENT(con->client, EV_TIMEOUT, &timeout);
+        *disp_flag = DISP_STOP;
+        return FALSE;
+    }
+    default:
+        break;
+    }
+
+    g_message("%s: too many running queries for user:%s, db:%s, queued:%d, con:%p", G_STRLOC,
+              con->client->response->username->str, con->client->default_db->str,
+              result == ADMISSION_TIMEOUT, con);
+    if (result == ADMISSION_TIMEOUT) {
+        network_mysqld_con_send_error_full(con->client, C("query queue timeout, too many running queries"),
+                                           ER_CETUS_TOO_MANY_QUERIES, "HY000");
+    } else {
+        network_mysqld_con_send_error_full(con->client, C("query queue is full, too many running queries"),
+                                           ER_CETUS_TOO_MANY_QUERIES, "HY000");
+    }
+    network_queue_clear(con->client->recv_queue);
+    network_mysqld_queue_reset(con->client);
+    con->state = ST_SEND_QUERY_RESULT;
+    *disp_flag = DISP_CONTINUE;
+    return FALSE;
+}
+
 static int
 handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
 {
@@ -2481,6 +2844,10 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
     recv_sock = con->client;
 
     recv_sock->total_output = 0;
+    recv_sock->query_sent_bytes = 0;
+    recv_sock->err_sent = 0;
+    con->resp_err_met = 0;
+    con->digest = NULL;
 
     recv_sock->compressed_packet_id = 0;
     recv_sock->do_strict_compress = 0;
@@ -2488,11 +2855,17 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
     con->client->do_query_cache = 0;
     con->client->query_cache_too_long = 0;
     con->query_cache_judged = 0;
+    g_strfreev(con->query_cache_tables);
+    con->query_cache_tables = NULL;
+    network_mysqld_con_backend_request_end(con, FALSE);
     con->is_read_ro_server_allowed = 0;
 
     gettimeofday(&(con->req_recv_time), NULL);
 
-    if (!con->is_wait_server) {
+    if (!con->is_wait_server && !con->is_wait_admission) {
+        /* the last query is done */
+        network_mysqld_con_admission_leave(con);
+
         do {
             switch (network_mysqld_read(srv, recv_sock)) {
             case NETWORK_SOCKET_SUCCESS:
@@ -2550,6 +2923,13 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
         g_debug("%s:wait server.", G_STRLOC);
     }
 
+    if (!con->is_wait_server) {
+        int disp_flag = DISP_CONTINUE;
+        if (!process_query_admission(con, &disp_flag)) {
+            return disp_flag;
+        }
+    }
+
     con->resp_too_long = 0;
 
     /* check for tracing some problems and it will be removed later */
@@ -2575,8 +2955,12 @@ handle_read_query(network_mysqld_con *con, network_mysqld_con_state_t ostate)
             if (con->retry_serv_cnt % 8 == 0) {
                 network_connection_pool_create_conn(con);
             }
+            if (!con->is_wait_server) {
+                gettimeofday(&(con->pool_wait_begin), NULL);
+            }
             con->retry_serv_cnt++;
             con->is_wait_server = 1;
+            query_admission_note_shortage(srv->admission, get_timer_microseconds());
             timeout = network_mysqld_con_retry_timeout(con);
 
             g_debug(G_STRLOC ": wait again:%d, con:%p, l:%d", con->retry_serv_cnt, con, (int)timeout.tv_usec);
@@ -2687,6 +3071,7 @@ process_shard_write(network_mysqld_con *con, int *disp_flag)
         ss->fresh = 0;
         ss->server->compressed_packet_id = 0xFF;
         ss->server->resp_len = 0;
+        ss->server->resp_merged_len = 0;
         ss->server->is_read_finished = 0;
         ss->server->is_waiting = 0;
 
@@ -2727,6 +3112,34 @@ process_shard_write(network_mysqld_con *con, int *disp_flag)
     return 1;
 }
 
+/**
+ * COM_STMT_CLOSE and COM_STMT_SEND_LONG_DATA get no response, they may be
+ * queued ahead of the command whose response is read
+ */
+static GString *
+network_mysqld_first_command_packet(GQueue *chunks)
+{
+    GList *chunk = chunks->head;
+
+    while (chunk && chunk->next) {
+        GString *s = chunk->data;
+        if (s->len <= NET_HEADER_SIZE) {
+            break;
+        }
+        guint8 command = s->str[NET_HEADER_SIZE];
+        if (command != COM_STMT_CLOSE && command != COM_STMT_SEND_LONG_DATA) {
+            break;
+        }
+        /* skip the rest of a payload split into several packets */
+        while (chunk->next && network_mysqld_proto_get_packet_len(chunk->data) == PACKET_LEN_MAX) {
+            chunk = chunk->next;
+        }
+        chunk = chunk->next;
+    }
+
+    return chunk ? chunk->data : g_queue_peek_head(chunks);
+}
+
 static int
 process_rw_write(network_mysqld_con *con, network_mysqld_con_state_t ostate, int *disp_flag)
 {
@@ -2745,7 +3158,7 @@ process_rw_write(network_mysqld_con *con, network_mysqld_con_state_t ostate, int
             /* only parse the packets once */
             network_packet packet;
             GQueue *chunks = con->server->send_queue->chunks;
-            packet.data = g_queue_peek_head(chunks);
+            packet.data = network_mysqld_first_command_packet(chunks);
             packet.offset = 0;
 
             if (network_mysqld_con_command_states_init(con, &packet)) {
@@ -2836,11 +3249,60 @@ process_rw_write(network_mysqld_con *con, network_mysqld_con_state_t ostate, int
     return 1;
 }
 
+#ifndef SIMPLE_PARSER
+/**
+ * a recovery could not tell the prepared branches were committed,
+ * turn the queued XA COMMITs into XA ROLLBACKs
+ */
+static void
+xa_commit_to_rollback(network_mysqld_con *con)
+{
+    g_critical("%s: xa decision of %s is not durable, roll back", G_STRLOC, con->xid_str);
+
+    guint i;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        GList *l;
+        for (l = ss->server->send_queue->chunks->head; l; l = l->next) {
+            GString *packet = l->data;
+            gsize cmd_len = sizeof("XA COMMIT ") - 1;
+            if (packet->len <= NET_HEADER_SIZE + 1 + cmd_len
+                || strncmp(packet->str + NET_HEADER_SIZE + 1, "XA COMMIT ", cmd_len) != 0)
+            {
+                continue;
+            }
+            g_string_erase(packet, NET_HEADER_SIZE + 1, cmd_len);
+            g_string_insert(packet, NET_HEADER_SIZE + 1, "XA ROLLBACK ");
+            network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+        }
+    }
+
+    /* the client is told the transaction failed */
+    con->dist_tran_failed = 1;
+    con->is_commit_or_rollback = 1;
+}
+#endif
+
 static int
 handle_send_query_to_servers(network_mysqld_con *con, network_mysqld_con_state_t ostate)
 {
     int disp_flag = 0;
 
+#ifndef SIMPLE_PARSER
+    if (con->xa_decision_to_log) {
+        con->xa_decision_to_log = 0;
+        /* XA COMMIT is sent once the decision is durable, the log resumes us */
+        if (cetus_xa_log_commit(con->srv->xa_decision_log, con)) {
+            g_debug("%s: wait for xa decision of con:%p", G_STRLOC, con);
+            return DISP_STOP;
+        }
+    }
+    if (con->xa_decision_lost) {
+        con->xa_decision_lost = 0;
+        xa_commit_to_rollback(con);
+    }
+#endif
+
     con->analysis_next_pos = 0;
     con->cur_resp_len = 0;
     con->eof_met_cnt = 0;
@@ -2849,6 +3311,7 @@ handle_send_query_to_servers(network_mysqld_con *con, network_mysqld_con_state_t
     con->fast_stream_need_more = 0;
     con->partically_record_left_cnt = 0;
     con->resp_err_met = 0;
+    con->splice_streamed = 0;
 
     /* 
      * send the query to the server
@@ -2925,6 +3388,7 @@ shard_read_response(network_mysqld_con *con, server_session_t *ss)
             ss->state = NET_RW_STATE_FINISHED;
             ss->server->is_read_finished = 1;
             ss->server->is_waiting = 0;
+            network_mysqld_con_backend_request_done(con, ss->backend, TRUE);
             if (con->srv->sql_mgr && (con->srv->sql_mgr->sql_log_switch == ON || con->srv->sql_mgr->sql_log_switch == REALTIME)) {
                 ss->ts_read_query_result_last = get_timer_microseconds();
                 network_mysqld_com_query_result_t *query = con->parse.data;
@@ -3006,7 +3470,8 @@ handle_dist_tran_after_read_mul_resp(network_mysqld_con *con, int *result_reserv
         g_debug("%s: call before, con dist tan state:%d for con:%p", G_STRLOC, con->dist_tran_state, con);
         build_xa_statements(con);
         g_debug("%s: call after, con dist tan state:%d for con:%p", G_STRLOC, con->dist_tran_state, con);
-        if (con->dist_tran_state != NEXT_ST_XA_PREPARE) {
+        /* the result of the statement is kept for the client while XA END and the prepare go out */
+        if (!con->xa_end_pipelined) {
             if (con->state == ST_SEND_QUERY) {
                 g_debug("%s: visit here", G_STRLOC);
                 if (con->dist_tran_failed && con->dist_tran_state == NEXT_ST_XA_ROLLBACK) {
@@ -3663,43 +4128,45 @@ send_result_to_client(network_mysqld_con *con, network_mysqld_con_state_t ostate
     gettimeofday(&(con->resp_send_time), NULL);
     handle_query_time_stats(con);
 
+    network_mysqld_con_backend_request_end(con, TRUE);
+
+    /* a write in transaction is visible once the transaction ends */
+    if (con->last_record_updated || con->is_write_uncommitted) {
+        con->last_write_msec = (guint64)con->resp_send_time.tv_sec * 1000 + con->resp_send_time.tv_usec / 1000;
+        con->is_write_uncommitted = con->is_in_transaction;
+    }
+
     if (con->client->do_query_cache) {
         if (con->client->query_cache_too_long) {
             network_queue_free(con->client->cache_queue);
             con->client->cache_queue = NULL;
         } else {
-            GString *key = g_string_new(NULL);
-            g_string_append(key, con->orig_sql->str);
-            g_string_append(key, con->client->response->username->str);
-            g_string_append(key, con->client->default_db->str);
-            g_message("%s:key for cache:%s", G_STRLOC, key->str);
-            gchar *md5_key = g_compute_checksum_for_string(G_CHECKSUM_MD5, S(key));
-            g_string_free(key, TRUE);
-
-            query_cache_item *item = g_hash_table_lookup(srv->query_cache_table, md5_key);
-            if (item) {
-                g_warning("%s:key for cache exists:%s", G_STRLOC, md5_key);
-                g_hash_table_remove(srv->query_cache_table, md5_key);
-                network_queue_free(con->client->cache_queue);
-                g_free(md5_key);
+            const char *user = con->client->response->username->str;
+            const char *db = con->client->default_db->str;
+            guint64 hash = query_cache_hash_key(S(con->orig_sql), user, db);
+            unsigned long long access_ms;
+            access_ms = con->resp_send_time.tv_sec * 1000 + con->resp_send_time.tv_usec / 1000;
+
+            network_queue *cache_queue = con->client->cache_queue;
+            gchar **tables = con->query_cache_tables;
+            con->query_cache_tables = NULL;
+            if (query_cache_insert(srv->query_cache, hash, S(con->orig_sql), user, db, cache_queue->chunks,
+                                   cache_queue->len, access_ms + srv->default_query_cache_timeout,
+                                   tables, con->query_cache_version)) {
+                g_debug("%s:put content to cache:%s", G_STRLOC, con->orig_sql->str);
             } else {
-                g_debug("%s:put content to cache:%s", G_STRLOC, md5_key);
-                item = g_new0(query_cache_item, 1);
-                g_hash_table_insert(srv->query_cache_table, md5_key, item);
-                gchar *dup_key = g_strdup(md5_key);
-                query_cache_index_item *index = g_new0(query_cache_index_item, 1);
-                index->key = dup_key;
-                unsigned long long access_ms;
-                access_ms = con->resp_send_time.tv_sec * 1000 + con->resp_send_time.tv_usec / 1000;
-                index->expire_ms = access_ms + srv->default_query_cache_timeout;
-                g_queue_push_tail(srv->cache_index, index);
-
-                item->queue = con->client->cache_queue;
+                g_debug("%s:content is not cached:%s", G_STRLOC, con->orig_sql->str);
             }
+            /* packets not taken by the cache are freed here */
+            network_queue_free(cache_queue);
             con->client->cache_queue = NULL;
         }
     }
 
+    if (!con->is_in_transaction) {
+        query_cache_flush_dirty_tables(con);
+    }
+
     con->client->update_time = srv->current_time;
     if (!con->is_admin_client && !con->client->is_server_conn_reserved) {
         con->client->is_need_q_peek_exec = 1;
@@ -4002,6 +4469,31 @@ fast_analyze_stream(network_mysqld_con *con, network_socket *server, int *send_f
 }
 
 
+#ifdef SIMPLE_PARSER
+static void
+fast_stream_resp_finished(network_mysqld_con *con)
+{
+    con->state = ST_SEND_QUERY_RESULT;
+    if (con->is_calc_found_rows) {
+        con->client->is_server_conn_reserved = 1;
+        g_debug("%s: set is_server_conn_reserved true for con:%p", G_STRLOC, con);
+    } else {
+        if (!con->is_prepared && !con->is_in_sess_context && !con->last_warning_met) {
+            con->client->is_server_conn_reserved = 0;
+            g_debug("%s: set is_server_conn_reserved false", G_STRLOC);
+        } else {
+            con->client->is_server_conn_reserved = 1;
+            g_debug("%s: set is_server_conn_reserved true", G_STRLOC);
+        }
+    }
+
+    proxy_plugin_con_t *st = con->plugin_con_state;
+    network_injection_queue_reset(st->injected.queries);
+    network_queue_clear(con->client->recv_queue);
+    network_mysqld_queue_reset(con->client);
+}
+#endif
+
 static network_socket_retval_t
 network_mysqld_process_select_resp(network_mysqld_con *con, network_socket *server, int *finish_flag, int *disp_flag)
 {
@@ -4042,24 +4534,7 @@ network_mysqld_process_select_resp(network_mysqld_con *con, network_socket *serv
                     server->recv_queue_raw->chunks->length, con);
         }
 
-        con->state = ST_SEND_QUERY_RESULT;
-        if (con->is_calc_found_rows) {
-            con->client->is_server_conn_reserved = 1;
-            g_debug("%s: set is_server_conn_reserved true for con:%p", G_STRLOC, con);
-        } else {
-            if (!con->is_prepared && !con->is_in_sess_context && !con->last_warning_met) {
-                con->client->is_server_conn_reserved = 0;
-                g_debug("%s: set is_server_conn_reserved false", G_STRLOC);
-            } else {
-                con->client->is_server_conn_reserved = 1;
-                g_debug("%s: set is_server_conn_reserved true", G_STRLOC);
-            }
-        }
-
-        proxy_plugin_con_t *st = con->plugin_con_state;
-        network_injection_queue_reset(st->injected.queries);
-        network_queue_clear(con->client->recv_queue);
-        network_mysqld_queue_reset(con->client);
+        fast_stream_resp_finished(con);
         if (disp_flag) {
             *disp_flag = DISP_CONTINUE;
         }
@@ -4096,6 +4571,132 @@ network_mysqld_process_select_resp(network_mysqld_con *con, network_socket *serv
     return NETWORK_SOCKET_SUCCESS;
 }
 
+#ifdef SIMPLE_PARSER
+#define SPLICE_PEEK_LEN 16384
+
+/**
+ * check if the response could be spliced to the client
+ *
+ * spliced bytes are never seen by cetus, so compression, ssl and
+ * query cache capture all stay on the buffered path
+ */
+static gboolean
+splice_stream_allowed(network_mysqld_con *con, network_socket *server)
+{
+    network_socket *client = con->client;
+
+    if (!con->srv->splice_stream_enabled || con->resultset_is_needed || !con->candidate_fast_streamed) {
+        return FALSE;
+    }
+
+    if (server->do_compress || client->do_compress || server->ssl || client->ssl || client->do_query_cache) {
+        return FALSE;
+    }
+
+    /* nothing of the response is buffered yet */
+    return server->resp_len == 0 && g_queue_is_empty(server->recv_queue_raw->chunks)
+        && g_queue_is_empty(server->recv_queue->chunks) && g_queue_is_empty(client->send_queue->chunks);
+}
+
+/**
+ * forward the response of @server to the client with splice()
+ *
+ * only packet headers are peeked to find the end of the resultset.
+ * con->cur_resp_len counts the bytes forwarded and con->analysis_next_pos
+ * is the end of the packets whose header is known. A header cut by the
+ * end of the socket buffer is kept in con->last_payload.
+ */
+static int
+network_mysqld_splice_resp(network_mysqld_con *con, network_socket *server)
+{
+    network_socket *client = con->client;
+    unsigned char buf[ANALYSIS_PACKET_LEN + SPLICE_PEEK_LEN];
+
+    for (;;) {
+        if (client->splice_pending > 0 || con->analysis_next_pos > con->cur_resp_len) {
+            gsize moved = 0;
+            network_socket_retval_t ret = network_socket_splice(server, client,
+                                                                con->analysis_next_pos - con->cur_resp_len, &moved);
+            con->cur_resp_len += moved;
+            server->resp_len += moved;
+
+            switch (ret) {
+            case NETWORK_SOCKET_SUCCESS:
+                continue;
+            case NETWORK_SOCKET_WAIT_FOR_EVENT:
+                if (client->splice_pending > 0) {
+                    WAIT_FOR_EVENT(con->client, EV_WRITE, &(con->write_timeout));
+                } else {
+                    WAIT_FOR_EVENT(server, EV_READ, &(con->read_timeout));
+                }
+                return DISP_STOP;
+            default:
+                g_message("%s: splice response failed for con:%p, forwarded:%llu", G_STRLOC, con,
+                          (unsigned long long)con->cur_resp_len);
+                con->prev_state = con->state;
+                con->state = ST_ERROR;
+                return DISP_CONTINUE;
+            }
+        }
+
+        if (con->eof_met_cnt > 1) {
+            g_debug("%s: spliced %llu bytes for con:%p", G_STRLOC, (unsigned long long)con->cur_resp_len, con);
+            fast_stream_resp_finished(con);
+            return DISP_CONTINUE;
+        }
+
+        gsize kept = con->last_payload_len;
+        memcpy(buf, con->last_payload, kept);
+
+        gssize len = recv(server->fd, buf + kept, SPLICE_PEEK_LEN, MSG_PEEK);
+        if (len <= 0) {
+            if (len == -1 && errno != EAGAIN && errno != E_NET_WOULDBLOCK && errno != ECONNRESET) {
+                g_message("%s: recv() failed: %s (errno=%d)", G_STRLOC, g_strerror(errno), errno);
+                con->prev_state = con->state;
+                con->state = ST_ERROR;
+                return DISP_CONTINUE;
+            }
+            /* a closed connection is left to the ioctl() */
+            WAIT_FOR_EVENT(server, EV_READ, &(con->read_timeout));
+            return DISP_STOP;
+        }
+
+        gsize avail = kept + len;
+        gsize pos = 0;
+        while (pos + NET_HEADER_SIZE <= avail) {
+            guint32 packet_len = buf[pos] | (buf[pos + 1] << 8) | (buf[pos + 2] << 16);
+            /* the payload of a continued packet starts with row data */
+            if (packet_len > 0 && !con->splice_long_packet) {
+                if (pos + NET_HEADER_SIZE == avail) {
+                    break;
+                }
+                guchar type = buf[pos + NET_HEADER_SIZE];
+                if (type == MYSQLD_PACKET_EOF && packet_len < 9) {
+                    con->eof_met_cnt++;
+                } else if (type == MYSQLD_PACKET_ERR) {
+                    con->eof_met_cnt += 2;
+                }
+            }
+            con->splice_long_packet = (packet_len == PACKET_LEN_MAX);
+            client->last_packet_id = buf[pos + NET_HEADER_SIZE - 1];
+            pos += NET_HEADER_SIZE + packet_len;
+            if (con->eof_met_cnt > 1) {
+                break;
+            }
+        }
+
+        if (pos >= avail || con->eof_met_cnt > 1) {
+            con->last_payload_len = 0;
+        } else {
+            /* forward the cut header as well, it is parsed again from the copy */
+            con->last_payload_len = avail - pos;
+            memcpy(con->last_payload, buf + pos, avail - pos);
+            pos = avail;
+        }
+        con->analysis_next_pos = con->cur_resp_len - kept + pos;
+    }
+}
+#endif
 
 network_socket_retval_t
 network_mysqld_read_rw_resp(network_mysqld_con *con, network_socket *server, int *disp_flag)
@@ -4203,6 +4804,19 @@ normal_read_query_result(network_mysqld_con *con, network_mysqld_con_state_t ost
             }
         }
 
+#ifdef SIMPLE_PARSER
+        if (!con->splice_streamed && recv_sock->to_read > 0 && splice_stream_allowed(con, recv_sock)) {
+            g_debug("%s: splice the response for con:%p", G_STRLOC, con);
+            con->splice_streamed = 1;
+            con->splice_long_packet = 0;
+            con->last_payload_len = 0;
+        }
+
+        if (con->splice_streamed) {
+            return network_mysqld_splice_resp(con, recv_sock);
+        }
+#endif
+
         int disp_flag = 0;
         switch (network_mysqld_read_rw_resp(con, recv_sock, &disp_flag)) {
         case NETWORK_SOCKET_SUCCESS:
@@ -4646,7 +5260,11 @@ network_mysqld_con_handle(int event_fd, short events, void *user_data)
             case NETWORK_SOCKET_WAIT_FOR_EVENT:
                 if (con->retry_serv_cnt < con->max_retry_serv_cnt) {
                     con->master_conn_shortaged = 1;
+                    if (!con->is_wait_server) {
+                        gettimeofday(&(con->pool_wait_begin), NULL);
+                    }
                     con->is_wait_server = 1;
+                    query_admission_note_shortage(srv->admission, get_timer_microseconds());
                     if (con->retry_serv_cnt % 8 == 0) {
                         network_connection_pool_create_conn(con);
                     }
@@ -5814,6 +6432,11 @@ network_connection_pool_create_conn(network_mysqld_con *con)
                 }
             }
 
+            if (!network_conn_budget_acquire(srv, backend)) {
+                network_conn_budget_borrow(srv, backend, username);
+                continue;
+            }
+
             server_connection_state_t *scs = network_mysqld_self_con_init(srv);
 
             g_message("%s: create %s connection for backend ndx:%d, ptr:%p", G_STRLOC, username, i, backend);
@@ -5879,10 +6502,16 @@ network_connection_pool_create_conn(network_mysqld_con *con)
 }
 
 
-void
+/**
+ * start creating connections for backends below mid_conn_pool
+ *
+ * @return number of up backends which still need more connections
+ */
+int
 network_connection_pool_create_conns(chassis *srv)
 {
     int i, j;
+    int warming = 0;
     chassis_private *g = srv->priv;
 
     int backends_count = network_backends_count(g->backends);
@@ -5901,8 +6530,11 @@ network_connection_pool_create_conns(chassis *srv)
 
             allowd_conn_num = allowd_conn_num - total;
 
+            /* more to create on next check */
+            gboolean is_warming = FALSE;
             if (allowd_conn_num > srv->connections_created_per_time) {
                 allowd_conn_num = srv->connections_created_per_time;
+                is_warming = (backend->state == BACKEND_STATE_UP);
             }
 
             if (allowd_conn_num > 0) {
@@ -5910,6 +6542,10 @@ network_connection_pool_create_conns(chassis *srv)
             }
 
             for (j = 0; j < allowd_conn_num; j++) {
+                if (!network_conn_budget_acquire(srv, backend)) {
+                    is_warming = FALSE;
+                    break;
+                }
                 server_connection_state_t *scs = network_mysqld_self_con_init(srv);
                 if (srv->disable_dns_cache)
                     network_address_set_address(scs->server->dst, backend->address->str);
@@ -5971,12 +6607,18 @@ network_connection_pool_create_conns(chassis *srv)
                 }
 
                 if (create_err) {
+                    is_warming = FALSE;
                     break;
                 }
             }
+
+            if (is_warming) {
+                warming++;
+            }
         }
     }
 
+    return warming;
 }
 
 void
@@ -6022,11 +6664,11 @@ close_old_server_connetions(chassis *chas)
             if (users != NULL) {
                 GHashTableIter iter;
                 GString *key;
-                GQueue *queue;
+                network_connection_pool_bucket *bucket;
                 g_hash_table_iter_init(&iter, users);
-                /* count all users' pooled connections */
-                while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&queue)) {
-                    g_queue_foreach(queue, check_old_server_connection, chas);
+                /* close all users' pooled connections */
+                while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&bucket)) {
+                    g_queue_foreach(&(bucket->conns), check_old_server_connection, chas);
                 }
             }
         }
@@ -6044,13 +6686,17 @@ check_and_create_conns_func(int fd, short what, void *arg)
         chas->is_need_to_create_conns = 1;
     }
 
+    /* give back the budget of closed connections */
+    network_conn_budget_sync_all(chas);
+
+    int warming = 0;
     if (!chas->maintain_close_mode) {
         if (chas->is_need_to_create_conns) {
             chas->is_need_to_create_conns = 0;
-            network_connection_pool_create_conns(chas);
+            warming = network_connection_pool_create_conns(chas);
         } else {
             if (chas->complement_conn_flag) {
-                network_connection_pool_create_conns(chas);
+                warming = network_connection_pool_create_conns(chas);
                 chas->complement_conn_flag = 0;
             }
         }
@@ -6085,7 +6731,13 @@ check_and_create_conns_func(int fd, short what, void *arg)
     }
 #endif
     g_debug("%s: check_and_create_conns_func", G_STRLOC);
-    struct timeval check_interval = {10, 0};
+    struct timeval check_interval = {POOL_CHECK_INTERVAL_SEC, 0};
+    if (warming) {
+        /* keep filling pools of backends just up, instead of waiting in queries */
+        chas->complement_conn_flag = 1;
+        check_interval.tv_sec = 0;
+        check_interval.tv_usec = POOL_WARMING_INTERVAL_USEC;
+    }
     chassis_event_add_with_timeout(chas, &chas->auto_create_conns_event, &check_interval);
 }
 
@@ -51,6 +51,7 @@
 #include "sys-pedantic.h"
 #include "network-backend.h"
 #include "cetus-error.h"
+#include "query-admission.h"
 
 #define ANALYSIS_PACKET_LEN 5
 #define RECORD_PACKET_LEN 11
@@ -331,6 +332,7 @@ typedef struct merge_parameters_s {
     int off_pos;
     int is_pack_err;
     int aggr_output_len;
+    GString *last_row;          /* copy of the last row merged, for DISTINCT */
 
 } merge_parameters_t;
 
@@ -385,16 +387,8 @@ typedef struct mysqld_query_attr_t {
     unsigned int conn_reserved:1;
 } mysqld_query_attr_t;
 
-typedef struct query_cache_index_item {
-    gchar *key;
-    unsigned long long expire_ms;
-} query_cache_index_item;
-
-typedef struct query_cache_item {
-    network_queue *queue;
-} query_cache_item;
-
 struct query_queue_t;
+struct sql_digest_t;
 
 enum {
     AUTH_SWITCH = 3, /* for now, value not equal to 0 or 0xff is fine */
@@ -404,6 +398,13 @@ enum {
  */
 NETWORK_API const char *network_mysqld_con_st_name(network_mysqld_con_state_t state);
 
+/* a backend the current query is sent to, for read balancing */
+typedef struct {
+    network_backend_t *backend;
+    guint64 ts_begin;
+    unsigned int is_done:1;     /* response read, or given up */
+} backend_request_t;
+
 /**
  * Encapsulates the state and callback functions for a MySQL protocol-based 
  * connection to and from cetus.
@@ -524,6 +525,7 @@ struct network_mysqld_con {
     mysqld_query_attr_t query_attr;
 
     unsigned int is_wait_server:1;  /* first connect to backend failed, retrying */
+    unsigned int is_wait_admission:1;   /* query queued for a running slot */
     unsigned int is_calc_found_rows:1;
     unsigned int is_auto_commit:1;
     unsigned int is_start_tran_command:1;
@@ -546,6 +548,8 @@ struct network_mysqld_con {
     unsigned int process_through_special_tunnel:1;
     unsigned int candidate_tcp_streamed:1;
     unsigned int candidate_fast_streamed:1;
+    unsigned int splice_streamed:1;
+    unsigned int splice_long_packet:1;
     unsigned int is_new_server_added:1;
     unsigned int is_attr_adjust:1;
     unsigned int sql_modified:1;
@@ -574,10 +578,20 @@ struct network_mysqld_con {
     unsigned int xa_query_status_error_and_abort:1;
     unsigned int use_all_prev_servers:1;
     unsigned int partially_merged:1;
+    unsigned int resp_cut_off:1;
     unsigned int last_record_updated:1;
+    unsigned int is_write_uncommitted:1;
     unsigned int query_cache_judged:1;
     unsigned int is_client_compressed:1;
     unsigned int write_flag:1;
+    unsigned int lock_read_flag:1;
+    unsigned int xa_end_pipelined:1;
+    /* the commit decision goes to the xa decision log before XA COMMIT */
+    unsigned int xa_decision_to_log:1;
+    unsigned int xa_decision_waiting:1;
+    unsigned int xa_decision_logged:1;
+    /* the decision could not be made durable, the branches are rolled back */
+    unsigned int xa_decision_lost:1;
     unsigned int is_processed_by_subordinate:1;
     unsigned int is_admin_client:1;
     unsigned int is_admin_waiting_resp:1;
@@ -631,6 +645,8 @@ struct network_mysqld_con {
     unsigned char last_payload[ANALYSIS_PACKET_LEN];
     unsigned char record_last_payload[RECORD_PACKET_LEN];
     struct timeval req_recv_time;
+    /* first failed backend checkout of the waiting request */
+    struct timeval pool_wait_begin;
     struct timeval resp_recv_time;
     struct timeval resp_send_time;
 
@@ -639,6 +655,29 @@ struct network_mysqld_con {
     guint64 analysis_next_pos;
     guint64 cur_resp_len;
 
+    /* tables read by the current cacheable query, "db.table" */
+    gchar **query_cache_tables;
+    /* query cache version when the current query was sent */
+    guint64 query_cache_version;
+    /* tables written and not yet committed, "*" stands for all tables */
+    GHashTable *query_cache_dirty_tables;
+    /* tables written by prepared statements of this connection */
+    GHashTable *query_cache_prepared_tables;
+
+    /* backend_request_t of the current query, for read balancing */
+    GArray *pending_backends;
+
+    /* running slot of the current query, see query-admission.h */
+    admission_ticket_t admission;
+
+    /* fingerprint of the current query, owned by the parser context */
+    struct sql_digest_t *digest;
+
+    /* time(ms) the last write of this session became visible on master */
+    guint64 last_write_msec;
+    /* staleness bound of slave reads set by the session, 0 if none */
+    int max_replica_lag_msec;
+
     /**
      * An integer indicating the result received from a server 
      * after sending an authentication request.
@@ -706,6 +745,9 @@ typedef struct server_session_t {
     unsigned int fresh:1;
     unsigned int participated:1;
     unsigned int has_xa_write:1;
+    unsigned int has_xa_lock:1;
+    /* read-only, committed in one phase while the writers are prepared */
+    unsigned int xa_committed_early:1;
     unsigned int xa_start_already_sent:1;
     unsigned int dist_tran_participated:1;
     unsigned int xa_query_status_error_and_abort:1;
@@ -744,6 +786,14 @@ typedef struct {
     int trx_read_write;         /* default TF_READ_WRITE */
     int trx_isolation_level;    /* default TF_REPEATABLE_READ */
 
+    /* rw-only, multiplexed prepared statements, client stmt id -> struct proxy_stmt_t */
+    GHashTable *stmts;
+    guint32 last_stmt_id;
+    /* statement of the current command */
+    struct proxy_stmt_t *stmt;
+    /* statements with an open cursor, the server connection is kept meanwhile */
+    int stmt_cursors;
+
 } proxy_plugin_con_t;
 
 NETWORK_API network_mysqld_con *network_mysqld_con_new(void);
@@ -771,6 +821,7 @@ NETWORK_API void network_mysqld_con_reset_query_state(network_mysqld_con *con);
 NETWORK_API network_socket_retval_t network_mysqld_read(chassis *srv, network_socket *con);
 NETWORK_API network_socket_retval_t network_mysqld_write(network_socket *con);
 NETWORK_API network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED *chas, network_socket *con);
+NETWORK_API network_socket_retval_t network_mysqld_con_get_uncompressed_packet(chassis *chas, network_socket *con);
 
 struct chassis_private {
     GPtrArray *cons;                          /**< array(network_mysqld_con) */
@@ -788,6 +839,10 @@ NETWORK_API network_socket_retval_t
 network_mysqld_read_mul_packets(chassis G_GNUC_UNUSED *chas, network_mysqld_con *con,
                                 network_socket *server, int *is_finished);
 
+NETWORK_API void network_mysqld_con_backend_request_begin(network_mysqld_con *con, network_backend_t *backend);
+NETWORK_API void network_mysqld_con_backend_request_done(network_mysqld_con *con, network_backend_t *backend,
+                                                         gboolean is_answered);
+NETWORK_API void network_mysqld_con_backend_request_end(network_mysqld_con *con, gboolean is_answered);
 NETWORK_API void send_part_content_to_client(network_mysqld_con *con);
 NETWORK_API void set_conn_attr(network_mysqld_con *con, network_socket *server);
 NETWORK_API int network_mysqld_init(chassis *srv);
@@ -801,16 +856,21 @@ NETWORK_API void network_mysqld_con_clear_xa_env_when_not_expected(network_mysql
 
 NETWORK_API void network_connection_pool_create_conn_and_kill_query(network_mysqld_con *con);
 NETWORK_API void network_connection_pool_create_conn(network_mysqld_con *con);
-NETWORK_API void network_connection_pool_create_conns(chassis *srv);
+/* seconds between pool checks, and usec between them while pools are warming up */
+#define POOL_CHECK_INTERVAL_SEC 1
+#define POOL_WARMING_INTERVAL_USEC (100 * 1000)
+
+NETWORK_API int network_connection_pool_create_conns(chassis *srv);
 NETWORK_API void check_and_create_conns_func(int fd, short what, void *arg);
 NETWORK_API void update_time_func(int fd, short what, void *arg);
 NETWORK_API char *generate_or_retrieve_xid_str(network_mysqld_con *con, network_socket *server, int need_generate_new);
 
 NETWORK_API void record_xa_log_for_mending(network_mysqld_con *con, network_socket *sock);
 NETWORK_API gboolean shard_set_autocommit(network_mysqld_con *con);
-NETWORK_API gboolean shard_set_charset_consistant(network_mysqld_con *con);
-NETWORK_API gboolean shard_set_default_db_consistant(network_mysqld_con *con);
-NETWORK_API gboolean shard_set_multi_stmt_consistant(network_mysqld_con *con);
+NETWORK_API gboolean shard_set_attrs_pipelined(network_mysqld_con *con);
 NETWORK_API int shard_build_xa_query(network_mysqld_con *con, server_session_t *ss);
+NETWORK_API void shard_count_xa_write_servers(network_mysqld_con *con);
+NETWORK_API network_mysqld_con_dist_tran_state_t shard_build_xa_prepare_after_end(network_mysqld_con *con,
+                                                                                  server_session_t *ss);
 
 #endif
@@ -26,6 +26,44 @@
 #include "network-queue.h"
 #include "network-mysqld-proto.h"
 
+static GString *chunk_pool[NETWORK_QUEUE_CHUNK_POOL_MAX];
+static int chunk_pool_len;
+
+/**
+ * get an empty buffer for @len bytes
+ *
+ * small buffers come from the pool, so that reading a socket does not
+ * cost an allocation
+ */
+GString *
+network_queue_chunk_new(gsize len)
+{
+    if (len >= NETWORK_QUEUE_CHUNK_SIZE) {
+        return g_string_sized_new(calculate_alloc_len(len));
+    }
+
+    if (chunk_pool_len > 0) {
+        return chunk_pool[--chunk_pool_len];
+    }
+
+    return g_string_sized_new(NETWORK_QUEUE_CHUNK_SIZE - 1);
+}
+
+/**
+ * free a chunk, buffers of the pool size are kept for reuse
+ */
+void
+network_queue_chunk_free(GString *chunk)
+{
+    if (chunk->allocated_len == NETWORK_QUEUE_CHUNK_SIZE && chunk_pool_len < NETWORK_QUEUE_CHUNK_POOL_MAX) {
+        g_string_truncate(chunk, 0);
+        chunk_pool[chunk_pool_len++] = chunk;
+        return;
+    }
+
+    g_string_free(chunk, TRUE);
+}
+
 network_queue *
 network_queue_new()
 {
@@ -47,7 +85,7 @@ network_queue_free(network_queue *queue)
 
     GString *packet;
     while ((packet = g_queue_pop_head(queue->chunks))) {
-        g_string_free(packet, TRUE);
+        network_queue_chunk_free(packet);
     }
 
     g_queue_free(queue->chunks);
@@ -63,7 +101,7 @@ network_queue_clear(network_queue *queue)
 
     GString *packet;
     while ((packet = g_queue_pop_head(queue->chunks)) != NULL) {
-        g_string_free(packet, TRUE);
+        network_queue_chunk_free(packet);
     }
     queue->len = queue->offset = 0;
 }
@@ -157,7 +195,8 @@ network_queue_pop_str(network_queue *queue, gsize steal_len, GString *dest)
             /* optimize the common case that we want to have to full chunk
              *
              * if dest is null, we can remove the GString from the queue and
-             * return it directly without copying it
+             * return it directly without copying it, a pooled buffer goes
+             * back to the pool when the packet is written out
              */
             dest = g_queue_pop_head(queue->chunks);
             queue->len -= we_have;
@@ -176,7 +215,7 @@ network_queue_pop_str(network_queue *queue, gsize steal_len, GString *dest)
 
         if (chunk->len == queue->offset) {
             /* the chunk is done, remove it */
-            g_string_free(g_queue_pop_head(queue->chunks), TRUE);
+            network_queue_chunk_free(g_queue_pop_head(queue->chunks));
             queue->offset = 0;
         } else {
             break;
@@ -25,6 +25,13 @@
 
 #include <glib.h>
 
+/**
+ * receive buffers up to this size are recycled within a worker, only
+ * the event loop thread reads and frees them
+ */
+#define NETWORK_QUEUE_CHUNK_SIZE 16384
+#define NETWORK_QUEUE_CHUNK_POOL_MAX 512
+
 /* a input or output stream */
 typedef struct {
     GQueue *chunks;
@@ -39,5 +46,7 @@ void network_queue_clear(network_queue *queue);
 NETWORK_API int network_queue_append(network_queue *queue, GString *chunk);
 NETWORK_API GString *network_queue_pop_str(network_queue *queue, gsize steal_len, GString *dest);
 NETWORK_API GString *network_queue_peek_str(network_queue *queue, gsize peek_len, GString *dest);
+NETWORK_API GString *network_queue_chunk_new(gsize len);
+NETWORK_API void network_queue_chunk_free(GString *chunk);
 
 #endif
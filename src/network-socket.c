@@ -81,6 +81,8 @@
 #include "network-compress.h"
 #include "glib-ext.h"
 #include "network-ssl.h"
+#include "query-cache.h"
+#include "network-stmt-cache.h"
 
 network_socket *
 network_socket_new()
@@ -106,6 +108,8 @@ network_socket_new()
     s->sql_mode = g_string_new(NULL);
 
     s->fd = -1;
+    s->splice_pipe[0] = -1;
+    s->splice_pipe[1] = -1;
     s->socket_type = SOCK_STREAM;   /* let's default to TCP */
     s->packet_id_is_reset = TRUE;
 
@@ -133,16 +137,41 @@ network_socket_send_quit_and_free(network_socket *s)
     network_socket_free(s);
 }
 
+static void
+network_socket_drop_borrowed_chunks(network_socket *s)
+{
+    while (s->cache_borrowed > 0) {
+        g_queue_pop_head(s->send_queue->chunks);
+        s->cache_borrowed--;
+    }
+    query_cache_entry_unref(s->cache_entry);
+    s->cache_entry = NULL;
+}
+
 void
 network_socket_free(network_socket *s)
 {
     if (!s)
         return;
 
+    if (s->cache_entry) {
+        network_socket_drop_borrowed_chunks(s);
+    }
+
+    if (s->stmt_cache) {
+        network_stmt_cache_free(s->stmt_cache);
+        s->stmt_cache = NULL;
+    }
+
     if (s->last_compressed_packet) {
         g_string_free(s->last_compressed_packet, TRUE);
         s->last_compressed_packet = NULL;
     }
+
+    if (s->xa_resp_err) {
+        g_string_free(s->xa_resp_err, TRUE);
+        s->xa_resp_err = NULL;
+    }
     network_queue_free(s->send_queue);
     network_queue_free(s->send_queue_compressed);
     network_queue_free(s->recv_queue);
@@ -168,6 +197,11 @@ network_socket_free(network_socket *s)
         closesocket(s->fd);
     }
 
+    if (s->splice_pipe[0] != -1) {
+        close(s->splice_pipe[0]);
+        close(s->splice_pipe[1]);
+    }
+
     g_string_free(s->default_db, TRUE);
     g_string_free(s->charset_client, TRUE);
     g_string_free(s->charset_connection, TRUE);
@@ -616,9 +650,7 @@ network_socket_read(network_socket *sock)
     gssize len;
 
     if (sock->to_read > 0) {
-        GString *packet = g_string_sized_new(calculate_alloc_len(sock->to_read));
-
-        g_queue_push_tail(sock->recv_queue_raw->chunks, packet);
+        GString *packet = network_queue_chunk_new(sock->to_read);
 
         g_debug("%s: recv queue length:%d, sock:%p, client addr:%s, to read:%d",
                 G_STRLOC, sock->recv_queue_raw->chunks->length, sock, sock->src->name->str, (int)sock->to_read);
@@ -626,6 +658,10 @@ network_socket_read(network_socket *sock)
         g_debug("%s: tcp read:%d for fd:%d", G_STRLOC, (int)sock->to_read, sock->fd);
         len = recv(sock->fd, packet->str, sock->to_read, 0);
 
+        if (len <= 0) {
+            network_queue_chunk_free(packet);
+        }
+
         if (-1 == len) {
             switch (errno) {
             case E_NET_CONNABORTED:
@@ -650,13 +686,88 @@ network_socket_read(network_socket *sock)
         }
 
         sock->to_read -= len;
-        sock->recv_queue_raw->len += len;
         packet->len = len;
+        packet->str[len] = '\0';
+        network_queue_append(sock->recv_queue_raw, packet);
     }
 
     return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * move @len bytes from @src to @dst without copying them to user space
+ *
+ * the bytes go through the pipe of @dst. Bytes taken from @src but not
+ * accepted by @dst yet stay in the pipe and are written out first on the
+ * next call, so a call with @len 0 only flushes the pipe.
+ *
+ * @param moved  set to the number of bytes taken from @src
+ * @return NETWORK_SOCKET_SUCCESS if all bytes are written to @dst,
+ *         NETWORK_SOCKET_WAIT_FOR_EVENT if @src is empty or @dst is full
+ *         (dst->splice_pending is not 0 then)
+ */
+network_socket_retval_t
+network_socket_splice(network_socket *src, network_socket *dst, gsize len, gsize *moved)
+{
+    gssize n;
+
+    *moved = 0;
+
+    if (dst->splice_pipe[0] == -1) {
+        if (pipe2(dst->splice_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            g_critical("%s: pipe2() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+            dst->splice_pipe[0] = -1;
+            dst->splice_pipe[1] = -1;
+            return NETWORK_SOCKET_ERROR;
+        }
+    }
+
+    for (;;) {
+        if (dst->splice_pending > 0) {
+            n = splice(dst->splice_pipe[0], NULL, dst->fd, NULL, dst->splice_pending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n == -1) {
+                switch (errno) {
+                case E_NET_WOULDBLOCK:
+                case EAGAIN:
+                    return NETWORK_SOCKET_WAIT_FOR_EVENT;
+                default:
+                    g_message("%s: splice() to fd:%d failed: %s (%d)", G_STRLOC, dst->fd, g_strerror(errno), errno);
+                    return NETWORK_SOCKET_ERROR;
+                }
+            }
+            dst->splice_pending -= n;
+            if (dst->splice_pending > 0) {
+                return NETWORK_SOCKET_WAIT_FOR_EVENT;
+            }
+        }
+
+        if (*moved == len) {
+            return NETWORK_SOCKET_SUCCESS;
+        }
+
+        n = splice(src->fd, NULL, dst->splice_pipe[1], NULL, len - *moved,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+        if (n == -1) {
+            switch (errno) {
+            case E_NET_CONNRESET:
+            case E_NET_WOULDBLOCK:
+            case EAGAIN:
+                return NETWORK_SOCKET_WAIT_FOR_EVENT;
+            default:
+                g_message("%s: splice() from fd:%d failed: %s (%d)", G_STRLOC, src->fd, g_strerror(errno), errno);
+                return NETWORK_SOCKET_ERROR;
+            }
+        } else if (n == 0) {
+            /* connection close, let the ioctl() handle it */
+            return NETWORK_SOCKET_WAIT_FOR_EVENT;
+        }
+
+        *moved += n;
+        dst->splice_pending += n;
+        src->to_read = src->to_read > n ? src->to_read - n : 0;
+    }
+}
 
 /**
  * write data to the socket
@@ -748,6 +859,7 @@ network_socket_write_writev(network_socket *con, int send_chunks)
 
     send_queue->offset += len;
     send_queue->len -= len;
+    con->query_sent_bytes += len;
 
     /* check all the chunks which we have sent out */
     for (chunk = send_queue->chunks->head; chunk;) {
@@ -764,21 +876,10 @@ network_socket_write_writev(network_socket *con, int send_chunks)
             /* to trace the data we sent to the socket, enable this */
             g_debug_hexdump(G_STRLOC, S(s));
 #endif
-            if (!con->do_query_cache) {
-                g_string_free(s, TRUE);
+            if (send_queue == con->send_queue) {
+                network_socket_release_sent_chunk(con, s);
             } else {
-                size_t len = con->cache_queue->len + s->len;
-                if (len > MAX_QUERY_CACHE_SIZE) {
-                    if (!con->query_cache_too_long) {
-                        g_message("%s:too long for cache queue:%p, len:%d", G_STRLOC, con, (int)len);
-                        con->query_cache_too_long = 1;
-                    }
-                    g_string_free(s, TRUE);
-                } else {
-                    g_debug("%s:append packet to cache queue:%p, len:%d, total:%d",
-                            G_STRLOC, con, (int)s->len, (int)len);
-                    network_queue_append(con->cache_queue, s);
-                }
+                network_queue_chunk_free(s);
             }
 
             g_queue_delete_link(send_queue->chunks, chunk);
@@ -793,6 +894,48 @@ network_socket_write_writev(network_socket *con, int send_chunks)
     return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * release a chunk which has been written out of the send queue
+ *
+ * chunks borrowed from a cached response are owned by the cache entry,
+ * the others are freed or kept for the query cache
+ */
+void
+network_socket_release_sent_chunk(network_socket *sock, GString *s)
+{
+    if (sock->cache_borrowed > 0) {
+        sock->cache_borrowed--;
+        if (sock->cache_borrowed == 0) {
+            query_cache_entry_unref(sock->cache_entry);
+            sock->cache_entry = NULL;
+        }
+        return;
+    }
+
+    if (!sock->do_query_cache) {
+        network_queue_chunk_free(s);
+    } else {
+        size_t len = sock->cache_queue->len + s->len;
+        if (len > MAX_QUERY_CACHE_SIZE) {
+            if (!sock->query_cache_too_long) {
+                g_message("%s:too long for cache queue:%p, len:%d", G_STRLOC, sock, (int)len);
+                sock->query_cache_too_long = 1;
+            }
+            network_queue_chunk_free(s);
+        } else {
+            if (s->allocated_len == NETWORK_QUEUE_CHUNK_SIZE) {
+                /* a forwarded receive buffer, cache only its content */
+                GString *copy = g_string_new_len(s->str, s->len);
+                network_queue_chunk_free(s);
+                s = copy;
+            }
+            g_debug("%s:append packet to cache queue:%p, len:%d, total:%d",
+                    G_STRLOC, sock, (int)s->len, (int)len);
+            network_queue_append(sock->cache_queue, s);
+        }
+    }
+}
+
 /**
  * write a content of con->send_queue to the socket
  *
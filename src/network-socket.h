@@ -101,6 +101,8 @@ typedef struct {
 } server_query_status;
 
 typedef struct network_ssl_connection_s network_ssl_connection_t;
+struct query_cache_entry_t;
+struct network_stmt_cache_t;
 
 #define XID_LEN 128
 
@@ -131,13 +133,32 @@ typedef struct {
     network_queue *send_queue;
     network_queue *send_queue_compressed;
     network_queue *cache_queue;
+    /* packets at the head of send_queue borrowed from a cached response */
+    struct query_cache_entry_t *cache_entry;
+    guint cache_borrowed;
+    /* only used for server, statements prepared on the connection */
+    struct network_stmt_cache_t *stmt_cache;
+    /* only used for server, responses of pipelined attribute adjustments not read yet */
+    guint attr_resp_pending;
+    /* only used for server, answers of XA commands pipelined ahead of a statement */
+    guint xa_resp_pending;
+    /* the first of them failed, it answers the statement instead */
+    GString *xa_resp_err;
+    /* only used for client, responses spliced from the server pass through it */
+    int splice_pipe[2];
+    /* bytes in splice_pipe not written to the socket yet */
+    gsize splice_pending;
 
     GString *last_compressed_packet;
     int compressed_unsend_offset;
     int total_output;
+    /* bytes written for the current query */
+    guint64 query_sent_bytes;
 
     off_t to_read;
     long long resp_len;
+    /* the part of resp_len already consumed by the streaming merge */
+    long long resp_merged_len;
 
     /**
      * data extracted from the handshake  
@@ -161,14 +182,18 @@ typedef struct {
     unsigned int is_waiting:1;
     unsigned int is_read_only:1;
     unsigned int is_read_finished:1;
+    unsigned int is_resp_abandoned:1;   /* rest of the resultset to be drained */
     unsigned int query_cache_too_long:1;
     unsigned int max_header_size_reached:1;
     unsigned int do_compress:1;
     unsigned int do_strict_compress:1;
     unsigned int do_query_cache:1;
     unsigned int write_uncomplete:1; /* only valid for compresssion */
+    unsigned int err_sent:1;         /* an error is sent for the current query */
 
     guint8 charset_code;
+    /* only used for client, user id in connection pools, 0 if not resolved */
+    int pool_user_id;
 
     /**
      * store the default-db of the socket
@@ -202,7 +227,10 @@ NETWORK_API network_socket *network_socket_new(void);
 NETWORK_API void network_socket_free(network_socket *s);
 NETWORK_API network_socket_retval_t network_socket_write(network_socket *con, int send_chunks);
 NETWORK_API void network_socket_send_quit_and_free(network_socket *s);
+NETWORK_API void network_socket_release_sent_chunk(network_socket *sock, GString *s);
 NETWORK_API network_socket_retval_t network_socket_read(network_socket *con);
+NETWORK_API network_socket_retval_t network_socket_splice(network_socket *src, network_socket *dst,
+                                                          gsize len, gsize *moved);
 NETWORK_API network_socket_retval_t network_socket_to_read(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_set_non_blocking(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_connect(network_socket *con);
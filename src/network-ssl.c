@@ -311,6 +311,7 @@ network_ssl_write(network_socket *sock, int send_chunks)
 
     send_queue->offset += len;
     send_queue->len -= len;
+    sock->query_sent_bytes += len;
 
     /* check all the chunks which we have sent out */
     for (chunk = send_queue->chunks->head; chunk;) {
@@ -325,21 +326,10 @@ network_ssl_write(network_socket *sock, int send_chunks)
 #if NETWORK_DEBUG_TRACE_IO
             g_debug("%s:output for sock:%p", G_STRLOC, sock);
 #endif
-            if (!sock->do_query_cache) {
-                g_string_free(s, TRUE);
+            if (send_queue == sock->send_queue) {
+                network_socket_release_sent_chunk(sock, s);
             } else {
-                size_t len = sock->cache_queue->len + s->len;
-                if (len > MAX_QUERY_CACHE_SIZE) {
-                    if (!sock->query_cache_too_long) {
-                        g_message("%s:too long for cache queue:%p, len:%d", G_STRLOC, sock, (int)len);
-                        sock->query_cache_too_long = 1;
-                    }
-                    g_string_free(s, TRUE);
-                } else {
-                    g_debug("%s:append packet to cache queue:%p, len:%d, total:%d",
-                            G_STRLOC, sock, (int)s->len, (int)len);
-                    network_queue_append(sock->cache_queue, s);
-                }
+                g_string_free(s, TRUE);
             }
 
             g_queue_delete_link(send_queue->chunks, chunk);
@@ -398,7 +388,7 @@ static int network_ssl_write_to_rbio(network_socket* sock)
 
         if (queue->offset >= s->len) {
             queue->offset -= s->len;
-            g_string_free(s, TRUE);
+            network_queue_chunk_free(s);
             g_queue_delete_link(queue->chunks, chunk);
             chunk = queue->chunks->head;
         } else {
@@ -0,0 +1,161 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "cetus-util.h"
+#include "network-mysqld-proto.h"
+#include "network-stmt-cache.h"
+
+static void
+network_stmt_free(network_stmt_t *stmt)
+{
+    g_string_free(stmt->key, TRUE);
+    g_free(stmt);
+}
+
+static void
+network_stmt_cache_set_probe(network_stmt_cache_t *cache, const char *db, const char *sql, gsize sql_len)
+{
+    g_string_assign(cache->probe, db);
+    g_string_append_c(cache->probe, '\0');
+    g_string_append_len(cache->probe, sql, sql_len);
+}
+
+network_stmt_cache_t *
+network_stmt_cache_new(void)
+{
+    network_stmt_cache_t *cache = g_new0(network_stmt_cache_t, 1);
+    cache->stmts = g_hash_table_new_full((GHashFunc)g_string_hash, (GEqualFunc)g_string_equal,
+                                         NULL, (GDestroyNotify)network_stmt_free);
+    g_queue_init(&(cache->lru));
+    g_queue_init(&(cache->pending));
+    cache->probe = g_string_new(NULL);
+
+    return cache;
+}
+
+void
+network_stmt_cache_free(network_stmt_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    network_stmt_cache_clear(cache);
+    g_hash_table_destroy(cache->stmts);
+    g_string_free(cache->probe, TRUE);
+    g_free(cache);
+}
+
+/**
+ * forget all statements, the server has dropped them
+ * (COM_CHANGE_USER, COM_RESET_CONNECTION)
+ */
+void
+network_stmt_cache_clear(network_stmt_cache_t *cache)
+{
+    GString *payload;
+    while ((payload = g_queue_pop_head(&(cache->pending)))) {
+        g_string_free(payload, TRUE);
+    }
+
+    g_queue_init(&(cache->lru));
+    g_hash_table_remove_all(cache->stmts);
+}
+
+/**
+ * @return the server statement id, 0 if @sql is not prepared here
+ */
+guint32
+network_stmt_cache_lookup(network_stmt_cache_t *cache, const char *db, const char *sql, gsize sql_len)
+{
+    network_stmt_cache_set_probe(cache, db, sql, sql_len);
+    network_stmt_t *stmt = g_hash_table_lookup(cache->stmts, cache->probe);
+    if (stmt == NULL) {
+        return 0;
+    }
+
+    /* move to the head of lru */
+    if (cache->lru.head != &(stmt->lru_link)) {
+        g_queue_unlink(&(cache->lru), &(stmt->lru_link));
+        g_queue_push_head_link(&(cache->lru), &(stmt->lru_link));
+    }
+
+    return stmt->stmt_id;
+}
+
+static void
+network_stmt_cache_close(network_stmt_cache_t *cache, guint32 stmt_id)
+{
+    GString *payload = g_string_sized_new(5);
+    network_mysqld_proto_append_int8(payload, COM_STMT_CLOSE);
+    network_mysqld_proto_append_int32(payload, stmt_id);
+    g_queue_push_tail(&(cache->pending), payload);
+}
+
+/**
+ * remember @sql is prepared as @stmt_id
+ *
+ * @return the number of statements evicted, their COM_STMT_CLOSE is pending
+ */
+guint
+network_stmt_cache_insert(network_stmt_cache_t *cache, const char *db, const char *sql, gsize sql_len,
+                          guint32 stmt_id)
+{
+    network_stmt_cache_set_probe(cache, db, sql, sql_len);
+    network_stmt_t *stmt = g_hash_table_lookup(cache->stmts, cache->probe);
+    if (stmt) {
+        /* prepared twice, keep the newer one */
+        network_stmt_cache_close(cache, stmt->stmt_id);
+        stmt->stmt_id = stmt_id;
+        return 0;
+    }
+
+    guint evicted = 0;
+    while (cache->lru.length >= NETWORK_STMT_CACHE_SIZE) {
+        network_stmt_t *victim = cache->lru.tail->data;
+        g_debug("%s: evict stmt:%u", G_STRLOC, victim->stmt_id);
+        network_stmt_cache_close(cache, victim->stmt_id);
+        g_queue_unlink(&(cache->lru), &(victim->lru_link));
+        g_hash_table_remove(cache->stmts, victim->key);
+        evicted++;
+    }
+
+    stmt = g_new0(network_stmt_t, 1);
+    stmt->key = g_string_new_len(S(cache->probe));
+    stmt->stmt_id = stmt_id;
+    stmt->lru_link.data = stmt;
+    g_hash_table_insert(cache->stmts, stmt->key, stmt);
+    g_queue_push_head_link(&(cache->lru), &(stmt->lru_link));
+
+    return evicted;
+}
+
+/**
+ * queue a command without response, takes over @payload
+ */
+void
+network_stmt_cache_add_pending(network_stmt_cache_t *cache, GString *payload)
+{
+    g_queue_push_tail(&(cache->pending), payload);
+}
@@ -0,0 +1,70 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _NETWORK_STMT_CACHE_H_
+#define _NETWORK_STMT_CACHE_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/* statements kept prepared on one backend connection */
+#define NETWORK_STMT_CACHE_SIZE 256
+
+/**
+ * A statement prepared on a backend connection.
+ */
+typedef struct network_stmt_t {
+    GString *key;               /* db \0 sql */
+    guint32 stmt_id;            /* id assigned by the server */
+    GList lru_link;             /* intrusive link in the lru list */
+} network_stmt_t;
+
+/**
+ * Prepared statements of one backend connection.
+ *
+ * The statements stay prepared while the connection sits in the pool, any
+ * client executing the same sql with the same default db reuses them. The
+ * least recently used statement is closed when the cache is full.
+ * COM_STMT_CLOSE and COM_STMT_SEND_LONG_DATA get no response, they are held
+ * in pending and go out right before the next command on the connection.
+ */
+typedef struct network_stmt_cache_t {
+    /* GString key -> network_stmt_t */
+    GHashTable *stmts;
+    /* head is the most recently used statement */
+    GQueue lru;
+    /* GString payloads */
+    GQueue pending;
+    GString *probe;
+} network_stmt_cache_t;
+
+NETWORK_API network_stmt_cache_t *network_stmt_cache_new(void);
+NETWORK_API void network_stmt_cache_free(network_stmt_cache_t *cache);
+NETWORK_API void network_stmt_cache_clear(network_stmt_cache_t *cache);
+
+NETWORK_API guint32 network_stmt_cache_lookup(network_stmt_cache_t *cache, const char *db,
+                                              const char *sql, gsize sql_len);
+NETWORK_API guint network_stmt_cache_insert(network_stmt_cache_t *cache, const char *db,
+                                            const char *sql, gsize sql_len, guint32 stmt_id);
+
+NETWORK_API void network_stmt_cache_add_pending(network_stmt_cache_t *cache, GString *payload);
+
+#endif
@@ -72,8 +72,7 @@ typedef int socklen_t;
 #include "network-ssl.h"
 #include "chassis-sql-log.h"
 #include "cetus-acl.h"
-
-#define MAX_CACHED_ITEMS 65536
+#include "query-cache.h"
 
 extern int      cetus_last_process;
 
@@ -502,18 +501,24 @@ do_check_qeury_cache(network_mysqld_con *con)
     }
 
     con->query_cache_judged = 1;
+
+    /* tables read are unknown, so the response could not be invalidated */
+    if (con->query_cache_tables == NULL) {
+        return 0;
+    }
+
     gettimeofday(&(con->resp_recv_time), NULL);
     int diff = (con->resp_recv_time.tv_sec - con->req_recv_time.tv_sec) * 1000;
     diff += (con->resp_recv_time.tv_usec - con->req_recv_time.tv_usec) / 1000;
     g_debug("%s:req time:%d, min:%d for cache", G_STRLOC, diff, con->srv->min_req_time_for_cache);
     if (diff >= con->srv->min_req_time_for_cache) {
-        if (g_hash_table_size(con->srv->query_cache_table) < MAX_CACHED_ITEMS) {
+        if (con->srv->query_cache->max_bytes > 0) {
             con->client->do_query_cache = 1;
             con->client->cache_queue = network_queue_new();
             g_debug("%s: candidate for query cache", G_STRLOC);
             return 1;
         } else {
-            g_message("%s: too many cached items", G_STRLOC);
+            g_debug("%s: query cache size is zero", G_STRLOC);
         }
     } else {
         g_debug("%s: not cached for sql:%s", G_STRLOC, con->orig_sql->str);
@@ -522,55 +527,101 @@ do_check_qeury_cache(network_mysqld_con *con)
     return 0;
 }
 
-int
-try_to_get_resp_from_query_cache(network_mysqld_con *con)
+static void
+query_cache_add_table(GPtrArray *names, const char *db, const char *table)
 {
-    chassis *srv = con->srv;
-    GString *key = g_string_new(NULL);
-    g_string_append(key, con->orig_sql->str);
-    g_string_append(key, con->client->response->username->str);
-    g_string_append(key, con->client->default_db->str);
-    gchar *md5_key = g_compute_checksum_for_string(G_CHECKSUM_MD5, S(key));
+    gchar *name = query_cache_table_name(db, table);
+    guint i;
+    for (i = 0; i < names->len; i++) {
+        if (strcmp(g_ptr_array_index(names, i), name) == 0) {
+            g_free(name);
+            return;
+        }
+    }
+    g_ptr_array_add(names, name);
+}
 
-    g_debug("%s:visit try_to_get_resp_from_query_cache:%s", G_STRLOC, key->str);
-    g_string_free(key, TRUE);
+static gboolean query_cache_collect_select(sql_select_t *, const char *, GPtrArray *);
 
-    unsigned long long access_ms;
-    access_ms = con->req_recv_time.tv_sec * 1000 + con->req_recv_time.tv_usec / 1000;
-    /* purge first */
-    if (srv->last_cache_purge_time != access_ms) {
-        int len = srv->cache_index->length;
-        while (len > 0) {
-            query_cache_index_item *index = g_queue_peek_head(srv->cache_index);
-            if (index->expire_ms > access_ms) {
-                break;
-            } else {
-                g_debug("%s:drop content from cache:%s", G_STRLOC, index->key);
-                g_hash_table_remove(con->srv->query_cache_table, index->key);
-                g_queue_pop_head(srv->cache_index);
-                len = srv->cache_index->length;
-                g_free(index->key);
-                g_free(index);
+static gboolean
+query_cache_collect_src(sql_src_list_t *srcs, const char *db, GPtrArray *names)
+{
+    guint i;
+    for (i = 0; srcs && i < srcs->len; i++) {
+        sql_src_item_t *src = g_ptr_array_index(srcs, i);
+        if (src->table_name) {
+            query_cache_add_table(names, src->dbname ? src->dbname : db, src->table_name);
+        } else if (src->select) {
+            if (!query_cache_collect_select(src->select, db, names)) {
+                return FALSE;
             }
+        } else {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean
+query_cache_collect_select(sql_select_t *select, const char *db, GPtrArray *names)
+{
+    /* compound selects are chained by prior */
+    for (; select; select = select->prior) {
+        if (!query_cache_collect_src(select->from_src, db, names)) {
+            return FALSE;
         }
+    }
+    return TRUE;
+}
 
-        srv->last_cache_purge_time = access_ms;
+/**
+ * @return NULL-terminated table names read by a cacheable SELECT,
+ *         or NULL if they could not all be resolved
+ */
+static gchar **
+query_cache_read_tables(sql_context_t *context, const char *db)
+{
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    if (!query_cache_collect_select(context->sql_statement, db, names) || names->len == 0) {
+        g_ptr_array_free(names, TRUE);
+        return NULL;
     }
+    g_ptr_array_add(names, NULL);
+    return (gchar **)g_ptr_array_free(names, FALSE);
+}
+
+int
+try_to_get_resp_from_query_cache(network_mysqld_con *con, sql_context_t *context)
+{
+    network_socket *client = con->client;
+    const char *user = client->response->username->str;
+    const char *db = client->default_db->str;
+    guint64 hash = query_cache_hash_key(S(con->orig_sql), user, db);
 
-    query_cache_item *item = g_hash_table_lookup(con->srv->query_cache_table, md5_key);
-    g_free(md5_key);
+    g_debug("%s:visit try_to_get_resp_from_query_cache:%s", G_STRLOC, con->orig_sql->str);
 
-    if (item != NULL) {
-        int i;
-        int len = item->queue->chunks->length;
-        for (i = 0; i < len; i++) {
-            /* TODO g_queue_peek_nth is not efficient*/
-            GString *packet = g_queue_peek_nth(item->queue->chunks, i);
-            GString *dup_packet = g_string_new(NULL);
-            g_string_append_len(dup_packet, S(packet));
-            network_queue_append(con->client->send_queue, dup_packet);
-            g_debug("%s:read packet len:%d from cache", G_STRLOC, (int)dup_packet->len);
+    unsigned long long access_ms;
+    access_ms = con->req_recv_time.tv_sec * 1000 + con->req_recv_time.tv_usec / 1000;
+
+    query_cache_entry_t *entry = query_cache_lookup(con->srv->query_cache, hash,
+                                                    S(con->orig_sql), user, db, access_ms);
+    if (entry != NULL) {
+        network_queue *send_queue = client->send_queue;
+        guint i;
+        if (client->cache_borrowed == 0 && g_queue_is_empty(send_queue->chunks)) {
+            /* packets are immutable, send them without copying */
+            for (i = 0; i < entry->packet_num; i++) {
+                network_queue_append(send_queue, entry->packets[i]);
+            }
+            client->cache_entry = query_cache_entry_ref(entry);
+            client->cache_borrowed = entry->packet_num;
+        } else {
+            for (i = 0; i < entry->packet_num; i++) {
+                GString *packet = entry->packets[i];
+                network_queue_append(send_queue, g_string_new_len(S(packet)));
+            }
         }
+        g_debug("%s:read %d packets from cache", G_STRLOC, (int)entry->packet_num);
         con->state = ST_SEND_QUERY_RESULT;
         con->client->do_query_cache = 0;
         g_debug("%s:read content from cache:%s", G_STRLOC, con->orig_sql->str);
@@ -581,10 +632,127 @@ try_to_get_resp_from_query_cache(network_mysqld_con *con)
         return 1;
     } else {
         g_debug("%s:no cached item for con:%p", G_STRLOC, con);
+        g_strfreev(con->query_cache_tables);
+        con->query_cache_tables = query_cache_read_tables(context, db);
+        con->query_cache_version = con->srv->query_cache->version;
         return 0;
     }
 }
 
+static GHashTable *
+query_cache_table_set(GHashTable **set)
+{
+    if (*set == NULL) {
+        *set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+    return *set;
+}
+
+/**
+ * remember the tables written by @context
+ *
+ * They are invalidated in the query cache when the transaction ends,
+ * statements being prepared only take effect when executed.
+ */
+void
+query_cache_record_write(network_mysqld_con *con, sql_context_t *context, gboolean is_prepare)
+{
+    if (context->explain) {
+        return;
+    }
+
+    const char *db = con->client->default_db->str;
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    gboolean resolved = FALSE;
+    switch (context->stmt_type) {
+    case STMT_INSERT:{
+        sql_insert_t *insert = context->sql_statement;
+        resolved = query_cache_collect_src(insert->table, db, names);
+        break;
+    }
+    case STMT_UPDATE:{
+        sql_update_t *update = context->sql_statement;
+        if (update->table_reference) {
+            resolved = query_cache_collect_src(update->table_reference->table_list, db, names);
+        }
+        break;
+    }
+    case STMT_DELETE:{
+        sql_delete_t *delete = context->sql_statement;
+        resolved = query_cache_collect_src(delete->from_src, db, names);
+        break;
+    }
+    case STMT_COMMON_DDL:
+    case STMT_DROP_DATABASE:
+    case STMT_CALL:
+        break;
+    default:
+        g_ptr_array_free(names, TRUE);
+        return;
+    }
+
+    GHashTable *set = query_cache_table_set(is_prepare ? &(con->query_cache_prepared_tables)
+                                            : &(con->query_cache_dirty_tables));
+    if (!resolved || names->len == 0) {
+        g_hash_table_insert(set, g_strdup(QUERY_CACHE_ALL_TABLES), GINT_TO_POINTER(1));
+    } else {
+        guint i;
+        for (i = 0; i < names->len; i++) {
+            g_hash_table_insert(set, g_strdup(g_ptr_array_index(names, i)), GINT_TO_POINTER(1));
+        }
+    }
+    g_ptr_array_free(names, TRUE);
+}
+
+/**
+ * a prepared statement of @con is executed, the tables written by any of
+ * its prepared statements become dirty
+ */
+void
+query_cache_record_execute(network_mysqld_con *con)
+{
+    GHashTable *prepared = con->query_cache_prepared_tables;
+    if (prepared == NULL || g_hash_table_size(prepared) == 0) {
+        return;
+    }
+
+    GHashTable *set = query_cache_table_set(&(con->query_cache_dirty_tables));
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, prepared);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_hash_table_insert(set, g_strdup(key), GINT_TO_POINTER(1));
+    }
+}
+
+/**
+ * invalidate cached responses reading tables written by @con
+ */
+void
+query_cache_flush_dirty_tables(network_mysqld_con *con)
+{
+    GHashTable *dirty = con->query_cache_dirty_tables;
+    if (dirty == NULL || g_hash_table_size(dirty) == 0) {
+        return;
+    }
+
+    query_cache_t *cache = con->srv->query_cache;
+    if (cache) {
+        if (g_hash_table_lookup(dirty, QUERY_CACHE_ALL_TABLES)) {
+            g_debug("%s:flush query cache for con:%p", G_STRLOC, con);
+            query_cache_clear(cache);
+        } else {
+            GHashTableIter iter;
+            gpointer key;
+            g_hash_table_iter_init(&iter, dirty);
+            while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                query_cache_invalidate_table(cache, key);
+            }
+        }
+    }
+    g_hash_table_remove_all(dirty);
+}
+
 gboolean
 proxy_put_shard_conn_to_pool(network_mysqld_con *con)
 {
@@ -622,7 +790,8 @@ proxy_put_shard_conn_to_pool(network_mysqld_con *con)
                 g_warning("%s: xa is not over yet", G_STRLOC);
             }
 
-            if (is_put_to_pool_allowed && server->recv_queue->chunks->length > 0) {
+            /* an abandoned resultset is dropped by the drain */
+            if (is_put_to_pool_allowed && !server->is_resp_abandoned && server->recv_queue->chunks->length > 0) {
                 g_message("%s: server recv queue not empty, sql:%s", G_STRLOC, con->orig_sql->str);
                 is_put_to_pool_allowed = 0;
             }
@@ -649,7 +818,11 @@ proxy_put_shard_conn_to_pool(network_mysqld_con *con)
             if (is_put_to_pool_allowed) {
                 g_debug("%s: is_put_to_pool_allowed true here, server:%p, con:%p, num:%d",
                         G_STRLOC, server, con, (int)con->servers->len);
-                network_pool_add_idle_conn(pool, con->srv, server);
+                if (server->is_resp_abandoned) {
+                    network_pool_drain_conn(pool, con->srv, server);
+                } else {
+                    network_pool_add_idle_conn(pool, con->srv, server);
+                }
             } else {
                 g_debug("%s: is_put_to_pool_allowed false here, server:%p, con:%p, num:%d",
                         G_STRLOC, server, con, (int)con->servers->len);
@@ -676,6 +849,7 @@ proxy_put_shard_conn_to_pool(network_mysqld_con *con)
     }
     con->client->is_server_conn_reserved = 0;
     con->attr_adj_state = ATTR_START;
+    con->resp_cut_off = 0;
 
     return TRUE;
 }
@@ -48,7 +48,10 @@ NETWORK_API network_socket_retval_t do_read_auth(network_mysqld_con *);
 NETWORK_API network_socket_retval_t do_connect_cetus(network_mysqld_con *, network_backend_t **, int *);
 NETWORK_API network_socket_retval_t plugin_add_backends(chassis *, gchar **, gchar **);
 NETWORK_API int do_check_qeury_cache(network_mysqld_con *con);
-NETWORK_API int try_to_get_resp_from_query_cache(network_mysqld_con *con);
+NETWORK_API int try_to_get_resp_from_query_cache(network_mysqld_con *con, struct sql_context_t *context);
+NETWORK_API void query_cache_record_write(network_mysqld_con *con, struct sql_context_t *context, gboolean is_prepare);
+NETWORK_API void query_cache_record_execute(network_mysqld_con *con);
+NETWORK_API void query_cache_flush_dirty_tables(network_mysqld_con *con);
 NETWORK_API gboolean proxy_put_shard_conn_to_pool(network_mysqld_con *con);
 NETWORK_API void remove_mul_server_recv_packets(network_mysqld_con *con);
 NETWORK_API void truncate_default_db_when_drop_database(network_mysqld_con *con, char *);
@@ -0,0 +1,401 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "glib-ext.h"
+#include "query-admission.h"
+
+/* virtual time a query of weight 1 takes in the fair queue */
+#define ADMISSION_TAG_UNIT 1024
+
+#define ADMISSION_TICKET(l) ((admission_ticket_t *)((char *)(l) - G_STRUCT_OFFSET(admission_ticket_t, link)))
+
+typedef struct admission_limit_t {
+    int limit;
+    guint weight;
+} admission_limit_t;
+
+static void
+admission_tenant_free(admission_tenant_t *t)
+{
+    g_free(t->name);
+    g_free(t);
+}
+
+query_admission_t *
+query_admission_new(void)
+{
+    query_admission_t *adm = g_new0(query_admission_t, 1);
+    adm->users = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)admission_tenant_free);
+    adm->dbs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)admission_tenant_free);
+    g_queue_init(&(adm->waiting));
+    adm->max_queued = ADMISSION_DEF_MAX_QUEUED;
+    adm->queue_timeout = ADMISSION_DEF_QUEUE_TIMEOUT;
+
+    return adm;
+}
+
+void
+query_admission_free(query_admission_t *adm)
+{
+    if (adm == NULL) {
+        return;
+    }
+
+    g_hash_table_destroy(adm->users);
+    g_hash_table_destroy(adm->dbs);
+    if (adm->user_limits) {
+        g_hash_table_destroy(adm->user_limits);
+    }
+    if (adm->db_limits) {
+        g_hash_table_destroy(adm->db_limits);
+    }
+    g_free(adm);
+}
+
+/**
+ * queries pass straight through unless some limit is set
+ */
+gboolean
+query_admission_enabled(query_admission_t *adm)
+{
+    return adm && (adm->max_running > 0 || adm->user_limits || adm->db_limits);
+}
+
+/**
+ * parse "name:limit[:weight],..." into name -> admission_limit_t
+ *
+ * @return NULL if @limits is empty or malformed
+ */
+static GHashTable *
+admission_parse_limits(const char *limits)
+{
+    if (limits == NULL) {
+        return NULL;
+    }
+
+    GHashTable *table = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    gchar **items = g_strsplit(limits, ",", -1);
+    gboolean ok = TRUE;
+    int i;
+    for (i = 0; items[i] && ok; i++) {
+        gchar *item = g_strstrip(items[i]);
+        if (*item == '\0') {
+            continue;
+        }
+        gchar **parts = g_strsplit(item, ":", 3);
+        guint num = g_strv_length(parts);
+        if (num < 2 || *g_strstrip(parts[0]) == '\0') {
+            ok = FALSE;
+        } else {
+            char *end = NULL;
+            admission_limit_t *l = g_new0(admission_limit_t, 1);
+            l->limit = strtol(parts[1], &end, 10);
+            if (end == parts[1] || *end != '\0' || l->limit < 0) {
+                ok = FALSE;
+            }
+            l->weight = ADMISSION_DEF_WEIGHT;
+            if (num == 3) {
+                long weight = strtol(parts[2], &end, 10);
+                if (end == parts[2] || *end != '\0' || weight < 1 || weight > ADMISSION_TAG_UNIT) {
+                    ok = FALSE;
+                }
+                l->weight = weight;
+            }
+            g_hash_table_insert(table, g_strdup(parts[0]), l);
+        }
+        g_strfreev(parts);
+    }
+    g_strfreev(items);
+
+    if (!ok || g_hash_table_size(table) == 0) {
+        g_hash_table_destroy(table);
+        return NULL;
+    }
+    return table;
+}
+
+gboolean
+query_admission_check_limits(const char *limits)
+{
+    if (limits == NULL || *limits == '\0') {
+        return TRUE;
+    }
+    GHashTable *table = admission_parse_limits(limits);
+    if (table == NULL) {
+        return FALSE;
+    }
+    g_hash_table_destroy(table);
+    return TRUE;
+}
+
+static void
+admission_tenant_apply(admission_tenant_t *t, GHashTable *limits)
+{
+    admission_limit_t *l = NULL;
+    if (limits) {
+        l = g_hash_table_lookup(limits, t->name);
+        if (l == NULL) {
+            l = g_hash_table_lookup(limits, ADMISSION_ANY_TENANT);
+        }
+    }
+    t->limit = l ? l->limit : 0;
+    t->weight = l ? l->weight : ADMISSION_DEF_WEIGHT;
+}
+
+static void
+admission_set_limits(GHashTable *tenants, GHashTable **limits, const char *str)
+{
+    if (*limits) {
+        g_hash_table_destroy(*limits);
+    }
+    *limits = admission_parse_limits(str);
+
+    GHashTableIter iter;
+    admission_tenant_t *t;
+    g_hash_table_iter_init(&iter, tenants);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&t)) {
+        admission_tenant_apply(t, *limits);
+    }
+}
+
+void
+query_admission_set_user_limits(query_admission_t *adm, const char *limits)
+{
+    admission_set_limits(adm->users, &(adm->user_limits), limits);
+}
+
+void
+query_admission_set_db_limits(query_admission_t *adm, const char *limits)
+{
+    admission_set_limits(adm->dbs, &(adm->db_limits), limits);
+}
+
+void
+query_admission_set_max_running(query_admission_t *adm, int max_running)
+{
+    adm->max_running = MAX(max_running, 0);
+}
+
+static admission_tenant_t *
+admission_get_tenant(GHashTable *tenants, GHashTable *limits, const char *name)
+{
+    admission_tenant_t *t = g_hash_table_lookup(tenants, name);
+    if (t == NULL) {
+        t = g_new0(admission_tenant_t, 1);
+        t->name = g_strdup(name);
+        admission_tenant_apply(t, limits);
+        g_hash_table_insert(tenants, t->name, t);
+    }
+    return t;
+}
+
+static gboolean
+admission_tenant_full(admission_tenant_t *t)
+{
+    return t->limit > 0 && t->running >= t->limit;
+}
+
+/**
+ * the worker takes no more queries, whoever asks
+ */
+static gboolean
+admission_worker_full(query_admission_t *adm, guint64 now)
+{
+    if (adm->max_running > 0 && adm->running >= adm->max_running) {
+        return TRUE;
+    }
+    /* let running queries get the backends first, they wake the queue when done */
+    return adm->running > 0 && now < adm->shortage_usec + ADMISSION_SHORTAGE_WINDOW;
+}
+
+static void
+admission_admit(query_admission_t *adm, admission_ticket_t *ticket)
+{
+    ticket->admitted = 1;
+    ticket->user->running++;
+    ticket->user->admitted++;
+    ticket->db->running++;
+    ticket->db->admitted++;
+    adm->running++;
+}
+
+/**
+ * admit queued tickets in tag order as long as they fit
+ *
+ * @return owners of the admitted tickets
+ */
+static GList *
+admission_dispatch(query_admission_t *adm, guint64 now)
+{
+    GList *owners = NULL;
+    GList *l = adm->waiting.head;
+    while (l && !admission_worker_full(adm, now)) {
+        GList *next = l->next;
+        admission_ticket_t *ticket = ADMISSION_TICKET(l);
+        if (!admission_tenant_full(ticket->user) && !admission_tenant_full(ticket->db)) {
+            g_queue_unlink(&(adm->waiting), l);
+            ticket->queued = 0;
+            ticket->user->queued--;
+            ticket->db->queued--;
+            ticket->user->wait_usec += now - ticket->enqueue_usec;
+            ticket->db->wait_usec += now - ticket->enqueue_usec;
+            adm->vtime = MAX(adm->vtime, ticket->tag);
+            admission_admit(adm, ticket);
+            owners = g_list_prepend(owners, l->data);
+        }
+        l = next;
+    }
+    return g_list_reverse(owners);
+}
+
+static void
+admission_enqueue(query_admission_t *adm, admission_ticket_t *ticket, guint64 now)
+{
+    admission_tenant_t *user = ticket->user;
+    ticket->tag = MAX(adm->vtime, user->finish_tag) + ADMISSION_TAG_UNIT / user->weight;
+    user->finish_tag = ticket->tag;
+    ticket->enqueue_usec = now;
+    ticket->deadline_usec = now + (guint64)adm->queue_timeout * 1000;
+    ticket->queued = 1;
+    user->queued++;
+    user->delayed++;
+    ticket->db->queued++;
+    ticket->db->delayed++;
+
+    /* tags only grow, so new tickets mostly land at the tail */
+    GList *l = adm->waiting.tail;
+    while (l) {
+        if (ADMISSION_TICKET(l)->tag <= ticket->tag) {
+            break;
+        }
+        l = l->prev;
+    }
+    if (l) {
+        g_queue_insert_after_link(&(adm->waiting), l, &(ticket->link));
+    } else {
+        g_queue_push_head_link(&(adm->waiting), &(ticket->link));
+    }
+}
+
+/**
+ * ask for a running slot for a query of @user on @db
+ *
+ * ADMISSION_QUEUED means the owner (ticket->link.data) is handed out by
+ * query_admission_leave once the ticket is admitted, it should also call
+ * query_admission_poll when ticket->deadline_usec is reached.
+ */
+admission_result_t
+query_admission_enter(query_admission_t *adm, admission_ticket_t *ticket,
+                      const char *user, const char *db, guint64 now)
+{
+    ticket->user = admission_get_tenant(adm->users, adm->user_limits, user);
+    ticket->db = admission_get_tenant(adm->dbs, adm->db_limits, db);
+    ticket->queued = 0;
+    ticket->admitted = 0;
+
+    /*
+     * queued tickets are either held back by the worker or by their own
+     * tenants, a query fitting now does not overtake anyone
+     */
+    if (!admission_worker_full(adm, now)
+        && !admission_tenant_full(ticket->user) && !admission_tenant_full(ticket->db))
+    {
+        admission_admit(adm, ticket);
+        return ADMISSION_OK;
+    }
+
+    if ((int)adm->waiting.length >= adm->max_queued) {
+        g_debug("%s:admission queue is full, user:%s", G_STRLOC, user);
+        ticket->user->rejected++;
+        ticket->db->rejected++;
+        return ADMISSION_REJECTED;
+    }
+
+    admission_enqueue(adm, ticket, now);
+    g_debug("%s:query of user:%s queued, tag:%llu", G_STRLOC, user, (unsigned long long)ticket->tag);
+
+    /* some query is running whenever one is queued, its leave serves the queue */
+    return ADMISSION_QUEUED;
+}
+
+admission_result_t
+query_admission_poll(query_admission_t *adm, admission_ticket_t *ticket, guint64 now)
+{
+    if (ticket->admitted) {
+        return ADMISSION_OK;
+    }
+    if (!ticket->queued) {
+        return ADMISSION_REJECTED;
+    }
+    if (now < ticket->deadline_usec) {
+        return ADMISSION_QUEUED;
+    }
+
+    g_queue_unlink(&(adm->waiting), &(ticket->link));
+    ticket->queued = 0;
+    ticket->user->queued--;
+    ticket->db->queued--;
+    ticket->user->timeouts++;
+    ticket->db->timeouts++;
+    ticket->user->wait_usec += now - ticket->enqueue_usec;
+    ticket->db->wait_usec += now - ticket->enqueue_usec;
+    return ADMISSION_TIMEOUT;
+}
+
+/**
+ * give back the slot of @ticket, or drop it from the queue
+ *
+ * @return owners of tickets admitted in turn, to be woken up
+ */
+GList *
+query_admission_leave(query_admission_t *adm, admission_ticket_t *ticket, guint64 now)
+{
+    if (ticket->queued) {
+        g_queue_unlink(&(adm->waiting), &(ticket->link));
+        ticket->queued = 0;
+        ticket->user->queued--;
+        ticket->db->queued--;
+        return NULL;
+    }
+    if (!ticket->admitted) {
+        return NULL;
+    }
+
+    ticket->admitted = 0;
+    ticket->user->running--;
+    ticket->db->running--;
+    adm->running--;
+
+    if (adm->waiting.length == 0) {
+        return NULL;
+    }
+    return admission_dispatch(adm, now);
+}
+
+void
+query_admission_note_shortage(query_admission_t *adm, guint64 now)
+{
+    adm->shortage_usec = now;
+}
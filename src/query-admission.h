@@ -0,0 +1,114 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _QUERY_ADMISSION_H_
+#define _QUERY_ADMISSION_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+#define ADMISSION_DEF_QUEUE_TIMEOUT 1000    /* ms */
+#define ADMISSION_DEF_MAX_QUEUED 1024
+/* name of the entry giving the limit of users and dbs not listed */
+#define ADMISSION_ANY_TENANT "*"
+#define ADMISSION_DEF_WEIGHT 1
+/* new queries are queued for a while after one waited for a backend */
+#define ADMISSION_SHORTAGE_WINDOW 50000 /* us */
+
+typedef enum {
+    ADMISSION_OK,
+    ADMISSION_QUEUED,
+    ADMISSION_REJECTED,
+    ADMISSION_TIMEOUT
+} admission_result_t;
+
+/**
+ * A user or a database sharing the running query slots of a worker.
+ */
+typedef struct admission_tenant_t {
+    gchar *name;
+    /* max running queries, 0 for no limit */
+    int limit;
+    /* share of the slots when queries are queued, users only */
+    guint weight;
+    int running;
+    int queued;
+    /* virtual finish time of the last query queued by the tenant */
+    guint64 finish_tag;
+
+    guint64 admitted;
+    guint64 delayed;
+    guint64 timeouts;
+    guint64 rejected;
+    guint64 wait_usec;
+} admission_tenant_t;
+
+/**
+ * Admission state of a client query, embedded in the connection.
+ */
+typedef struct admission_ticket_t {
+    admission_tenant_t *user;
+    admission_tenant_t *db;
+    guint64 tag;
+    guint64 enqueue_usec;
+    guint64 deadline_usec;
+    GList link;                 /* in the wait queue, data is the owner */
+    unsigned int queued:1;
+    unsigned int admitted:1;
+} admission_ticket_t;
+
+typedef struct query_admission_t {
+    /* name -> admission_tenant_t */
+    GHashTable *users;
+    GHashTable *dbs;
+    /* tickets ordered by tag, head is served first */
+    GQueue waiting;
+    /* tag of the last ticket served from the queue */
+    guint64 vtime;
+    int running;
+    /* max running queries of the worker, 0 for no limit */
+    int max_running;
+    int max_queued;
+    int queue_timeout;          /* ms */
+    /* last time a query waited for a backend connection */
+    guint64 shortage_usec;
+    /* parsed from "name:limit[:weight],..." */
+    GHashTable *user_limits;
+    GHashTable *db_limits;
+} query_admission_t;
+
+NETWORK_API query_admission_t *query_admission_new(void);
+NETWORK_API void query_admission_free(query_admission_t *adm);
+NETWORK_API gboolean query_admission_enabled(query_admission_t *adm);
+
+NETWORK_API gboolean query_admission_check_limits(const char *limits);
+NETWORK_API void query_admission_set_user_limits(query_admission_t *adm, const char *limits);
+NETWORK_API void query_admission_set_db_limits(query_admission_t *adm, const char *limits);
+NETWORK_API void query_admission_set_max_running(query_admission_t *adm, int max_running);
+
+NETWORK_API admission_result_t query_admission_enter(query_admission_t *adm, admission_ticket_t *ticket,
+                                                     const char *user, const char *db, guint64 now);
+NETWORK_API admission_result_t query_admission_poll(query_admission_t *adm, admission_ticket_t *ticket,
+                                                    guint64 now);
+NETWORK_API GList *query_admission_leave(query_admission_t *adm, admission_ticket_t *ticket, guint64 now);
+NETWORK_API void query_admission_note_shortage(query_admission_t *adm, guint64 now);
+
+#endif
@@ -0,0 +1,413 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "glib-ext.h"
+#include "cetus-util.h"
+#include "query-cache.h"
+
+/* each packet costs the GString header besides its payload */
+#define QUERY_CACHE_PACKET_OVERHEAD (sizeof(GString) + sizeof(GString *))
+
+static void
+query_cache_entry_free(query_cache_entry_t *entry)
+{
+    guint i;
+    for (i = 0; i < entry->packet_num; i++) {
+        g_string_free(entry->packets[i], TRUE);
+    }
+    g_free(entry->packets);
+    g_free(entry->key);
+    g_strfreev(entry->tables);
+    g_free(entry);
+}
+
+query_cache_entry_t *
+query_cache_entry_ref(query_cache_entry_t *entry)
+{
+    entry->refcount++;
+    return entry;
+}
+
+void
+query_cache_entry_unref(query_cache_entry_t *entry)
+{
+    if (entry == NULL) {
+        return;
+    }
+
+    entry->refcount--;
+    if (entry->refcount == 0) {
+        query_cache_entry_free(entry);
+    }
+}
+
+static void
+query_cache_table_free(query_cache_table_t *t)
+{
+    g_hash_table_destroy(t->entries);
+    g_free(t);
+}
+
+query_cache_t *
+query_cache_new(gsize max_bytes)
+{
+    query_cache_t *cache = g_new0(query_cache_t, 1);
+    int i;
+    for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        query_cache_shard_t *shard = &(cache->shards[i]);
+        shard->entries = g_hash_table_new(g_int64_hash, g_int64_equal);
+        g_queue_init(&(shard->lru));
+    }
+    cache->tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)query_cache_table_free);
+    cache->tables_prune_at = QUERY_CACHE_TABLES_PRUNE_MIN;
+    query_cache_set_max_bytes(cache, max_bytes);
+
+    return cache;
+}
+
+void
+query_cache_free(query_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    query_cache_clear(cache);
+
+    int i;
+    for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        g_hash_table_destroy(cache->shards[i].entries);
+    }
+    g_hash_table_destroy(cache->tables);
+    g_free(cache);
+}
+
+static void
+query_cache_detach(query_cache_t *cache, query_cache_shard_t *shard, query_cache_entry_t *entry)
+{
+    g_hash_table_remove(shard->entries, &(entry->hash));
+    g_queue_unlink(&(shard->lru), &(entry->lru_link));
+
+    gchar **name;
+    for (name = entry->tables; name && *name; name++) {
+        query_cache_table_t *t = g_hash_table_lookup(cache->tables, *name);
+        if (t) {
+            g_hash_table_remove(t->entries, entry);
+        }
+    }
+    shard->bytes -= entry->bytes;
+    cache->bytes -= entry->bytes;
+    cache->entry_num--;
+    query_cache_entry_unref(entry);
+}
+
+static void
+query_cache_shard_shrink(query_cache_t *cache, query_cache_shard_t *shard, gsize needed)
+{
+    while (shard->lru.tail && shard->bytes + needed > cache->shard_max_bytes) {
+        query_cache_entry_t *victim = shard->lru.tail->data;
+        g_debug("%s: evict cached item, bytes:%d", G_STRLOC, (int)victim->bytes);
+        query_cache_detach(cache, shard, victim);
+        cache->stats.evictions++;
+    }
+}
+
+void
+query_cache_set_max_bytes(query_cache_t *cache, gsize max_bytes)
+{
+    cache->max_bytes = max_bytes;
+    cache->shard_max_bytes = max_bytes / QUERY_CACHE_SHARDS;
+
+    int i;
+    for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        query_cache_shard_shrink(cache, &(cache->shards[i]), 0);
+    }
+}
+
+/**
+ * tables are matched case-insensitively, a case sensitive server only
+ * gets a few more invalidations
+ */
+gchar *
+query_cache_table_name(const char *db, const char *table)
+{
+    gchar *name = g_strdup_printf("%s.%s", db, table);
+    gchar *lower = g_ascii_strdown(name, -1);
+    g_free(name);
+    return lower;
+}
+
+guint64
+query_cache_hash_key(const char *sql, gsize sql_len, const char *user, const char *db)
+{
+    guint64 hash = cetus_hash64(sql, sql_len, 0);
+    hash = cetus_hash64(user, strlen(user), hash);
+    return cetus_hash64(db, strlen(db), hash);
+}
+
+static gboolean
+query_cache_key_equal(query_cache_entry_t *entry, const char *sql, gsize sql_len, const char *user, const char *db)
+{
+    gsize user_len = strlen(user);
+    gsize db_len = strlen(db);
+    if (entry->key_len != sql_len + user_len + db_len + 2) {
+        return FALSE;
+    }
+
+    const char *p = entry->key;
+    if (memcmp(p, sql, sql_len) != 0) {
+        return FALSE;
+    }
+    p += sql_len + 1;
+    if (memcmp(p, user, user_len) != 0) {
+        return FALSE;
+    }
+    p += user_len + 1;
+    return memcmp(p, db, db_len) == 0;
+}
+
+query_cache_entry_t *
+query_cache_lookup(query_cache_t *cache, guint64 hash, const char *sql, gsize sql_len,
+                   const char *user, const char *db, unsigned long long now_ms)
+{
+    query_cache_shard_t *shard = &(cache->shards[hash & QUERY_CACHE_SHARD_MASK]);
+    query_cache_entry_t *entry = g_hash_table_lookup(shard->entries, &hash);
+
+    if (entry == NULL || !query_cache_key_equal(entry, sql, sql_len, user, db)) {
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    if (entry->expire_ms <= now_ms) {
+        g_debug("%s:drop expired content from cache", G_STRLOC);
+        query_cache_detach(cache, shard, entry);
+        cache->stats.expirations++;
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    /* move to the head of lru */
+    if (shard->lru.head != &(entry->lru_link)) {
+        g_queue_unlink(&(shard->lru), &(entry->lru_link));
+        g_queue_push_head_link(&(shard->lru), &(entry->lru_link));
+    }
+    cache->stats.hits++;
+
+    return entry;
+}
+
+static gboolean
+query_cache_table_unused(gpointer key, gpointer value, gpointer user_data)
+{
+    query_cache_table_t *t = value;
+    return g_hash_table_size(t->entries) == 0;
+}
+
+/**
+ * drop the tables no cached entry reads, so written or temporary tables
+ * do not pile up
+ *
+ * their versions are forgotten, a missing table counts as written at
+ * prune_version instead
+ */
+static void
+query_cache_prune_tables(query_cache_t *cache)
+{
+    guint num = g_hash_table_foreach_remove(cache->tables, query_cache_table_unused, NULL);
+    cache->prune_version = cache->version;
+    cache->tables_prune_at = MAX(QUERY_CACHE_TABLES_PRUNE_MIN, 2 * g_hash_table_size(cache->tables));
+    g_debug("%s:drop %u tables without cached items", G_STRLOC, num);
+}
+
+static query_cache_table_t *
+query_cache_get_table(query_cache_t *cache, const char *name)
+{
+    query_cache_table_t *t = g_hash_table_lookup(cache->tables, name);
+    if (t == NULL) {
+        if (g_hash_table_size(cache->tables) >= cache->tables_prune_at) {
+            query_cache_prune_tables(cache);
+        }
+        t = g_new0(query_cache_table_t, 1);
+        t->entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_hash_table_insert(cache->tables, g_strdup(name), t);
+    }
+    return t;
+}
+
+/**
+ * check that none of @tables was written after @version was taken
+ */
+static gboolean
+query_cache_tables_unchanged(query_cache_t *cache, gchar **tables, guint64 version)
+{
+    if (cache->flush_version > version) {
+        return FALSE;
+    }
+
+    gchar **name;
+    for (name = tables; *name; name++) {
+        query_cache_table_t *t = g_hash_table_lookup(cache->tables, *name);
+        if (t == NULL) {
+            if (cache->prune_version > version) {
+                return FALSE;
+            }
+        } else if (t->version > version) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * take over all packets in @packets, the queue is left empty
+ *
+ * @tables is the NULL-terminated list of tables read by the query and is
+ * always taken over. @version is the cache version seen when the query
+ * was sent, the response is dropped if any table was written since then.
+ */
+gboolean
+query_cache_insert(query_cache_t *cache, guint64 hash, const char *sql, gsize sql_len,
+                   const char *user, const char *db, GQueue *packets, gsize bytes,
+                   unsigned long long expire_ms, gchar **tables, guint64 version)
+{
+    query_cache_shard_t *shard = &(cache->shards[hash & QUERY_CACHE_SHARD_MASK]);
+    guint packet_num = packets->length;
+    gsize user_len = strlen(user);
+    gsize db_len = strlen(db);
+    gsize key_len = sql_len + user_len + db_len + 2;
+    gsize total = bytes + key_len + sizeof(query_cache_entry_t) + packet_num * QUERY_CACHE_PACKET_OVERHEAD;
+
+    if (total > cache->shard_max_bytes || packet_num == 0) {
+        cache->stats.rejects++;
+        g_strfreev(tables);
+        return FALSE;
+    }
+
+    if (!query_cache_tables_unchanged(cache, tables, version)) {
+        g_debug("%s:table written while query in flight, not cached", G_STRLOC);
+        cache->stats.rejects++;
+        g_strfreev(tables);
+        return FALSE;
+    }
+
+    query_cache_entry_t *old = g_hash_table_lookup(shard->entries, &hash);
+    if (old) {
+        g_debug("%s:replace content in cache", G_STRLOC);
+        query_cache_detach(cache, shard, old);
+    }
+
+    query_cache_shard_shrink(cache, shard, total);
+
+    query_cache_entry_t *entry = g_new0(query_cache_entry_t, 1);
+    entry->hash = hash;
+    entry->key_len = key_len;
+    entry->key = g_malloc(key_len + 1);
+    memcpy(entry->key, sql, sql_len);
+    entry->key[sql_len] = '\0';
+    memcpy(entry->key + sql_len + 1, user, user_len + 1);
+    memcpy(entry->key + sql_len + 1 + user_len + 1, db, db_len + 1);
+    entry->packets = g_new(GString *, packet_num);
+    entry->packet_num = packet_num;
+    guint i;
+    for (i = 0; i < packet_num; i++) {
+        entry->packets[i] = g_queue_pop_head(packets);
+    }
+    entry->bytes = total;
+    entry->expire_ms = expire_ms;
+    entry->refcount = 1;
+    entry->lru_link.data = entry;
+    entry->tables = tables;
+
+    gchar **name;
+    for (name = tables; *name; name++) {
+        query_cache_table_t *t = query_cache_get_table(cache, *name);
+        g_hash_table_insert(t->entries, entry, entry);
+    }
+
+    g_hash_table_insert(shard->entries, &(entry->hash), entry);
+    g_queue_push_head_link(&(shard->lru), &(entry->lru_link));
+    shard->bytes += total;
+    cache->bytes += total;
+    cache->entry_num++;
+    cache->stats.inserts++;
+
+    return TRUE;
+}
+
+void
+query_cache_remove(query_cache_t *cache, guint64 hash)
+{
+    query_cache_shard_t *shard = &(cache->shards[hash & QUERY_CACHE_SHARD_MASK]);
+    query_cache_entry_t *entry = g_hash_table_lookup(shard->entries, &hash);
+    if (entry) {
+        query_cache_detach(cache, shard, entry);
+    }
+}
+
+void
+query_cache_clear(query_cache_t *cache)
+{
+    cache->version++;
+    cache->flush_version = cache->version;
+
+    int i;
+    for (i = 0; i < QUERY_CACHE_SHARDS; i++) {
+        query_cache_shard_t *shard = &(cache->shards[i]);
+        while (shard->lru.head) {
+            query_cache_detach(cache, shard, shard->lru.head->data);
+        }
+    }
+
+    /* nothing in flight gets cached past the flush, versions are not needed */
+    g_hash_table_remove_all(cache->tables);
+}
+
+/**
+ * drop all entries reading @table ("db.table")
+ *
+ * @return the number of dropped entries
+ */
+guint
+query_cache_invalidate_table(query_cache_t *cache, const char *table)
+{
+    cache->version++;
+    cache->stats.invalidations++;
+
+    query_cache_table_t *t = query_cache_get_table(cache, table);
+    t->version = cache->version;
+
+    guint num = g_hash_table_size(t->entries);
+    if (num > 0) {
+        GList *entries = g_hash_table_get_keys(t->entries);
+        GList *l;
+        for (l = entries; l; l = l->next) {
+            query_cache_entry_t *entry = l->data;
+            query_cache_detach(cache, &(cache->shards[entry->hash & QUERY_CACHE_SHARD_MASK]), entry);
+        }
+        g_list_free(entries);
+    }
+    g_debug("%s:invalidate %u cached items for table:%s", G_STRLOC, num, table);
+
+    return num;
+}
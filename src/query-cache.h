@@ -0,0 +1,127 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _QUERY_CACHE_H_
+#define _QUERY_CACHE_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+#define QUERY_CACHE_SHARDS 16
+#define QUERY_CACHE_SHARD_MASK (QUERY_CACHE_SHARDS - 1)
+#define QUERY_CACHE_DEF_SIZE (64 * 1024 * 1024)
+/* tables without cached entries are dropped once there are this many tables */
+#define QUERY_CACHE_TABLES_PRUNE_MIN 1024
+/* stands for every table in a set of written tables */
+#define QUERY_CACHE_ALL_TABLES "*"
+
+/**
+ * A cached response.
+ *
+ * Packets are immutable once the entry is published. Sockets sending
+ * a cache hit borrow the packets and hold a reference on the entry
+ * until they are written out, so eviction never frees data in flight.
+ */
+typedef struct query_cache_entry_t {
+    guint64 hash;
+    gchar *key;                 /* sql \0 user \0 db, for collision checks */
+    gsize key_len;
+    GString **packets;
+    guint packet_num;
+    gsize bytes;
+    unsigned long long expire_ms;
+    int refcount;
+    GList lru_link;             /* intrusive link in the shard lru list */
+    gchar **tables;             /* "db.table" names read by the query */
+} query_cache_entry_t;
+
+/**
+ * Entries reading one table, dropped together when the table is written.
+ */
+typedef struct query_cache_table_t {
+    /* query_cache_entry_t set */
+    GHashTable *entries;
+    /* cache version when the table was last invalidated */
+    guint64 version;
+} query_cache_table_t;
+
+typedef struct query_cache_shard_t {
+    /* guint64 hash -> query_cache_entry_t */
+    GHashTable *entries;
+    /* head is the most recently used entry */
+    GQueue lru;
+    gsize bytes;
+} query_cache_shard_t;
+
+typedef struct query_cache_stats_t {
+    guint64 hits;
+    guint64 misses;
+    guint64 inserts;
+    guint64 evictions;
+    guint64 expirations;
+    guint64 rejects;
+    guint64 invalidations;
+} query_cache_stats_t;
+
+typedef struct query_cache_t {
+    query_cache_shard_t shards[QUERY_CACHE_SHARDS];
+    gsize max_bytes;
+    gsize shard_max_bytes;
+    gsize bytes;
+    guint entry_num;
+    /* "db.table" -> query_cache_table_t */
+    GHashTable *tables;
+    /* bumped on every invalidation */
+    guint64 version;
+    /* version of the last full flush */
+    guint64 flush_version;
+    /* version when tables without entries were last dropped */
+    guint64 prune_version;
+    /* table count which triggers the next drop */
+    guint tables_prune_at;
+    query_cache_stats_t stats;
+} query_cache_t;
+
+NETWORK_API query_cache_t *query_cache_new(gsize max_bytes);
+NETWORK_API void query_cache_free(query_cache_t *cache);
+NETWORK_API void query_cache_set_max_bytes(query_cache_t *cache, gsize max_bytes);
+
+NETWORK_API gchar *query_cache_table_name(const char *db, const char *table);
+NETWORK_API guint64 query_cache_hash_key(const char *sql, gsize sql_len, const char *user, const char *db);
+
+NETWORK_API query_cache_entry_t *query_cache_lookup(query_cache_t *cache, guint64 hash,
+                                                    const char *sql, gsize sql_len,
+                                                    const char *user, const char *db,
+                                                    unsigned long long now_ms);
+
+NETWORK_API gboolean query_cache_insert(query_cache_t *cache, guint64 hash,
+                                        const char *sql, gsize sql_len, const char *user, const char *db,
+                                        GQueue *packets, gsize bytes, unsigned long long expire_ms,
+                                        gchar **tables, guint64 version);
+
+NETWORK_API void query_cache_remove(query_cache_t *cache, guint64 hash);
+NETWORK_API void query_cache_clear(query_cache_t *cache);
+NETWORK_API guint query_cache_invalidate_table(query_cache_t *cache, const char *table);
+
+NETWORK_API query_cache_entry_t *query_cache_entry_ref(query_cache_entry_t *entry);
+NETWORK_API void query_cache_entry_unref(query_cache_entry_t *entry);
+
+#endif
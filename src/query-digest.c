@@ -0,0 +1,280 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "query-digest.h"
+#include "chassis-stats.h"
+
+/* worker local: digest -> entry of its own slot */
+static GHashTable *digest_index;
+static query_digest_slot_t *digest_slot;
+
+static gsize
+query_digest_bytes(int size, int worker_num, gsize *slot_bytes)
+{
+    gsize bytes = sizeof(query_digest_slot_t) + sizeof(query_digest_entry_t) * size;
+    bytes = (bytes + CHASSIS_CACHE_LINE_SIZE - 1) & ~((gsize)CHASSIS_CACHE_LINE_SIZE - 1);
+    if (slot_bytes) {
+        *slot_bytes = bytes;
+    }
+    return sizeof(query_digest_t) + bytes * worker_num;
+}
+
+/**
+ * must be created before forking the workers
+ *
+ * @param size  max fingerprints kept by each worker
+ */
+query_digest_t *
+query_digest_new(int size, int worker_num)
+{
+    gsize slot_bytes;
+    query_digest_t *qd = chassis_shm_alloc(query_digest_bytes(size, worker_num, &slot_bytes));
+    if (qd == NULL) {
+        g_critical("%s:digest table disabled", G_STRLOC);
+        return NULL;
+    }
+    qd->size = size;
+    qd->worker_num = worker_num;
+    qd->slot_bytes = slot_bytes;
+
+    return qd;
+}
+
+void
+query_digest_free(query_digest_t *qd)
+{
+    if (qd) {
+        chassis_shm_free(qd, query_digest_bytes(qd->size, qd->worker_num, NULL));
+    }
+}
+
+query_digest_slot_t *
+query_digest_get_slot(query_digest_t *qd, int worker)
+{
+    if (worker < 0 || worker >= qd->worker_num) {
+        return NULL;
+    }
+    return (query_digest_slot_t *)(qd->slots + qd->slot_bytes * worker);
+}
+
+static void
+query_digest_clear_slot(query_digest_t *qd)
+{
+    digest_slot->used = 0;
+    digest_slot->evicted = 0;
+    digest_slot->lost = 0;
+    digest_slot->generation = qd->generation;
+    g_hash_table_remove_all(digest_index);
+}
+
+/**
+ * called by a worker when it starts, a respawned worker starts over
+ */
+void
+query_digest_attach(query_digest_t *qd, int worker)
+{
+    digest_slot = query_digest_get_slot(qd, worker);
+    if (digest_slot == NULL) {
+        return;
+    }
+    if (digest_index == NULL) {
+        digest_index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    }
+    query_digest_clear_slot(qd);
+    digest_slot->pid = getpid();
+}
+
+/**
+ * the least used of a few entries taken at random, an older one on ties
+ *
+ * scanning the whole slot would touch every entry on each new
+ * fingerprint while the statements keep changing
+ */
+static query_digest_entry_t *
+query_digest_evict(query_digest_t *qd)
+{
+    query_digest_entry_t *victim = NULL;
+    int i;
+    for (i = 0; i < QUERY_DIGEST_EVICT_SAMPLES; i++) {
+        query_digest_entry_t *e = &(digest_slot->entries[g_random_int_range(0, qd->size)]);
+        if (victim == NULL || e->count < victim->count ||
+            (e->count == victim->count && e->last_seen < victim->last_seen)) {
+            victim = e;
+        }
+    }
+
+    g_hash_table_remove(digest_index, &(victim->digest));
+    digest_slot->evicted++;
+    digest_slot->lost += victim->count;
+    return victim;
+}
+
+void
+query_digest_record(query_digest_t *qd, const sql_digest_t *d, guint64 usec,
+                    guint64 rows, guint64 bytes, gboolean is_err, guint fanout)
+{
+    if (digest_slot == NULL || d->text->len == 0) {
+        return;
+    }
+    if (digest_slot->generation != qd->generation) {
+        query_digest_clear_slot(qd);
+    }
+
+    time_t now = time(0);
+    query_digest_entry_t *e = g_hash_table_lookup(digest_index, &(d->hash));
+    if (e == NULL) {
+        gboolean is_full = digest_slot->used >= qd->size;
+        guint32 seq = 0;
+        if (is_full) {
+            e = query_digest_evict(qd);
+            seq = e->seq & ~1U;
+            e->seq = seq + 1;
+            __sync_synchronize();
+        } else {
+            e = &(digest_slot->entries[digest_slot->used]);
+        }
+        memset((char *)e + sizeof(e->seq), 0, sizeof(*e) - sizeof(e->seq));
+        e->digest = d->hash;
+        e->text_len = MIN(d->text->len, sizeof(e->text) - 1);
+        memcpy(e->text, d->text->str, e->text_len);
+        e->first_seen = now;
+        __sync_synchronize();
+        if (is_full) {
+            e->seq = seq + 2;
+        } else {
+            digest_slot->used++;
+        }
+        g_hash_table_insert(digest_index, &(e->digest), e);
+    }
+
+    e->count++;
+    e->total_usec += usec;
+    e->max_usec = MAX(e->max_usec, usec);
+    e->rows += rows;
+    e->bytes += bytes;
+    e->errors += is_err ? 1 : 0;
+    e->fanout += fanout;
+    e->max_fanout = MAX(e->max_fanout, fanout);
+    e->last_seen = now;
+}
+
+void
+query_digest_reset(query_digest_t *qd)
+{
+    __sync_fetch_and_add(&(qd->generation), 1);
+}
+
+/* an entry being handed over is skipped after a few tries */
+static gboolean
+query_digest_read_entry(const query_digest_entry_t *e, query_digest_entry_t *snap)
+{
+    int tries;
+    for (tries = 0; tries < 16; tries++) {
+        guint32 seq = e->seq;
+        if (seq & 1) {
+            continue;
+        }
+        __sync_synchronize();
+        memcpy(snap, (const void *)e, sizeof(*snap));
+        __sync_synchronize();
+        if (e->seq == seq) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gint
+query_digest_cmp_total(gconstpointer a, gconstpointer b)
+{
+    const query_digest_entry_t *e1 = *(query_digest_entry_t **)a;
+    const query_digest_entry_t *e2 = *(query_digest_entry_t **)b;
+    if (e1->total_usec == e2->total_usec) {
+        return 0;
+    }
+    return e1->total_usec < e2->total_usec ? 1 : -1;
+}
+
+/**
+ * merge the entries of all workers by digest
+ *
+ * @param num      max entries returned, the ones with the largest total time
+ * @param evicted  fingerprints the workers evicted for new ones
+ * @param lost     statements of the evicted fingerprints
+ * @return array of query_digest_entry_t, to be freed by the caller
+ */
+GPtrArray *
+query_digest_top(query_digest_t *qd, guint num, guint64 *evicted, guint64 *lost)
+{
+    GHashTable *merged = g_hash_table_new(g_int64_hash, g_int64_equal);
+    GPtrArray *result = g_ptr_array_new_with_free_func(g_free);
+    *evicted = 0;
+    *lost = 0;
+
+    int i;
+    for (i = 0; i < qd->worker_num; i++) {
+        query_digest_slot_t *slot = query_digest_get_slot(qd, i);
+        if (slot->pid == 0 || slot->generation != qd->generation) {
+            continue;
+        }
+        *evicted += slot->evicted;
+        *lost += slot->lost;
+
+        guint used = MIN(slot->used, (guint)qd->size);
+        __sync_synchronize();
+        guint j;
+        for (j = 0; j < used; j++) {
+            query_digest_entry_t snap;
+            if (!query_digest_read_entry(&(slot->entries[j]), &snap)) {
+                continue;
+            }
+            query_digest_entry_t *e = &snap;
+            query_digest_entry_t *m = g_hash_table_lookup(merged, &(e->digest));
+            if (m == NULL) {
+                m = g_memdup(e, sizeof(*e));
+                g_ptr_array_add(result, m);
+                g_hash_table_insert(merged, &(m->digest), m);
+                continue;
+            }
+            m->count += e->count;
+            m->total_usec += e->total_usec;
+            m->max_usec = MAX(m->max_usec, e->max_usec);
+            m->rows += e->rows;
+            m->bytes += e->bytes;
+            m->errors += e->errors;
+            m->fanout += e->fanout;
+            m->max_fanout = MAX(m->max_fanout, e->max_fanout);
+            m->first_seen = MIN(m->first_seen, e->first_seen);
+            m->last_seen = MAX(m->last_seen, e->last_seen);
+        }
+    }
+    g_hash_table_destroy(merged);
+
+    g_ptr_array_sort(result, query_digest_cmp_total);
+    if (result->len > num) {
+        g_ptr_array_set_size(result, num);
+    }
+    return result;
+}
@@ -0,0 +1,101 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifndef _QUERY_DIGEST_H_
+#define _QUERY_DIGEST_H_
+
+#include <time.h>
+#include <sys/types.h>
+
+#include <glib.h>
+
+#include "network-exports.h"
+#include "sql-digest.h"
+
+#define QUERY_DIGEST_DEF_SIZE 1024
+/* entries sampled for the least used one when a slot is full */
+#define QUERY_DIGEST_EVICT_SAMPLES 8
+
+/**
+ * Statistics of the statements sharing one fingerprint.
+ *
+ * seq is odd while the entry is handed over to another fingerprint.
+ */
+typedef struct query_digest_entry_t {
+    volatile guint32 seq;
+    guint64 digest;
+    guint64 count;
+    guint64 total_usec;
+    guint64 max_usec;
+    guint64 rows;               /* rows returned or affected by the backends */
+    guint64 bytes;              /* bytes sent to the clients */
+    guint64 errors;
+    guint64 fanout;             /* backends touched, summed over the statements */
+    guint32 max_fanout;
+    guint32 text_len;
+    time_t first_seen;
+    time_t last_seen;
+    char text[SQL_DIGEST_MAX_LEN + 4];
+} query_digest_entry_t;
+
+/**
+ * Entries recorded by one worker, only written by that worker.
+ *
+ * An entry is filled before used is bumped, readers in other processes
+ * never see a half-made fingerprint, counters may be one statement late.
+ * Once the slot is full, the least used of a few sampled entries makes
+ * room for a new fingerprint.
+ */
+typedef struct query_digest_slot_t {
+    pid_t pid;
+    guint generation;           /* table generation the entries belong to */
+    guint used;
+    guint64 evicted;            /* fingerprints evicted, the slot is full */
+    guint64 lost;               /* statements of the evicted fingerprints */
+    query_digest_entry_t entries[0];
+} query_digest_slot_t;
+
+/**
+ * Per worker digest tables in shared memory, read by the admin in the
+ * master without asking the workers.
+ *
+ * Resetting only bumps the generation, each worker clears its own slot
+ * before recording the next statement.
+ */
+typedef struct query_digest_t {
+    int size;                   /* entries per worker */
+    int worker_num;
+    volatile guint generation;
+    gsize slot_bytes;
+    char slots[0];
+} query_digest_t;
+
+NETWORK_API query_digest_t *query_digest_new(int size, int worker_num);
+NETWORK_API void query_digest_free(query_digest_t *qd);
+
+NETWORK_API void query_digest_attach(query_digest_t *qd, int worker);
+NETWORK_API void query_digest_record(query_digest_t *qd, const sql_digest_t *d, guint64 usec,
+                                     guint64 rows, guint64 bytes, gboolean is_err, guint fanout);
+NETWORK_API void query_digest_reset(query_digest_t *qd);
+
+NETWORK_API query_digest_slot_t *query_digest_get_slot(query_digest_t *qd, int worker);
+NETWORK_API GPtrArray *query_digest_top(query_digest_t *qd, guint num, guint64 *evicted, guint64 *lost);
+
+#endif
@@ -28,9 +28,11 @@
 #include <time.h>
 #include <stdio.h>
 #include <math.h>
+#include <errno.h>
 
 #include <mysqld_error.h>
 #include "glib-ext.h"
+#include "cetus-util.h"
 #include "network-mysqld-packet.h"
 #include "sys-pedantic.h"
 #include "resultset_merge.h"
@@ -71,12 +73,8 @@ const char *type_name[] = {
     "FIELD_TYPE_GEOMETRY"       //0xff   
 };
 
-#define MAX_PACK_LEN 2048
 #define MAX_COL_VALUE_LEN 512
 
-#define PRIOR_TO 1
-#define NOR_REL 0
-
 typedef struct cetus_result_t {
     network_mysqld_proto_fielddefs_t *fielddefs;
 
@@ -96,8 +94,6 @@ cetus_result_destroy(cetus_result_t *res)
     }
 }
 
-static int compare_records_from_column(char *, char *, int, int, int *);
-
 static int
 check_str_num_supported(char *s, int len, char **p)
 {
@@ -278,247 +274,6 @@ cmp_str_num(char *s1, int len1, char *s2, int len2, int *compare_failed)
     }
 }
 
-static int
-padding_zero(char *s1, int *p_len1, int size1, char *s2, int *p_len2, int size2)
-{
-    char *p = NULL, *q = NULL;
-
-    int len1 = *p_len1;
-    int len2 = *p_len2;
-
-    if (len1 == 0) {
-        s1[0] = '0';
-        len1 = 1;
-        *p_len1 = len1;
-    } else {
-        p = strchr(s1, '.');
-    }
-
-    if (len2 == 0) {
-        s2[0] = '0';
-        len2 = 1;
-        *p_len2 = len2;
-    } else {
-        q = strchr(s2, '.');
-    }
-
-    if (p == NULL && q == NULL) {
-        return 1;
-    }
-
-    int s1_int_len, s2_int_len;
-    int short_len1 = 0, short_len2 = 0;
-    char *short1, *short2;
-
-    if (p == NULL) {
-        s1_int_len = len1;
-        s1[len1] = '.';
-        *p_len1 = (*p_len1) + 1;
-        short1 = s1 + len1 + 1;
-    } else {
-        s1_int_len = p - s1;
-        short1 = p + 1;
-        short_len1 = len1 - s1_int_len - 1;
-    }
-
-    if (q == NULL) {
-        s2_int_len = len2;
-        s2[len2] = '.';
-        *p_len2 = (*p_len2) + 1;
-        short2 = s2 + len2 + 1;
-    } else {
-        s2_int_len = q - s2;
-        short2 = q + 1;
-        short_len2 = len2 - s2_int_len - 1;
-    }
-
-    char *padding;
-    int pad_len, new_str_len;
-    if (short_len1 == short_len2) {
-        return 1;
-    } else if (short_len1 < short_len2) {
-        padding = short1 + short_len1;
-        pad_len = short_len2 - short_len1;
-        new_str_len = (*p_len1) + pad_len;
-        if (new_str_len >= size1) {
-            return 0;
-        }
-        *p_len1 = new_str_len;
-    } else {
-        padding = short2 + short_len2;
-        pad_len = short_len1 - short_len2;
-        new_str_len = (*p_len2) + pad_len;
-        if (new_str_len >= size2) {
-            return 0;
-        }
-        *p_len2 = new_str_len;
-    }
-
-    int i;
-
-    for (i = 0; i < pad_len; i++) {
-        padding[i] = '0';
-    }
-
-    return 1;
-}
-
-static int
-compare_str_num_value(char *str1, char *str2, int com_type, int *dest, int desc, int *compare_failed)
-{
-    int len1 = strlen(str1);
-    int len2 = strlen(str2);
-
-    if (!padding_zero(str1, &len1, MAX_COL_VALUE_LEN, str2, &len2, MAX_COL_VALUE_LEN)) {
-        *compare_failed = 1;
-        return 0;
-    }
-
-    int result = cmp_str_num(str1, len1, str2, len2, compare_failed);
-
-    g_debug("%s:string str1:%s, str2:%s, cmp result:%d", G_STRLOC, str1, str2, result);
-
-    if (result == 0) {
-        return 1;
-    }
-
-    if ((desc && result > 0) || (!desc && result < 0)) {
-        *dest = 1;
-        return 0;
-    }
-
-    if ((desc && result < 0) || (!desc && result > 0)) {
-        if (com_type == PRIOR_TO) {
-            *dest = 0;
-        } else {
-            *dest = -1;
-        }
-        return 0;
-    }
-
-    g_critical("%s: reach the unreachable place", G_STRLOC);
-    return 0;
-}
-
-static int
-compare_date(char *str1, char *str2, int com_type, int *result, int desc)
-{
-    if (str1[0] == '\0') {
-        strcpy(str1, EPOCH);
-    }
-
-    if (str2[0] == '\0') {
-        strcpy(str2, EPOCH);
-    }
-
-    struct tm tm1 = { 0 };
-    struct tm tm2 = { 0 };
-    g_debug("%s:data1:%s, data2:%s", G_STRLOC, str1, str2);
-    strptime(str1, "%Y-%m-%d", &tm1);
-    strptime(str2, "%Y-%m-%d", &tm2);
-
-    int diff[6];
-    diff[0] = tm1.tm_year - tm2.tm_year;
-    diff[1] = tm1.tm_mon - tm2.tm_mon;
-    diff[2] = tm1.tm_mday - tm2.tm_mday;
-
-    g_debug("%s:diff0:%d, diff1:%d, diff2:%d", G_STRLOC, diff[0], diff[1], diff[2]);
-    int p;
-    for (p = 0; p < 3; p++) {
-        if ((desc && diff[p] > 0) || (!desc && diff[p] < 0)) {
-            *result = 1;
-            return 0;
-        }
-
-        if ((desc && diff[p] < 0) || (!desc && diff[p] > 0)) {
-            if (com_type == PRIOR_TO) {
-                *result = 0;
-            } else {
-                *result = -1;
-            }
-            return 0;
-        }
-    }
-
-    return 1;
-}
-
-static int
-compare_time(char *str1, char *str2, int com_type, int *result, int desc)
-{
-    if (str1[0] == '\0') {
-        strcpy(str1, EPOCH);
-    }
-
-    if (str2[0] == '\0') {
-        strcpy(str2, EPOCH);
-    }
-
-    struct tm tm1 = { 0 };
-    struct tm tm2 = { 0 };
-
-    strptime(str1, "%H:%M:%S", &tm1);
-    strptime(str2, "%H:%M:%S", &tm2);
-
-    int diff[3];
-    diff[0] = tm1.tm_hour - tm2.tm_hour;
-    diff[1] = tm1.tm_min - tm2.tm_min;
-    diff[2] = tm1.tm_sec - tm2.tm_sec;
-
-    int p;
-    for (p = 0; p < 3; p++) {
-        if ((desc && diff[p] > 0) || (!desc && diff[p] < 0)) {
-            *result = 1;
-            return 0;
-        }
-
-        if ((desc && diff[p] < 0) || (!desc && diff[p] > 0)) {
-            if (com_type == PRIOR_TO) {
-                *result = 0;
-            } else {
-                *result = -1;
-            }
-
-            return 0;
-        }
-    }
-
-    return 1;
-}
-
-static int
-compare_year(char *str1, char *str2, int com_type, int *result, int desc)
-{
-    if (str1[0] == '\0') {
-        strcpy(str1, EPOCH);
-    }
-
-    if (str2[0] == '\0') {
-        strcpy(str2, EPOCH);
-    }
-
-    long y1 = atol(str1);
-    long y2 = atol(str2);
-
-    if (y1 == y2) {
-        return 1;
-    }
-
-    if (desc) {
-        *result = y1 > y2;
-    } else {
-        *result = y1 < y2;
-    }
-
-    if (com_type != PRIOR_TO) {
-        if (*result == 0) {
-            *result = -1;
-        }
-    }
-
-    return 0;
-}
-
 /* skip some column (lenenc_str or NULL) */
 static inline gint
 skip_field(network_packet *packet, guint skip)
@@ -542,68 +297,6 @@ skip_field(network_packet *packet, guint skip)
     return 0;
 }
 
-#define MAX_ORDER_BY_ITEMS 32
-
-/**
- * @breif For all ORDER-BY columns, get their offsets inside Row-Packet
- * @return At most 4 offset values embedded in a 64-bit integer: 4 * int16_t --> int64_t
- */
-static guint64
-get_field_offsets(network_packet *packet, ORDER_BY order_array[], int order_array_size)
-{
-    int i, max_pos = 0;
-    int orderby_count = MIN(order_array_size, 4);
-
-    for (i = 0; i < orderby_count; i++) {
-        if (order_array[i].pos > max_pos) {
-            max_pos = order_array[i].pos;
-        }
-    }
-
-    if (max_pos > MAX_ORDER_BY_ITEMS) {
-        return 0;
-    }
-
-    unsigned char map[MAX_ORDER_BY_ITEMS] = { 0 };  /* field pos ==> order by pos */
-    for (i = 0; i < orderby_count; i++) {
-        /* hack: add 1 for existence probing */
-        map[order_array[i].pos] = i + 1;
-    }
-
-    guint64 value = 0;
-    if (max_pos == 0) {
-        value = NET_HEADER_SIZE;
-    }
-
-    guint iter;
-    for (iter = 0; iter < max_pos; iter++) {
-        if (packet->data->str[packet->offset] == (char)MYSQLD_PACKET_NULL) {
-            network_mysqld_proto_skip(packet, 1);
-        } else {
-            if (network_mysqld_proto_skip_lenenc_str(packet) == -1) {
-                return 0;
-            }
-        }
-        size_t next_iter = iter + 1;
-        if (next_iter < MAX_ORDER_BY_ITEMS && map[next_iter]) {
-            int seq = map[next_iter] - 1;
-            guint64 new_value = packet->offset;
-            g_debug("offset value:%ld, seq=%d, iter=%d %p", new_value, seq, iter, packet->data);
-            if (new_value <= 0xFFFF) {
-                int j;
-                for (j = 0; j < seq; j++) {
-                    new_value = new_value << 16;
-                }
-
-                value += new_value;
-            }
-            g_debug("part all value set:%ld for %p", value, packet->data);
-        }
-    }
-
-    return value;
-}
-
 /**
  *      OK Packet                   0x00
  *      Error Packet                0xff  255
@@ -630,1658 +323,1827 @@ retrieve_aggr_value(GString *data, int pos, char *str)
     return str;
 }
 
-static char *
-str_int_add(char *merged_int, char *s1, int len1, char *s2, int len2, int carry)
+/* find index of field by name, the name might be an alias */
+static int
+cetus_result_find_fielddef(cetus_result_t *res, const char *table, const char *field)
 {
-    char *large = s2;
-    int len = len1;
-    int max_len = len2;
-
-    if (len1 > len2) {
-        len = len2;
-        max_len = len1;
-        large = s1;
-    }
-
-    char *p = s1 + len1 - 1;
-    char *q = s2 + len2 - 1;
-    char *dest = merged_int + max_len;
-    int tmp = carry;
     int i;
-    for (i = len - 1; i >= 0; i--) {
-        tmp += *p - '0' + *q - '0';
-        *dest = tmp % 10 + '0';
-        tmp = tmp / 10;
-        p--;
-        q--;
-        dest--;
-    }
-
-    len = max_len - len;
-    if (len == 0) {
-        *dest = tmp + '0';
-    } else {
-        large = large + len - 1;
-        for (i = len - 1; i >= 0; i--) {
-            tmp += *large - '0';
-            *dest = tmp % 10 + '0';
-            tmp = tmp / 10;
-            large--;
-            dest--;
+    for (i = 0; i < res->fielddefs->len; ++i) {
+        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res->fielddefs, i);
+        if (table && table[0] != '\0') {
+            if ((fdef->table && strcmp(table, fdef->table) == 0)
+                || (fdef->org_table && strcmp(table, fdef->org_table) == 0)) {
+                if ((fdef->name && strcmp(field, fdef->name) == 0)
+                    || (fdef->org_name && strcmp(field, fdef->org_name) == 0))
+                    return i;
+            }
+        } else {
+            if ((fdef->name && strcmp(field, fdef->name) == 0)
+                || (fdef->org_name && strcmp(field, fdef->org_name) == 0))
+                return i;
         }
-
-        *dest = tmp + '0';
     }
-
-    return merged_int;
+    return -1;
 }
 
-static char *
-str_int_sub(char *merged_int, char *s1, int len1, char *s2, int len2, int borrow)
+static gboolean
+cetus_result_parse_fielddefs(cetus_result_t *res_merge, GQueue *input)
 {
-    char *p = s1 + len1 - 1;
-    char *q = s2 + len2 - 1;
-    char *dest = merged_int + len1 - 1;
-    int tmp = 0;
-    int i;
-    for (i = len2 - 1; i >= 0; i--) {
-        tmp = (*p - '0') - (*q - '0') - borrow;
-        if (tmp < 0) {
-            borrow = 1;
-            tmp = tmp + 10;
-        } else {
-            borrow = 0;
-        }
-
-        *dest = tmp + '0';
-        p--;
-        q--;
-        dest--;
+    if (res_merge->field_count >= input->length) {
+        g_critical("%s: res_merge->field_count:%d, queue length:%d",
+                G_STRLOC, res_merge->field_count, input->length);
+        return FALSE;
     }
 
-    int len = len1 - len2;
-    if (len != 0) {
-        char *large = s1 + len - 1;
-        for (i = len - 1; i >= 0; i--) {
-            tmp = (*large - '0') - borrow;
-            if (tmp < 0) {
-                borrow = 1;
-                tmp = tmp + 10;
-            } else {
-                borrow = 0;
-            }
-            *dest = tmp + '0';
-            large--;
-            dest--;
+    network_packet packet = { 0 };
+
+    res_merge->fielddefs = g_ptr_array_new_with_free_func((GDestroyNotify)network_mysqld_proto_fielddef_free);
+    int i;
+    for (i = 0; i < res_merge->field_count; ++i) {
+        /* TODO g_queue_peek_nth is not efficient*/
+        packet.data = g_queue_peek_nth(input, i + 1);
+        packet.offset = 0;
+        network_mysqld_proto_skip_network_header(&packet);
+        network_mysqld_proto_fielddef_t *fdef;
+        fdef = network_mysqld_proto_fielddef_new();
+        int err = network_mysqld_proto_get_fielddef(&packet, fdef, CLIENT_PROTOCOL_41);
+        if (err) {
+            network_mysqld_proto_fielddef_free(fdef);
+            g_ptr_array_free(res_merge->fielddefs, TRUE);
+            res_merge->fielddefs = NULL;
+            return FALSE;
         }
+        g_ptr_array_add(res_merge->fielddefs, fdef);
     }
 
-    return merged_int;
+    return TRUE;
 }
 
-static char *
-str_decimal_add(char *merged_value, char *s1, int len1, char *s2, int len2)
+static gboolean
+cetus_result_retrieve_field_count(GQueue *input, guint64 *p_field_count)
 {
-    char *p, *q;
-
-    p = strchr(s1, '.');
-    q = strchr(s2, '.');
-
-    if (p != NULL && q != NULL) {
-        p[0] = '\0';
-        q[0] = '\0';
-
-        int s1_int_len = p - s1;
-        int s2_int_len = q - s2;
-
-        int int_len;
-        if (s1_int_len < s2_int_len) {
-            int_len = s2_int_len;
-        } else {
-            int_len = s1_int_len;
-        }
-
-        char *short1 = p + 1;
-        char *short2 = q + 1;
-        char *merged_short = merged_value + int_len + 1;
-
-        merged_short[0] = '.';
-        merged_short++;
-
-        int short_len = len1 - s1_int_len - 1;
-
-        int i;
-
-        int tmp = 0;
-        for (i = short_len - 1; i >= 0; i--) {
-            tmp += short1[i] - '0' + short2[i] - '0';
-            merged_short[i] = tmp % 10 + '0';
-            tmp = tmp / 10;
-        }
-
-        str_int_add(merged_value, s1, s1_int_len, s2, s2_int_len, tmp);
-
-        p[0] = '.';
-        q[0] = '.';
-
-    } else {
-        str_int_add(merged_value, s1, len1, s2, len2, 0);
+    g_debug("%s:call cetus_result_retrieve_field_count", G_STRLOC);
+    int packet_count = g_queue_get_length(input);
+    network_packet packet = { 0 };
+    packet.data = g_queue_peek_head(input); /* Number-of-Field packet */
+    int err = network_mysqld_proto_skip_network_header(&packet);
+    guint64 field_count;
+    err |= network_mysqld_proto_get_lenenc_int(&packet, &field_count);
+    if (err || field_count >= packet_count) {
+        return FALSE;
     }
 
-    return merged_value;
+    *p_field_count = field_count;
+
+    return TRUE;
 }
 
-static char *
-str_decimal_sub(char *merged_value, char *s1, int len1, char *s2, int len2)
+/**
+ * Get order_array.pos, order_array.type
+ */
+static gboolean
+get_order_by_fields(cetus_result_t *res_merge, ORDER_BY *order_array,
+                    guint order_array_size, result_merge_t *merged_result)
 {
-    char *p, *q;
-
-    p = strchr(s1, '.');
-    q = strchr(s2, '.');
-
-    if (p != NULL && q != NULL) {
-        p[0] = '\0';
-        q[0] = '\0';
-
-        int s1_int_len = p - s1;
-        int s2_int_len = q - s2;
+    int i;
+    for (i = 0; i < order_array_size; ++i) {
+        ORDER_BY *orderby = &(order_array[i]);
 
-        int int_len;
-        if (s1_int_len < s2_int_len) {
-            int_len = s2_int_len;
-        } else {
-            int_len = s1_int_len;
+        if (orderby->pos == -1) {
+            int index = cetus_result_find_fielddef(res_merge,
+                                                   orderby->table_name, orderby->name);
+            if (index == -1) {
+                merged_result->status = RM_FAIL;
+                char msg[128] = { 0 };
+                snprintf(msg, sizeof(msg), "order by:no %s in field list", orderby->name);
+                merged_result->detail = g_string_new(msg);
+                return FALSE;
+            }
+            orderby->pos = index;
         }
+        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res_merge->fielddefs, orderby->pos);
+        orderby->type = fdef->type;
+    }
+    return TRUE;
+}
 
-        char *short1 = p + 1;
-        char *short2 = q + 1;
-        char *merged_short = merged_value + int_len;
-
-        merged_short[0] = '.';
-        merged_short++;
+static gboolean
+get_group_by_fields(cetus_result_t *res_merge, group_by_t *group_array, guint group_array_size,
+                    result_merge_t *merged_result)
+{
+    int i;
+    for (i = 0; i < group_array_size; ++i) {
+        group_by_t *groupby = &(group_array[i]);
+        if (groupby->pos == -1) {
+            int index = cetus_result_find_fielddef(res_merge,
+                                                   groupby->table_name, groupby->name);
+            if (index == -1) {
+                merged_result->status = RM_FAIL;
+                char msg[128] = { 0 };
+                snprintf(msg, sizeof(msg), "group by: no %s in field list", groupby->name);
+                merged_result->detail = g_string_new(msg);
+                return FALSE;
+            }
+            groupby->pos = index;
+        }
+        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res_merge->fielddefs, groupby->pos);
+        groupby->type = fdef->type;
+    }
+    return TRUE;
+}
 
-        int short_len = len1 - s1_int_len - 1;
+static gboolean
+fulfill_condi(char *aggr_value, having_condition_t *hav_condi, result_merge_t *merged_result)
+{
+    int is_num = 0;
+    switch (hav_condi->data_type) {
+    case TK_INTEGER:
+        is_num = 1;
+        break;
+    case TK_FLOAT:
+        is_num = 1;
+        break;
+    default:
+        break;
+    }
 
-        int i;
+    int len1 = strlen(aggr_value);
+    int len2 = strlen(hav_condi->condition_value);
+    int result;
 
-        int borrow = 0;
-        for (i = short_len - 1; i >= 0; i--) {
-            int tmp = (short1[i] - '0') - (short2[i] - '0') - borrow;
-            if (tmp < 0) {
-                borrow = 1;
-                tmp = tmp + 10;
-            } else {
-                borrow = 0;
-            }
-            merged_short[i] = tmp + '0';
+    if (is_num) {
+        if (len2 == 0) {
+            return TRUE;
         }
 
-        str_int_sub(merged_value, s1, s1_int_len, s2, s2_int_len, borrow);
+        if (len1 == 0) {
+            return FALSE;
+        }
 
-        p[0] = '.';
-        q[0] = '.';
+        int num_unsupported = 0;
+        result = cmp_str_num(aggr_value, len1, hav_condi->condition_value, len2, &num_unsupported);
+        if (num_unsupported) {
+            merged_result->status = RM_FAIL;
+            g_warning("%s:merge_failed,num_unsupported", G_STRLOC);
+            return FALSE;
+        }
 
     } else {
-        str_int_sub(merged_value, s1, len1, s2, len2, 0);
+        result = strcmp(aggr_value, hav_condi->condition_value);
     }
 
-    return merged_value;
-}
-
-static void
-trim_zero(char *s)
-{
-    char *p = s;
-    char *q = NULL;
-    int depth = 0;
-    while (p[0] == '0') {
-        if (p[1] >= '0' && p[1] <= '9') {
-            depth++;
-            p++;
-            if (p[0] == '.') {
-                q = p - 1;
-            } else if (p[0] != '0') {
-                q = p;
-            }
-        } else {
-            break;
+    switch (hav_condi->rel_type) {
+    case TK_LE:
+        if (result <= 0) {
+            return TRUE;
         }
-    }
-
-    if (depth > 0) {
-        if (q == NULL) {
-            q = p;
+        break;
+    case TK_GE:
+        if (result >= 0) {
+            return TRUE;
         }
-    }
-
-    if (q != NULL) {
-        p = s;
-        while (q[0] != '\0') {
-            *p++ = *q++;
+        break;
+    case TK_LT:
+        if (result < 0) {
+            return TRUE;
+        }
+        break;
+    case TK_GT:
+        if (result > 0) {
+            return TRUE;
         }
-        *p = '\0';
+        break;
+    case TK_EQ:
+        if (result == 0) {
+            return TRUE;
+        }
+        break;
+    case TK_NE:
+        if (result != 0) {
+            return TRUE;
+        }
+        break;
     }
+
+    return FALSE;
 }
 
-static int
-dispose_sign_add(int is_integer, char *merged_value, char *s1, int len1, char *s2, int len2, int *supported)
+static void
+check_server_sess_wait_for_event(network_mysqld_con *con, int ss_index, short ev_type, struct timeval *timeout)
 {
-    if (s1[0] != '-' && s2[0] != '-') {
-        if (is_integer) {
-            str_int_add(merged_value, s1, len1, s2, len2, 0);
-        } else {
-            str_decimal_add(merged_value, s1, len1, s2, len2);
-        }
-        trim_zero(merged_value);
-    } else if (s1[0] == '-' && s2[0] == '-') {
-        if (is_integer) {
-            str_int_add(merged_value + 1, s1 + 1, len1 - 1, s2 + 1, len2 - 1, 0);
-        } else {
-            str_decimal_add(merged_value + 1, s1 + 1, len1 - 1, s2 + 1, len2 - 1);
-        }
-        trim_zero(merged_value + 1);
-        merged_value[0] = '-';
-    } else if (s1[0] == '-') {
-        int result = cmp_str_num(s1 + 1, len1 - 1, s2, len2, supported);
-        if (result > 0) {
-            if (is_integer) {
-                str_int_sub(merged_value + 1, s1 + 1, len1 - 1, s2, len2, 0);
-            } else {
-                str_decimal_sub(merged_value + 1, s1 + 1, len1 - 1, s2, len2);
-            }
-            trim_zero(merged_value + 1);
-            merged_value[0] = '-';
-        } else if (result < 0) {
-            if (is_integer) {
-                str_int_sub(merged_value, s2, len2, s1 + 1, len1 - 1, 0);
-            } else {
-                str_decimal_sub(merged_value, s2, len2, s1 + 1, len1 - 1);
+    size_t i;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (ss_index >= 0) {
+            if (ss_index != i) {
+                continue;
             }
-            trim_zero(merged_value);
-        } else {
-            merged_value[0] = '0';
-            return 0;
         }
-    } else if (s2[0] == '-') {
-        int result = cmp_str_num(s1, len1, s2 + 1, len2 - 1, supported);
-        if (result > 0) {
-            if (is_integer) {
-                str_int_sub(merged_value, s1 + 1, len1 - 1, s2, len2, 0);
-            } else {
-                str_decimal_sub(merged_value, s1, len1, s2 + 1, len2 - 1);
-            }
-            trim_zero(merged_value);
-        } else if (result < 0) {
-            if (is_integer) {
-                str_int_sub(merged_value + 1, s2 + 1, len2 - 1, s1, len1, 0);
-            } else {
-                str_decimal_sub(merged_value + 1, s2 + 1, len2 - 1, s1, len1);
+
+        if (!ss->server->is_read_finished) {
+            if (ss->server->is_waiting) {
+                g_debug("%s: ss %d is waiting", G_STRLOC, (int)i);
+                continue;
             }
-            trim_zero(merged_value + 1);
-            merged_value[0] = '-';
+            con->num_read_pending++;
+            ss->read_cal_flag = 0;
+            g_debug("%s: ss %d is not read finished, read pending:%d, fd:%d, ss index:%d",
+                    G_STRLOC, (int)i, con->num_read_pending, ss->server->fd, ss->index);
+            event_set(&(ss->server->event), ss->server->fd, ev_type, server_session_con_handler, ss);
+            chassis_event_add_with_timeout(con->srv, &(ss->server->event), timeout);
+            g_debug("%s: call chassis_event_add_with_timeout", G_STRLOC);
+            ss->server->is_waiting = 1;
         } else {
-            merged_value[0] = '0';
-            return 0;
+            g_debug("%s: ss %d is read finished", G_STRLOC, (int)i);
         }
     }
-
-    return 1;
 }
 
-static char *
-str_add(int type, char *merged_value, char *s1, int len1, char *s2, int len2, int *merge_failed)
+/**
+ * the rest of the rows could only be dropped when the server connections
+ * are not kept by the session and each unfinished shard is sending rows
+ */
+static gboolean
+merge_cut_off_allowed(network_mysqld_con *con)
 {
-    int is_result_padding = 0, is_integer = 0, is_need_check = 0;
-
-    switch (type) {
-    case FIELD_TYPE_TINY:
-    case FIELD_TYPE_SHORT:
-    case FIELD_TYPE_LONG:
-    case FIELD_TYPE_LONGLONG:
-    case FIELD_TYPE_INT24:
-        is_integer = 1;
-        break;
-    case FIELD_TYPE_DOUBLE:
-    case FIELD_TYPE_FLOAT:
-        is_need_check = 1;
-        break;
-    case FIELD_TYPE_NEWDECIMAL:
-    case FIELD_TYPE_DECIMAL:
-        is_result_padding = 1;
-        break;
-    default:
-        g_warning("%s: unknown type for add:%d", G_STRLOC, type);
-        *merge_failed = 1;
-        return NULL;
+    if (con->servers == NULL || con->parse.command != COM_QUERY) {
+        return FALSE;
     }
 
-    if (!is_integer) {
-        if (is_need_check) {
-            if (!check_str_num_supported(s1, len1, NULL)) {
-                g_warning("%s: str num is not supported:%s", G_STRLOC, s1);
-                *merge_failed = 1;
-                return NULL;
-            }
-            if (!check_str_num_supported(s2, len2, NULL)) {
-                g_warning("%s: str num is not supported:%s", G_STRLOC, s2);
-                *merge_failed = 1;
-                return NULL;
-            }
-        }
-
-        if (!padding_zero(s1, &len1, MAX_COL_VALUE_LEN, s2, &len2, MAX_COL_VALUE_LEN)) {
-            *merge_failed = 1;
-            return NULL;
-        }
+    if (con->is_in_transaction || !con->is_auto_commit || con->dist_tran) {
+        return FALSE;
     }
 
-    int result = dispose_sign_add(is_integer, merged_value, s1,
-                                  len1, s2, len2, merge_failed);
-    if (*merge_failed) {
-        return NULL;
+    if (con->is_prepared || con->is_in_sess_context || con->is_calc_found_rows) {
+        return FALSE;
     }
 
-    if ((!result) && is_result_padding) {
-        int merged_len = strlen(merged_value);
-        if (!padding_zero(merged_value, &merged_len, 2 * MAX_COL_VALUE_LEN, s2, &len2, MAX_COL_VALUE_LEN)) {
-            *merge_failed = 1;
-            return NULL;
+    size_t i;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        if (!ss->server->is_read_finished && ss->server->parse.qs_state != PARSE_COM_QUERY_RESULT) {
+            return FALSE;
         }
     }
 
-    return merged_value;
+    return TRUE;
 }
 
-static int
-merge_aggr_value(int fun_type, int type, char *merged_value,
-                 char *str1, char *str2, int len1, int len2, int *merge_failed)
+/**
+ * stop reading the shards which have not finished yet, their rows are
+ * drained when the connections are returned to the pool
+ */
+static void
+merge_cut_off_shards(network_mysqld_con *con, merge_parameters_t *data)
 {
-    if (len1 == 0 || len2 == 0) {
-        if (len1 == 0 && len2 == 0) {
-            return 0;
-        } else if (len1 == 0) {
-            strncpy(merged_value, str2, len2);
-            merged_value[len2] = '\0';
-            return 1;
-        } else {
-            strncpy(merged_value, str1, len1);
-            merged_value[len1] = '\0';
-            return 1;
-        }
-    }
-
-    int is_str_type = 0;
-    switch (type) {
-    case FIELD_TYPE_TIME:
-    case FIELD_TYPE_TIMESTAMP:
-    case FIELD_TYPE_DATETIME:
-    case FIELD_TYPE_YEAR:
-    case FIELD_TYPE_NEWDATE:
-    case FIELD_TYPE_DATE:
-    case FIELD_TYPE_VAR_STRING:
-    case FIELD_TYPE_STRING:
-        is_str_type = 1;
-        break;
-    default:
-        break;
-    }
+    size_t i;
+    for (i = 0; i < con->servers->len; i++) {
+        server_session_t *ss = g_ptr_array_index(con->servers, i);
+        network_socket *server = ss->server;
 
-    switch (fun_type) {
-    case FT_SUM:
-        if (!str_add(type, merged_value, str1, len1, str2, len2, merge_failed)) {
-            return 0;
-        }
-        break;
-    case FT_MAX:
-        if (is_str_type) {
-            if (strcmp(str1, str2) >= 0) {
-                return 0;
-            } else {
-                strncpy(merged_value, str2, len2);
-                merged_value[len2] = '\0';
-            }
-        } else {
-            if (cmp_str_num(str1, len1, str2, len2, merge_failed) > 0) {
-                return 0;
-            } else {
-                strncpy(merged_value, str2, len2);
-                merged_value[len2] = '\0';
-            }
-        }
-        break;
-    case FT_MIN:
-        if (is_str_type) {
-            if (strcmp(str1, str2) <= 0) {
-                return 0;
-            } else {
-                strncpy(merged_value, str2, len2);
-                merged_value[len2] = '\0';
-            }
-        } else {
-            if (cmp_str_num(str1, len1, str2, len2, merge_failed) <= 0) {
-                return 0;
-            } else {
-                strncpy(merged_value, str2, len2);
-                merged_value[len2] = '\0';
-            }
+        data->candidates[i] = NULL;
+        if (server->is_read_finished) {
+            continue;
         }
-        break;
-    case FT_COUNT:
-        if (!str_add(type, merged_value, str1, len1, str2, len2, merge_failed)) {
-            return 0;
+
+        if (server->is_waiting) {
+            CHECK_PENDING_EVENT(&(server->event));
+            server->is_waiting = 0;
         }
-        break;
+        server->is_resp_abandoned = 1;
+        server->is_read_finished = 1;
+        ss->state = NET_RW_STATE_FINISHED;
+        network_mysqld_con_backend_request_done(con, ss->backend, FALSE);
+        g_debug("%s: abandon resp of server:%p, fd:%d", G_STRLOC, server, server->fd);
     }
 
-    return 1;
+    con->num_pending_servers = 0;
+    con->num_read_pending = 0;
+    con->resp_cut_off = 1;
 }
 
 static int
-modify_record(GList *cand1, group_aggr_t * aggr,
-              network_packet *packet1, network_packet *packet2, int *orig_packet_len, int *merge_failed)
+check_after_limit(network_mysqld_con *con, merge_parameters_t *data, int is_finished)
 {
-    char str1[MAX_COL_VALUE_LEN] = { 0 };
-    char str2[MAX_COL_VALUE_LEN] = { 0 };
-    char merged_value[2 * MAX_COL_VALUE_LEN] = { 0 };
-
-    char *before, *hit, *after;
-
-    GString *pkt1 = packet1->data;
-
-    before = (char *)(pkt1->str + packet1->offset);
-    skip_field(packet1, aggr->pos);
-    skip_field(packet2, aggr->pos);
-
-    hit = (char *)(pkt1->str + packet1->offset);
-    network_mysqld_proto_get_column(packet1, str1, MAX_COL_VALUE_LEN);
-    network_mysqld_proto_get_column(packet2, str2, MAX_COL_VALUE_LEN);
-
-    after = (char *)(pkt1->str + packet1->offset);
+    GPtrArray *recv_queues = data->recv_queues;
+    GList **candidates = data->candidates;
+    gboolean is_more_to_read = FALSE;
+    GList *candidate = NULL;
+    size_t iter;
 
-    char buffer[MAX_PACK_LEN] = { 0 };
-    char *buf_pos = buffer;
-    int len = hit - before;
-    memcpy(buf_pos, before, len);
-    buf_pos = buf_pos + len + 1;
+    g_debug("%s: call check_after_limit", G_STRLOC);
 
-    int len1 = strlen(str1);
-    int len2 = strlen(str2);
-    if (!merge_aggr_value(aggr->fun_type, aggr->type, merged_value, str1, str2, len1, len2, merge_failed)) {
-        return 0;
+    if (!is_finished && merge_cut_off_allowed(con)) {
+        merge_cut_off_shards(con, data);
+        return 1;
     }
 
-    len = strlen(merged_value);
-    if (aggr->type == FIELD_TYPE_DOUBLE || aggr->type == FIELD_TYPE_FLOAT) {
-        char *p = strchr(merged_value, '.');
-        if (p != NULL) {
-            int i = len - 1;
-            while (i >= 1 && merged_value[i] == '0') {
-                len--;
-                i--;
+    for (iter = 0; iter < recv_queues->len; iter++) {
+        gboolean is_over = FALSE;
+        do {
+            candidate = candidates[iter];
+            if (candidate == NULL || candidate->data == NULL) {
+                con->partially_merged = 1;
+                is_more_to_read = TRUE;
+                g_debug("%s: item is nil, index:%d", G_STRLOC, (int)iter);
+                break;
             }
 
-            if (merged_value[i] == '.') {
-                len--;
+            GString *item = candidate->data;
+            guchar pkt_type = get_pkt_type(item);
+            if (pkt_type == MYSQLD_PACKET_EOF || pkt_type == MYSQLD_PACKET_ERR) {
+                g_debug("%s: is over true:%d, pkt type:%d", G_STRLOC, (int)iter, (int)pkt_type);
+                is_over = TRUE;
+                break;
             }
-        }
-    }
 
-    if (len == len1) {
-        memcpy(hit + 1, merged_value, len);
-    } else {
-        int packet_len = (*orig_packet_len) - len1 + len;
-
-        if (packet_len > MAX_PACK_LEN) {
-            *merge_failed = 1;
-            return 0;
-        }
-
-        strncpy(buf_pos, merged_value, len);
-        *(buf_pos - 1) = (char)len;
-        buf_pos = buf_pos + len;
-        memcpy(buf_pos, after, (*orig_packet_len) - (after - before));
+            candidates[iter] = candidate->next;
+            g_debug("%s: free packet addr:%p, iter:%d, pkt_type:%d", G_STRLOC,
+                    candidate->data, (int)iter, (int)pkt_type);
+            g_string_free((GString *)candidate->data, TRUE);
+            network_queue *recv_queue = recv_queues->pdata[iter];
+            g_queue_delete_link(recv_queue->chunks, candidate);
+        } while (!is_over);
+    }
 
-        *orig_packet_len = packet_len;
-        GString *packet = g_string_sized_new(calculate_alloc_len(NET_HEADER_SIZE + packet_len));
-        packet->len = NET_HEADER_SIZE;
-        g_string_append_len(packet, buffer, packet_len);
-        network_mysqld_proto_set_packet_len(packet, packet_len);
+    if (is_finished && is_more_to_read) {
+        g_warning("%s: finished reading, but needs more read:%p", G_STRLOC, con);
+    } else if ((!is_finished) && (!is_more_to_read)) {
+        g_warning("%s: not finished reading, but is_more_to_read false:%p", G_STRLOC, con);
+    }
 
-        g_string_free(cand1->data, TRUE);
-        cand1->data = packet;
-        packet1->data = packet;
+    if (is_more_to_read) {
+        g_debug("%s: need more reading for:%p", G_STRLOC, con);
+        check_server_sess_wait_for_event(con, -1, EV_READ, &con->read_timeout);
+        return 0;
     }
 
     return 1;
 }
 
-static gint
-combine_aggr_record(GList *cand1, GList *cand2, aggr_by_group_para_t *para, int *merge_failed)
+/* rows handed on no longer count against the read-ahead of their shard */
+static void
+merge_release_row(network_mysqld_con *con, int index, gsize len)
 {
-    int i;
-    network_packet packet1;
-    network_packet packet2;
-    packet1.data = cand1->data;
-    packet2.data = cand2->data;
+    if (con->servers && index < con->servers->len) {
+        server_session_t *ss = g_ptr_array_index(con->servers, index);
+        ss->server->resp_merged_len += len;
+    }
+}
+
+static int
+do_simple_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished)
+{
+    network_queue *send_queue = data->send_queue;
+    GPtrArray *recv_queues = data->recv_queues;
+    GList **candidates = data->candidates;
+    limit_t *limit = &(data->limit);
+    int *row_cnter = &(data->row_cnter);
+    int *off_pos = &(data->off_pos);
 
-    int orig_packet_len = network_mysqld_proto_get_packet_len(packet1.data);
+    GList *candidate = NULL;
+    size_t iter;
 
-    if (orig_packet_len >= MAX_PACK_LEN) {
-        g_warning("%s record too long for group by", G_STRLOC);
-        *merge_failed = 1;
-        return 0;
+    int merged_output_size = con->srv->merged_output_size;
+    if (con->is_client_compressed) {
+        merged_output_size = con->srv->compressed_merged_output_size;
     }
 
-    short aggr_num = para->aggr_num;
+    g_debug("%s: call do_simple_merge", G_STRLOC);
 
-    for (i = 0; i < aggr_num; i++) {
-        group_aggr_t *aggr = para->aggr_array + (aggr_num - 1 - i);
-
-        packet1.offset = NET_HEADER_SIZE;
-        packet2.offset = NET_HEADER_SIZE;
-
-        /* if equal, combined */
-        switch (aggr->type) {
-        case FIELD_TYPE_TINY:
-        case FIELD_TYPE_SHORT:
-        case FIELD_TYPE_LONG:
-        case FIELD_TYPE_LONGLONG:
-        case FIELD_TYPE_INT24:
-            modify_record(cand1, aggr, &packet1, &packet2, &orig_packet_len, merge_failed);
-            break;
-        case FIELD_TYPE_NEWDECIMAL:
-        case FIELD_TYPE_DECIMAL:
-        case FIELD_TYPE_FLOAT:
-        case FIELD_TYPE_DOUBLE:
-            modify_record(cand1, aggr, &packet1, &packet2, &orig_packet_len, merge_failed);
-            break;
-        case FIELD_TYPE_TIME:
-        case FIELD_TYPE_TIMESTAMP:
-        case FIELD_TYPE_DATETIME:
-        case FIELD_TYPE_YEAR:
-        case FIELD_TYPE_NEWDATE:
-        case FIELD_TYPE_DATE:
-        case FIELD_TYPE_VAR_STRING:
-        case FIELD_TYPE_STRING:
-            switch (aggr->fun_type) {
-            case FT_MAX:
-            case FT_MIN:
+    gboolean shortaged = FALSE;
+    for (iter = 0; iter < recv_queues->len; iter++) {
+        candidate = candidates[iter];
+        network_queue *recv_queue = recv_queues->pdata[iter];
+
+        while (candidate != NULL) {
+            if (candidate->data == NULL) {
+                g_debug("%s: candidate data is nil:%d", G_STRLOC, (int)iter);
                 break;
-            default:
-                g_warning("%s: string is not valid for aggr fun:%d", G_STRLOC, aggr->fun_type);
-                *merge_failed = 1;
-                return 0;
             }
 
-            modify_record(cand1, aggr, &packet1, &packet2, &orig_packet_len, merge_failed);
-            break;
-
-        default:
-            *merge_failed = 1;
-            g_warning("%s:unknown Field Type: %d", G_STRLOC, para->group_array[i].type);
-            return 1;
-        }
-    }
-    return 0;
-}
+            if ((*row_cnter) == limit->row_count) {
+                g_debug("%s: reach limit:%d", G_STRLOC, (int)iter);
+                break;
+            }
 
-static gint
-cal_aggr_rec_rel(GList *cand1, GList *cand2, aggr_by_group_para_t *para, int *merge_failed)
-{
-    int i, disp_flag;
-    char str1[MAX_COL_VALUE_LEN] = { 0 };
-    char str2[MAX_COL_VALUE_LEN] = { 0 };
-    network_packet packet1;
-    network_packet packet2;
-    packet1.data = cand1->data;
-    packet2.data = cand2->data;
+            guchar pkt_type = get_pkt_type((GString *)candidate->data);
+            if (pkt_type == MYSQLD_PACKET_EOF) {
+                g_debug("%s: MYSQLD_PACKET_EOF here:%d", G_STRLOC, (int)iter);
+                break;
+            }
 
-    group_by_t *group_array = para->group_array;
+            if (pkt_type == MYSQLD_PACKET_ERR) {
+                data->is_pack_err = 1;
+                data->err_pack = candidate->data;
+                g_debug("%s: MYSQLD_PACKET_ERR here:%d", G_STRLOC, (int)iter);
+                break;
+            }
 
-    for (i = 0; i < para->group_array_size; i++) {
-        disp_flag = 0;
+            merge_release_row(con, iter, ((GString *)candidate->data)->len);
+            if ((*off_pos) < limit->offset) {
+                (*off_pos)++;
+                g_string_free((GString *)candidate->data, TRUE);
+            } else {
 
-        packet1.offset = NET_HEADER_SIZE;
-        packet2.offset = NET_HEADER_SIZE;
+                int packet_len = network_mysqld_proto_get_packet_len(candidate->data);
+                data->aggr_output_len += packet_len;
 
-        skip_field(&packet1, group_array[i].pos);
-        skip_field(&packet2, group_array[i].pos);
+                ((GString *)candidate->data)->str[3] = data->pkt_count + 1;
+                ++(data->pkt_count);
+                network_queue_append(send_queue, (GString *)candidate->data);
+                if (data->aggr_output_len >= merged_output_size) {
+                    g_debug("%s: send_part_content_to_client:%d, iter:%d", G_STRLOC, data->aggr_output_len, (int)iter);
+                    send_part_content_to_client(con);
+                    data->aggr_output_len = 0;
+                }
+                (*row_cnter)++;
+            }
 
-        network_mysqld_proto_get_column(&packet1, str1, MAX_COL_VALUE_LEN);
-        network_mysqld_proto_get_column(&packet2, str2, MAX_COL_VALUE_LEN);
+            candidates[iter] = candidate->next;
+            g_queue_delete_link(recv_queue->chunks, candidate);
+            candidate = candidates[iter];
+        }
 
-        switch (group_array[i].type) {
-        case FIELD_TYPE_DATE:
-            if (!compare_date(str1, str2, NOR_REL, &disp_flag, group_array[i].desc)) {
-                return disp_flag;
-            }
-            break;
-        case FIELD_TYPE_TIME:
-            if (!compare_time(str1, str2, NOR_REL, &disp_flag, group_array[i].desc)) {
-                return disp_flag;
-            }
-            break;
-        case FIELD_TYPE_YEAR:
-            if (!compare_year(str1, str2, NOR_REL, &disp_flag, group_array[i].desc)) {
-                return disp_flag;
-            }
-            break;
-        case FIELD_TYPE_NEWDATE:
-            return 1;
-            /* case FIELD_TYPE_VARCHAR: */
-        case FIELD_TYPE_VAR_STRING:
-        case FIELD_TYPE_TIMESTAMP:
-        case FIELD_TYPE_DATETIME:
-        case FIELD_TYPE_STRING:
-            if (!compare_records_from_column(str1, str2, NOR_REL, group_array[i].desc, &disp_flag)) {
-                return disp_flag;
+        if (candidate == NULL || candidate->data == NULL) {
+            if (con->servers) {
+                server_session_t *ss = g_ptr_array_index(con->servers, iter);
+                if (ss->server->is_waiting) {
+                    g_debug("%s: is_waiting true:%d", G_STRLOC, (int)iter);
+                    continue;
+                }
+                candidates[iter] = NULL;
+                g_debug("%s: candidate is nil for i:%d, recv_queues:%p",
+                        G_STRLOC, (int)iter, recv_queues);
+                shortaged = TRUE;
+            } else {
+                g_warning("%s: return part of responses", G_STRLOC);
             }
+        }
+    }
 
-            break;
-        case FIELD_TYPE_TINY:
-        case FIELD_TYPE_SHORT:
-        case FIELD_TYPE_LONG:
-        case FIELD_TYPE_LONGLONG:
-        case FIELD_TYPE_INT24:
-        case FIELD_TYPE_DOUBLE:
-        case FIELD_TYPE_NEWDECIMAL:
-        case FIELD_TYPE_DECIMAL:
-        case FIELD_TYPE_FLOAT:
-            if (!compare_str_num_value(str1, str2, NOR_REL, &disp_flag, group_array[i].desc, merge_failed)) {
-                return disp_flag;
+    if (shortaged) {
+        con->partially_merged = 1;
+        g_debug("%s: need more reading for:%p", G_STRLOC, con);
+        if (data->aggr_output_len >= merged_output_size) {
+            send_part_content_to_client(con);
+            data->aggr_output_len = 0;
+        }
+        check_server_sess_wait_for_event(con, -1, EV_READ, &con->read_timeout);
+        return 0;
+    } else {
+        if (!is_finished) {
+            g_debug("%s: check limit for:%p", G_STRLOC, con);
+            if (limit->row_count > 0 && (*row_cnter) >= limit->row_count) {
+                g_debug("%s: do call check_after_limit for:%p", G_STRLOC, con);
+                if (check_after_limit(con, data, is_finished) == FALSE) {
+                    g_debug("%s: call check_after_limit over for:%p", G_STRLOC, con);
+                    return 0;
+                }
             }
-            break;
-
-        default:
-            g_warning("%s:unknown Field Type: %d", G_STRLOC, group_array[i].type);
-            *merge_failed = 1;
-            return 1;
         }
     }
-    return combine_aggr_record(cand1, cand2, para, merge_failed);
-}
 
-static int heap_count = 0;
+    return 1;
+}
 
+/* @return -1 if the field type is not known */
 static int
-compare_value_from_records(network_packet *packet1, network_packet *packet2,
-                           ORDER_BY *ob, int type, int *result, int *compare_failed)
+sort_key_kind(unsigned int type)
 {
-    char str1[MAX_COL_VALUE_LEN] = { 0 };
-    char str2[MAX_COL_VALUE_LEN] = { 0 };
-
-    skip_field(packet1, ob->pos);
-    skip_field(packet2, ob->pos);
-    network_mysqld_proto_get_column(packet1, str1, MAX_COL_VALUE_LEN);
-    network_mysqld_proto_get_column(packet2, str2, MAX_COL_VALUE_LEN);
-
     switch (type) {
+    case FIELD_TYPE_TINY:
+    case FIELD_TYPE_SHORT:
     case FIELD_TYPE_LONG:
+    case FIELD_TYPE_LONGLONG:
+    case FIELD_TYPE_INT24:
+    case FIELD_TYPE_NEWDECIMAL:
+    case FIELD_TYPE_DECIMAL:
+        return SORT_KEY_DECIMAL;
+    case FIELD_TYPE_FLOAT:
     case FIELD_TYPE_DOUBLE:
-        return compare_str_num_value(str1, str2, PRIOR_TO, result, ob->desc, compare_failed);
+        return SORT_KEY_DOUBLE;
     case FIELD_TYPE_DATE:
-        return compare_date(str1, str2, PRIOR_TO, result, ob->desc);
+    case FIELD_TYPE_NEWDATE:
+        return SORT_KEY_DATE;
     case FIELD_TYPE_TIME:
-        return compare_time(str1, str2, PRIOR_TO, result, ob->desc);
+        return SORT_KEY_TIME;
     case FIELD_TYPE_YEAR:
-        return compare_year(str1, str2, PRIOR_TO, result, ob->desc);
+        return SORT_KEY_YEAR;
+    case FIELD_TYPE_TIMESTAMP:
+    case FIELD_TYPE_DATETIME:
+    case FIELD_TYPE_VAR_STRING:
+    case FIELD_TYPE_STRING:
+    case FIELD_TYPE_ENUM:
+    case FIELD_TYPE_SET:
+    case FIELD_TYPE_TINY_BLOB:
+    case FIELD_TYPE_MEDIUM_BLOB:
+    case FIELD_TYPE_LONG_BLOB:
+    case FIELD_TYPE_BLOB:
+        return SORT_KEY_STR;
+    case FIELD_TYPE_NULL:
+    case FIELD_TYPE_BIT:
+    case FIELD_TYPE_GEOMETRY:
+        return SORT_KEY_NONE;
+    default:
+        return -1;
     }
-    return 1;
 }
 
-static int
-compare_records_from_column(char *str1, char *str2, int com_type, int desc, int *result)
-{
-    g_debug("%s: str1:%s, str2:%s", G_STRLOC, str1, str2);
-    int ret = 0;
-    if (str1[0] == '\0' && str2[0] != '\0') {
-        ret = -1;
-    } else if (str1[0] != '\0' && str2[0] == '\0') {
-        ret = 1;
-    } else if (str1[0] != '\0' && str2[0] != '\0') {
-        ret = strcasecmp(str1, str2);
-    } else {
-        ret = 0;
+/**
+ * split [+-]digits[.digits] into integer and fraction digits,
+ * leading zeros of the integer part and trailing zeros of the fraction
+ * are dropped, so that equal values get equal keys
+ */
+static gboolean
+sort_key_decode_decimal(sort_key_val_t *val, const char *s, int len)
+{
+    const char *end = s + len;
+
+    if (len == 0) {
+        return TRUE;
     }
 
-    if (ret == 0) {
-        return 1;
+    if (*s == '-' || *s == '+') {
+        val->is_neg = (*s == '-');
+        s++;
     }
 
-    if ((desc && ret > 0) || (!desc && ret < 0)) {
-        *result = 1;
-        return 0;
+    const char *p = s;
+    while (p < end && g_ascii_isdigit(*p)) {
+        p++;
     }
+    const char *int_end = p;
 
-    if ((desc && ret < 0) || (!desc && ret > 0)) {
-        if (com_type == PRIOR_TO) {
-            *result = 0;
-        } else {
-            *result = -1;
+    const char *frac = NULL;
+    int frac_len = 0;
+    if (p < end && *p == '.') {
+        frac = ++p;
+        while (p < end && g_ascii_isdigit(*p)) {
+            p++;
         }
-        return 0;
+        frac_len = p - frac;
     }
 
-    g_critical("%s: reach the unreachable place", G_STRLOC);
-
-    return 0;
-}
+    if (p != end || (int_end == s && frac_len == 0)) {
+        return FALSE;
+    }
 
-/* short means 16-bit integer */
-static guint16 get_nth_short(guint64 base, int n)
-{
-    g_assert(n < 4);
-    int i;
-    guint64 mask = 0xFFFF;
-    for (i = 0; i < n; i++) {
-        mask = mask << 16;
+    while (s < int_end && *s == '0') {
+        s++;
+    }
+    while (frac_len > 0 && frac[frac_len - 1] == '0') {
+        frac_len--;
     }
-    guint64 value = mask & base;
 
-    for (i = 0; i < n; i++) {
-        value = value >> 16;
+    val->str = s;
+    val->len = int_end - s;
+    val->frac = frac;
+    val->frac_len = frac_len;
+    if (val->len == 0 && val->frac_len == 0) {
+        val->is_neg = 0;
     }
-    return value;
+    return TRUE;
 }
 
-static int
-compare_records_by_str(network_packet *packet1, network_packet *packet2,
-                       order_by_para_t *para, int pkt1_index, int pkt2_index, int i, int *result)
+/* time is [-]hhh:mm:ss[.ffffff], hours may exceed 24 */
+static gboolean
+sort_key_decode_time(sort_key_val_t *val, const char *buf)
 {
-    char str1[MAX_COL_VALUE_LEN] = { 0 };
-    char str2[MAX_COL_VALUE_LEN] = { 0 };
-    ORDER_BY *ob = &(para->order_array[i]);
-
-    uint64_t offsets_1, offsets_2;
-    if (para->field_offsets_cache[pkt1_index]) {
-        offsets_1 = para->field_offsets_cache[pkt1_index];
-    } else {
-        offsets_1 = get_field_offsets(packet1, para->order_array, para->order_array_size);
-        para->field_offsets_cache[pkt1_index] = offsets_1;
+    int neg = 0, h = 0, m = 0, s = 0;
+    if (*buf == '-') {
+        neg = 1;
+        buf++;
     }
-
-    guint offset = get_nth_short(offsets_1, i);
-    if (offset == 0) {
-        offset = NET_HEADER_SIZE;
+    if (sscanf(buf, "%d:%d:%d", &h, &m, &s) != 3) {
+        return FALSE;
     }
-    packet1->offset = offset;
 
-    if (para->field_offsets_cache[pkt2_index]) {
-        offsets_2 = para->field_offsets_cache[pkt2_index];
-    } else {
-        offsets_2 = get_field_offsets(packet2, para->order_array, para->order_array_size);
-        para->field_offsets_cache[pkt2_index] = offsets_2;
+    gint64 usec = 0;
+    const char *dot = strchr(buf, '.');
+    if (dot) {
+        int i;
+        for (i = 1; i <= 6; i++) {
+            usec *= 10;
+            if (g_ascii_isdigit(dot[i])) {
+                usec += dot[i] - '0';
+            } else {
+                for (i++; i <= 6; i++) {
+                    usec *= 10;
+                }
+                break;
+            }
+        }
     }
 
-    offset = get_nth_short(offsets_2, i);
-    if (offset == 0) {
-        offset = NET_HEADER_SIZE;
+    val->v.num = (((gint64)h * 60 + m) * 60 + s) * 1000000 + usec;
+    if (neg) {
+        val->v.num = -val->v.num;
     }
-    packet2->offset = offset;
-
-    network_mysqld_proto_get_column(packet1, str1, MAX_COL_VALUE_LEN);
-    network_mysqld_proto_get_column(packet2, str2, MAX_COL_VALUE_LEN);
-
-    return compare_records_from_column(str1, str2, PRIOR_TO, ob->desc, result);
+    return TRUE;
 }
 
-/**
- *  is_prior_to Relation(record_A *record_B) defined ORDER BY
- *  return 1 if record A is prior to record B  else 0
- */
-static gint
-is_prior_to(GString *pkt1, GString *pkt2, order_by_para_t *para,
-            int pkt1_index, int pkt2_index, int *is_record_equal, int *compare_failed)
-{
-    int i, equal_field_cnt, result;
-    network_packet packet1;
-    network_packet packet2;
-
-    packet1.data = pkt1;
-    packet2.data = pkt2;
+#define SORT_KEY_NUM_LEN 64
 
-    equal_field_cnt = 0;
-
-    g_debug("%s: call is_prior_to, index1:%d, index2:%d, count:%d, pkt1:%p, pkt2:%p",
-            G_STRLOC, pkt1_index, pkt2_index, ++heap_count, pkt1, pkt2);
+static gboolean
+sort_key_decode(sort_key_val_t *val, sort_key_kind_t kind, const char *s, int len)
+{
+    memset(val, 0, sizeof(*val));
+    if (s == NULL) {
+        val->is_null = 1;
+        return TRUE;
+    }
+
+    char buf[SORT_KEY_NUM_LEN];
+    switch (kind) {
+    case SORT_KEY_NONE:
+        return TRUE;
+    case SORT_KEY_STR:
+        val->str = s;
+        val->len = len;
+        return TRUE;
+    case SORT_KEY_DECIMAL:
+        return sort_key_decode_decimal(val, s, len);
+    default:
+        break;
+    }
 
-    for (i = 0; i < para->order_array_size; i++) {
-        result = 0;
-        packet1.offset = NET_HEADER_SIZE;
-        packet2.offset = NET_HEADER_SIZE;
+    /* the rest are short values, parse them from a C string */
+    if (len >= SORT_KEY_NUM_LEN) {
+        return FALSE;
+    }
+    memcpy(buf, s, len);
+    buf[len] = '\0';
 
-        ORDER_BY *order = &(para->order_array[i]);
+    switch (kind) {
+    case SORT_KEY_DOUBLE: {
+        char *endptr = NULL;
+        val->v.dbl = len > 0 ? g_ascii_strtod(buf, &endptr) : 0;
+        return len == 0 || endptr == buf + len;
+    }
+    case SORT_KEY_DATE: {
+        int y = 0, m = 0, d = 0;
+        if (len > 0 && sscanf(buf, "%d-%d-%d", &y, &m, &d) != 3) {
+            return FALSE;
+        }
+        val->v.num = (gint64)y * 10000 + m * 100 + d;
+        return TRUE;
+    }
+    case SORT_KEY_TIME:
+        return len == 0 || sort_key_decode_time(val, buf);
+    case SORT_KEY_YEAR:
+        val->v.num = atol(buf);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
 
-        switch (order->type) {
-        case FIELD_TYPE_TINY:
-        case FIELD_TYPE_SHORT:
-        case FIELD_TYPE_LONG:
-        case FIELD_TYPE_LONGLONG:
-        case FIELD_TYPE_INT24:
-            if (!compare_value_from_records(&packet1, &packet2, order, FIELD_TYPE_LONG, &result, compare_failed)) {
-                return result;
-            }
-            equal_field_cnt++;
-            break;
-        case FIELD_TYPE_NEWDECIMAL:
-        case FIELD_TYPE_DECIMAL:
-        case FIELD_TYPE_FLOAT:
-        case FIELD_TYPE_DOUBLE:
-            if (!compare_value_from_records(&packet1, &packet2, order, FIELD_TYPE_DOUBLE, &result, compare_failed)) {
-                return result;
-            }
-            equal_field_cnt++;
-            break;
-        case FIELD_TYPE_DATE:
-            if (!compare_value_from_records(&packet1, &packet2, order, FIELD_TYPE_DATE, &result, compare_failed)) {
-                return result;
-            }
+static int
+sort_key_cmp_decimal(const sort_key_val_t *a, const sort_key_val_t *b)
+{
+    if (a->is_neg != b->is_neg) {
+        return a->is_neg ? -1 : 1;
+    }
 
-            equal_field_cnt++;
-            break;
-        case FIELD_TYPE_TIME:
-            if (!compare_value_from_records(&packet1, &packet2, order, FIELD_TYPE_DATE, &result, compare_failed)) {
-                return result;
-            }
-            equal_field_cnt++;
-            break;
-        case FIELD_TYPE_YEAR:
-            if (!compare_value_from_records(&packet1, &packet2, order, FIELD_TYPE_DATE, &result, compare_failed)) {
-                return result;
-            }
-            equal_field_cnt++;
-            break;
-        case FIELD_TYPE_NEWDATE:
-            return 1;
-            /* case FIELD_TYPE_VARCHAR: */
-        case FIELD_TYPE_TIMESTAMP:
-        case FIELD_TYPE_DATETIME:
-        case FIELD_TYPE_VAR_STRING:
-        case FIELD_TYPE_STRING:
-            if (!compare_records_by_str(&packet1, &packet2, para, pkt1_index, pkt2_index, i, &result)) {
-                return result;
+    int r;
+    if (a->len != b->len) {
+        r = a->len < b->len ? -1 : 1;
+    } else {
+        r = a->len > 0 ? memcmp(a->str, b->str, a->len) : 0;
+        if (r == 0) {
+            int n = MIN(a->frac_len, b->frac_len);
+            r = n > 0 ? memcmp(a->frac, b->frac, n) : 0;
+            if (r == 0) {
+                /* trailing zeros are gone, the longer fraction is greater */
+                r = a->frac_len - b->frac_len;
             }
-            equal_field_cnt++;
-            break;
-        case FIELD_TYPE_NULL:
-        case FIELD_TYPE_BIT:
-        case FIELD_TYPE_ENUM:
-        case FIELD_TYPE_SET:
-        case FIELD_TYPE_TINY_BLOB:
-        case FIELD_TYPE_MEDIUM_BLOB:
-        case FIELD_TYPE_LONG_BLOB:
-        case FIELD_TYPE_BLOB:
-        case FIELD_TYPE_GEOMETRY:
-            return 1;
-        default:
-            *compare_failed = 1;
-            g_warning("%s:unknown Field Type: %d", G_STRLOC, order->type);
-            return 1;
         }
     }
 
-    if (equal_field_cnt == para->order_array_size) {
-        if (is_record_equal) {
-            *is_record_equal = 1;
-        }
-    }
+    r = (r > 0) - (r < 0);
+    return a->is_neg ? -r : r;
+}
 
-    return 1;
+static int
+sort_key_cmp(sort_key_kind_t kind, const sort_key_val_t *a, const sort_key_val_t *b)
+{
+    /* NULL goes first in ascending order, the same as mysql */
+    if (a->is_null || b->is_null) {
+        return b->is_null - a->is_null;
+    }
+
+    switch (kind) {
+    case SORT_KEY_DECIMAL:
+        return sort_key_cmp_decimal(a, b);
+    case SORT_KEY_DOUBLE:
+        return (a->v.dbl > b->v.dbl) - (a->v.dbl < b->v.dbl);
+    case SORT_KEY_DATE:
+    case SORT_KEY_TIME:
+    case SORT_KEY_YEAR:
+        return (a->v.num > b->v.num) - (a->v.num < b->v.num);
+    case SORT_KEY_STR: {
+        int r = g_ascii_strncasecmp(a->str, b->str, MIN(a->len, b->len));
+        if (r == 0) {
+            r = a->len - b->len;
+        }
+        return (r > 0) - (r < 0);
+    }
+    default:
+        return 0;
+    }
 }
 
-/* find index of field by name, the name might be an alias */
 static int
-cetus_result_find_fielddef(cetus_result_t *res, const char *table, const char *field)
+merge_key_cmp(merge_tree_t *tree, const sort_key_val_t *a, const sort_key_val_t *b)
 {
     int i;
-    for (i = 0; i < res->fielddefs->len; ++i) {
-        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res->fielddefs, i);
-        if (table && table[0] != '\0') {
-            if ((fdef->table && strcmp(table, fdef->table) == 0)
-                || (fdef->org_table && strcmp(table, fdef->org_table) == 0)) {
-                if ((fdef->name && strcmp(field, fdef->name) == 0)
-                    || (fdef->org_name && strcmp(field, fdef->org_name) == 0))
-                    return i;
-            }
-        } else {
-            if ((fdef->name && strcmp(field, fdef->name) == 0)
-                || (fdef->org_name && strcmp(field, fdef->org_name) == 0))
-                return i;
+    for (i = 0; i < tree->order_array_size; i++) {
+        int r = sort_key_cmp(tree->kinds[i], a + i, b + i);
+        if (r != 0) {
+            return tree->order_array[i].desc ? -r : r;
         }
     }
-    return -1;
+    return 0;
 }
 
+/* decode the ORDER BY values of the head row, in one pass over its columns */
 static gboolean
-cetus_result_parse_fielddefs(cetus_result_t *res_merge, GQueue *input)
+merge_leaf_decode(merge_tree_t *tree, merge_leaf_t *leaf)
 {
-    if (res_merge->field_count >= input->length) {
-        g_critical("%s: res_merge->field_count:%d, queue length:%d",
-                G_STRLOC, res_merge->field_count, input->length);
-        return FALSE;
-    }
+    network_packet packet;
+    packet.data = leaf->record->data;
+    packet.offset = NET_HEADER_SIZE;
 
-    network_packet packet = { 0 };
+    int pos, i;
+    for (pos = 0; pos <= tree->max_pos; pos++) {
+        const char *s = NULL;
+        guint64 len = 0;
+        guint8 first = 0;
 
-    res_merge->fielddefs = g_ptr_array_new_with_free_func((GDestroyNotify)network_mysqld_proto_fielddef_free);
-    int i;
-    for (i = 0; i < res_merge->field_count; ++i) {
-        /* TODO g_queue_peek_nth is not efficient*/
-        packet.data = g_queue_peek_nth(input, i + 1);
-        packet.offset = 0;
-        network_mysqld_proto_skip_network_header(&packet);
-        network_mysqld_proto_fielddef_t *fdef;
-        fdef = network_mysqld_proto_fielddef_new();
-        int err = network_mysqld_proto_get_fielddef(&packet, fdef, CLIENT_PROTOCOL_41);
-        if (err) {
-            network_mysqld_proto_fielddef_free(fdef);
-            g_ptr_array_free(res_merge->fielddefs, TRUE);
-            res_merge->fielddefs = NULL;
+        if (network_mysqld_proto_peek_int8(&packet, &first) == -1) {
             return FALSE;
         }
-        g_ptr_array_add(res_merge->fielddefs, fdef);
-    }
+        if (first == MYSQLD_PACKET_NULL) {
+            network_mysqld_proto_skip(&packet, 1);
+        } else {
+            if (network_mysqld_proto_get_lenenc_int(&packet, &len) != 0
+                || packet.offset + len > packet.data->len) {
+                return FALSE;
+            }
+            s = packet.data->str + packet.offset;
+            network_mysqld_proto_skip(&packet, len);
+        }
 
+        for (i = 0; i < tree->order_array_size; i++) {
+            if (tree->order_array[i].pos != pos) {
+                continue;
+            }
+            if (!sort_key_decode(leaf->key + i, tree->kinds[i], s, (int)len)) {
+                g_warning("%s: value of %s not supported for order by", G_STRLOC, tree->order_array[i].name);
+                return FALSE;
+            }
+        }
+    }
     return TRUE;
 }
 
+/* take the next row of the shard as its head */
 static gboolean
-cetus_result_retrieve_field_count(GQueue *input, guint64 *p_field_count)
+merge_leaf_load(merge_tree_t *tree, merge_parameters_t *data, int index)
 {
-    g_debug("%s:call cetus_result_retrieve_field_count", G_STRLOC);
-    int packet_count = g_queue_get_length(input);
-    network_packet packet = { 0 };
-    packet.data = g_queue_peek_head(input); /* Number-of-Field packet */
-    int err = network_mysqld_proto_skip_network_header(&packet);
-    guint64 field_count;
-    err |= network_mysqld_proto_get_lenenc_int(&packet, &field_count);
-    if (err || field_count >= packet_count) {
-        return FALSE;
+    merge_leaf_t *leaf = &(tree->leaves[index]);
+    GList *candidate = data->candidates[index];
+    guchar pkt_type = get_pkt_type(candidate->data);
+
+    leaf->record = NULL;
+    if (pkt_type == MYSQLD_PACKET_EOF || pkt_type == MYSQLD_PACKET_ERR) {
+        g_debug("%s: index is over:%d", G_STRLOC, index);
+        leaf->is_over = 1;
+        if (pkt_type == MYSQLD_PACKET_ERR) {
+            leaf->is_err = 1;
+            tree->is_err = 1;
+            data->err_pack = candidate->data;
+        }
+        return TRUE;
     }
 
-    *p_field_count = field_count;
-
-    return TRUE;
+    leaf->record = candidate;
+    return merge_leaf_decode(tree, leaf);
 }
 
-/**
- * Get order_array.pos, order_array.type
- */
+/* TRUE if leaf a goes out before leaf b, finished shards go last */
 static gboolean
-get_order_by_fields(cetus_result_t *res_merge, ORDER_BY *order_array,
-                    guint order_array_size, result_merge_t *merged_result)
+merge_leaf_before(merge_tree_t *tree, int a, int b)
 {
-    int i;
-    for (i = 0; i < order_array_size; ++i) {
-        ORDER_BY *orderby = &(order_array[i]);
+    merge_leaf_t *la = &(tree->leaves[a]);
+    merge_leaf_t *lb = &(tree->leaves[b]);
 
-        if (orderby->pos == -1) {
-            int index = cetus_result_find_fielddef(res_merge,
-                                                   orderby->table_name, orderby->name);
-            if (index == -1) {
-                merged_result->status = RM_FAIL;
-                char msg[128] = { 0 };
-                snprintf(msg, sizeof(msg), "order by:no %s in field list", orderby->name);
-                merged_result->detail = g_string_new(msg);
-                return FALSE;
-            }
-            orderby->pos = index;
+    if (la->is_over || lb->is_over) {
+        if (la->is_over && lb->is_over) {
+            return a < b;
         }
-        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res_merge->fielddefs, orderby->pos);
-        orderby->type = fdef->type;
+        return lb->is_over;
     }
-    return TRUE;
+
+    int r = merge_key_cmp(tree, la->key, lb->key);
+    return r < 0 || (r == 0 && a < b);
 }
 
-static gboolean
-get_group_by_fields(cetus_result_t *res_merge, group_by_t *group_array, guint group_array_size,
-                    result_merge_t *merged_result)
+/**
+ * replay the matches on the path from @leaf to the root, leaves sit
+ * at virtual positions len..2*len-1 of the tree
+ */
+static void
+merge_tree_replay(merge_tree_t *tree, int leaf)
 {
-    int i;
-    for (i = 0; i < group_array_size; ++i) {
-        group_by_t *groupby = &(group_array[i]);
-        if (groupby->pos == -1) {
-            int index = cetus_result_find_fielddef(res_merge,
-                                                   groupby->table_name, groupby->name);
-            if (index == -1) {
-                merged_result->status = RM_FAIL;
-                char msg[128] = { 0 };
-                snprintf(msg, sizeof(msg), "group by: no %s in field list", groupby->name);
-                merged_result->detail = g_string_new(msg);
-                return FALSE;
-            }
-            groupby->pos = index;
+    int winner = leaf;
+    int node;
+    for (node = (leaf + tree->len) / 2; node > 0; node /= 2) {
+        if (tree->nodes[node] == -1) {
+            /* still building, wait here for the other side */
+            tree->nodes[node] = winner;
+            return;
+        }
+        if (merge_leaf_before(tree, tree->nodes[node], winner)) {
+            int loser = winner;
+            winner = tree->nodes[node];
+            tree->nodes[node] = loser;
         }
-        network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(res_merge->fielddefs, groupby->pos);
-        groupby->type = fdef->type;
     }
-    return TRUE;
+    tree->nodes[0] = winner;
 }
 
-static gboolean
-fulfill_condi(char *aggr_value, having_condition_t *hav_condi, result_merge_t *merged_result)
+/* the tree is built once every shard has its first row */
+static int
+merge_tree_build(network_mysqld_con *con, merge_parameters_t *data, int *compare_failed)
 {
-    int is_num = 0;
-    switch (hav_condi->data_type) {
-    case TK_INTEGER:
-        is_num = 1;
-        break;
-    case TK_FLOAT:
-        is_num = 1;
-        break;
-    default:
-        break;
+    merge_tree_t *tree = data->heap;
+    GList **candidates = data->candidates;
+    int i, shortaged = 0;
+
+    for (i = 0; i < tree->len; i++) {
+        merge_leaf_t *leaf = &(tree->leaves[i]);
+        if (leaf->record != NULL || leaf->is_over) {
+            continue;
+        }
+        if (candidates[i] == NULL || candidates[i]->data == NULL) {
+            check_server_sess_wait_for_event(con, i, EV_READ, &con->read_timeout);
+            shortaged = 1;
+            continue;
+        }
+        if (!merge_leaf_load(tree, data, i)) {
+            *compare_failed = 1;
+            return 0;
+        }
     }
 
-    int len1 = strlen(aggr_value);
-    int len2 = strlen(hav_condi->condition_value);
-    int result;
+    if (shortaged) {
+        con->partially_merged = 1;
+        return 0;
+    }
 
-    if (is_num) {
-        if (len2 == 0) {
-            return TRUE;
-        }
+    for (i = 0; i < tree->len; i++) {
+        tree->nodes[i] = -1;
+    }
+    for (i = 0; i < tree->len; i++) {
+        merge_tree_replay(tree, i);
+    }
+    tree->is_built = 1;
 
-        if (len1 == 0) {
-            return FALSE;
-        }
+    g_debug("%s: create merge tree over", G_STRLOC);
 
-        int num_unsupported = 0;
-        result = cmp_str_num(aggr_value, len1, hav_condi->condition_value, len2, &num_unsupported);
-        if (num_unsupported) {
-            merged_result->status = RM_FAIL;
-            g_warning("%s:merge_failed,num_unsupported", G_STRLOC);
-            return FALSE;
-        }
+    return 1;
+}
 
-    } else {
-        result = strcmp(aggr_value, hav_condi->condition_value);
+/* keep the key of a row leaving the merge, for DISTINCT */
+static void
+merge_tree_save_last(merge_tree_t *tree, merge_parameters_t *data, merge_leaf_t *leaf)
+{
+    GString *row = leaf->record->data;
+    if (data->last_row == NULL) {
+        data->last_row = g_string_sized_new(row->len);
     }
+    g_string_truncate(data->last_row, 0);
+    g_string_append_len(data->last_row, row->str, row->len);
 
-    switch (hav_condi->rel_type) {
-    case TK_LE:
-        if (result <= 0) {
-            return TRUE;
-        }
-        break;
-    case TK_GE:
-        if (result >= 0) {
-            return TRUE;
-        }
-        break;
-    case TK_LT:
-        if (result < 0) {
-            return TRUE;
-        }
-        break;
-    case TK_GT:
-        if (result > 0) {
-            return TRUE;
+    int i;
+    for (i = 0; i < tree->order_array_size; i++) {
+        sort_key_val_t *val = tree->last_key + i;
+        *val = leaf->key[i];
+        if (val->str) {
+            val->str = data->last_row->str + (val->str - row->str);
         }
-        break;
-    case TK_EQ:
-        if (result == 0) {
-            return TRUE;
+        if (val->frac) {
+            val->frac = data->last_row->str + (val->frac - row->str);
         }
-        break;
-    case TK_NE:
-        if (result != 0) {
-            return TRUE;
+    }
+    tree->has_last = 1;
+}
+
+static merge_tree_t *
+merge_tree_new(merge_parameters_t *data, ORDER_BY *order_array, int order_array_size, int len)
+{
+    int i, max_pos = 0;
+    sort_key_kind_t kinds[MAX_ORDER_COLS];
+    for (i = 0; i < order_array_size; i++) {
+        int kind = sort_key_kind(order_array[i].type);
+        if (kind < 0 || order_array[i].pos < 0) {
+            g_warning("%s:unknown Field Type: %d", G_STRLOC, order_array[i].type);
+            return NULL;
         }
-        break;
+        kinds[i] = kind;
+        max_pos = MAX(max_pos, order_array[i].pos);
     }
 
-    return FALSE;
+    merge_tree_t *tree = g_malloc0(sizeof(merge_tree_t) + len * sizeof(int));
+    memcpy(tree->order_array, order_array, order_array_size * sizeof(ORDER_BY));
+    memcpy(tree->kinds, kinds, order_array_size * sizeof(sort_key_kind_t));
+    tree->order_array_size = order_array_size;
+    tree->max_pos = max_pos;
+    tree->pending = -1;
+    tree->len = len;
+
+    /* leaves, then one key per leaf and the key of the last row */
+    char *elements = g_malloc0(len * sizeof(merge_leaf_t) + (len + 1) * order_array_size * sizeof(sort_key_val_t));
+    tree->leaves = (merge_leaf_t *)elements;
+    sort_key_val_t *keys = (sort_key_val_t *)(elements + len * sizeof(merge_leaf_t));
+    for (i = 0; i < len; i++) {
+        tree->leaves[i].key = keys + i * order_array_size;
+    }
+    tree->last_key = keys + len * order_array_size;
+
+    data->heap = tree;
+    data->elements = elements;
+    return tree;
 }
 
 static int
-aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count, result_merge_t *merged_result)
+do_sort_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished, int *compare_failed)
 {
-    guint cand_index = 0;
-    GList *candidate = NULL;
-    size_t row_cnter = 0;
-    size_t off_pos = 0;
-    size_t iter;
+    network_queue *send_queue = data->send_queue;
+    GPtrArray *recv_queues = data->recv_queues;
+    GList **candidates = data->candidates;
+    limit_t *limit = &(data->limit);
+    merge_tree_t *tree = data->heap;
+    int *row_cnter = &(data->row_cnter);
+    int *off_pos = &(data->off_pos);
 
-    GPtrArray *recv_queues = para->recv_queues;
+    int merged_output_size = con->srv->merged_output_size;
+    if (con->is_client_compressed) {
+        merged_output_size = con->srv->compressed_merged_output_size;
+    }
 
-    while (row_cnter < para->limit->row_count) {
-        if (!candidate || get_pkt_type((GString *)candidate->data) == MYSQLD_PACKET_EOF) {
-            for (iter = 0; iter < recv_queues->len; iter++) {
-                GString *item = candidates[iter]->data;
-                if (item != NULL && get_pkt_type(item) != MYSQLD_PACKET_EOF) {
-                    cand_index = iter;
-                    candidate = candidates[iter];
-                    break;
-                }
-            }
+    if (!tree->is_built) {
+        if (!merge_tree_build(con, data, compare_failed)) {
+            return 0;
         }
-        /* if candidate is still NULL, all possible candidates have been exhausted */
-        if (candidate == NULL || get_pkt_type((GString *)candidate->data) == MYSQLD_PACKET_EOF) {
-            break;
+    }
+
+    if (tree->pending >= 0) {
+        int index = tree->pending;
+        if (candidates[index] == NULL || candidates[index]->data == NULL) {
+            g_debug("%s: index:%d still waits", G_STRLOC, index);
+            check_server_sess_wait_for_event(con, index, EV_READ, &con->read_timeout);
+            return 0;
+        }
+        if (!merge_leaf_load(tree, data, index)) {
+            *compare_failed = 1;
+            return 0;
         }
+        tree->pending = -1;
+        merge_tree_replay(tree, index);
+    }
 
-        /* to obtain candidate ptr and its index in recv_queues by scanning candidates once */
-        for (iter = 0; iter < recv_queues->len; iter++) {
-            /* don't compare with itself */
-            if (iter == cand_index) {
-                continue;
-            } else {
-                GList *tmp_list = candidates[iter];
-                /* some recv_queue may be shorter than others */
-                if (tmp_list == NULL || get_pkt_type((GString *)tmp_list->data) == MYSQLD_PACKET_EOF) {
-                    continue;
-                }
+    while ((*row_cnter) < limit->row_count) {
+        int index = tree->nodes[0];
+        merge_leaf_t *leaf = &(tree->leaves[index]);
+        if (leaf->is_over) {
+            if (tree->is_err) {
+                data->is_pack_err = 1;
+            }
+            break;
+        }
 
-                /* 1, output; 0, wait; -1, change index */
+        GList *candidate = leaf->record;
+        GString *row = candidate->data;
+        gsize row_len = row->len;
 
-                g_debug("record1:%p, record2:%p", candidate, tmp_list);
-                int merge_failed = 0;
-                int result = cal_aggr_rec_rel(candidate, tmp_list, para, &merge_failed);
+        g_debug("%s: row counter:%d", G_STRLOC, (int)(*row_cnter));
 
-                if (merge_failed) {
-                    merged_result->status = RM_FAIL;
-                    g_warning("%s:merge_failed", G_STRLOC);
-                    return 0;
-                }
+        if (data->is_distinct && tree->has_last && merge_key_cmp(tree, leaf->key, tree->last_key) == 0) {
+            g_debug("%s: dup element at:%d", G_STRLOC, index);
+            g_string_free(row, TRUE);
+        } else if ((*off_pos) < limit->offset) {
+            (*off_pos)++;
+            if (data->is_distinct) {
+                merge_tree_save_last(tree, data, leaf);
+            }
+            g_string_free(row, TRUE);
+            g_debug("%s: off pos here:%d", G_STRLOC, (int)(*off_pos));
+        } else {
+            if (data->is_distinct) {
+                merge_tree_save_last(tree, data, leaf);
+            }
+            int packet_len = network_mysqld_proto_get_packet_len(row);
+            data->aggr_output_len += packet_len;
+            row->str[3] = data->pkt_count + 1;
+            ++(data->pkt_count);
+            network_queue_append(send_queue, row);
+            (*row_cnter)++;
 
-                if (result == -1) {
-                    candidate = tmp_list;
-                    cand_index = iter;
-                } else if (result == 0) {
-                    candidates[iter] = tmp_list->next;
-                    continue;
-                }
+            if (data->aggr_output_len >= merged_output_size) {
+                g_debug("%s: send_part_content_to_client:%d", G_STRLOC, data->aggr_output_len);
+                send_part_content_to_client(con);
+                data->aggr_output_len = 0;
             }
         }
 
-        g_debug("candidate:%p, off_pos:%d, para->limit->offset:%d",
-                candidate, (int) off_pos, (int) para->limit->offset);
-        if (off_pos < para->limit->offset) {
-            off_pos++;
-            candidates[cand_index] = candidate->next;
-            candidate = candidate->next;
-            continue;
-        } else {
-            char aggr_value[MAX_COL_VALUE_LEN] = { 0 };
-            retrieve_aggr_value(candidate->data, para->hav_condi->column_index, aggr_value);
+        merge_release_row(con, index, row_len);
+        leaf->record = NULL;
+        candidates[index] = candidate->next;
+        network_queue *recv_queue = recv_queues->pdata[index];
+        g_debug("%s: remove candidate:%p for queue:%p, ss:%d", G_STRLOC, candidate, recv_queue, index);
+        g_queue_delete_link(recv_queue->chunks, candidate);
 
-            if (!para->hav_condi->rel_type || fulfill_condi(aggr_value, para->hav_condi, merged_result)) {
-                ((GString *)candidate->data)->str[3] = (*pkt_count) + 1;
-                ++(*pkt_count);
-                row_cnter++;
-                network_queue_append(para->send_queue, (GString *)candidate->data);
-            } else {
-                g_string_free((GString *)candidate->data, TRUE);
+        if (candidates[index] == NULL || candidates[index]->data == NULL) {
+            /* only the shard just consumed is read further, the others keep their rows */
+            tree->pending = index;
+            con->partially_merged = 1;
+            g_debug("%s: item is nil, index:%d", G_STRLOC, index);
+            if (data->aggr_output_len >= merged_output_size) {
+                send_part_content_to_client(con);
+                g_debug("%s: send_part_content_to_client:%d", G_STRLOC, data->aggr_output_len);
+                data->aggr_output_len = 0;
             }
+            check_server_sess_wait_for_event(con, index, EV_READ, &con->read_timeout);
+            return 0;
+        }
+
+        if (!merge_leaf_load(tree, data, index)) {
+            *compare_failed = 1;
+            return 0;
+        }
+        merge_tree_replay(tree, index);
+    }
 
-            candidates[cand_index] = candidate->next;
-            GList *ptr_to_unlink = candidate;
-            candidate = candidate->next;
-            network_queue *recv_queue = recv_queues->pdata[cand_index];
-            g_queue_delete_link(recv_queue->chunks, ptr_to_unlink);
+    if (limit->row_count > 0 && (*row_cnter) >= limit->row_count) {
+        if (check_after_limit(con, data, is_finished) == FALSE) {
+            return 0;
         }
     }
 
     return 1;
 }
 
-void
-heap_adjust(heap_type *heap, int s, int m, int *compare_failed)
-{
-    g_debug("%s: call heap_adjust, s:%d, m:%d", G_STRLOC, s, m);
-
-    s = s - 1;
-    m = m - 1;
+#define AGGR_NOT_FIXED_DEC 31
+/* hash table node and bookkeeping of a group */
+#define AGGR_GROUP_OVERHEAD 64
 
-    heap_element *rc = heap->element[s];
+static gboolean
+aggr_col_init(aggr_col_t *col, group_aggr_t *aggr, network_mysqld_proto_fielddefs_t *fielddefs)
+{
+    network_mysqld_proto_fielddef_t *fdef = g_ptr_array_index(fielddefs, aggr->pos);
+    int kind = sort_key_kind(aggr->type);
 
-    int j, k, is_dup;
+    col->pos = aggr->pos;
+    col->key_kind = kind;
+    col->scale = 0;
 
-    for (j = (s << 1) + 1; j <= m; j = (j << 1) + 1) {
-        if (j < m) {
-            if (heap->element[j]->is_over && heap->element[j + 1]->is_over) {
-                g_debug("%s: in adjust, break here:%d", G_STRLOC, j);
-                break;
-            }
+    switch (aggr->fun_type) {
+    case FT_COUNT:
+        col->kind = AGGR_ACC_COUNT;
+        return TRUE;
+    case FT_SUM:
+        if (kind == SORT_KEY_DECIMAL) {
+            col->kind = AGGR_ACC_SUM_DECIMAL;
+            if (aggr->type == FIELD_TYPE_NEWDECIMAL || aggr->type == FIELD_TYPE_DECIMAL) {
+                col->scale = fdef->decimals;
+            }
+            return col->scale < AGGR_NOT_FIXED_DEC;
+        } else if (kind == SORT_KEY_DOUBLE) {
+            col->kind = AGGR_ACC_SUM_DOUBLE;
+            col->scale = fdef->decimals;
+            return TRUE;
+        }
+        g_warning("%s: type is not valid for sum:%d", G_STRLOC, aggr->type);
+        return FALSE;
+    case FT_MIN:
+    case FT_MAX:
+        if (kind < 0) {
+            g_warning("%s:unknown Field Type: %d", G_STRLOC, aggr->type);
+            return FALSE;
+        }
+        col->kind = aggr->fun_type == FT_MIN ? AGGR_ACC_MIN : AGGR_ACC_MAX;
+        return TRUE;
+    default:
+        g_warning("%s: aggr fun not supported:%d", G_STRLOC, aggr->fun_type);
+        return FALSE;
+    }
+}
 
-            if (heap->element[j]->is_over) {
-                j++;
-            } else if (!heap->element[j + 1]->is_over) {
-                if (!heap->element[j]->refreshed && !heap->element[j + 1]->refreshed && heap->element[j]->is_prior_to == -1) {
-                    j++;
-                } else {
-                    is_dup = 0;
-                    k = j;
-                    if (!is_prior_to(heap->element[j]->record->data,
-                                     heap->element[j + 1]->record->data, &(heap->order_para),
-                                     heap->element[j]->index, heap->element[j + 1]->index, &is_dup, compare_failed)) {
-                        j++;
-                        heap->element[j]->is_prior_to = -1;
+static aggr_table_t *
+aggr_table_new(aggr_by_group_para_t *para)
+{
+    aggr_table_t *t = g_new0(aggr_table_t, 1);
+    int i;
 
-                    } else {
-                        if (is_dup) {
-                            heap->element[j + 1]->is_dup = 1;
-                        } else {
-                        }
+    t->group_array = para->group_array;
+    t->group_num = para->group_array_size;
+    t->aggr_num = para->aggr_num;
+    t->mem_limit = para->mem_limit;
 
-                        heap->element[j]->is_prior_to = 1;
-                    }
+    for (i = 0; i < t->group_num; i++) {
+        int kind = sort_key_kind(t->group_array[i].type);
+        if (kind < 0) {
+            g_warning("%s:unknown Field Type: %d", G_STRLOC, t->group_array[i].type);
+            g_free(t);
+            return NULL;
+        }
+        t->group_kinds[i] = kind;
+        t->max_pos = MAX(t->max_pos, t->group_array[i].pos);
+    }
 
-                    heap->element[k]->refreshed = 0;
-                    heap->element[k + 1]->refreshed = 0;
-                }
-            }
-        } else {
-            if (heap->element[j]->is_over) {
-                g_debug("%s: call over here, break j:%d", G_STRLOC, j);
-                break;
-            }
+    for (i = 0; i < t->aggr_num; i++) {
+        if (!aggr_col_init(&(t->cols[i]), para->aggr_array + i, para->fielddefs)) {
+            g_free(t);
+            return NULL;
         }
+        t->max_pos = MAX(t->max_pos, t->cols[i].pos);
+    }
 
-        if (!rc->is_over) {
-            is_dup = 0;
-            if (is_prior_to(rc->record->data, heap->element[j]->record->data,
-                            &(heap->order_para), rc->index, heap->element[j]->index, &is_dup, compare_failed)) {
-                if (is_dup) {
-                    if (heap->element[j]->is_dup) {
-                        heap->element[s]->is_dup = 1;
-                    } else {
-                        heap->element[j]->is_dup = 1;
-                    }
-                }
+    t->fields = g_new(aggr_field_t, (t->max_pos + 1) * AGGR_BATCH_SIZE);
+    t->keys = g_string_sized_new(1024);
+    t->output = g_ptr_array_new();
+    return t;
+}
 
-                break;
-            }
-        }
+static guint
+aggr_group_hash(gconstpointer v)
+{
+    const aggr_group_t *group = v;
+    return (guint)(group->hash ^ (group->hash >> 32));
+}
 
-        heap->element[s] = heap->element[j];
-        heap->element[s]->refreshed = 1;
+static gboolean
+aggr_group_equal(gconstpointer a, gconstpointer b)
+{
+    const aggr_group_t *g1 = a;
+    const aggr_group_t *g2 = b;
+    return g1->hash == g2->hash && g1->key->len == g2->key->len
+        && memcmp(g1->key->str, g2->key->str, g1->key->len) == 0;
+}
 
-        s = j;
+static void
+aggr_group_free(aggr_table_t *t, aggr_group_t *group)
+{
+    int i;
+    for (i = 0; i < t->aggr_num; i++) {
+        if (group->acc[i].val) {
+            g_string_free(group->acc[i].val, TRUE);
+        }
     }
-
-    heap->element[s] = rc;
-    heap->element[s]->refreshed = 1;
+    if (group->row) {
+        g_string_free(group->row, TRUE);
+    }
+    g_string_free(group->key, TRUE);
+    g_free(group);
 }
 
 static void
-check_server_sess_wait_for_event(network_mysqld_con *con, int ss_index, short ev_type, struct timeval *timeout)
+aggr_table_free(aggr_table_t *t)
 {
-    size_t i;
-    for (i = 0; i < con->servers->len; i++) {
-        server_session_t *ss = g_ptr_array_index(con->servers, i);
-        if (ss_index >= 0) {
-            if (ss_index != i) {
-                continue;
-            }
+    int i;
+    if (t->groups) {
+        GHashTableIter iter;
+        aggr_group_t *group;
+        g_hash_table_iter_init(&iter, t->groups);
+        while (g_hash_table_iter_next(&iter, (gpointer *)&group, NULL)) {
+            aggr_group_free(t, group);
         }
+        g_hash_table_destroy(t->groups);
+    }
+    for (i = 0; i < AGGR_SPILL_PARTS; i++) {
+        if (t->parts[i]) {
+            fclose(t->parts[i]);
+        }
+    }
+    for (i = 0; i < t->output->len; i++) {
+        aggr_row_t *out = g_ptr_array_index(t->output, i);
+        if (out->row) {
+            g_string_free(out->row, TRUE);
+        }
+        g_free(out);
+    }
+    g_ptr_array_free(t->output, TRUE);
+    g_string_free(t->keys, TRUE);
+    g_free(t->fields);
+    g_free(t);
+}
 
-        if (!ss->server->is_read_finished) {
-            if (ss->server->is_waiting) {
-                g_debug("%s: ss %d is waiting", G_STRLOC, (int)i);
-                continue;
-            }
-            con->num_read_pending++;
-            ss->read_cal_flag = 0;
-            g_debug("%s: ss %d is not read finished, read pending:%d, fd:%d, ss index:%d",
-                    G_STRLOC, (int)i, con->num_read_pending, ss->server->fd, ss->index);
-            event_set(&(ss->server->event), ss->server->fd, ev_type, server_session_con_handler, ss);
-            chassis_event_add_with_timeout(con->srv, &(ss->server->event), timeout);
-            g_debug("%s: call chassis_event_add_with_timeout", G_STRLOC);
-            ss->server->is_waiting = 1;
+/* split a row into its columns up to max_pos */
+static gboolean
+aggr_split_row(GString *row, aggr_field_t *fields, int max_pos)
+{
+    network_packet packet;
+    packet.data = row;
+    packet.offset = NET_HEADER_SIZE;
+
+    int pos;
+    for (pos = 0; pos <= max_pos; pos++) {
+        aggr_field_t *field = fields + pos;
+        guint8 first = 0;
+
+        field->raw = row->str + packet.offset;
+        if (network_mysqld_proto_peek_int8(&packet, &first) == -1) {
+            return FALSE;
+        }
+        if (first == MYSQLD_PACKET_NULL) {
+            network_mysqld_proto_skip(&packet, 1);
+            field->str = NULL;
+            field->len = 0;
         } else {
-            g_debug("%s: ss %d is read finished", G_STRLOC, (int)i);
+            if (network_mysqld_proto_get_lenenc_int(&packet, &(field->len)) != 0
+                || packet.offset + field->len > row->len) {
+                return FALSE;
+            }
+            field->str = row->str + packet.offset;
+            network_mysqld_proto_skip(&packet, field->len);
         }
     }
+    return TRUE;
 }
 
-static int
-check_after_limit(network_mysqld_con *con, merge_parameters_t *data, int is_finished)
+/* append the group values in a form equal for equal values */
+static gboolean
+aggr_encode_key(aggr_table_t *t, aggr_field_t *fields, GString *key)
 {
-    GPtrArray *recv_queues = data->recv_queues;
-    GList **candidates = data->candidates;
-    gboolean is_more_to_read = FALSE;
-    GList *candidate = NULL;
-    size_t iter;
+    int i;
+    for (i = 0; i < t->group_num; i++) {
+        aggr_field_t *field = fields + t->group_array[i].pos;
+        sort_key_val_t val;
+        guint32 len;
 
-    g_debug("%s: call check_after_limit", G_STRLOC);
+        if (!sort_key_decode(&val, t->group_kinds[i], field->str, field->len)) {
+            g_warning("%s: value of %s not supported for group by", G_STRLOC, t->group_array[i].name);
+            return FALSE;
+        }
+        if (val.is_null) {
+            g_string_append_c(key, 0);
+            continue;
+        }
+        g_string_append_c(key, 1);
 
-    for (iter = 0; iter < recv_queues->len; iter++) {
-        gboolean is_over = FALSE;
-        do {
-            candidate = candidates[iter];
-            if (candidate == NULL || candidate->data == NULL) {
-                con->partially_merged = 1;
-                is_more_to_read = TRUE;
-                g_debug("%s: item is nil, index:%d", G_STRLOC, (int)iter);
-                break;
+        switch (t->group_kinds[i]) {
+        case SORT_KEY_DECIMAL:
+            g_string_append_c(key, val.is_neg);
+            len = val.len;
+            g_string_append_len(key, (const char *)&len, sizeof(len));
+            g_string_append_len(key, val.str, val.len);
+            g_string_append_len(key, val.frac, val.frac_len);
+            break;
+        case SORT_KEY_DOUBLE:
+            if (val.v.dbl == 0) {
+                val.v.dbl = 0;  /* -0.0 */
             }
-
-            GString *item = candidate->data;
-            guchar pkt_type = get_pkt_type(item);
-            if (pkt_type == MYSQLD_PACKET_EOF || pkt_type == MYSQLD_PACKET_ERR) {
-                g_debug("%s: is over true:%d, pkt type:%d", G_STRLOC, (int)iter, (int)pkt_type);
-                is_over = TRUE;
-                break;
+            g_string_append_len(key, (const char *)&val.v.dbl, sizeof(val.v.dbl));
+            break;
+        case SORT_KEY_DATE:
+        case SORT_KEY_TIME:
+        case SORT_KEY_YEAR:
+            g_string_append_len(key, (const char *)&val.v.num, sizeof(val.v.num));
+            break;
+        default: {
+            /* strings group case insensitively, as they are compared */
+            gsize j, off;
+            len = field->len;
+            g_string_append_len(key, (const char *)&len, sizeof(len));
+            off = key->len;
+            g_string_append_len(key, field->str, field->len);
+            for (j = off; j < key->len; j++) {
+                key->str[j] = g_ascii_tolower(key->str[j]);
             }
+            break;
+        }
+        }
+    }
+    return TRUE;
+}
 
-            candidates[iter] = candidate->next;
-            g_debug("%s: free packet addr:%p, iter:%d, pkt_type:%d", G_STRLOC,
-                    candidate->data, (int)iter, (int)pkt_type);
-            g_string_free((GString *)candidate->data, TRUE);
-            network_queue *recv_queue = recv_queues->pdata[iter];
-            g_queue_delete_link(recv_queue->chunks, candidate);
-        } while (!is_over);
+/* parse [+-]digits[.digits] as an integer scaled by 10^scale */
+static gboolean
+aggr_parse_decimal(const char *s, guint64 len, int scale, __int128 *v)
+{
+    const char *end = s + len;
+    int neg = 0, frac = -1;
+    __int128 r = 0;
+
+    if (s < end && (*s == '-' || *s == '+')) {
+        neg = (*s == '-');
+        s++;
+    }
+    if (s == end) {
+        return FALSE;
     }
 
-    if (is_finished && is_more_to_read) {
-        g_warning("%s: finished reading, but needs more read:%p", G_STRLOC, con);
-    } else if ((!is_finished) && (!is_more_to_read)) {
-        g_warning("%s: not finished reading, but is_more_to_read false:%p", G_STRLOC, con);
+    for (; s < end; s++) {
+        if (*s == '.' && frac < 0) {
+            frac = 0;
+            continue;
+        }
+        if (!g_ascii_isdigit(*s)) {
+            return FALSE;
+        }
+        if (frac >= 0) {
+            if (frac == scale) {
+                if (*s != '0') {
+                    return FALSE;
+                }
+                continue;
+            }
+            frac++;
+        }
+        if (__builtin_mul_overflow(r, 10, &r) || __builtin_add_overflow(r, *s - '0', &r)) {
+            return FALSE;
+        }
     }
 
-    if (is_more_to_read) {
-        g_debug("%s: need more reading for:%p", G_STRLOC, con);
-        check_server_sess_wait_for_event(con, -1, EV_READ, &con->read_timeout);
-        return 0;
+    for (frac = MAX(frac, 0); frac < scale; frac++) {
+        if (__builtin_mul_overflow(r, 10, &r)) {
+            return FALSE;
+        }
     }
 
-    return 1;
+    *v = neg ? -r : r;
+    return TRUE;
 }
 
-static int
-do_simple_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished)
+static gboolean
+aggr_acc_update(aggr_table_t *t, aggr_col_t *col, aggr_acc_t *acc, aggr_field_t *field)
 {
-    network_queue *send_queue = data->send_queue;
-    GPtrArray *recv_queues = data->recv_queues;
-    GList **candidates = data->candidates;
-    limit_t *limit = &(data->limit);
-    int *row_cnter = &(data->row_cnter);
-    int *off_pos = &(data->off_pos);
-
-    GList *candidate = NULL;
-    size_t iter;
-
-    heap_count = 0;
+    if (field->str == NULL) {
+        /* aggregates skip NULL */
+        return TRUE;
+    }
 
-    int merged_output_size = con->srv->merged_output_size;
-    if (con->is_client_compressed) {
-        merged_output_size = con->srv->compressed_merged_output_size;
+    switch (col->kind) {
+    case AGGR_ACC_COUNT: {
+        __int128 v;
+        if (!aggr_parse_decimal(field->str, field->len, 0, &v) || v > G_MAXINT64 || v < 0) {
+            g_warning("%s: invalid count:%.*s", G_STRLOC, (int)field->len, field->str);
+            return FALSE;
+        }
+        acc->v.count += (gint64)v;
+        break;
+    }
+    case AGGR_ACC_SUM_DECIMAL: {
+        __int128 v;
+        if (!aggr_parse_decimal(field->str, field->len, col->scale, &v)
+            || __builtin_add_overflow(acc->v.sum, v, &(acc->v.sum))) {
+            g_warning("%s: sum out of range:%.*s", G_STRLOC, (int)field->len, field->str);
+            return FALSE;
+        }
+        break;
+    }
+    case AGGR_ACC_SUM_DOUBLE: {
+        sort_key_val_t val;
+        if (!sort_key_decode(&val, SORT_KEY_DOUBLE, field->str, field->len)) {
+            g_warning("%s: str num is not supported:%.*s", G_STRLOC, (int)field->len, field->str);
+            return FALSE;
+        }
+        acc->v.dbl += val.v.dbl;
+        break;
+    }
+    case AGGR_ACC_MIN:
+    case AGGR_ACC_MAX: {
+        sort_key_val_t val;
+        if (!sort_key_decode(&val, col->key_kind, field->str, field->len)) {
+            g_warning("%s: value not supported for min/max:%.*s", G_STRLOC, (int)field->len, field->str);
+            return FALSE;
+        }
+        if (acc->has_value) {
+            int r = sort_key_cmp(col->key_kind, &val, &(acc->key));
+            if ((col->kind == AGGR_ACC_MIN && r >= 0) || (col->kind == AGGR_ACC_MAX && r <= 0)) {
+                return TRUE;
+            }
+            t->bytes -= acc->val->allocated_len;
+            g_string_truncate(acc->val, 0);
+        } else {
+            acc->val = g_string_sized_new(field->len + 1);
+        }
+        g_string_append_len(acc->val, field->str, field->len);
+        t->bytes += acc->val->allocated_len;
+        /* decode again to point into the copy */
+        sort_key_decode(&(acc->key), col->key_kind, acc->val->str, acc->val->len);
+        break;
+    }
     }
 
-    g_debug("%s: call do_simple_merge", G_STRLOC);
+    acc->has_value = 1;
+    return TRUE;
+}
 
-    gboolean shortaged = FALSE;
-    for (iter = 0; iter < recv_queues->len; iter++) {
-        candidate = candidates[iter];
-        network_queue *recv_queue = recv_queues->pdata[iter];
+static void
+aggr_format_decimal(GString *out, __int128 v, int scale)
+{
+    char digits[64];
+    int n = 0;
+    unsigned __int128 u = v < 0 ? -(unsigned __int128)v : (unsigned __int128)v;
+
+    do {
+        digits[n++] = '0' + (int)(u % 10);
+        u /= 10;
+    } while (u > 0);
+    while (n <= scale) {
+        digits[n++] = '0';
+    }
 
-        while (candidate != NULL) {
-            if (candidate->data == NULL) {
-                g_debug("%s: candidate data is nil:%d", G_STRLOC, (int)iter);
-                break;
-            }
+    if (v < 0) {
+        g_string_append_c(out, '-');
+    }
+    while (n-- > 0) {
+        g_string_append_c(out, digits[n]);
+        if (n == scale && n > 0) {
+            g_string_append_c(out, '.');
+        }
+    }
+}
 
-            if ((*row_cnter) == limit->row_count) {
-                g_debug("%s: reach limit:%d", G_STRLOC, (int)iter);
-                break;
-            }
+static void
+aggr_format_double(GString *out, double d, int scale)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    char fmt[16];
 
-            guchar pkt_type = get_pkt_type((GString *)candidate->data);
-            if (pkt_type == MYSQLD_PACKET_EOF) {
-                g_debug("%s: MYSQLD_PACKET_EOF here:%d", G_STRLOC, (int)iter);
+    if (scale < AGGR_NOT_FIXED_DEC) {
+        g_snprintf(fmt, sizeof(fmt), "%%.%df", scale);
+        g_ascii_formatd(buf, sizeof(buf), fmt, d);
+    } else {
+        /* the shortest form reading back the same */
+        int precision;
+        for (precision = 15; precision <= 17; precision++) {
+            g_snprintf(fmt, sizeof(fmt), "%%.%dg", precision);
+            g_ascii_formatd(buf, sizeof(buf), fmt, d);
+            if (g_ascii_strtod(buf, NULL) == d) {
                 break;
             }
+        }
+    }
+    g_string_append(out, buf);
+}
 
-            if (pkt_type == MYSQLD_PACKET_ERR) {
-                data->is_pack_err = 1;
-                data->err_pack = candidate->data;
-                g_debug("%s: MYSQLD_PACKET_ERR here:%d", G_STRLOC, (int)iter);
-                break;
-            }
+/* the output row: the first row of the group with its aggregates replaced */
+static aggr_row_t *
+aggr_group_finish(aggr_table_t *t, aggr_group_t *group)
+{
+    GString *row = group->row;
+    GString *out_row = g_string_sized_new(row->len + 32);
+    GString *value = g_string_sized_new(64);
+    network_packet packet;
+    int pos = 0, i;
 
-            if ((*off_pos) < limit->offset) {
-                (*off_pos)++;
-                g_string_free((GString *)candidate->data, TRUE);
-            } else {
+    packet.data = row;
+    packet.offset = NET_HEADER_SIZE;
+    g_string_append_len(out_row, row->str, NET_HEADER_SIZE);
 
-                int packet_len = network_mysqld_proto_get_packet_len(candidate->data);
-                data->aggr_output_len += packet_len;
+    while (packet.offset < row->len) {
+        gsize start = packet.offset;
+        skip_field(&packet, 1);
 
-                ((GString *)candidate->data)->str[3] = data->pkt_count + 1;
-                ++(data->pkt_count);
-                network_queue_append(send_queue, (GString *)candidate->data);
-                if (data->aggr_output_len >= merged_output_size) {
-                    g_debug("%s: send_part_content_to_client:%d, iter:%d", G_STRLOC, data->aggr_output_len, (int)iter);
-                    send_part_content_to_client(con);
-                    data->aggr_output_len = 0;
-                }
-                (*row_cnter)++;
+        for (i = 0; i < t->aggr_num; i++) {
+            if (t->cols[i].pos == pos) {
+                break;
             }
-
-            candidates[iter] = candidate->next;
-            g_queue_delete_link(recv_queue->chunks, candidate);
-            candidate = candidates[iter];
         }
 
-        if (candidate == NULL || candidate->data == NULL) {
-            if (con->servers) {
-                server_session_t *ss = g_ptr_array_index(con->servers, iter);
-                if (ss->server->is_waiting) {
-                    g_debug("%s: is_waiting true:%d", G_STRLOC, (int)iter);
-                    continue;
+        if (i == t->aggr_num) {
+            g_string_append_len(out_row, row->str + start, packet.offset - start);
+        } else {
+            aggr_col_t *col = &(t->cols[i]);
+            aggr_acc_t *acc = &(group->acc[i]);
+            g_string_truncate(value, 0);
+            switch (col->kind) {
+            case AGGR_ACC_COUNT:
+                g_string_append_printf(value, "%" G_GINT64_FORMAT, acc->v.count);
+                break;
+            case AGGR_ACC_SUM_DECIMAL:
+                aggr_format_decimal(value, acc->v.sum, col->scale);
+                break;
+            case AGGR_ACC_SUM_DOUBLE:
+                aggr_format_double(value, acc->v.dbl, col->scale);
+                break;
+            default:
+                if (acc->has_value) {
+                    g_string_append_len(value, acc->val->str, acc->val->len);
                 }
-                candidates[iter] = NULL;
-                g_debug("%s: candidate is nil for i:%d, recv_queues:%p",
-                        G_STRLOC, (int)iter, recv_queues);
-                shortaged = TRUE;
+                break;
+            }
+            if (acc->has_value || col->kind == AGGR_ACC_COUNT) {
+                network_mysqld_proto_append_lenenc_str_len(out_row, value->str, value->len);
             } else {
-                g_warning("%s: return part of responses", G_STRLOC);
+                network_mysqld_proto_append_lenenc_str_len(out_row, NULL, 0);
             }
         }
+        pos++;
     }
+    g_string_free(value, TRUE);
+    network_mysqld_proto_set_packet_len(out_row, out_row->len - NET_HEADER_SIZE);
 
-    if (shortaged) {
-        con->partially_merged = 1;
-        g_debug("%s: need more reading for:%p", G_STRLOC, con);
-        if (data->aggr_output_len >= merged_output_size) {
-            send_part_content_to_client(con);
-            data->aggr_output_len = 0;
-        }
-        check_server_sess_wait_for_event(con, -1, EV_READ, &con->read_timeout);
-        return 0;
-    } else {
-        if (!is_finished) {
-            g_debug("%s: check limit for:%p", G_STRLOC, con);
-            if (limit->row_count > 0 && (*row_cnter) >= limit->row_count) {
-                g_debug("%s: do call check_after_limit for:%p", G_STRLOC, con);
-                if (check_after_limit(con, data, is_finished) == FALSE) {
-                    g_debug("%s: call check_after_limit over for:%p", G_STRLOC, con);
-                    return 0;
-                }
-            }
-        }
+    aggr_row_t *out = g_malloc0(sizeof(aggr_row_t) + t->group_num * sizeof(sort_key_val_t));
+    out->row = out_row;
+
+    aggr_field_t *fields = t->fields;
+    if (!aggr_split_row(out_row, fields, t->max_pos)) {
+        g_critical("%s: output row broken", G_STRLOC);
+    }
+    for (i = 0; i < t->group_num; i++) {
+        aggr_field_t *field = fields + t->group_array[i].pos;
+        sort_key_decode(out->key + i, t->group_kinds[i], field->str, field->len);
     }
 
-    return 1;
+    return out;
 }
 
-static int
-do_sort_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finished, int *compare_failed)
+/* all groups in memory are done, move them to the output */
+static void
+aggr_table_flush(aggr_table_t *t)
 {
-    network_queue *send_queue = data->send_queue;
-    GPtrArray *recv_queues = data->recv_queues;
-    GList **candidates = data->candidates;
-    limit_t *limit = &(data->limit);
-    heap_type *heap = data->heap;
-    int *row_cnter = &(data->row_cnter);
-    int *off_pos = &(data->off_pos);
-    uint64_t *field_offsets = heap->order_para.field_offsets_cache;
-
-    GList *candidate = NULL;
-
-    int merged_output_size = con->srv->merged_output_size;
-    if (con->is_client_compressed) {
-        merged_output_size = con->srv->compressed_merged_output_size;
+    if (t->groups == NULL) {
+        return;
     }
-    int last_output_index = -1;
-    while ((*row_cnter) < limit->row_count) {
-        if (heap->element[0]->is_over) {
-            if (heap->is_err) {
-                data->is_pack_err = 1;
-            }
-            break;
-        }
 
-        int cand_index = heap->element[0]->index;
+    GHashTableIter iter;
+    aggr_group_t *group;
+    g_hash_table_iter_init(&iter, t->groups);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&group, NULL)) {
+        g_ptr_array_add(t->output, aggr_group_finish(t, group));
+        aggr_group_free(t, group);
+        g_hash_table_iter_remove(&iter);
+    }
+    t->bytes = 0;
+}
 
-        if (heap->element[0]->record == NULL) {
-            if (candidates[cand_index] == NULL) {
-                g_debug("%s: cand_index:%d is nil", G_STRLOC, cand_index);
-                check_server_sess_wait_for_event(con, cand_index, EV_READ, &con->read_timeout);
-                return 0;
-            } else {
-                heap->element[0]->record = candidates[cand_index];
-                g_debug("%s: record:%p for index:%d", G_STRLOC, heap->element[0]->record, cand_index);
-                heap_adjust(heap, 1, recv_queues->len, compare_failed);
-                if (*compare_failed) {
-                    return 0;
-                }
-                cand_index = heap->element[0]->index;
-            }
+static gboolean
+aggr_table_spill(aggr_table_t *t, GString *row, guint64 hash)
+{
+    int part = (hash >> 32) % AGGR_SPILL_PARTS;
+    if (t->parts[part] == NULL) {
+        t->parts[part] = tmpfile();
+        if (t->parts[part] == NULL) {
+            g_warning("%s: create spill file failed:%s", G_STRLOC, g_strerror(errno));
+            return FALSE;
         }
+    }
+
+    guint32 len = row->len;
+    if (fwrite(&len, sizeof(len), 1, t->parts[part]) != 1 || fwrite(row->str, 1, len, t->parts[part]) != len) {
+        g_warning("%s: write spill file failed:%s", G_STRLOC, g_strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
 
-        candidate = heap->element[0]->record;
-        field_offsets[cand_index] = 0;
+/**
+ * aggregate a batch of rows, all rows are taken over
+ *
+ * keys and hashes of the whole batch are computed first, then the rows
+ * are folded into their groups
+ */
+static gboolean
+aggr_table_feed(aggr_table_t *t, GString **rows, int n)
+{
+    guint64 hashes[AGGR_BATCH_SIZE];
+    gsize key_offsets[AGGR_BATCH_SIZE + 1];
+    int stride = t->max_pos + 1;
+    gboolean ok = TRUE;
+    int i, j;
 
-        g_debug("%s: row counter:%d", G_STRLOC, (int)(*row_cnter));
+    if (t->groups == NULL) {
+        t->groups = g_hash_table_new(aggr_group_hash, aggr_group_equal);
+    }
 
-        if (data->is_distinct && heap->element[0]->is_dup && cand_index != last_output_index) {
-            g_debug("%s: dup element at:%d", G_STRLOC, cand_index);
-            g_string_free((GString *)candidate->data, TRUE);
-        } else if ((*off_pos) < limit->offset) {
-            (*off_pos)++;
-            g_string_free((GString *)candidate->data, TRUE);
-            g_debug("%s: off pos here:%d", G_STRLOC, (int)(*off_pos));
-        } else {
+    g_string_truncate(t->keys, 0);
+    for (i = 0; i < n; i++) {
+        key_offsets[i] = t->keys->len;
+        if (!aggr_split_row(rows[i], t->fields + i * stride, t->max_pos)) {
+            g_warning("%s: row packet broken", G_STRLOC);
+            ok = FALSE;
+            break;
+        }
+        if (!aggr_encode_key(t, t->fields + i * stride, t->keys)) {
+            ok = FALSE;
+            break;
+        }
+        hashes[i] = cetus_hash64(t->keys->str + key_offsets[i], t->keys->len - key_offsets[i], 0);
+    }
+    key_offsets[i] = t->keys->len;
 
-            int packet_len = network_mysqld_proto_get_packet_len(candidate->data);
-            data->aggr_output_len += packet_len;
-            ((GString *)candidate->data)->str[3] = data->pkt_count + 1;
-            ++(data->pkt_count);
-            network_queue_append(send_queue, (GString *)candidate->data);
-            (*row_cnter)++;
-            last_output_index = cand_index;
+    for (i = 0; ok && i < n; i++) {
+        GString probe_key;
+        aggr_group_t probe;
+        probe_key.str = t->keys->str + key_offsets[i];
+        probe_key.len = key_offsets[i + 1] - key_offsets[i];
+        probe.hash = hashes[i];
+        probe.key = &probe_key;
 
-            if (data->aggr_output_len >= merged_output_size) {
-                g_debug("%s: send_part_content_to_client:%d", G_STRLOC, data->aggr_output_len);
-                send_part_content_to_client(con);
-                data->aggr_output_len = 0;
+        aggr_group_t *group = g_hash_table_lookup(t->groups, &probe);
+        if (group == NULL) {
+            if (t->is_spilling) {
+                ok = aggr_table_spill(t, rows[i], hashes[i]);
+                continue;
             }
+            group = g_malloc0(sizeof(aggr_group_t) + t->aggr_num * sizeof(aggr_acc_t));
+            group->hash = hashes[i];
+            group->key = g_string_new_len(probe_key.str, probe_key.len);
+            group->row = rows[i];
+            rows[i] = NULL;
+            g_hash_table_add(t->groups, group);
+            t->bytes += sizeof(aggr_group_t) + t->aggr_num * sizeof(aggr_acc_t) + AGGR_GROUP_OVERHEAD
+                + group->key->allocated_len + group->row->allocated_len;
         }
 
-        heap->element[0]->is_dup = 0;
-        heap->element[0]->is_err = 0;
-        heap->element[0]->refreshed = 0;
-        heap->element[0]->is_prior_to = 0;
-        heap->element[0]->record = heap->element[0]->record->next;
+        aggr_field_t *fields = t->fields + i * stride;
+        for (j = 0; ok && j < t->aggr_num; j++) {
+            ok = aggr_acc_update(t, &(t->cols[j]), &(group->acc[j]), fields + t->cols[j].pos);
+        }
 
-        candidates[cand_index] = candidate->next;
-        network_queue *recv_queue = recv_queues->pdata[cand_index];
-        g_debug("%s: remove candidate:%p for queue:%p, ss:%d", G_STRLOC, candidate, recv_queue, cand_index);
-        g_queue_delete_link(recv_queue->chunks, candidate);
+        if (!t->is_spilling && !t->spill_disabled && t->mem_limit > 0 && t->bytes > t->mem_limit) {
+            g_message("%s: group by exceeds memory limit, groups:%d, spill to disk",
+                      G_STRLOC, g_hash_table_size(t->groups));
+            t->is_spilling = 1;
+        }
+    }
 
-        if (candidates[cand_index] == NULL || candidates[cand_index]->data == NULL) {
-            con->partially_merged = 1;
-            g_debug("%s: item is nil, index:%d", G_STRLOC, cand_index);
-            if (data->aggr_output_len >= merged_output_size) {
-                send_part_content_to_client(con);
-                g_debug("%s: send_part_content_to_client:%d", G_STRLOC, data->aggr_output_len);
-                data->aggr_output_len = 0;
-            }
-            check_server_sess_wait_for_event(con, cand_index, EV_READ, &con->read_timeout);
-            return 0;
+    for (i = 0; i < n; i++) {
+        if (rows[i]) {
+            g_string_free(rows[i], TRUE);
         }
+    }
+    return ok;
+}
+
+/* aggregate the spilled rows, one partition at a time */
+static gboolean
+aggr_table_drain_parts(aggr_table_t *t)
+{
+    GString *rows[AGGR_BATCH_SIZE];
+    int i;
 
-        GString *item = candidates[cand_index]->data;
-        guchar pkt_type = get_pkt_type(item);
+    t->is_spilling = 0;
+    t->spill_disabled = 1;
 
-        if (pkt_type == MYSQLD_PACKET_EOF || pkt_type == MYSQLD_PACKET_ERR) {
-            g_debug("%s: index is over:%d", G_STRLOC, cand_index);
-            heap->element[0]->is_over = 1;
-            if (pkt_type == MYSQLD_PACKET_ERR) {
-                heap->element[0]->is_err = 1;
-                heap->is_err = 1;
-                data->err_pack = item;
+    for (i = 0; i < AGGR_SPILL_PARTS; i++) {
+        FILE *fp = t->parts[i];
+        if (fp == NULL) {
+            continue;
+        }
+        rewind(fp);
+
+        int n = 0;
+        guint32 len;
+        while (fread(&len, sizeof(len), 1, fp) == 1) {
+            GString *row = g_string_sized_new(len + 1);
+            if (fread(row->str, 1, len, fp) != len) {
+                g_warning("%s: read spill file failed", G_STRLOC);
+                g_string_free(row, TRUE);
+                while (n-- > 0) {
+                    g_string_free(rows[n], TRUE);
+                }
+                return FALSE;
+            }
+            row->len = len;
+            row->str[len] = '\0';
+            rows[n++] = row;
+            if (n == AGGR_BATCH_SIZE) {
+                if (!aggr_table_feed(t, rows, n)) {
+                    return FALSE;
+                }
+                n = 0;
             }
-        } else {
-            heap->element[0]->is_over = 0;
         }
-
-        g_debug("%s: candidate:%p for queue:%p, ss:%d", G_STRLOC, candidates[cand_index], recv_queue, cand_index);
-
-        heap_adjust(heap, 1, recv_queues->len, compare_failed);
-        if (*compare_failed) {
-            return 0;
+        if (!aggr_table_feed(t, rows, n)) {
+            return FALSE;
         }
+
+        fclose(fp);
+        t->parts[i] = NULL;
+        aggr_table_flush(t);
     }
+    return TRUE;
+}
 
-    if (limit->row_count > 0 && (*row_cnter) >= limit->row_count) {
-        if (check_after_limit(con, data, is_finished) == FALSE) {
-            return 0;
+static gint
+aggr_row_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    aggr_table_t *t = user_data;
+    const aggr_row_t *r1 = *(aggr_row_t **)a;
+    const aggr_row_t *r2 = *(aggr_row_t **)b;
+    int i;
+
+    for (i = 0; i < t->group_num; i++) {
+        int r = sort_key_cmp(t->group_kinds[i], r1->key + i, r2->key + i);
+        if (r != 0) {
+            return t->group_array[i].desc ? -r : r;
         }
     }
-
-    return 1;
+    return 0;
 }
 
+/**
+ * merge the partial aggregates of all shards, the shards may return
+ * their groups in any order
+ */
 static int
-create_heap_for_merge_sort(network_mysqld_con *con, merge_parameters_t *data, int *compare_failed)
+aggr_by_group(aggr_by_group_para_t *para, GList **candidates, guint *pkt_count, result_merge_t *merged_result)
 {
-    GList **candidates = data->candidates;
-    heap_type *heap = data->heap;
+    GPtrArray *recv_queues = para->recv_queues;
+    GString *rows[AGGR_BATCH_SIZE];
+    int n = 0, ok = 1;
     size_t iter;
 
-    for (iter = 0; iter < heap->len; iter++) {
-        heap->element[iter]->is_dup = 0;
-        heap->element[iter]->is_err = 0;
-        heap->element[iter]->refreshed = 0;
-        heap->element[iter]->is_prior_to = 0;
-
-        if (candidates[iter] != NULL) {
-            GString *item = candidates[iter]->data;
-            if (item != NULL) {
-                guchar pkt_type = get_pkt_type(item);
-                if (pkt_type == MYSQLD_PACKET_EOF || pkt_type == MYSQLD_PACKET_ERR) {
-                    heap->element[iter]->is_over = 1;
-                    if (pkt_type == MYSQLD_PACKET_ERR) {
-                        heap->element[iter]->is_err = 1;
-                        heap->is_err = 1;
-                        data->err_pack = item;
-                    }
-                } else {
-                    heap->element[iter]->record = candidates[iter];
-                    heap->element[iter]->index = iter;
-                    heap->element[iter]->is_over = 0;
+    aggr_table_t *t = aggr_table_new(para);
+    if (t == NULL) {
+        merged_result->status = RM_FAIL;
+        return 0;
+    }
+
+    for (iter = 0; ok && iter < recv_queues->len; iter++) {
+        network_queue *recv_queue = recv_queues->pdata[iter];
+        while (candidates[iter] != NULL) {
+            GString *row = candidates[iter]->data;
+            guchar pkt_type = get_pkt_type(row);
+            if (pkt_type == MYSQLD_PACKET_EOF) {
+                break;
+            } else if (pkt_type == MYSQLD_PACKET_ERR) {
+                g_warning("%s: err packet met in rows of:%d", G_STRLOC, (int)iter);
+                ok = 0;
+                break;
+            }
+
+            candidates[iter] = candidates[iter]->next;
+            g_queue_pop_head(recv_queue->chunks);
+            rows[n++] = row;
+            if (n == AGGR_BATCH_SIZE) {
+                ok = aggr_table_feed(t, rows, n);
+                n = 0;
+                if (!ok) {
+                    break;
                 }
-            } else {
-                con->partially_merged = 1;
-                check_server_sess_wait_for_event(con, iter, EV_READ, &con->read_timeout);
-                return 0;
             }
         }
     }
 
-    for (iter = heap->len / 2; iter > 0; --iter) {
-        heap_adjust(heap, iter, heap->len, compare_failed);
-        if (*compare_failed) {
-            return 0;
+    if (ok) {
+        ok = aggr_table_feed(t, rows, n);
+    } else {
+        int i;
+        for (i = 0; i < n; i++) {
+            g_string_free(rows[i], TRUE);
         }
     }
 
-    g_debug("%s: create heap over", G_STRLOC);
+    if (ok) {
+        aggr_table_flush(t);
+        ok = aggr_table_drain_parts(t);
+    }
+
+    if (!ok) {
+        g_warning("%s:merge_failed", G_STRLOC);
+        aggr_table_free(t);
+        merged_result->status = RM_FAIL;
+        return 0;
+    }
+
+    /* groups come out ordered by the group columns, as mysql sorts GROUP BY */
+    g_ptr_array_sort_with_data(t->output, aggr_row_cmp, t);
+
+    size_t row_cnter = 0;
+    size_t off_pos = 0;
+    for (iter = 0; iter < t->output->len && row_cnter < para->limit->row_count; iter++) {
+        aggr_row_t *out = g_ptr_array_index(t->output, iter);
+        GString *row = out->row;
+
+        if (para->hav_condi->rel_type) {
+            char aggr_value[MAX_COL_VALUE_LEN] = { 0 };
+            retrieve_aggr_value(row, para->hav_condi->column_index, aggr_value);
+            if (!fulfill_condi(aggr_value, para->hav_condi, merged_result)) {
+                continue;
+            }
+        }
+
+        if (off_pos < para->limit->offset) {
+            off_pos++;
+            continue;
+        }
+
+        row->str[3] = (*pkt_count) + 1;
+        ++(*pkt_count);
+        row_cnter++;
+        network_queue_append(para->send_queue, row);
+        out->row = NULL;
+    }
 
+    aggr_table_free(t);
     return 1;
 }
 
@@ -2290,10 +2152,8 @@ callback_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finishe
 {
     int merge_failed = 0;
     network_queue *send_queue = data->send_queue;
-    heap_type *heap = data->heap;
-    int order_array_size = heap->order_para.order_array_size;
 
-    if (order_array_size > 0) {
+    if (data->heap) {
         int result = do_sort_merge(con, data, is_finished, &merge_failed);
         if (merge_failed) {
             return RM_FAIL;
@@ -2307,7 +2167,7 @@ callback_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finishe
         }
     }
 
-    if (is_finished) {
+    if (is_finished || con->resp_cut_off) {
         g_debug("%s: finished is true", G_STRLOC);
         if (data->is_pack_err) {
             if (data->err_pack == NULL) {
@@ -2340,18 +2200,13 @@ callback_merge(network_mysqld_con *con, merge_parameters_t *data, int is_finishe
 static int
 do_merge(network_mysqld_con *con, merge_parameters_t *data, int *merge_failed)
 {
-    heap_type *heap = data->heap;
     int is_finished = 0;
 
     if (con->num_pending_servers == 0) {
         is_finished = 1;
     }
 
-    if (heap->order_para.order_array_size > 0) {
-        if (!create_heap_for_merge_sort(con, data, merge_failed)) {
-            return 1;
-        }
-
+    if (data->heap) {
         if (!do_sort_merge(con, data, is_finished, merge_failed)) {
             return 1;
         }
@@ -3035,12 +2890,14 @@ merge_for_select(sql_context_t *context, network_queue *send_queue, GPtrArray *r
 
         para.send_queue = send_queue;
         para.recv_queues = recv_queues;
+        para.fielddefs = res_merge->fielddefs;
         para.limit = &limit;
         para.group_array = group_array;
         para.aggr_array = aggr_array;
         para.hav_condi = hav_condi;
         para.group_array_size = group_array_size;
         para.aggr_num = aggr_num;
+        para.mem_limit = con->srv->aggr_mem_limit;
 
         if (!aggr_by_group(&para, candidates, &pkt_count, merged_result)) {
             g_free(candidates);
@@ -3050,36 +2907,23 @@ merge_for_select(sql_context_t *context, network_queue *send_queue, GPtrArray *r
         g_free(candidates);
     } else {
         merge_parameters_t *data = g_new0(merge_parameters_t, 1);
-        heap_type *heap = g_new0(heap_type, 1);
-        data->heap = heap;
-        heap->len = recv_queues->len;
-        heap_element *elements = g_new0(heap_element, heap->len);
-        data->elements = elements;
-
-        size_t iter;
-        for (iter = 0; iter < recv_queues->len; iter++) {
-            heap->element[iter] = elements + iter;
-            heap->element[iter]->is_dup = 0;
-            heap->element[iter]->is_err = 0;
-            heap->element[iter]->refreshed = 0;
-            heap->element[iter]->is_prior_to = 0;
-        }
-
         data->send_queue = send_queue;
         data->recv_queues = recv_queues;
         data->candidates = candidates;
         data->pkt_count = pkt_count;
         data->limit.offset = limit.offset;
         data->limit.row_count = limit.row_count;
+        data->pack_err_met = 0;
 
-        for (iter = 0; iter < order_array_size; iter++) {
-            memcpy((heap->order_para).order_array + iter, order_array + iter, sizeof(ORDER_BY));
+        if (order_array_size > 0) {
+            if (!merge_tree_new(data, order_array, order_array_size, recv_queues->len)) {
+                g_free(data);
+                g_free(candidates);
+                merged_result->status = RM_FAIL;
+                return 0;
+            }
         }
 
-        data->pack_err_met = 0;
-        heap->order_para.order_array_size = order_array_size;
-        data->heap = heap;
-
         con->data = data;
 
         if ((select->flags & SF_DISTINCT) || field_count == group_array_size) {
@@ -51,41 +51,148 @@ typedef struct ORDER_BY {
     int pos;
 } ORDER_BY;
 
-typedef struct {
-    GList *record;
-    int index;
-    int is_prior_to;
+typedef enum {
+    SORT_KEY_NONE = 0,          /* the type defines no order, values are equal */
+    SORT_KEY_DECIMAL,           /* integers and decimals, compared exactly */
+    SORT_KEY_DOUBLE,
+    SORT_KEY_DATE,
+    SORT_KEY_TIME,
+    SORT_KEY_YEAR,
+    SORT_KEY_STR,               /* case insensitive */
+} sort_key_kind_t;
+
+/**
+ * ORDER BY value of a row, decoded once when the row becomes the head
+ * of its shard. Strings and digits point into the row packet.
+ */
+typedef struct sort_key_val_t {
+    const char *str;            /* string, or integer digits of a decimal */
+    const char *frac;           /* fraction digits of a decimal */
+    union {
+        gint64 num;             /* date, time, year */
+        double dbl;
+    } v;
+    int len;                    /* string length, or integer digits count */
+    int frac_len;
+    unsigned int is_null:1;
+    unsigned int is_neg:1;
+} sort_key_val_t;
+
+typedef struct merge_leaf_t {
+    GList *record;              /* head row of the shard */
+    sort_key_val_t *key;        /* decoded ORDER BY values of the head row */
     unsigned int is_over:1;
     unsigned int is_err:1;
-    unsigned int refreshed:1;
-    unsigned int is_dup:1;
-} heap_element;
+} merge_leaf_t;
 
-typedef struct order_by_para_s {
+/**
+ * Loser tree over the shards of an ORDER BY merge, each row costs
+ * log2(shards) comparisons of decoded keys.
+ */
+typedef struct merge_tree_t {
     ORDER_BY order_array[MAX_ORDER_COLS];
-    uint64_t field_offsets_cache[MAX_SHARD_NUM];
+    sort_key_kind_t kinds[MAX_ORDER_COLS];
     int order_array_size;
-} order_by_para_t;
-
-typedef struct {
-    heap_element *element[MAX_SHARD_NUM];
-    order_by_para_t order_para;
-    unsigned int len:16;
-    unsigned int is_over:1;
+    int max_pos;                /* last column holding an ORDER BY value */
+    merge_leaf_t *leaves;
+    sort_key_val_t *last_key;   /* key of the last row sent, for DISTINCT */
+    int pending;                /* leaf waiting for its next row, -1 if none */
+    int len;
+    unsigned int is_built:1;
     unsigned int is_err:1;
-} heap_type;
+    unsigned int has_last:1;
+    int nodes[];                /* nodes[0] is the winner, the others hold losers */
+} merge_tree_t;
 
 typedef struct aggr_by_group_para_s {
     network_queue *send_queue;
     GPtrArray *recv_queues;
+    network_mysqld_proto_fielddefs_t *fielddefs;
     limit_t *limit;
     group_by_t *group_array;
     group_aggr_t *aggr_array;
     having_condition_t *hav_condi;
+    long long mem_limit;
     short aggr_num;
     short group_array_size;
 } aggr_by_group_para_t;
 
+#define AGGR_BATCH_SIZE 256
+#define AGGR_SPILL_PARTS 16
+
+typedef enum {
+    AGGR_ACC_COUNT,
+    AGGR_ACC_SUM_DECIMAL,       /* integers and decimals, as a scaled 128-bit integer */
+    AGGR_ACC_SUM_DOUBLE,
+    AGGR_ACC_MIN,
+    AGGR_ACC_MAX,
+} aggr_acc_kind_t;
+
+typedef struct aggr_col_t {
+    aggr_acc_kind_t kind;
+    sort_key_kind_t key_kind;   /* MIN and MAX compare values as ORDER BY does */
+    int pos;
+    int scale;                  /* digits after the decimal point */
+} aggr_col_t;
+
+typedef struct aggr_acc_t {
+    union {
+        gint64 count;
+        __int128 sum;
+        double dbl;
+    } v;
+    GString *val;               /* MIN or MAX value */
+    sort_key_val_t key;         /* decoded val */
+    unsigned int has_value:1;
+} aggr_acc_t;
+
+/**
+ * A group of the hash aggregation. The first row of the group is kept
+ * as it is and only its aggregate columns are rewritten at the end.
+ */
+typedef struct aggr_group_t {
+    guint64 hash;
+    GString *key;               /* normalized group values */
+    GString *row;
+    aggr_acc_t acc[];
+} aggr_group_t;
+
+typedef struct aggr_row_t {
+    GString *row;
+    sort_key_val_t key[];       /* decoded group values, for the final order */
+} aggr_row_t;
+
+typedef struct aggr_field_t {
+    const char *str;            /* NULL for NULL */
+    const char *raw;            /* the field with its length prefix */
+    guint64 len;
+} aggr_field_t;
+
+/**
+ * Partial results of all shards are merged by a hash table of groups.
+ * Past mem_limit no group is added any more: rows of unknown groups go
+ * to spill files partitioned by hash, which are aggregated one by one
+ * afterwards. This only caps the table, the shard results are all
+ * buffered in the recv queues before the merge starts.
+ */
+typedef struct aggr_table_t {
+    GHashTable *groups;
+    aggr_col_t cols[MAX_AGGR_FUNS];
+    sort_key_kind_t group_kinds[MAX_GROUP_COLS];
+    group_by_t *group_array;
+    int group_num;
+    int aggr_num;
+    int max_pos;                /* last column holding a group or aggregate value */
+    aggr_field_t *fields;       /* columns of the rows in a batch */
+    GString *keys;              /* group keys of the rows in a batch */
+    gsize bytes;
+    gsize mem_limit;
+    FILE *parts[AGGR_SPILL_PARTS];
+    GPtrArray *output;          /* finished rows, sorted by group at last */
+    unsigned int is_spilling:1;
+    unsigned int spill_disabled:1;
+} aggr_table_t;
+
 NETWORK_API int callback_merge(network_mysqld_con *, merge_parameters_t *, int);
 NETWORK_API void resultset_merge(network_queue *, GPtrArray *, network_mysqld_con *, uint64_t *, result_merge_t *);
 NETWORK_API void admin_resultset_merge(network_mysqld_con *, network_queue *, GPtrArray *, result_merge_t *);
@@ -116,6 +116,10 @@ do_tcp_stream_after_recv_resp(network_mysqld_con *con, server_session_t *ss)
                 network_mysqld_con_send_error_full(con->client, C("merge failed"), ER_CETUS_RESULT_MERGE, "HY000");
                 con->state = ST_SEND_QUERY_RESULT;
                 network_mysqld_con_handle(-1, 0, con);
+            } else if (con->resp_cut_off) {
+                g_debug("%s: merge over before all shards finished", G_STRLOC);
+                con->state = ST_SEND_QUERY_RESULT;
+                network_mysqld_con_handle(-1, 0, con);
             }
         }
     } else {
@@ -310,6 +314,7 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
             ss->state = NET_RW_STATE_FINISHED;
             ss->server->is_read_finished = 1;
             ss->server->is_waiting = 0;
+            network_mysqld_con_backend_request_done(con, ss->backend, TRUE);
             if (con->srv->sql_mgr && (con->srv->sql_mgr->sql_log_switch == ON || con->srv->sql_mgr->sql_log_switch == REALTIME)) {
                 ss->ts_read_query_result_last = get_timer_microseconds();
                 network_mysqld_com_query_result_t *query = con->parse.data;
@@ -344,7 +349,7 @@ process_read_server(network_mysqld_con *con, server_session_t *ss)
         }
         break;
     case NETWORK_SOCKET_WAIT_FOR_EVENT:
-        if (sock->resp_len > con->srv->max_resp_len) {
+        if (sock->resp_len - sock->resp_merged_len > con->srv->max_resp_len) {
             ss->state = NET_RW_STATE_FINISHED;
             con->server_to_be_closed = 1;
             con->resp_too_long = 1;
@@ -37,6 +37,10 @@ typedef struct {
     int trx_read_write;         /* default TF_READ_WRITE */
     int trx_isolation_level;    /* default TF_REPEATABLE_READ */
 
+    /* group of the query routed by a compiled plan, NULL if it was parsed */
+    GString *cached_group;
+    int cached_has_aggregate;
+
 } shard_plugin_con_t;
 
 NETWORK_API shard_plugin_con_t *shard_plugin_con_new();
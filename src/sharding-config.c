@@ -37,6 +37,9 @@ static GList *shard_conf_all_groups = NULL;
 
 static GString *parition_super_group = NULL;
 
+/* bumped on every change of the tables or vdbs */
+static guint64 shard_conf_version_num = 1;
+
 struct schema_table_t {
     const char *schema;
     const char *table;
@@ -183,7 +186,11 @@ void sharding_partition_free(sharding_partition_t *p)
 void sharding_partition_to_string(sharding_partition_t* p, GString* repr)
 {
     g_string_truncate(repr, 0);
-    if (p->method == SHARD_METHOD_RANGE) {
+    if (p->method == SHARD_METHOD_JUMP) {
+        g_string_printf(repr, "[%d]->%s", p->bucket, p->group_name->str);
+    } else if (p->method == SHARD_METHOD_KETAMA) {
+        g_string_printf(repr, "(weight %ld)->%s", (int64_t)p->value, p->group_name->str);
+    } else if (p->method == SHARD_METHOD_RANGE) {
         if (p->key_type == SHARD_DATA_TYPE_STR) {
             g_string_printf(repr, "(%s, %s]->%s", (char*)p->low_value, (char*)p->value,
                             p->group_name->str);
@@ -238,9 +245,209 @@ void sharding_vdb_free(sharding_vdb_t *vdb)
         sharding_partition_free(item);
     }
     g_ptr_array_free(vdb->partitions, TRUE);
+    g_free(vdb->ring);
+    g_free(vdb->hash_map);
     g_free(vdb);
 }
 
+guint64
+sharding_key_hash_str(const char *key)
+{
+    return cetus_hash64(key, strlen(key), 0);
+}
+
+guint64
+sharding_key_hash_int(gint64 key)
+{
+    return cetus_hash64(&key, sizeof(key), 0);
+}
+
+/**
+ * Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+ * growing from n to n+1 buckets moves only 1/(n+1) of the keys
+ */
+static int
+jump_consistent_hash(guint64 key, int num_buckets)
+{
+    gint64 b = -1, j = 0;
+    while (j < num_buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (gint64)((b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (int)b;
+}
+
+static int
+ketama_locate(const sharding_vdb_t *vdb, guint64 key_hash)
+{
+    guint32 point = (guint32)(key_hash >> 32);
+    int low = 0, high = vdb->ring_len;
+    /* first point not below the key, wrap around at the end */
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (vdb->ring[mid].point < point) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == vdb->ring_len) {
+        low = 0;
+    }
+    return vdb->ring[low].bucket;
+}
+
+int
+sharding_vdb_locate(const sharding_vdb_t *vdb, guint64 key_hash)
+{
+    if (vdb->method == SHARD_METHOD_JUMP) {
+        return jump_consistent_hash(key_hash, vdb->partitions->len);
+    } else if (vdb->method == SHARD_METHOD_KETAMA && vdb->ring_len > 0) {
+        return ketama_locate(vdb, key_hash);
+    }
+    return -1;
+}
+
+sharding_partition_t *
+sharding_vdb_get_by_hash(const sharding_vdb_t *vdb, int hash_mod)
+{
+    if (vdb->hash_map == NULL || hash_mod < 0 || hash_mod >= vdb->logic_shard_num) {
+        return NULL;
+    }
+    return vdb->hash_map[hash_mod];
+}
+
+sharding_partition_t *
+sharding_vdb_get_by_range_int(const sharding_vdb_t *vdb, gint64 val)
+{
+    GPtrArray *partitions = vdb->partitions;
+    int low = 0, high = partitions->len;
+    /* first partition whose high value is not below val */
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        sharding_partition_t *part = g_ptr_array_index(partitions, mid);
+        if ((int64_t)part->value < val) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == partitions->len) {
+        return NULL;
+    }
+    sharding_partition_t *part = g_ptr_array_index(partitions, low);
+    return val > (int64_t)part->low_value ? part : NULL;
+}
+
+sharding_partition_t *
+sharding_vdb_get_by_range_str(const sharding_vdb_t *vdb, const char *val)
+{
+    GPtrArray *partitions = vdb->partitions;
+    int low = 0, high = partitions->len;
+    /* first partition whose high value is not below val, NULL high is unlimited */
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        sharding_partition_t *part = g_ptr_array_index(partitions, mid);
+        if (part->value != NULL && strcmp(val, part->value) > 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == partitions->len) {
+        return NULL;
+    }
+    sharding_partition_t *part = g_ptr_array_index(partitions, low);
+    return (part->low_value == NULL || strcmp(val, part->low_value) > 0) ? part : NULL;
+}
+
+sharding_partition_t *
+sharding_vdb_get_by_key_hash(const sharding_vdb_t *vdb, guint64 key_hash)
+{
+    int bucket = sharding_vdb_locate(vdb, key_hash);
+    if (bucket < 0 || bucket >= vdb->partitions->len) {
+        return NULL;
+    }
+    return g_ptr_array_index(vdb->partitions, bucket);
+}
+
+static gint
+cmp_ring_point(gconstpointer a, gconstpointer b)
+{
+    const sharding_ring_point_t *p1 = a;
+    const sharding_ring_point_t *p2 = b;
+    if (p1->point != p2->point) {
+        return p1->point < p2->point ? -1 : 1;
+    }
+    /* keep the ring independent of the sort on collision */
+    return p1->bucket - p2->bucket;
+}
+
+/**
+ * points of a partition depend only on its group name, adding a group
+ * takes over its share of the ring and leaves the rest in place
+ */
+static void
+sharding_vdb_build_ring(sharding_vdb_t *vdb)
+{
+    int total = 0;
+    int i, j;
+    for (i = 0; i < vdb->partitions->len; ++i) {
+        sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+        total += (int)(int64_t)part->value * SHARD_KETAMA_POINTS;
+    }
+
+    g_free(vdb->ring);
+    vdb->ring = g_new0(sharding_ring_point_t, total);
+    vdb->ring_len = 0;
+    for (i = 0; i < vdb->partitions->len; ++i) {
+        sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+        int points = (int)(int64_t)part->value * SHARD_KETAMA_POINTS;
+        for (j = 0; j < points; ++j) {
+            guint64 h = cetus_hash64(part->group_name->str, part->group_name->len, (guint64)j);
+            vdb->ring[vdb->ring_len].point = (guint32)(h >> 32);
+            vdb->ring[vdb->ring_len].bucket = part->bucket;
+            vdb->ring_len++;
+        }
+    }
+    qsort(vdb->ring, vdb->ring_len, sizeof(sharding_ring_point_t), cmp_ring_point);
+}
+
+/**
+ * jump partitions carry their order: 0, 1, ... n-1, each exactly once
+ * ketama partitions carry their weight
+ */
+static gboolean
+sharding_vdb_consistent_is_valid(sharding_vdb_t *vdb)
+{
+    int len = vdb->partitions->len;
+    if (len == 0) {
+        return FALSE;
+    }
+    gboolean valid = TRUE;
+    char *value_set = g_malloc0(len);
+    int i;
+    for (i = 0; i < len; i++) {
+        sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+        int64_t value = (int64_t)part->value;
+        if (vdb->method == SHARD_METHOD_JUMP) {
+            if (value < 0 || value >= len || value_set[value]) {
+                g_critical("vdb-%d jump partition order error: %ld", vdb->id, value);
+                valid = FALSE;
+                break;
+            }
+            value_set[value] = 1;
+        } else if (value <= 0 || value > SHARD_KETAMA_MAX_WEIGHT) {
+            g_critical("vdb-%d ketama partition weight error: %ld", vdb->id, value);
+            valid = FALSE;
+            break;
+        }
+    }
+    g_free(value_set);
+    return valid;
+}
+
 gboolean sharding_vdb_is_valid(int is_partition_mode, sharding_vdb_t *vdb, int num_groups)
 {
     if (!is_partition_mode) {
@@ -250,6 +457,9 @@ gboolean sharding_vdb_is_valid(int is_partition_mode, sharding_vdb_t *vdb, int n
             return FALSE;
         }
     }
+    if (vdb->method == SHARD_METHOD_JUMP || vdb->method == SHARD_METHOD_KETAMA) {
+        return sharding_vdb_consistent_is_valid(vdb);
+    }
     if (vdb->method == SHARD_METHOD_HASH) {
         if (vdb->logic_shard_num <= 0 || vdb->logic_shard_num > MAX_HASH_VALUE_COUNT) {
             return FALSE;
@@ -553,13 +763,21 @@ shard_conf_try_setup(int is_partition_mode, GList *vdbs, GList *tables, GList *s
     shard_conf_set_all_groups(all_groups);
 
     parition_super_group = g_string_new(PARTITION_SUPER_GROUP);
+    shard_conf_version_num++;
 
     return TRUE;
 }
 
+guint64
+shard_conf_version(void)
+{
+    return shard_conf_version_num;
+}
+
 void
 shard_conf_destroy(void)
 {
+    shard_conf_version_num++;
     if (shard_conf_vdbs) {
         g_list_free_full(shard_conf_vdbs, (GDestroyNotify) sharding_vdb_free);
     }
@@ -678,18 +896,39 @@ const char* sharding_key_type_str(int type)
     return "error";
 }
 
-static int
+int
 sharding_method(const char *str)
 {
     if (strcasecmp(str, "hash") == 0) {
         return SHARD_METHOD_HASH;
     } else if (strcasecmp(str, "range") == 0) {
         return SHARD_METHOD_RANGE;
+    } else if (strcasecmp(str, "jump") == 0) {
+        return SHARD_METHOD_JUMP;
+    } else if (strcasecmp(str, "ketama") == 0) {
+        return SHARD_METHOD_KETAMA;
     } else {
         return SHARD_METHOD_UNKNOWN;
     }
 }
 
+const char*
+sharding_method_str(int method)
+{
+    switch (method) {
+    case SHARD_METHOD_HASH:
+        return "hash";
+    case SHARD_METHOD_RANGE:
+        return "range";
+    case SHARD_METHOD_JUMP:
+        return "jump";
+    case SHARD_METHOD_KETAMA:
+        return "ketama";
+    default:
+        return "error";
+    }
+}
+
 /*
  * Parse partitions from JSON to Hash Table
  * exmpale:
@@ -805,9 +1044,50 @@ cmp_shard_range_groups_str(gconstpointer a, gconstpointer b)
     return strcmp(s1, s2);
 }
 
+/**
+ * logic shard -> partition, the first partition wins if they overlap,
+ * same as testing the partitions in order
+ */
+static void
+sharding_vdb_build_hash_map(sharding_vdb_t *vdb)
+{
+    g_free(vdb->hash_map);
+    vdb->hash_map = NULL;
+    if (vdb->logic_shard_num <= 0 || vdb->logic_shard_num > MAX_HASH_VALUE_COUNT) {
+        return;
+    }
+    vdb->hash_map = g_new0(sharding_partition_t *, vdb->logic_shard_num);
+    int i, j;
+    for (i = 0; i < vdb->partitions->len; ++i) {
+        sharding_partition_t *part = g_ptr_array_index(vdb->partitions, i);
+        for (j = 0; j < vdb->logic_shard_num; ++j) {
+            if (vdb->hash_map[j] == NULL && TestBit(part->hash_set, j)) {
+                vdb->hash_map[j] = part;
+            }
+        }
+    }
+}
+
 static void setup_partitions(GPtrArray *partitions, sharding_vdb_t *vdb)
 {
-    if (vdb->method == SHARD_METHOD_RANGE) {
+    if (vdb->method == SHARD_METHOD_JUMP || vdb->method == SHARD_METHOD_KETAMA) {
+        if (vdb->method == SHARD_METHOD_JUMP) {
+            /* bucket i of the jump hash is the partition with order i */
+            g_ptr_array_sort(partitions, cmp_shard_range_groups_int);
+        }
+        int i;
+        for (i = 0; i < partitions->len; ++i) {
+            sharding_partition_t *part = g_ptr_array_index(partitions, i);
+            part->method = vdb->method;
+            part->key_type = vdb->key_type;
+            part->bucket = i;
+            part->vdb = vdb;
+        }
+        vdb->logic_shard_num = partitions->len;
+        if (vdb->method == SHARD_METHOD_KETAMA) {
+            sharding_vdb_build_ring(vdb);
+        }
+    } else if (vdb->method == SHARD_METHOD_RANGE) {
         /* sort partitions */
         if (vdb->key_type == SHARD_DATA_TYPE_INT
             || vdb->key_type == SHARD_DATA_TYPE_DATETIME
@@ -824,6 +1104,7 @@ static void setup_partitions(GPtrArray *partitions, sharding_vdb_t *vdb)
         for (i = 0; i < partitions->len; ++i) {
             sharding_partition_t *part = g_ptr_array_index(partitions, i);
             part->key_type = vdb->key_type;
+            part->vdb = vdb;
             if (vdb->key_type == SHARD_DATA_TYPE_STR) {
                 part->low_value = prev_str;
                 if (i != partitions->len - 1) {
@@ -840,7 +1121,9 @@ static void setup_partitions(GPtrArray *partitions, sharding_vdb_t *vdb)
             sharding_partition_t *part = g_ptr_array_index(partitions, i);
             part->key_type = vdb->key_type;
             part->hash_count = vdb->logic_shard_num;
+            part->vdb = vdb;
         }
+        sharding_vdb_build_hash_map(vdb);
     }
 }
 
@@ -996,6 +1279,7 @@ gboolean shard_conf_add_vdb(sharding_vdb_t* vdb)
     }
     setup_partitions(vdb->partitions, vdb);
     shard_conf_vdbs = g_list_append(shard_conf_vdbs, vdb);
+    shard_conf_version_num++;
     return TRUE;
 }
 
@@ -1005,6 +1289,7 @@ gboolean shard_conf_add_sharded_table(sharding_table_t* t)
     if (vdb) {
         t->vdb_ref = vdb;
         t->shard_key_type = vdb->key_type;
+        shard_conf_version_num++;
         return sharding_tables_add(t);
     } else {
         return FALSE;
@@ -1016,13 +1301,16 @@ static cJSON* json_create_vdb_object(sharding_vdb_t* vdb)
     cJSON *node = cJSON_CreateObject();
     cJSON_AddNumberToObject(node, "id", vdb->id);
     cJSON_AddStringToObject(node, "type", sharding_key_type_str(vdb->key_type));
-    cJSON_AddStringToObject(node, "method", vdb->method==SHARD_METHOD_HASH?"hash":"range");
+    cJSON_AddStringToObject(node, "method", sharding_method_str(vdb->method));
     cJSON_AddNumberToObject(node, "num", vdb->logic_shard_num);
     cJSON* pob = cJSON_CreateObject();
     int i=0;
     for (i=0; i < vdb->partitions->len; ++i) {
         sharding_partition_t* p = g_ptr_array_index(vdb->partitions, i);
-        if (vdb->method == SHARD_METHOD_RANGE) {
+        if (vdb->method == SHARD_METHOD_JUMP || vdb->method == SHARD_METHOD_KETAMA) {
+            /* order or weight */
+            cJSON_AddNumberToObject(pob, p->group_name->str, (int64_t)p->value);
+        } else if (vdb->method == SHARD_METHOD_RANGE) {
             if (vdb->key_type == SHARD_DATA_TYPE_STR) {
                 cJSON_AddStringToObject(pob, p->group_name->str, (char*)p->value);
             } else if (vdb->key_type == SHARD_DATA_TYPE_INT) {
@@ -1121,5 +1409,6 @@ gboolean shard_conf_add_single_table(const char* schema,
     st->schema = g_string_new(schema);
     st->name = g_string_new(table);
     shard_conf_single_tables = g_list_append(shard_conf_single_tables, st);
+    shard_conf_version_num++;
     return TRUE;
 }
@@ -41,7 +41,9 @@ enum sharding_method_t {
     SHARD_METHOD_UNKNOWN = -1,
     SHARD_METHOD_RANGE = 0,
     SHARD_METHOD_HASH = 1,
-    SHARD_METHOD_LIST = 2
+    SHARD_METHOD_LIST = 2,
+    SHARD_METHOD_JUMP = 3,      /* jump consistent hash over ordered partitions */
+    SHARD_METHOD_KETAMA = 4     /* hash ring with virtual nodes */
 };
 
 typedef struct sharding_vdb_t sharding_vdb_t;
@@ -49,6 +51,10 @@ typedef struct sharding_table_t sharding_table_t;
 
 #define MAX_HASH_VALUE_COUNT 1024
 
+/* virtual nodes on the ketama ring per unit of partition weight */
+#define SHARD_KETAMA_POINTS 160
+#define SHARD_KETAMA_MAX_WEIGHT 100
+
 typedef struct sharding_partition_t {
     char *value;                /* high range OR hash value */
     char *low_value;            /* low range OR null */
@@ -60,8 +66,17 @@ typedef struct sharding_partition_t {
 
     enum sharding_method_t method;
     enum shardkey_type_t key_type;
+
+    /* jump & ketama: index of the partition, value holds the order or the weight */
+    int bucket;
+    sharding_vdb_t *vdb;
 } sharding_partition_t;
 
+typedef struct sharding_ring_point_t {
+    guint32 point;
+    int bucket;
+} sharding_ring_point_t;
+
 gboolean sharding_partition_contain_hash(sharding_partition_t *, int);
 void sharding_partition_free(sharding_partition_t *);
 //gboolean sharding_partition_cover_range(sharding_partition_t *, );
@@ -73,10 +88,36 @@ struct sharding_vdb_t {
     int key_type;
     int logic_shard_num;
     GPtrArray *partitions;      /* GPtrArray<sharding_partition_t *> */
+    sharding_ring_point_t *ring;    /* ketama only, sorted by point */
+    int ring_len;
+    /* hash only, logic shard -> its partition, compiled at setup */
+    sharding_partition_t **hash_map;
 };
 
 void sharding_vdb_partitions_to_string(sharding_vdb_t* vdb, GString* repr);
 
+/* full-key hash of a sharding value, used by jump & ketama */
+guint64 sharding_key_hash_str(const char *key);
+guint64 sharding_key_hash_int(gint64 key);
+
+/**
+ * map a key hash to a partition bucket of a jump or ketama vdb
+ */
+int sharding_vdb_locate(const sharding_vdb_t *vdb, guint64 key_hash);
+
+/**
+ * the partition holding one sharding value, looked up in the tables
+ * compiled at setup instead of testing every partition
+ *   hash:          by the value modulo logic_shard_num
+ *   range:         binary search on the sorted high values
+ *   jump & ketama: by the full-key hash
+ * @return NULL if no partition holds the value
+ */
+sharding_partition_t *sharding_vdb_get_by_hash(const sharding_vdb_t *vdb, int hash_mod);
+sharding_partition_t *sharding_vdb_get_by_range_int(const sharding_vdb_t *vdb, gint64 val);
+sharding_partition_t *sharding_vdb_get_by_range_str(const sharding_vdb_t *vdb, const char *val);
+sharding_partition_t *sharding_vdb_get_by_key_hash(const sharding_vdb_t *vdb, guint64 key_hash);
+
 struct sharding_table_t {
     GString *schema;
     GString *name;
@@ -94,6 +135,8 @@ struct single_table_t {         /* single table only resides on 1 group */
 
 int sharding_key_type(const char *str);
 const char* sharding_key_type_str(int type);
+int sharding_method(const char *str);
+const char* sharding_method_str(int method);
 GPtrArray *shard_conf_get_any_group(GPtrArray *groups, const char *db, const char *table);
 
 GPtrArray *shard_conf_get_all_groups(GPtrArray *groups);
@@ -128,6 +171,9 @@ gboolean shard_conf_load(int, char *, int);
 
 void shard_conf_destroy(void);
 
+/* changes whenever the sharding configuration does */
+guint64 shard_conf_version(void);
+
 gboolean shard_conf_add_vdb(sharding_vdb_t* vdb);
 
 sharding_vdb_t *sharding_vdb_new();